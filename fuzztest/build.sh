@@ -9,6 +9,8 @@ make TEST_FUZZ=2
 mv civetweb civetweb_fuzz2
 make TEST_FUZZ=3
 mv civetweb civetweb_fuzz3
+make TEST_FUZZ=6
+mv civetweb civetweb_fuzz6
 
 echo ""
 echo "====================="
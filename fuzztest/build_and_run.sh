@@ -29,6 +29,14 @@ echo ""
 
 ./civetweb_fuzz3 -max_total_time=60 -max_len=2048 -dict=fuzztest/http1.dict fuzztest/http1c/
 
+echo ""
+echo "====================="
+echo "== run fuzz test 6 =="
+echo "====================="
+echo ""
+
+./civetweb_fuzz6 -max_total_time=60 -max_len=2048 -dict=fuzztest/http1.dict fuzztest/http1/
+
 echo ""
 echo "====================="
 echo "== fuzz tests done =="
@@ -0,0 +1,276 @@
+/********************************************************/
+/*                                                      */
+/*   FUZZ TEST for civetweb.c                           */
+/*                                                      */
+/*   Copyright (c) 2026 the CivetWeb developers         */
+/*                                                      */
+/*   This file contains test code for fuzz tests.       */
+/*   It should not be used in production code.          */
+/*                                                      */
+/********************************************************/
+
+/* Differential fuzz target for the HTTP request parser:
+ * parse_http_request using the SIMD character scanner (http_scan.inl) is
+ * compared with a copy of the previous byte by byte parser, for every
+ * scanner implementation supported by the CPU. Any difference in the
+ * result, the parsed request or the modified buffer aborts the test.
+ *
+ * Build (from the civetweb root directory):
+ *   make WITH_ALL=1 TEST_FUZZ=6
+ * or directly:
+ *   clang -g -O1 -fsanitize=address,fuzzer -Iinclude -DNO_SSL \
+ *     fuzztest/parsediff.c -lpthread -ldl -lm -o civetweb_fuzz6
+ * Run:
+ *   ./civetweb_fuzz6 -max_len=2048 -dict=fuzztest/http1.dict fuzztest/http1/
+ */
+
+#define CIVETWEB_API static
+#include "../src/civetweb.c"
+
+#include <stdint.h>
+
+
+/* Reference: the parser functions before the SIMD scanner was added */
+static int
+ref_get_http_header_len(const char *buf, int buflen)
+{
+	int i;
+	for (i = 0; i < buflen; i++) {
+		/* Do an unsigned comparison in some conditions below */
+		const unsigned char c = (unsigned char)buf[i];
+
+		if ((c < 128) && ((char)c != '\r') && ((char)c != '\n')
+		    && !isprint(c)) {
+			/* abort scan as soon as one malformed character is found */
+			return -1;
+		}
+
+		if (i < buflen - 1) {
+			if ((buf[i] == '\n') && (buf[i + 1] == '\n')) {
+				/* Two newline, no carriage return - not standard compliant,
+				 * but it should be accepted */
+				return i + 2;
+			}
+		}
+
+		if (i < buflen - 3) {
+			if ((buf[i] == '\r') && (buf[i + 1] == '\n') && (buf[i + 2] == '\r')
+			    && (buf[i + 3] == '\n')) {
+				/* Two \r\n - standard compliant */
+				return i + 4;
+			}
+		}
+	}
+
+	return 0;
+}
+
+
+static int
+ref_skip_to_end_of_word_and_terminate(char **ppw, int eol)
+{
+	while ((unsigned char)**ppw > 127 || isgraph((unsigned char)**ppw)) {
+		(*ppw)++;
+	}
+
+	if (eol) {
+		if ((**ppw != '\r') && (**ppw != '\n')) {
+			return -1;
+		}
+	} else {
+		if (**ppw != ' ') {
+			return -1;
+		}
+	}
+
+	do {
+		**ppw = 0;
+		(*ppw)++;
+	} while (isspace((unsigned char)**ppw));
+
+	if (!eol) {
+		if (!isgraph((unsigned char)**ppw)) {
+			return -1;
+		}
+	}
+	return 1;
+}
+
+
+static int
+ref_parse_http_headers(char **buf, struct mg_header hdr[MG_MAX_HEADERS])
+{
+	int i;
+	int num_headers = 0;
+
+	for (i = 0; i < (int)MG_MAX_HEADERS; i++) {
+		char *dp = *buf;
+
+		while ((*dp != ':') && (*dp >= 33) && (*dp <= 126)) {
+			dp++;
+		}
+		if (dp == *buf) {
+			break;
+		}
+		while (*dp == ' ') {
+			*dp = 0;
+			dp++;
+		}
+		if (*dp != ':') {
+			return -1;
+		}
+		*dp = 0;
+		hdr[i].name = *buf;
+		do {
+			dp++;
+		} while ((*dp == ' ') || (*dp == '\t'));
+		hdr[i].value = dp;
+		while ((*dp != 0) && (*dp != '\r') && (*dp != '\n')) {
+			dp++;
+		}
+		if (*dp == '\r') {
+			*dp = 0;
+			dp++;
+			if (*dp != '\n') {
+				return -1;
+			}
+		}
+		num_headers = i + 1;
+		if (*dp) {
+			*dp = 0;
+			dp++;
+			*buf = dp;
+			if ((dp[0] == '\r') || (dp[0] == '\n')) {
+				break;
+			}
+		} else {
+			*buf = dp;
+			break;
+		}
+	}
+	return num_headers;
+}
+
+
+static int
+ref_parse_http_request(char *buf, int len, struct mg_request_info *ri)
+{
+	int request_length;
+	int init_skip = 0;
+
+	ri->remote_user = ri->request_method = ri->request_uri = ri->http_version =
+	    NULL;
+	ri->num_headers = 0;
+
+	while ((len > 0) && isspace((unsigned char)*buf)) {
+		buf++;
+		len--;
+		init_skip++;
+	}
+	if (len == 0) {
+		return 0;
+	}
+	if (iscntrl((unsigned char)*buf)) {
+		return -1;
+	}
+	request_length = ref_get_http_header_len(buf, len);
+	if (request_length <= 0) {
+		return request_length;
+	}
+	buf[request_length - 1] = '\0';
+	if ((*buf == 0) || (*buf == '\r') || (*buf == '\n')) {
+		return -1;
+	}
+	ri->request_method = buf;
+	if (ref_skip_to_end_of_word_and_terminate(&buf, 0) <= 0) {
+		return -1;
+	}
+	ri->request_uri = buf;
+	if (ref_skip_to_end_of_word_and_terminate(&buf, 0) <= 0) {
+		return -1;
+	}
+	ri->http_version = buf;
+	if (ref_skip_to_end_of_word_and_terminate(&buf, 1) <= 0) {
+		return -1;
+	}
+	if (strncmp(ri->http_version, "HTTP/", 5) != 0) {
+		return -1;
+	}
+	ri->http_version += 5;
+	if (!is_valid_http_method(ri->request_method)) {
+		return -1;
+	}
+	ri->num_headers = ref_parse_http_headers(&buf, ri->http_headers);
+	if (ri->num_headers < 0) {
+		return -1;
+	}
+	return request_length + init_skip;
+}
+
+
+/* Offset of p in the buffer base, -1 for NULL */
+static long
+ofs(const char *p, const char *base)
+{
+	return p ? (long)(p - base) : -1L;
+}
+
+
+static void
+compare_request(const struct mg_request_info *a,
+                const char *a_base,
+                const struct mg_request_info *b,
+                const char *b_base)
+{
+	int i;
+
+	if ((ofs(a->request_method, a_base) != ofs(b->request_method, b_base))
+	    || (ofs(a->request_uri, a_base) != ofs(b->request_uri, b_base))
+	    || (ofs(a->http_version, a_base) != ofs(b->http_version, b_base))
+	    || (a->num_headers != b->num_headers)) {
+		abort();
+	}
+	for (i = 0; i < a->num_headers; i++) {
+		if ((ofs(a->http_headers[i].name, a_base)
+		     != ofs(b->http_headers[i].name, b_base))
+		    || (ofs(a->http_headers[i].value, a_base)
+		        != ofs(b->http_headers[i].value, b_base))) {
+			abort();
+		}
+	}
+}
+
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	static char buf[8192], ref_buf[8192];
+	struct mg_request_info ri, ref_ri;
+	int level, ret, ref_ret;
+
+	if (size > sizeof(buf)) {
+		return 0;
+	}
+
+	memcpy(ref_buf, data, size);
+	memset(&ref_ri, 0, sizeof(ref_ri));
+	ref_ret = ref_parse_http_request(ref_buf, (int)size, &ref_ri);
+
+	for (level = SCAN_LEVEL_SCALAR; level <= SCAN_LEVEL_AVX2; level++) {
+		if (!scan_select(level)) {
+			/* Not supported by this CPU */
+			continue;
+		}
+		memcpy(buf, data, size);
+		memset(&ri, 0, sizeof(ri));
+		ret = parse_http_request(buf, (int)size, &ri);
+		if ((ret != ref_ret) || memcmp(buf, ref_buf, size)) {
+			abort();
+		}
+		compare_request(&ri, buf, &ref_ri, ref_buf);
+	}
+	scan_init();
+	return 0;
+}
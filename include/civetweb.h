@@ -459,6 +459,37 @@ CIVETWEB_API struct mg_context *mg_start(const struct mg_callbacks *callbacks,
 CIVETWEB_API void mg_stop(struct mg_context *);
 
 
+/* Reopen the access log files.
+
+   If access_log_buffer_size is set, the access log files are kept open by
+   a writer thread. Call this function after the log files have been
+   renamed (log rotation), e.g. from a SIGHUP handler, to let the writer
+   thread close and create them again. Without access_log_buffer_size, the
+   files are opened for every request and this function does nothing.
+   The function does not block and is safe to call from any thread, but
+   not from a signal handler. */
+CIVETWEB_API void mg_reopen_log_files(struct mg_context *ctx);
+
+
+/* Replace the access control list of a running server.
+
+   Parameters:
+     ctx: server context
+     list: new list, in the format of the access_control_list option
+           (e.g. "-0.0.0.0/0,+192.168.0.0/16"), or NULL to allow all
+           addresses.
+   The list is used for all connections accepted after the function
+   returns. mg_get_option still returns the value set at server start.
+   Return:
+     0 on success,
+     -1 if ctx is not a server context,
+     -2 if the list is malformed,
+     -3 if out of memory.
+   In case of an error, the previous list remains active. */
+CIVETWEB_API int mg_set_access_control_list(struct mg_context *ctx,
+                                            const char *list);
+
+
 /* Add an additional domain to an already running web server.
  *
  * Parameters:
@@ -810,6 +841,27 @@ mg_get_response_info(const struct mg_connection *);
 CIVETWEB_API int mg_write(struct mg_connection *, const void *buf, size_t len);
 
 
+/* Send the data collected in the output buffer (see output_buffer_size)
+   to the client. Handlers streaming data (e.g., server sent events) must
+   call this function, if the output buffer is enabled. The buffer is
+   flushed automatically at the end of the request.
+   Return:
+    0   on success, or if there is no buffered data
+    -1  on error */
+CIVETWEB_API int mg_flush(struct mg_connection *conn);
+
+
+/* Allocate memory that is valid until the current request has been
+   handled. There is no function to free it: all memory allocated for a
+   request is released at once, when the next request is read or the
+   connection is closed. The memory is private to the connection, so the
+   function must only be called by the thread handling the request.
+   Return:
+    A pointer to size bytes of memory (aligned for any basic type),
+    or NULL if out of memory. */
+CIVETWEB_API void *mg_request_alloc(struct mg_connection *conn, size_t size);
+
+
 /* Send data to a websocket client wrapped in a websocket frame.  Uses
    mg_lock_connection to ensure that the transmission is not interrupted,
    i.e., when the application is proactively communicating and responding to
@@ -1065,6 +1117,60 @@ CIVETWEB_API const char *mg_get_header(const struct mg_connection *,
                                        const char *name);
 
 
+/* Well-known HTTP headers for mg_get_header_id.
+   The request and response headers are classified once when they are
+   read, so looking up one of these headers does not require string
+   compares. */
+enum {
+	MG_HDR_ACCEPT,
+	MG_HDR_ACCEPT_ENCODING,
+	MG_HDR_ACCEPT_LANGUAGE,
+	MG_HDR_ACCESS_CONTROL_REQUEST_HEADERS,
+	MG_HDR_ACCESS_CONTROL_REQUEST_METHOD,
+	MG_HDR_AUTHORIZATION,
+	MG_HDR_CACHE_CONTROL,
+	MG_HDR_CONNECTION,
+	MG_HDR_CONTENT_LENGTH,
+	MG_HDR_CONTENT_RANGE,
+	MG_HDR_CONTENT_TYPE,
+	MG_HDR_COOKIE,
+	MG_HDR_DEPTH,
+	MG_HDR_DESTINATION,
+	MG_HDR_EXPECT,
+	MG_HDR_HOST,
+	MG_HDR_IF_MODIFIED_SINCE,
+	MG_HDR_IF_NONE_MATCH,
+	MG_HDR_LOCATION,
+	MG_HDR_ORIGIN,
+	MG_HDR_OVERWRITE,
+	MG_HDR_RANGE,
+	MG_HDR_REFERER,
+	MG_HDR_SEC_WEBSOCKET_EXTENSIONS,
+	MG_HDR_SEC_WEBSOCKET_KEY,
+	MG_HDR_SEC_WEBSOCKET_KEY1,
+	MG_HDR_SEC_WEBSOCKET_KEY2,
+	MG_HDR_SEC_WEBSOCKET_PROTOCOL,
+	MG_HDR_SEC_WEBSOCKET_VERSION,
+	MG_HDR_TRANSFER_ENCODING,
+	MG_HDR_UPGRADE,
+	MG_HDR_USER_AGENT,
+	MG_HDR_X_FORWARDED_FOR,
+
+	/* Number of well-known headers (not a header) */
+	MG_HDR_COUNT
+};
+
+
+/* Get the value of a well-known HTTP header.
+
+   Same as mg_get_header, but the header is specified by its MG_HDR_* id
+   instead of its name. If the header is present multiple times, the value
+   of the first one is returned. If it is not present, or header_id is
+   invalid, NULL is returned. */
+CIVETWEB_API const char *mg_get_header_id(const struct mg_connection *,
+                                          int header_id);
+
+
 /* Get a value of particular form variable.
 
    Parameters:
@@ -1628,6 +1734,24 @@ CIVETWEB_API int mg_response_header_add_lines(struct mg_connection *conn,
 CIVETWEB_API int mg_response_header_send(struct mg_connection *conn);
 
 
+/* Compress the response body sent by mg_send_chunk, if the client accepts
+ * it (currently zstd, if the server is built with USE_ZSTD).
+ * Call this function after mg_response_header_start and before
+ * mg_response_header_send, for a response with "Transfer-Encoding: chunked".
+ * It adds a "Vary: Accept-Encoding" header and, if the response will be
+ * compressed, a "Content-Encoding" header. The response must be terminated
+ * by mg_send_chunk(conn, "", 0).
+ * Parameters:
+ *   conn: Current connection handle.
+ * Return:
+ *   1:    response body will be compressed
+ *   0:    response body will not be compressed
+ *  <0:    error (see mg_response_header_add)
+ */
+CIVETWEB_API int
+mg_response_header_add_compression(struct mg_connection *conn);
+
+
 /* Callback types for miscellaneous-socket-event handlers in C/C++.
 
    mg_misc_socket_flags_provider
@@ -0,0 +1,1059 @@
+/* access_log.inl
+ *
+ * Access log formats and asynchronous access log writer.
+ *
+ * Besides the NCSA text format, access log lines can be written as JSON
+ * (one object per line) or as length-prefixed binary records, with the
+ * fields selected by access_log_fields. The field list is parsed once
+ * per domain, a line is formatted in one pass into the buffer of
+ * log_access.
+ *
+ * Without this module, log_access opens the access log file, locks it,
+ * writes one line, flushes and closes it again for every request. If
+ * access_log_buffer_size is set, every worker thread gets a ring buffer
+ * of this size instead. A worker only copies the formatted line into its
+ * own ring (single producer, single consumer, no lock). A background
+ * thread drains all rings every access_log_flush_interval_ms (or earlier,
+ * if a ring is more than half full), keeps the log files open and writes
+ * all lines with one fflush per pass.
+ *
+ * If a ring is full, the line is dropped and counted, the worker never
+ * waits for the disk. Dropped lines are reported in the error log.
+ *
+ * Log files are reopened after mg_reopen_log_files (e.g. on SIGHUP) and,
+ * except on Windows, if the file has been moved or deleted (log rotation).
+ *
+ * Requires GCC compatible atomic builtins; without them, the access log
+ * is written synchronously as before.
+ *
+ * This file is part of the CivetWeb project.
+ */
+
+#if defined(NO_FILESYSTEMS)
+#error "This file must only be included, if NO_FILESYSTEMS is not set"
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define ACCESS_LOG_ASYNC
+#endif
+
+/* Smallest ring buffer size, must be a power of 2 and hold several lines
+ * of the maximum length (4 KB, see log_access) */
+#define ACCESS_LOG_MIN_RING_SIZE (16384)
+
+/* Limits for access_log_flush_interval_ms */
+#define ACCESS_LOG_MIN_INTERVAL_MS (10)
+#define ACCESS_LOG_DEFAULT_INTERVAL_MS (1000)
+
+
+/* Access log formats (access_log_format) */
+enum {
+	ACCESS_LOG_FORMAT_NCSA,
+	ACCESS_LOG_FORMAT_JSON,
+	ACCESS_LOG_FORMAT_BINARY
+};
+
+
+/* Fields of the JSON and binary formats (access_log_fields). The value is
+ * the field id in binary records: add new fields at the end. */
+enum {
+	ALF_REMOTE_ADDR,
+	ALF_REMOTE_PORT,
+	ALF_REMOTE_USER,
+	ALF_TIME,
+	ALF_METHOD,
+	ALF_URI,
+	ALF_QUERY,
+	ALF_HTTP_VERSION,
+	ALF_STATUS,
+	ALF_BYTES_SENT,
+	ALF_BYTES_RECEIVED,
+	ALF_REFERER,
+	ALF_USER_AGENT,
+	ALF_HOST,
+	ALF_DURATION,
+	ALF_TLS_PROTOCOL,
+	ALF_HANDLER,
+	ALF_COUNT
+};
+
+static const struct {
+	const char *name;
+	int is_number;
+} access_log_field_def[ALF_COUNT] = {{"remote_addr", 0},
+                                     {"remote_port", 1},
+                                     {"remote_user", 0},
+                                     {"time", 1},
+                                     {"method", 0},
+                                     {"uri", 0},
+                                     {"query", 0},
+                                     {"http_version", 0},
+                                     {"status", 1},
+                                     {"bytes_sent", 1},
+                                     {"bytes_received", 1},
+                                     {"referer", 0},
+                                     {"user_agent", 0},
+                                     {"host", 0},
+                                     {"duration_us", 1},
+                                     {"tls_protocol", 0},
+                                     {"handler", 0}};
+
+/* Field id of a text line returned by the Lua log() function. In the
+ * binary format, such a line is a record with only this string field. */
+#define ACCESS_LOG_TEXT_FIELD (255)
+
+mg_static_assert(ALF_COUNT < ACCESS_LOG_TEXT_FIELD,
+                 "field id must fit in one byte");
+
+
+/* Parse access_log_format and access_log_fields of a domain.
+ * Return -1 if both are valid, or the index of the invalid option. */
+static int
+access_log_parse_format(struct mg_domain_context *dom)
+{
+	const char *format = dom->config[ACCESS_LOG_FORMAT];
+	const char *list = dom->config[ACCESS_LOG_FIELDS];
+	struct vec vec;
+	unsigned i, n = 0;
+
+	if ((format == NULL) || !mg_strcasecmp(format, "ncsa")) {
+		dom->access_log_format = ACCESS_LOG_FORMAT_NCSA;
+	} else if (!mg_strcasecmp(format, "json")) {
+		dom->access_log_format = ACCESS_LOG_FORMAT_JSON;
+	} else if (!mg_strcasecmp(format, "binary")) {
+		dom->access_log_format = ACCESS_LOG_FORMAT_BINARY;
+	} else {
+		return ACCESS_LOG_FORMAT;
+	}
+
+	while ((list != NULL)
+	       && ((list = next_option(list, &vec, NULL)) != NULL)) {
+		for (i = 0; i < ALF_COUNT; i++) {
+			if ((strlen(access_log_field_def[i].name) == vec.len)
+			    && !mg_strncasecmp(access_log_field_def[i].name,
+			                       vec.ptr,
+			                       vec.len)) {
+				break;
+			}
+		}
+		if ((i == ALF_COUNT) || (n >= ACCESS_LOG_MAX_FIELDS)) {
+			return ACCESS_LOG_FIELDS;
+		}
+		dom->access_log_fields[n++] = (unsigned char)i;
+	}
+	dom->access_log_num_fields = n;
+	return -1;
+}
+
+
+/* Value of a field: a string (NULL if not available) for text fields,
+ * *num for number fields */
+static const char *
+access_log_field_value(const struct mg_connection *conn,
+                       int field,
+                       int64_t *num)
+{
+	const struct mg_request_info *ri = &conn->request_info;
+
+	*num = 0;
+	switch (field) {
+	case ALF_REMOTE_ADDR:
+		return ri->remote_addr;
+	case ALF_REMOTE_PORT:
+		*num = ri->remote_port;
+		break;
+	case ALF_REMOTE_USER:
+		return ri->remote_user;
+	case ALF_TIME:
+		*num = (int64_t)conn->conn_birth_time;
+		break;
+	case ALF_METHOD:
+		return ri->request_method;
+	case ALF_URI:
+		return ri->request_uri;
+	case ALF_QUERY:
+		return ri->query_string;
+	case ALF_HTTP_VERSION:
+		return ri->http_version;
+	case ALF_STATUS:
+		*num = conn->status_code;
+		break;
+	case ALF_BYTES_SENT:
+		*num = conn->num_bytes_sent;
+		break;
+	case ALF_BYTES_RECEIVED:
+		*num = conn->consumed_content;
+		break;
+	case ALF_REFERER:
+		return mg_get_header_id(conn, MG_HDR_REFERER);
+	case ALF_USER_AGENT:
+		return mg_get_header_id(conn, MG_HDR_USER_AGENT);
+	case ALF_HOST:
+		return mg_get_header_id(conn, MG_HDR_HOST);
+	case ALF_DURATION:
+#if defined(USE_SERVER_STATS)
+		*num = (int64_t)(conn->processing_time * 1.0E6);
+#else
+		{
+			struct timespec tnow;
+			clock_gettime(CLOCK_MONOTONIC, &tnow);
+			*num = (int64_t)(mg_difftimespec(&tnow, &conn->req_time) * 1.0E6);
+		}
+#endif
+		break;
+	case ALF_TLS_PROTOCOL:
+		if (conn->ssl == NULL) {
+			return NULL;
+		}
+#if defined(USE_MBEDTLS)
+		return mbedtls_ssl_get_version(conn->ssl);
+#elif defined(USE_GNUTLS)
+		return gnutls_protocol_get_name(
+		    gnutls_protocol_get_version(conn->ssl->sess));
+#elif !defined(NO_SSL)
+		return SSL_get_version(conn->ssl);
+#else
+		return NULL;
+#endif
+	case ALF_HANDLER:
+		return conn->handler_name;
+	default:
+		break;
+	}
+	return NULL;
+}
+
+
+/* Return the length of a valid UTF-8 encoded character with at least
+ * two bytes at s, or 0 (overlong forms and surrogates are invalid). */
+static size_t
+access_log_utf8_len(const unsigned char *s)
+{
+	unsigned char lo = 0x80, hi = 0xBF;
+	size_t len, i;
+
+	if ((s[0] >= 0xC2) && (s[0] <= 0xDF)) {
+		len = 2;
+	} else if ((s[0] >= 0xE0) && (s[0] <= 0xEF)) {
+		len = 3;
+		if (s[0] == 0xE0) {
+			lo = 0xA0;
+		} else if (s[0] == 0xED) {
+			hi = 0x9F;
+		}
+	} else if ((s[0] >= 0xF0) && (s[0] <= 0xF4)) {
+		len = 4;
+		if (s[0] == 0xF0) {
+			lo = 0x90;
+		} else if (s[0] == 0xF4) {
+			hi = 0x8F;
+		}
+	} else {
+		return 0;
+	}
+	if ((s[1] < lo) || (s[1] > hi)) {
+		return 0;
+	}
+	for (i = 2; i < len; i++) {
+		if ((s[i] < 0x80) || (s[i] > 0xBF)) {
+			return 0;
+		}
+	}
+	return len;
+}
+
+
+/* Append a JSON string in quotes, or null. Long strings are truncated,
+ * the result is always valid JSON if at least 4 bytes are available.
+ * Control characters, DEL and bytes not part of valid UTF-8 are written
+ * as \u00XX, so the output is valid UTF-8 as well. */
+static char *
+access_log_json_str(char *p, const char *end, const char *s)
+{
+	static const char hex[] = "0123456789abcdef";
+	unsigned char c;
+	size_t len;
+
+	if (s == NULL) {
+		memcpy(p, "null", 4);
+		return p + 4;
+	}
+	*p++ = '"';
+	for (; (c = (unsigned char)*s) != 0; s++) {
+		if ((c == '"') || (c == '\\')) {
+			if (end - p < 3) {
+				break;
+			}
+			*p++ = '\\';
+			*p++ = (char)c;
+		} else if ((c >= 0x20) && (c < 0x7F)) {
+			if (end - p < 2) {
+				break;
+			}
+			*p++ = (char)c;
+		} else if ((c >= 0x80)
+		           && ((len = access_log_utf8_len((const unsigned char *)s))
+		               > 0)) {
+			if (end - p < (ptrdiff_t)len + 1) {
+				break;
+			}
+			memcpy(p, s, len);
+			p += len;
+			s += len - 1;
+		} else {
+			if (end - p < 7) {
+				break;
+			}
+			memcpy(p, "\\u00", 4);
+			p[4] = hex[c >> 4];
+			p[5] = hex[c & 15];
+			p += 6;
+		}
+	}
+	*p++ = '"';
+	return p;
+}
+
+
+/* Format a JSON line (without '\n') with the fields configured for the
+ * domain. Fields not fitting into the buffer are omitted.
+ * Return the length, buf is NUL terminated. */
+static size_t
+access_log_format_json(const struct mg_connection *conn,
+                       char *buf,
+                       size_t buf_len)
+{
+	const struct mg_domain_context *dom = conn->dom_ctx;
+	char *p = buf, *end = buf + buf_len - 2; /* space for "}" and NUL */
+	const char *name, *val;
+	size_t name_len;
+	int64_t num;
+	unsigned i;
+
+	*p++ = '{';
+	for (i = 0; i < dom->access_log_num_fields; i++) {
+		name = access_log_field_def[dom->access_log_fields[i]].name;
+		name_len = strlen(name);
+		/* ,"name": and a number, null or at least "" */
+		if ((size_t)(end - p) < name_len + 4 + 21) {
+			break;
+		}
+		if (i > 0) {
+			*p++ = ',';
+		}
+		*p++ = '"';
+		memcpy(p, name, name_len);
+		p += name_len;
+		*p++ = '"';
+		*p++ = ':';
+		val = access_log_field_value(conn, dom->access_log_fields[i], &num);
+		if (access_log_field_def[dom->access_log_fields[i]].is_number) {
+			mg_snprintf(NULL,
+			            NULL,
+			            p,
+			            (size_t)(end - p),
+			            "%" INT64_FMT,
+			            num);
+			p += strlen(p);
+		} else {
+			p = access_log_json_str(p, end, val);
+		}
+	}
+	*p++ = '}';
+	*p = 0;
+	return (size_t)(p - buf);
+}
+
+
+/* Format a binary record with the fields configured for the domain:
+ *   4 bytes  length of the rest of the record
+ *   for every field:
+ *     1 byte   field id (ALF_*)
+ *     numbers: 8 bytes, signed
+ *     strings: 2 bytes length (0 if not available), followed by the bytes
+ * All integers are big-endian (network byte order). Long strings are
+ * truncated, fields not fitting into the buffer are omitted.
+ * Return the record length. */
+static size_t
+access_log_format_binary(const struct mg_connection *conn,
+                         char *buf,
+                         size_t buf_len)
+{
+	const struct mg_domain_context *dom = conn->dom_ctx;
+	unsigned char *p = (unsigned char *)buf + 4;
+	const unsigned char *end = (const unsigned char *)buf + buf_len;
+	const char *val;
+	size_t len;
+	uint64_t u;
+	int64_t num;
+	unsigned i;
+	int b;
+
+	for (i = 0; i < dom->access_log_num_fields; i++) {
+		val = access_log_field_value(conn, dom->access_log_fields[i], &num);
+		if (access_log_field_def[dom->access_log_fields[i]].is_number) {
+			if (end - p < 9) {
+				break;
+			}
+			*p++ = dom->access_log_fields[i];
+			u = (uint64_t)num;
+			for (b = 56; b >= 0; b -= 8) {
+				*p++ = (unsigned char)(u >> b);
+			}
+		} else {
+			if (end - p < 3) {
+				break;
+			}
+			len = (val != NULL) ? strlen(val) : 0;
+			if (len > (size_t)(end - p) - 3) {
+				len = (size_t)(end - p) - 3;
+			}
+			if (len > 0xFFFF) {
+				len = 0xFFFF;
+			}
+			*p++ = dom->access_log_fields[i];
+			*p++ = (unsigned char)(len >> 8);
+			*p++ = (unsigned char)len;
+			if (len > 0) {
+				memcpy(p, val, len);
+				p += len;
+			}
+		}
+	}
+
+	len = (size_t)(p - (unsigned char *)buf);
+	buf[0] = (char)((len - 4) >> 24);
+	buf[1] = (char)((len - 4) >> 16);
+	buf[2] = (char)((len - 4) >> 8);
+	buf[3] = (char)(len - 4);
+	return len;
+}
+
+
+/* Convert the text line in buf into a binary record with the only field
+ * ACCESS_LOG_TEXT_FIELD, so it does not corrupt the binary log. The text
+ * is truncated to fit into buf. Return the record length. */
+static size_t
+access_log_format_binary_text(char *buf, size_t buf_len)
+{
+	size_t len = strlen(buf);
+
+	if (len > buf_len - 7) {
+		len = buf_len - 7;
+	}
+	if (len > 0xFFFF) {
+		len = 0xFFFF;
+	}
+	memmove(buf + 7, buf, len);
+	buf[0] = (char)((len + 3) >> 24);
+	buf[1] = (char)((len + 3) >> 16);
+	buf[2] = (char)((len + 3) >> 8);
+	buf[3] = (char)(len + 3);
+	buf[4] = (char)ACCESS_LOG_TEXT_FIELD;
+	buf[5] = (char)(len >> 8);
+	buf[6] = (char)len;
+	return len + 7;
+}
+
+
+#if defined(ACCESS_LOG_ASYNC)
+
+/* Every line in a ring buffer starts with this header, followed by the
+ * data written to the file (text including '\n', or a binary record).
+ * Records are aligned to the header size. A record with dom == NULL fills
+ * the unused space at the end of the ring. */
+struct access_log_rec {
+	struct mg_domain_context *dom;
+	uint32_t len; /* data length */
+};
+
+#define ACCESS_LOG_REC_SIZE(len)                                               \
+	(sizeof(struct access_log_rec)                                             \
+	 + (((len) + sizeof(struct access_log_rec) - 1)                            \
+	    & ~(sizeof(struct access_log_rec) - 1)))
+
+
+/* Ring buffer of one worker thread. head is written only by the worker,
+ * tail only by the writer thread. Both are free running counters. */
+struct access_log_ring {
+	char *buf;
+	uint32_t head;
+	unsigned long dropped; /* written by the worker */
+	char pad1[64];
+	uint32_t tail;
+	char pad2[64];
+};
+
+
+/* Open log file of one domain (writer thread only) */
+struct access_log_file {
+	struct access_log_file *next;
+	struct mg_domain_context *dom;
+	FILE *fp;
+	int failed; /* open failed, error already reported */
+#if !defined(_WIN32)
+	dev_t dev;
+	ino_t ino;
+#endif
+};
+
+
+struct mg_access_log {
+	struct access_log_ring *rings; /* one per worker_connections entry */
+	unsigned num_rings;
+	uint32_t size; /* bytes per ring, power of 2 */
+	int interval_ms;
+
+	pthread_mutex_t mutex; /* protects the flags below, for cond */
+	pthread_cond_t cond;
+	int wakeup; /* a ring is more than half full */
+	int reopen; /* set by mg_reopen_log_files */
+	int stop;
+
+	pthread_t threadid;
+
+	/* Writer thread only */
+	struct access_log_file *files;
+	unsigned long lines;           /* lines written */
+	unsigned long dropped_reported; /* dropped lines reported */
+};
+
+
+/* Wake up the writer thread. Not used for every line, only if a ring
+ * crosses the half full mark. */
+static void
+access_log_wakeup(struct mg_access_log *al, int *flag)
+{
+	pthread_mutex_lock(&al->mutex);
+	*flag = 1;
+	pthread_cond_signal(&al->cond);
+	pthread_mutex_unlock(&al->mutex);
+}
+
+
+/* Store one log line in the ring buffer of a worker thread.
+ * Return 1 if the line has been stored, 0 if it has been dropped. */
+static int
+access_log_push(struct mg_access_log *al,
+                struct access_log_ring *ring,
+                struct mg_domain_context *dom,
+                const char *text,
+                size_t text_len)
+{
+	uint32_t head, tail, used, pos, contig, need, skip = 0;
+	struct access_log_rec *rec;
+
+	need = (uint32_t)ACCESS_LOG_REC_SIZE(text_len);
+	head = ring->head;
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	used = head - tail;
+	pos = head & (al->size - 1);
+	contig = al->size - pos;
+	if (contig < need) {
+		/* Skip the end of the ring, the record must be contiguous */
+		skip = contig;
+	}
+	if ((need > al->size / 2) || (al->size - used < skip + need)) {
+		/* Full: drop the line, do not wait for the writer */
+		__atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+
+	if (skip) {
+		rec = (struct access_log_rec *)(void *)(ring->buf + pos);
+		rec->dom = NULL;
+		rec->len = skip - (uint32_t)sizeof(*rec);
+		pos = 0;
+	}
+	rec = (struct access_log_rec *)(void *)(ring->buf + pos);
+	rec->dom = dom;
+	rec->len = (uint32_t)text_len;
+	memcpy((char *)(rec + 1), text, text_len);
+
+	__atomic_store_n(&ring->head, head + skip + need, __ATOMIC_RELEASE);
+
+	if ((used <= al->size / 2) && (used + skip + need > al->size / 2)) {
+		access_log_wakeup(al, &al->wakeup);
+	}
+	return 1;
+}
+
+
+/* Get the log file entry of a domain, open the file if required.
+ * Returns NULL if out of memory, the entry has fp == NULL if the file
+ * cannot be opened. */
+static struct access_log_file *
+access_log_file_of(struct mg_access_log *al,
+                   struct mg_context *ctx,
+                   struct mg_domain_context *dom)
+{
+	struct access_log_file *f;
+	struct mg_file fi;
+	const char *path = dom->config[ACCESS_LOG_FILE];
+
+	for (f = al->files; f != NULL; f = f->next) {
+		if (f->dom == dom) {
+			break;
+		}
+	}
+	if (f == NULL) {
+		f = (struct access_log_file *)mg_calloc_ctx(1, sizeof(*f), ctx);
+		if (f == NULL) {
+			return NULL;
+		}
+		f->dom = dom;
+		f->next = al->files;
+		al->files = f;
+	}
+
+	if ((f->fp == NULL) && (path != NULL)) {
+		if (mg_fopen(NULL, path, MG_FOPEN_MODE_APPEND, &fi)) {
+			f->fp = fi.access.fp;
+			f->failed = 0;
+#if !defined(_WIN32)
+			{
+				struct stat st;
+				if (fstat(fileno(f->fp), &st) == 0) {
+					f->dev = st.st_dev;
+					f->ino = st.st_ino;
+				}
+			}
+#endif
+		} else if (!f->failed) {
+			f->failed = 1;
+			mg_cry_ctx_internal(ctx, "Error writing log file %s", path);
+		}
+	}
+	return f;
+}
+
+
+/* Write all lines stored in a ring buffer to the log files */
+static void
+access_log_drain(struct mg_access_log *al,
+                 struct mg_context *ctx,
+                 struct access_log_ring *ring)
+{
+	uint32_t head, tail;
+	struct access_log_rec *rec;
+	struct access_log_file *f = NULL;
+	unsigned long lines = 0;
+
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	tail = ring->tail;
+
+	while (tail != head) {
+		rec = (struct access_log_rec *)(void *)(ring->buf
+		                                        + (tail & (al->size - 1)));
+		if (rec->dom != NULL) {
+			if ((f == NULL) || (f->dom != rec->dom)) {
+				f = access_log_file_of(al, ctx, rec->dom);
+			}
+			if ((f != NULL) && (f->fp != NULL)) {
+				if (fwrite(rec + 1, 1, rec->len, f->fp) == rec->len) {
+					lines++;
+				} else {
+					mg_cry_ctx_internal(ctx,
+					                    "Error writing log file %s",
+					                    rec->dom->config[ACCESS_LOG_FILE]);
+					/* Try to open it again for the next line */
+					fclose(f->fp);
+					f->fp = NULL;
+				}
+			}
+		}
+		tail += (uint32_t)ACCESS_LOG_REC_SIZE(rec->len);
+	}
+
+	__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&al->lines, lines, __ATOMIC_RELAXED);
+}
+
+
+/* Close all log files. They are opened again for the next line. */
+static void
+access_log_close_files(struct mg_access_log *al, int free_entries)
+{
+	struct access_log_file *f, *next;
+
+	for (f = al->files; f != NULL; f = next) {
+		next = f->next;
+		if (f->fp != NULL) {
+			fclose(f->fp);
+			f->fp = NULL;
+		}
+		if (free_entries) {
+			mg_free(f);
+		}
+	}
+	if (free_entries) {
+		al->files = NULL;
+	}
+}
+
+
+#if !defined(_WIN32)
+/* Close log files that have been renamed or deleted (log rotation) */
+static void
+access_log_check_rotation(struct mg_access_log *al)
+{
+	struct access_log_file *f;
+	struct stat st;
+
+	for (f = al->files; f != NULL; f = f->next) {
+		if (f->fp == NULL) {
+			continue;
+		}
+		if ((stat(f->dom->config[ACCESS_LOG_FILE], &st) != 0)
+		    || (st.st_dev != f->dev) || (st.st_ino != f->ino)) {
+			fclose(f->fp);
+			f->fp = NULL;
+		}
+	}
+}
+#endif
+
+
+/* Write all buffered lines and report dropped lines */
+static void
+access_log_flush(struct mg_access_log *al, struct mg_context *ctx)
+{
+	struct access_log_file *f;
+	unsigned long dropped = 0;
+	unsigned i;
+
+	for (i = 0; i < al->num_rings; i++) {
+		access_log_drain(al, ctx, &al->rings[i]);
+		dropped +=
+		    __atomic_load_n(&al->rings[i].dropped, __ATOMIC_RELAXED);
+	}
+	for (f = al->files; f != NULL; f = f->next) {
+		if ((f->fp != NULL) && (fflush(f->fp) != 0)) {
+			mg_cry_ctx_internal(ctx,
+			                    "Error writing log file %s",
+			                    f->dom->config[ACCESS_LOG_FILE]);
+		}
+	}
+
+	if (dropped != al->dropped_reported) {
+		mg_cry_ctx_internal(ctx,
+		                    "Access log buffer full: %lu lines dropped",
+		                    dropped - al->dropped_reported);
+		al->dropped_reported = dropped;
+	}
+}
+
+
+static void
+access_log_thread_run(struct mg_context *ctx)
+{
+	struct mg_access_log *al = ctx->access_log;
+	struct mg_workerTLS tls;
+	struct timespec abstime;
+	uint64_t next_rotation_check = 0, now;
+	int stop, reopen;
+
+	mg_set_thread_name("log");
+
+	tls.is_master = 0;
+	tls.thread_idx = (unsigned)mg_atomic_inc(&thread_idx_max);
+#if defined(_WIN32)
+	tls.pthread_cond_helper_mutex = CreateEvent(NULL, FALSE, FALSE, NULL);
+#endif
+#if defined(USE_IO_URING)
+	tls.uring = NULL;
+#endif
+	tls.user_ptr = NULL;
+	pthread_setspecific(sTlsKey, &tls);
+
+	do {
+		pthread_mutex_lock(&al->mutex);
+		if (!al->stop && !al->wakeup && !al->reopen) {
+			clock_gettime(CLOCK_REALTIME, &abstime);
+			abstime.tv_sec += al->interval_ms / 1000;
+			abstime.tv_nsec += (long)(al->interval_ms % 1000) * 1000000L;
+			if (abstime.tv_nsec >= 1000000000L) {
+				abstime.tv_sec++;
+				abstime.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait(&al->cond, &al->mutex, &abstime);
+		}
+		stop = al->stop;
+		reopen = al->reopen;
+		al->wakeup = 0;
+		al->reopen = 0;
+		pthread_mutex_unlock(&al->mutex);
+
+		if (reopen) {
+			access_log_close_files(al, 0);
+		}
+#if !defined(_WIN32)
+		now = mg_get_current_time_ns();
+		if (now >= next_rotation_check) {
+			access_log_check_rotation(al);
+			next_rotation_check =
+			    now + (uint64_t)al->interval_ms * 1000000u;
+		}
+#else
+		(void)now;
+		(void)next_rotation_check;
+#endif
+
+		/* Workers are stopped before this thread, so the last pass
+		 * writes all remaining lines. */
+		access_log_flush(al, ctx);
+	} while (!stop);
+
+	access_log_close_files(al, 1);
+
+#if defined(_WIN32)
+	CloseHandle(tls.pthread_cond_helper_mutex);
+#endif
+	pthread_setspecific(sTlsKey, NULL);
+}
+
+
+#if defined(_WIN32)
+static unsigned __stdcall access_log_thread(void *thread_func_param)
+{
+	access_log_thread_run((struct mg_context *)thread_func_param);
+	return 0;
+}
+#else
+static void *
+access_log_thread(void *thread_func_param)
+{
+#if !defined(__ZEPHYR__)
+	struct sigaction sa;
+
+	/* Ignore SIGPIPE */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &sa, NULL);
+#endif
+
+	access_log_thread_run((struct mg_context *)thread_func_param);
+	return NULL;
+}
+#endif
+
+
+/* Allocate the ring buffers and start the writer thread, if
+ * access_log_buffer_size is set. Must be called before the worker threads
+ * are started. Returns 0 on success (also if the log is synchronous). */
+static int
+access_log_init(struct mg_context *ctx)
+{
+	struct mg_access_log *al;
+	int size_cfg, interval;
+	uint32_t size;
+	unsigned i;
+
+	ctx->access_log = NULL;
+	size_cfg = atoi(ctx->dd.config[ACCESS_LOG_BUFFER_SIZE]);
+	if (size_cfg <= 0) {
+		return 0;
+	}
+	size = ACCESS_LOG_MIN_RING_SIZE;
+	while ((size < (uint32_t)size_cfg) && (size < 0x40000000u)) {
+		size *= 2;
+	}
+	interval = atoi(ctx->dd.config[ACCESS_LOG_FLUSH_INTERVAL]);
+	if (interval <= 0) {
+		interval = ACCESS_LOG_DEFAULT_INTERVAL_MS;
+	} else if (interval < ACCESS_LOG_MIN_INTERVAL_MS) {
+		interval = ACCESS_LOG_MIN_INTERVAL_MS;
+	}
+
+	al = (struct mg_access_log *)mg_calloc_ctx(1, sizeof(*al), ctx);
+	if (al == NULL) {
+		return -1;
+	}
+	al->size = size;
+	al->interval_ms = interval;
+	al->num_rings = ctx->cfg_max_worker_threads;
+	al->rings = (struct access_log_ring *)mg_calloc_ctx(al->num_rings,
+	                                                    sizeof(al->rings[0]),
+	                                                    ctx);
+	if (al->rings == NULL) {
+		mg_free(al);
+		return -1;
+	}
+	for (i = 0; i < al->num_rings; i++) {
+		al->rings[i].buf = (char *)mg_malloc_ctx(size, ctx);
+		if (al->rings[i].buf == NULL) {
+			goto fail;
+		}
+	}
+
+	if (0 != pthread_mutex_init(&al->mutex, &pthread_mutex_attr)) {
+		goto fail;
+	}
+	if (0 != pthread_cond_init(&al->cond, NULL)) {
+		pthread_mutex_destroy(&al->mutex);
+		goto fail;
+	}
+
+	ctx->access_log = al;
+	if (mg_start_thread_with_id(access_log_thread, ctx, &al->threadid) != 0) {
+		ctx->access_log = NULL;
+		pthread_cond_destroy(&al->cond);
+		pthread_mutex_destroy(&al->mutex);
+		goto fail;
+	}
+	return 0;
+
+fail:
+	for (i = 0; i < al->num_rings; i++) {
+		mg_free(al->rings[i].buf);
+	}
+	mg_free(al->rings);
+	mg_free(al);
+	return -1;
+}
+
+
+/* Called by the master thread when the server stops, after all worker
+ * threads have been joined: write the remaining lines and stop. */
+static void
+access_log_exit(struct mg_context *ctx)
+{
+	struct mg_access_log *al = ctx->access_log;
+
+	if (al) {
+		access_log_wakeup(al, &al->stop);
+		mg_join_thread(al->threadid);
+	}
+}
+
+
+/* Called by free_context, after all threads have been stopped. */
+static void
+access_log_free(struct mg_context *ctx)
+{
+	struct mg_access_log *al = ctx->access_log;
+	unsigned i;
+
+	if (al) {
+		pthread_cond_destroy(&al->cond);
+		pthread_mutex_destroy(&al->mutex);
+		for (i = 0; i < al->num_rings; i++) {
+			mg_free(al->rings[i].buf);
+		}
+		mg_free(al->rings);
+		mg_free(al);
+		ctx->access_log = NULL;
+	}
+}
+
+
+/* Return 1 if the access log of conn is written by the writer thread:
+ * the connection belongs to a worker thread, which has a ring buffer
+ * (set in worker_thread_run). */
+static int
+access_log_is_async(const struct mg_connection *conn)
+{
+	return conn->access_log_async;
+}
+
+
+/* Queue a line for the access log of conn->dom_ctx. Only for connections
+ * with access_log_is_async(conn) == 1. */
+static void
+access_log_queue(const struct mg_connection *conn,
+                 const char *text,
+                 size_t text_len)
+{
+	struct mg_access_log *al = conn->phys_ctx->access_log;
+
+	(void)access_log_push(al,
+	                      &al->rings[conn - conn->phys_ctx->worker_connections],
+	                      conn->dom_ctx,
+	                      text,
+	                      text_len);
+}
+
+
+/* Number of lines written and dropped, for mg_get_context_info */
+static void
+access_log_get_stats(struct mg_access_log *al,
+                     unsigned long *lines,
+                     unsigned long *dropped)
+{
+	unsigned i;
+
+	*lines = __atomic_load_n(&al->lines, __ATOMIC_RELAXED);
+	*dropped = 0;
+	for (i = 0; i < al->num_rings; i++) {
+		*dropped +=
+		    __atomic_load_n(&al->rings[i].dropped, __ATOMIC_RELAXED);
+	}
+}
+
+
+#else /* ACCESS_LOG_ASYNC */
+
+struct mg_access_log {
+	int unused;
+};
+
+
+static int
+access_log_init(struct mg_context *ctx)
+{
+	ctx->access_log = NULL;
+	if (atoi(ctx->dd.config[ACCESS_LOG_BUFFER_SIZE]) > 0) {
+		mg_cry_ctx_internal(ctx,
+		                    "%s",
+		                    "Asynchronous access log not supported");
+	}
+	return 0;
+}
+
+
+static void
+access_log_exit(struct mg_context *ctx)
+{
+	(void)ctx;
+}
+
+
+static void
+access_log_free(struct mg_context *ctx)
+{
+	(void)ctx;
+}
+
+
+static int
+access_log_is_async(const struct mg_connection *conn)
+{
+	(void)conn;
+	return 0;
+}
+
+
+static void
+access_log_queue(const struct mg_connection *conn,
+                 const char *text,
+                 size_t text_len)
+{
+	(void)conn;
+	(void)text;
+	(void)text_len;
+}
+
+#endif /* ACCESS_LOG_ASYNC */
+
+
+CIVETWEB_API void
+mg_reopen_log_files(struct mg_context *ctx)
+{
+#if defined(ACCESS_LOG_ASYNC)
+	if ((ctx != NULL) && (ctx->access_log != NULL)) {
+		access_log_wakeup(ctx->access_log, &ctx->access_log->reopen);
+	}
+#else
+	(void)ctx;
+#endif
+}
@@ -0,0 +1,288 @@
+/* acl.inl
+ *
+ * Compiled access_control_list.
+ *
+ * The access control list is compiled into a binary trie of the subnet
+ * prefixes (one for IPv4, one for IPv6) when the server is started and by
+ * mg_set_access_control_list. Checking the address of a new connection
+ * walks at most 32 (IPv4) or 128 (IPv6) nodes, instead of parsing the
+ * whole list.
+ *
+ * A node stores the position of the last list entry for its prefix. As for
+ * the uncompiled list, the last matching entry wins: this is the entry with
+ * the highest position on the path of the address. If more specific
+ * subnets follow less specific ones in the list, this is the longest prefix
+ * match.
+ *
+ * The compiled list is published like the routing table (route_table.inl):
+ * two slots with reader counters, writers are serialized by the context
+ * lock.
+ *
+ * This file is part of the CivetWeb project.
+ */
+
+
+/* Root nodes. 0 is not a valid child index. */
+#define ACL_ROOT_IPV4 (0)
+#define ACL_ROOT_IPV6 (1)
+
+
+struct mg_acl_node {
+	unsigned child[2]; /* Node index for the next bit, or 0 */
+	int rule;          /* 2 * list position + 1 for '+', or -1 */
+};
+
+struct mg_acl {
+	struct mg_acl_node *nodes;
+	unsigned num_nodes;
+	unsigned max_nodes;
+};
+
+
+static void
+acl_free(struct mg_acl *acl)
+{
+	if (acl != NULL) {
+		mg_free(acl->nodes);
+		mg_free(acl);
+	}
+}
+
+
+/* Add a node. Return its index, or 0 if out of memory. */
+static unsigned
+acl_new_node(struct mg_context *ctx, struct mg_acl *acl)
+{
+	struct mg_acl_node *nodes;
+	unsigned n;
+
+	(void)ctx; /* unused, if memory statistics are disabled */
+	if (acl->num_nodes == acl->max_nodes) {
+		n = acl->max_nodes * 2;
+		nodes = (struct mg_acl_node *)
+		    mg_realloc_ctx(acl->nodes, n * sizeof(nodes[0]), ctx);
+		if (nodes == NULL) {
+			return 0;
+		}
+		acl->nodes = nodes;
+		acl->max_nodes = n;
+	}
+	n = acl->num_nodes++;
+	acl->nodes[n].child[0] = 0;
+	acl->nodes[n].child[1] = 0;
+	acl->nodes[n].rule = -1;
+	return n;
+}
+
+
+/* Add the prefix of addr with bits bits. Return 0 if out of memory. */
+static int
+acl_insert(struct mg_context *ctx,
+           struct mg_acl *acl,
+           unsigned node,
+           const uint8_t *addr,
+           unsigned bits,
+           int rule)
+{
+	unsigned i, bit, next;
+
+	for (i = 0; i < bits; i++) {
+		bit = (addr[i >> 3] >> (7 - (i & 7))) & 1u;
+		next = acl->nodes[node].child[bit];
+		if (next == 0) {
+			next = acl_new_node(ctx, acl);
+			if (next == 0) {
+				return 0;
+			}
+			acl->nodes[node].child[bit] = next;
+		}
+		node = next;
+	}
+	/* Later entries for the same subnet override earlier ones */
+	acl->nodes[node].rule = rule;
+	return 1;
+}
+
+
+/* Compile the access control list. Return NULL if list is NULL (all
+ * addresses are allowed), if list is malformed (*error = -2) or if out of
+ * memory (*error = -3). */
+static struct mg_acl *
+acl_create(struct mg_context *ctx, const char *list, int *error)
+{
+	struct mg_acl *acl;
+	struct vec vec;
+	uint8_t addr[16];
+	unsigned bits, i;
+	int flag, family, pos = 0;
+
+	*error = 0;
+	if (list == NULL) {
+		return NULL;
+	}
+	acl = (struct mg_acl *)mg_calloc_ctx(1, sizeof(*acl), ctx);
+	if (acl == NULL) {
+		*error = -3;
+		return NULL;
+	}
+	acl->max_nodes = 64;
+	acl->nodes = (struct mg_acl_node *)
+	    mg_malloc_ctx(acl->max_nodes * sizeof(acl->nodes[0]), ctx);
+	if ((acl->nodes == NULL) || (acl_new_node(ctx, acl) != ACL_ROOT_IPV4)
+	    || (acl_new_node(ctx, acl) != ACL_ROOT_IPV6)) {
+		acl_free(acl);
+		*error = -3;
+		return NULL;
+	}
+
+	while ((list = next_option(list, &vec, NULL)) != NULL) {
+		flag = vec.ptr[0];
+		if ((vec.len == 0) || ((flag != '+') && (flag != '-'))) {
+			*error = -2;
+			break;
+		}
+		vec.ptr++;
+		vec.len--;
+		if (!parse_net(&vec, 1, &family, addr, &bits)) {
+			*error = -2;
+			break;
+		}
+
+		/* An address with bits set after the prefix never matches */
+		for (i = bits; i < ((family == AF_INET) ? 32u : 128u); i++) {
+			if ((addr[i >> 3] >> (7 - (i & 7))) & 1u) {
+				break;
+			}
+		}
+		if ((i == ((family == AF_INET) ? 32u : 128u))
+		    && !acl_insert(ctx,
+		                   acl,
+		                   (family == AF_INET) ? ACL_ROOT_IPV4 : ACL_ROOT_IPV6,
+		                   addr,
+		                   bits,
+		                   2 * pos + (flag == '+'))) {
+			*error = -3;
+			break;
+		}
+		pos++;
+	}
+
+	if (*error != 0) {
+		if (*error == -2) {
+			mg_cry_ctx_internal(ctx, "subnet must be [+|-]IP-addr[/x]");
+		}
+		acl_free(acl);
+		return NULL;
+	}
+	return acl;
+}
+
+
+/* Return 1 if sa is allowed by the list, 0 otherwise */
+static int
+acl_match(const struct mg_acl *acl, const union usa *sa)
+{
+	const struct mg_acl_node *nodes = acl->nodes;
+	const uint8_t *addr;
+	unsigned node, bits, i;
+	int best;
+
+	if (sa->sa.sa_family == AF_INET) {
+		addr = (const uint8_t *)&sa->sin.sin_addr.s_addr;
+		node = ACL_ROOT_IPV4;
+		bits = 32;
+#if defined(USE_IPV6)
+	} else if (sa->sa.sa_family == AF_INET6) {
+		addr = sa->sin6.sin6_addr.s6_addr;
+		node = ACL_ROOT_IPV6;
+		bits = 128;
+#endif
+	} else {
+		/* If any ACL is set, deny by default */
+		return 0;
+	}
+
+	best = nodes[node].rule;
+	for (i = 0; i < bits; i++) {
+		node = nodes[node].child[(addr[i >> 3] >> (7 - (i & 7))) & 1u];
+		if (node == 0) {
+			break;
+		}
+		if (nodes[node].rule > best) {
+			best = nodes[node].rule;
+		}
+	}
+	return (best >= 0) && (best & 1);
+}
+
+
+/* Get the current list for a lookup. The list must be released by
+ * acl_release(ctx, *slot). NULL means all addresses are allowed. */
+static const struct mg_acl *
+acl_acquire(struct mg_context *ctx, int *slot)
+{
+	ptrdiff_t gen;
+
+	for (;;) {
+		gen = ctx->acl_gen;
+		*slot = (int)(gen & 1);
+		mg_atomic_inc(&ctx->acl_readers[*slot]);
+		if (ctx->acl_gen == gen) {
+			return ctx->acl[*slot];
+		}
+		/* A new list has been published in the meantime */
+		mg_atomic_dec(&ctx->acl_readers[*slot]);
+	}
+}
+
+
+static void
+acl_release(struct mg_context *ctx, int slot)
+{
+	mg_atomic_dec(&ctx->acl_readers[slot]);
+}
+
+
+/* Compile and publish list. The caller must hold the context lock. Wait
+ * until no lookup uses the previous list any more, and free it.
+ * Return 0 if ok, -2 if list is malformed and -3 if out of memory (the
+ * previous list remains in both cases). */
+static int
+acl_update(struct mg_context *ctx, const char *list)
+{
+	struct mg_acl *acl;
+	int cur = (int)(ctx->acl_gen & 1);
+	int error;
+
+	acl = acl_create(ctx, list, &error);
+	if (error != 0) {
+		return error;
+	}
+
+	/* The other slot is unused: its list has been freed by the previous
+	 * update. Incrementing the generation publishes the new list. */
+	ctx->acl[1 - cur] = acl;
+	mg_atomic_inc(&ctx->acl_gen);
+
+	while (ctx->acl_readers[cur] != 0) {
+		mg_sleep(1);
+	}
+	acl_free(ctx->acl[cur]);
+	ctx->acl[cur] = NULL;
+	return 0;
+}
+
+
+CIVETWEB_API int
+mg_set_access_control_list(struct mg_context *ctx, const char *list)
+{
+	int ret;
+
+	if ((ctx == NULL) || (ctx->context_type != CONTEXT_SERVER)) {
+		return -1;
+	}
+	mg_lock_context(ctx);
+	ret = acl_update(ctx, list);
+	mg_unlock_context(ctx);
+	return ret;
+}
@@ -0,0 +1,531 @@
+/* auth_cache.inl
+ *
+ * Cache for parsed passwords files.
+ *
+ * Without the cache, every request to a protected resource opens the
+ * passwords file (global_auth_file, put_delete_auth_file, protect_uri or
+ * .htpasswd) and scans it line by line, including all files referenced by
+ * ":include=" lines. If auth_file_cache_size is set, a passwords file is
+ * parsed once into a hash table from user and realm to HA1, and checking
+ * the credentials of a request is a hash table lookup.
+ *
+ * A cached file is reloaded if the size or the modification time of the
+ * file, or of one of the included files, has changed, or if any passwords
+ * file has been modified by mg_modify_passwords_file. The status of the
+ * files is checked at most every MG_AUTH_CACHE_CHECK_INTERVAL_MS, by one
+ * request while the others keep using the cached data. A file modified
+ * within the second it has been loaded is reloaded at every check, until
+ * the modification time allows to detect a later change.
+ *
+ * A passwords file that does not exist (e.g., .htpasswd of a directory
+ * without protection) is cached as well, and checked in the same interval,
+ * so requests do not look for it again.
+ *
+ * The cache mutex is only held to find a file and to update the LRU list.
+ * Files are reference counted, so reading and checking files and
+ * verifying passwords do not block other requests.
+ *
+ * This file is part of the CivetWeb project.
+ */
+
+#if defined(NO_FILESYSTEMS)
+#error "This file must only be included, if NO_FILESYSTEMS is not set"
+#endif
+
+/* Minimum time between two status checks of the files of a cached
+ * passwords file */
+#if !defined(MG_AUTH_CACHE_CHECK_INTERVAL_MS)
+#define MG_AUTH_CACHE_CHECK_INTERVAL_MS (1000) /* in milliseconds */
+#endif
+
+
+/* One "user:domain:ha1" line */
+struct mg_auth_user {
+	struct mg_auth_user *next; /* Same hash bucket */
+	uint32_t hash;             /* Hash of user and domain */
+	unsigned src;              /* Index of the file containing the line */
+	const char *domain;        /* Allocated together with the entry */
+	const char *ha1;
+	char user[1];
+};
+
+/* A file read to build the table: the passwords file or an included file */
+struct mg_auth_file {
+	struct mg_auth_file *next;
+	int found;
+	struct mg_file_stat stat;
+	char path[1]; /* Allocated together with the entry */
+};
+
+/* One parsed passwords file */
+struct mg_auth_db {
+	struct mg_auth_db *lru_prev; /* more recently used */
+	struct mg_auth_db *lru_next; /* less recently used */
+	uint32_t hash;               /* Hash of the path */
+	struct mg_auth_file *files;  /* First: the passwords file itself */
+	unsigned num_files;
+	time_t loaded;         /* time() when the files have been read */
+	ptrdiff_t generation;  /* auth_file_generation when loaded */
+	int racy;              /* A file was modified in the second it was read */
+	int missing;           /* The passwords file does not exist */
+	struct mg_auth_user **buckets;
+	uint32_t bucket_mask;
+	unsigned count;
+
+	/* Changed after loading */
+	volatile ptrdiff_t refs; /* The cache list and every user (atomic) */
+	uint64_t next_check;     /* Time of the next status check (ns) */
+	int checking;            /* A request is checking the status */
+};
+
+struct mg_auth_cache {
+	pthread_mutex_t mutex;
+	struct mg_auth_db lru; /* List head, lru.lru_next is the most recently
+	                        * used file */
+	unsigned count;
+	unsigned max_count;
+	uint64_t check_interval; /* MG_AUTH_CACHE_CHECK_INTERVAL_MS in ns */
+};
+
+
+static uint32_t
+auth_cache_hash(const char *s1, const char *s2)
+{
+	/* FNV-1a of s1, ':' and s2 */
+	uint32_t h = 2166136261u;
+	while (*s1) {
+		h ^= (uint8_t)*s1++;
+		h *= 16777619u;
+	}
+	if (s2 != NULL) {
+		h ^= (uint8_t)':';
+		h *= 16777619u;
+		while (*s2) {
+			h ^= (uint8_t)*s2++;
+			h *= 16777619u;
+		}
+	}
+	return h;
+}
+
+
+static void
+auth_db_free(struct mg_auth_db *db)
+{
+	struct mg_auth_user *u, *next_u;
+	struct mg_auth_file *f, *next_f;
+	uint32_t i;
+
+	if (db->buckets != NULL) {
+		for (i = 0; i <= db->bucket_mask; i++) {
+			for (u = db->buckets[i]; u != NULL; u = next_u) {
+				next_u = u->next;
+				mg_free(u);
+			}
+		}
+		mg_free(db->buckets);
+	}
+	for (f = db->files; f != NULL; f = next_f) {
+		next_f = f->next;
+		mg_free(f);
+	}
+	mg_free(db);
+}
+
+
+/* Double the number of hash buckets. Return 0 if out of memory. */
+static int
+auth_db_grow(struct mg_connection *conn, struct mg_auth_db *db)
+{
+	uint32_t i, mask = db->bucket_mask * 2 + 1;
+	struct mg_auth_user **buckets, *u, *next;
+
+	(void)conn; /* unused, if memory statistics are disabled */
+	buckets = (struct mg_auth_user **)
+	    mg_calloc_ctx((size_t)mask + 1, sizeof(buckets[0]), conn->phys_ctx);
+	if (buckets == NULL) {
+		return 0;
+	}
+	for (i = 0; i <= db->bucket_mask; i++) {
+		for (u = db->buckets[i]; u != NULL; u = next) {
+			next = u->next;
+			u->next = buckets[u->hash & mask];
+			buckets[u->hash & mask] = u;
+		}
+	}
+	mg_free(db->buckets);
+	db->buckets = buckets;
+	db->bucket_mask = mask;
+	return 1;
+}
+
+
+/* Add an entry read from file number stack[depth]. read_auth_file stops
+ * reading a file at the first line for the user and domain, so lines
+ * following another line for the same user and domain in the same file or
+ * in a file including it are never used.
+ * Return 0 if out of memory. */
+static int
+auth_db_add_user(struct mg_connection *conn,
+                 struct mg_auth_db *db,
+                 const char *user,
+                 const char *domain,
+                 const char *ha1,
+                 const unsigned *stack,
+                 int depth)
+{
+	uint32_t hash = auth_cache_hash(user, domain);
+	size_t ul = strlen(user), dl = strlen(domain), hl = strlen(ha1);
+	struct mg_auth_user *u;
+	int i;
+
+	for (u = db->buckets[hash & db->bucket_mask]; u != NULL; u = u->next) {
+		if ((u->hash == hash) && !strcmp(u->user, user)
+		    && !strcmp(u->domain, domain)) {
+			for (i = 0; i <= depth; i++) {
+				if (u->src == stack[i]) {
+					/* Shadowed by an earlier line */
+					return 1;
+				}
+			}
+		}
+	}
+
+	if ((db->count >= db->bucket_mask) && !auth_db_grow(conn, db)) {
+		return 0;
+	}
+	u = (struct mg_auth_user *)
+	    mg_malloc_ctx(sizeof(*u) + ul + dl + hl + 2, conn->phys_ctx);
+	if (u == NULL) {
+		return 0;
+	}
+	memcpy(u->user, user, ul + 1);
+	u->domain = u->user + ul + 1;
+	memcpy((char *)u->domain, domain, dl + 1);
+	u->ha1 = u->domain + dl + 1;
+	memcpy((char *)u->ha1, ha1, hl + 1);
+	u->hash = hash;
+	u->src = stack[depth];
+	u->next = db->buckets[hash & db->bucket_mask];
+	db->buckets[hash & db->bucket_mask] = u;
+	db->count++;
+	return 1;
+}
+
+
+/* Read path and all included files into db, like read_auth_file does.
+ * Return 1 on success, 0 if path cannot be opened, -1 if out of memory. */
+static int
+auth_db_read(struct mg_connection *conn,
+             struct mg_auth_db *db,
+             const char *path,
+             unsigned *stack,
+             int depth)
+{
+	struct mg_file file = STRUCT_FILE_INITIALIZER;
+	struct mg_auth_file *f, **pf;
+	char buf[256 + 256 + 40];
+	const char *user, *domain, *ha1;
+	size_t len = strlen(path);
+	int ret = 1, r;
+
+	/* Remember the status of every file, even if it cannot be opened */
+	f = (struct mg_auth_file *)mg_malloc_ctx(sizeof(*f) + len,
+	                                         conn->phys_ctx);
+	if (f == NULL) {
+		return -1;
+	}
+	memcpy(f->path, path, len + 1);
+	f->next = NULL;
+	pf = &db->files;
+	while (*pf != NULL) {
+		pf = &(*pf)->next;
+	}
+	*pf = f;
+
+	f->found = mg_stat(conn, path, &f->stat);
+	if (!f->found || !mg_fopen(conn, path, MG_FOPEN_MODE_READ, &file)) {
+		return 0;
+	}
+	if (f->stat.last_modified >= db->loaded) {
+		db->racy = 1;
+	}
+
+	stack[depth] = db->num_files++;
+	while ((ret > 0) && (mg_fgets(buf, sizeof(buf), &file) != NULL)) {
+		switch (auth_file_parse_line(conn, buf, &user, &domain, &ha1)) {
+		case AUTH_LINE_INCLUDE:
+			if (depth + 1 >= INITIAL_DEPTH) {
+				/* read_auth_file does not read deeper nested files */
+				break;
+			}
+			r = auth_db_read(conn, db, user, stack, depth + 1);
+			if (r == 0) {
+				mg_cry_internal(conn,
+				                "cannot open authorization file: %s",
+				                buf);
+			} else if (r < 0) {
+				ret = -1;
+			}
+			break;
+
+		case AUTH_LINE_ENTRY:
+			if (!auth_db_add_user(conn, db, user, domain, ha1, stack, depth)) {
+				ret = -1;
+			}
+			break;
+
+		default:
+			break;
+		}
+	}
+	(void)mg_fclose(&file.access); /* ignore error on read only file */
+	return ret;
+}
+
+
+/* Read the passwords file path. Return NULL if it cannot be read. If it
+ * does not exist, return an empty entry with missing set. */
+static struct mg_auth_db *
+auth_db_load(struct mg_connection *conn, const char *path)
+{
+	unsigned stack[INITIAL_DEPTH];
+	struct mg_auth_db *db;
+	int ret;
+
+	db = (struct mg_auth_db *)mg_calloc_ctx(1, sizeof(*db), conn->phys_ctx);
+	if (db == NULL) {
+		return NULL;
+	}
+	db->bucket_mask = 15;
+	db->buckets = (struct mg_auth_user **)mg_calloc_ctx(db->bucket_mask + 1,
+	                                                    sizeof(db->buckets[0]),
+	                                                    conn->phys_ctx);
+	db->hash = auth_cache_hash(path, NULL);
+	db->loaded = time(NULL);
+	db->generation = auth_file_generation;
+
+	if (db->buckets == NULL) {
+		auth_db_free(db);
+		return NULL;
+	}
+	ret = auth_db_read(conn, db, path, stack, 0);
+	if ((ret == 0) && !db->files->found) {
+		db->missing = 1;
+	} else if (ret <= 0) {
+		auth_db_free(db);
+		return NULL;
+	}
+	return db;
+}
+
+
+/* Check if db still has the content of the files */
+static int
+auth_db_is_current(const struct mg_connection *conn,
+                   const struct mg_auth_db *db)
+{
+	const struct mg_auth_file *f;
+	struct mg_file_stat fst;
+	int found;
+
+	if (db->racy) {
+		return 0;
+	}
+	for (f = db->files; f != NULL; f = f->next) {
+		found = mg_stat(conn, f->path, &fst);
+		if ((found != f->found)
+		    || (found
+		        && ((fst.size != f->stat.size)
+		            || (fst.last_modified != f->stat.last_modified)))) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+
+/* Drop a reference. The last one frees db. */
+static void
+auth_db_release(struct mg_auth_db *db)
+{
+	if (mg_atomic_dec(&db->refs) == 0) {
+		auth_db_free(db);
+	}
+}
+
+
+/* Remove db from the list. Call with the mutex locked. The reference of
+ * the list is released by the caller. */
+static void
+auth_cache_unlink(struct mg_auth_cache *ac, struct mg_auth_db *db)
+{
+	db->lru_prev->lru_next = db->lru_next;
+	db->lru_next->lru_prev = db->lru_prev;
+	ac->count--;
+}
+
+
+static void
+auth_cache_link(struct mg_auth_cache *ac, struct mg_auth_db *db)
+{
+	db->lru_next = ac->lru.lru_next;
+	db->lru_prev = &ac->lru;
+	ac->lru.lru_next->lru_prev = db;
+	ac->lru.lru_next = db;
+	ac->count++;
+}
+
+
+/* Find the passwords file path in the cache. Call with the mutex locked. */
+static struct mg_auth_db *
+auth_cache_find(struct mg_auth_cache *ac, const char *path, uint32_t hash)
+{
+	struct mg_auth_db *db;
+
+	for (db = ac->lru.lru_next; db != &ac->lru; db = db->lru_next) {
+		if ((db->hash == hash) && !strcmp(db->files->path, path)) {
+			return db;
+		}
+	}
+	return NULL;
+}
+
+
+/* Get the parsed passwords file path, loading it if it is not in the
+ * cache or has changed. Return NULL if the file cannot be loaded, or an
+ * entry with missing set if it does not exist.
+ * The result must be released using auth_db_release. */
+static struct mg_auth_db *
+auth_cache_acquire(struct mg_connection *conn, const char *path)
+{
+	struct mg_auth_cache *ac = conn->phys_ctx->auth_cache;
+	uint32_t hash = auth_cache_hash(path, NULL);
+	uint64_t now = mg_get_current_time_ns();
+	struct mg_auth_db *db, *old;
+	int check = 0, current;
+
+	pthread_mutex_lock(&ac->mutex);
+	db = auth_cache_find(ac, path, hash);
+	if ((db != NULL) && (db->generation != auth_file_generation)) {
+		/* Modified by mg_modify_passwords_file */
+		auth_cache_unlink(ac, db);
+		auth_db_release(db);
+		db = NULL;
+	}
+	if (db != NULL) {
+		if ((now >= db->next_check) && !db->checking) {
+			db->checking = 1;
+			check = 1;
+		}
+		mg_atomic_inc(&db->refs);
+		if (ac->lru.lru_next != db) {
+			auth_cache_unlink(ac, db);
+			auth_cache_link(ac, db);
+		}
+	}
+	pthread_mutex_unlock(&ac->mutex);
+
+	if (check) {
+		/* Other requests use the file until the check is done */
+		current = auth_db_is_current(conn, db);
+		pthread_mutex_lock(&ac->mutex);
+		db->checking = 0;
+		if (current) {
+			db->next_check = now + ac->check_interval;
+		} else if (auth_cache_find(ac, path, hash) == db) {
+			auth_cache_unlink(ac, db);
+			auth_db_release(db);
+		}
+		pthread_mutex_unlock(&ac->mutex);
+		if (!current) {
+			auth_db_release(db);
+			db = NULL;
+		}
+	}
+	if (db != NULL) {
+		return db;
+	}
+
+	/* Do not block other requests while reading the file */
+	db = auth_db_load(conn, path);
+	if (db == NULL) {
+		return NULL;
+	}
+	db->refs = 2; /* The cache list and the caller */
+	db->next_check = now + ac->check_interval;
+
+	pthread_mutex_lock(&ac->mutex);
+	old = auth_cache_find(ac, path, hash);
+	if (old != NULL) {
+		/* Loaded by another thread in the meantime */
+		auth_cache_unlink(ac, old);
+		auth_db_release(old);
+	}
+	auth_cache_link(ac, db);
+	while (ac->count > ac->max_count) {
+		old = ac->lru.lru_prev;
+		auth_cache_unlink(ac, old);
+		auth_db_release(old);
+	}
+	pthread_mutex_unlock(&ac->mutex);
+	return db;
+}
+
+
+/* Authorize against a parsed passwords file.
+ * Return 1 if authorized, 0 if not. */
+static int
+auth_db_authorize(struct mg_connection *conn,
+                  const struct mg_auth_db *db,
+                  const struct auth_header *ah,
+                  const char *domain)
+{
+	uint32_t hash = auth_cache_hash(ah->user, domain);
+	const struct mg_auth_user *u;
+
+	/* All lines read_auth_file would check, in any order */
+	for (u = db->buckets[hash & db->bucket_mask]; u != NULL; u = u->next) {
+		if ((u->hash == hash) && !strcmp(u->user, ah->user)
+		    && !strcmp(u->domain, domain)
+		    && auth_check_ha1(conn, ah, domain, u->ha1)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+static void
+mg_auth_cache_free(struct mg_auth_cache *ac)
+{
+	struct mg_auth_db *db, *next;
+
+	if (ac == NULL) {
+		return;
+	}
+	for (db = ac->lru.lru_next; db != &ac->lru; db = next) {
+		next = db->lru_next;
+		auth_db_release(db);
+	}
+	pthread_mutex_destroy(&ac->mutex);
+	mg_free(ac);
+}
+
+
+static struct mg_auth_cache *
+mg_auth_cache_create(struct mg_context *ctx, unsigned max_files)
+{
+	struct mg_auth_cache *ac;
+
+	(void)ctx; /* unused, if memory statistics are disabled */
+	ac = (struct mg_auth_cache *)mg_calloc_ctx(1, sizeof(*ac), ctx);
+	if (ac == NULL) {
+		return NULL;
+	}
+	pthread_mutex_init(&ac->mutex, &pthread_mutex_attr);
+	ac->lru.lru_next = ac->lru.lru_prev = &ac->lru;
+	ac->max_count = max_files;
+	ac->check_interval = (uint64_t)MG_AUTH_CACHE_CHECK_INTERVAL_MS * 1000000;
+	return ac;
+}
@@ -172,6 +172,26 @@ mg_static_assert(sizeof(void *) >= sizeof(int), "data type size check");
 #error "Inconsistent build flags, NO_FILESYSTEMS requires NO_FILES"
 #endif
 
+#if defined(LOCKFREE_QUEUE)
+/* LOCKFREE_QUEUE = use a lock-free ring buffer to pass accepted sockets
+ * to the worker threads. Idle worker threads wait on a futex.
+ */
+#if defined(ALTERNATIVE_QUEUE)
+#error "Inconsistent build flags, LOCKFREE_QUEUE and ALTERNATIVE_QUEUE"
+#endif
+#if !defined(__linux__) || !defined(__GNUC__)
+#error "LOCKFREE_QUEUE requires Linux and a GCC compatible compiler"
+#endif
+#endif
+
+#if defined(USE_IO_URING)
+/* USE_IO_URING = worker threads use io_uring for socket I/O and for
+ * sending files (see mod_io_uring.inl). */
+#if !defined(__linux__) || !defined(__GNUC__)
+#error "USE_IO_URING requires Linux and a GCC compatible compiler"
+#endif
+#endif
+
 #if defined(__SYMBIAN32__)
 /* According to https://en.wikipedia.org/wiki/Symbian#History,
  * Symbian is no longer maintained since 2014-01-01.
@@ -457,6 +477,17 @@ _civet_safe_clock_gettime(int clk_id, struct timespec *t)
 #include "zlib-ng.h"
 #endif
 
+#if defined(USE_ZSTD)
+#include "zstd.h"
+#endif
+
+/* SIMD character scanner for the HTTP parser, see http_scan.inl */
+#if !defined(NO_SIMD) && (defined(__GNUC__) || defined(__clang__))            \
+    && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
 /********************************************************************/
 /* CivetWeb configuration defines */
 /********************************************************************/
@@ -501,6 +532,12 @@ _civet_safe_clock_gettime(int clk_id, struct timespec *t)
 #define MG_BUF_LEN (1024 * 8)
 #endif
 
+/* Block size of the per-request arena (mg_request_alloc). Larger
+ * allocations get a block of their own. */
+#if !defined(MG_REQUEST_ARENA_BLOCK_SIZE)
+#define MG_REQUEST_ARENA_BLOCK_SIZE (4096) /* in bytes */
+#endif
+
 
 /********************************************************************/
 
@@ -897,6 +934,18 @@ typedef unsigned short int in_port_t;
 #if defined(USE_X_DOM_SOCKET)
 #include <sys/un.h>
 #endif
+#if defined(__linux__)
+#include <sys/epoll.h>
+#if defined(LOCKFREE_QUEUE)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#if defined(USE_IO_URING)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
 #endif
 
 #define vsnprintf_impl vsnprintf
@@ -1636,6 +1685,9 @@ struct mg_workerTLS {
 #if defined(MG_ALLOW_USING_GET_REQUEST_INFO_FOR_RESPONSE)
 	char txtbuf[4];
 #endif
+#if defined(USE_IO_URING)
+	struct mg_uring *uring; /* Only valid if is_master == 0 */
+#endif
 };
 
 
@@ -1805,8 +1857,11 @@ typedef struct SSL_CTX SSL_CTX;
 #include <openssl/dh.h>
 #include <openssl/engine.h>
 #include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
 #include <openssl/opensslv.h>
 #include <openssl/pem.h>
+#include <openssl/rand.h>
 #include <openssl/ssl.h>
 #include <openssl/tls1.h>
 #include <openssl/x509.h>
@@ -1861,6 +1916,16 @@ typedef struct SSL_CTX SSL_CTX;
 
 #endif /* Various SSL bindings */
 
+#if (defined(OPENSSL_API_1_1) || defined(OPENSSL_API_3_0)) && !defined(NO_SSL)
+/* Session ticket keys, see ssl_tickets.inl */
+#define USE_SSL_TICKET_KEYS
+#endif
+
+#if defined(OPENSSL_API_3_0) && !defined(NO_SSL) && defined(__linux__)
+/* Kernel TLS, static files are sent by SSL_sendfile */
+#define USE_KTLS
+#endif
+
 
 #if !defined(NO_CACHING)
 static const char month_names[][4] = {"Jan",
@@ -1917,20 +1982,42 @@ struct vec {
 	size_t len;
 };
 
+/* Content codings (Accept-Encoding / Content-Encoding) */
+enum {
+	CONTENT_CODING_IDENTITY = 0,
+	CONTENT_CODING_GZIP,
+	CONTENT_CODING_BR,
+	CONTENT_CODING_ZSTD,
+	CONTENT_CODING_COUNT
+};
+
+static const struct {
+	const char *name; /* Name in Accept-Encoding and Content-Encoding */
+	const char *ext;  /* File extension of precompressed static files */
+} content_codings[CONTENT_CODING_COUNT] = {{"identity", ""},
+                                           {"gzip", ".gz"},
+                                           {"br", ".br"},
+                                           {"zstd", ".zst"}};
+
 struct mg_file_stat {
 	/* File properties filled by mg_stat: */
 	uint64_t size;
 	time_t last_modified;
 	int is_directory; /* Set to 1 if mg_stat is called for a directory */
-	int is_gzipped;   /* Set to 1 if the content is gzipped, in which
-	                   * case we need a "Content-Eencoding: gzip" header */
+	int encoding;     /* CONTENT_CODING_* of a precompressed file, which
+	                   * needs a "Content-Encoding" header */
 	int location;     /* 0 = nowhere, 1 = on disk, 2 = in memory */
 };
 
 
+struct mg_file_cache_entry; /* see file_cache.inl */
+
 struct mg_file_access {
 	/* File properties filled by mg_fopen: */
 	FILE *fp;
+	/* Set by mg_fopen_cached, if fp is NULL and the file descriptor of the
+	 * file cache is used */
+	struct mg_file_cache_entry *cached;
 };
 
 struct mg_file {
@@ -1943,7 +2030,7 @@ struct mg_file {
 	{                                                                          \
 		{(uint64_t)0, (time_t)0, 0, 0, 0},                                     \
 		{                                                                      \
-			(FILE *)NULL                                                       \
+			(FILE *)NULL, (struct mg_file_cache_entry *)NULL                   \
 		}                                                                      \
 	}
 
@@ -1960,6 +2047,10 @@ struct socket {
 	unsigned char
 	    is_optional; /* Shouldn't cause us to exit if we can't bind to it */
 	unsigned char in_use; /* 0: invalid, 1: valid, 2: free */
+#if defined(__linux__)
+	struct mg_parked_connection *parked; /* Set if a kept-alive connection is
+	                                      * resumed from parking */
+#endif
 };
 
 
@@ -1977,10 +2068,15 @@ enum {
 	CONFIG_TCP_NODELAY, /* Prepended CONFIG_ to avoid conflict with the
 	                     * socket option typedef TCP_NODELAY. */
 	MAX_REQUEST_SIZE,
+	OUTPUT_BUFFER_SIZE,
 	LINGER_TIMEOUT,
 	CONNECTION_QUEUE_SIZE,
+	CONNECTION_QUEUE_HIGH_WATER,
+	CONNECTION_OVERLOAD_ACTION,
+	CONNECTION_OVERLOAD_RETRY_AFTER,
 	LISTEN_BACKLOG_SIZE,
 #if defined(__linux__)
+	ACCEPTOR_THREADS,
 	ALLOW_SENDFILE_CALL,
 #endif
 #if defined(_WIN32)
@@ -1990,19 +2086,37 @@ enum {
 	ENABLE_KEEP_ALIVE,
 	REQUEST_TIMEOUT,
 	KEEP_ALIVE_TIMEOUT,
+#if defined(__linux__)
+	ENABLE_KEEP_ALIVE_PARKING,
+#endif
 #if defined(USE_WEBSOCKET)
 	WEBSOCKET_TIMEOUT,
 	ENABLE_WEBSOCKET_PING_PONG,
 #endif
 	DECODE_URL,
 	DECODE_QUERY_STRING,
+	STATIC_FILE_STAT_CACHE_SIZE,
+	STATIC_FILE_STAT_CACHE_TTL,
+	STATIC_FILE_MEMORY_CACHE_SIZE,
+#if defined(USE_ZLIB)
+	STATIC_FILE_COMPRESSION_LEVEL,
+	STATIC_FILE_COMPRESSION_CACHE_SIZE,
+	STATIC_FILE_COMPRESSION_CACHE_DIR,
+#endif
 #if defined(USE_LUA)
 	LUA_BACKGROUND_SCRIPT,
 	LUA_BACKGROUND_SCRIPT_PARAMS,
+	LUA_STATE_POOL_SIZE,
+	LUA_STATE_POOL_RESET,
 #endif
 #if defined(USE_HTTP2)
 	ENABLE_HTTP2,
+	HTTP2_STREAM_THREADS,
+	ENABLE_HTTP2_CLEARTEXT,
 #endif
+	ACCESS_LOG_BUFFER_SIZE,
+	ACCESS_LOG_FLUSH_INTERVAL,
+	AUTH_FILE_CACHE_SIZE,
 
 	/* Once for each domain */
 	DOCUMENT_ROOT,           /* the original argument, for backwards compatibility -- accepts one path */
@@ -2010,6 +2124,8 @@ enum {
 	FALLBACK_DOCUMENT_ROOT,  /* deprecated */
 
 	ACCESS_LOG_FILE,
+	ACCESS_LOG_FORMAT,
+	ACCESS_LOG_FIELDS,
 	ERROR_LOG_FILE,
 
 	CGI_EXTENSIONS,
@@ -2074,6 +2190,13 @@ enum {
 	SSL_CIPHER_LIST,
 	SSL_PROTOCOL_VERSION,
 	SSL_SHORT_TRUST,
+	SSL_SESSION_TICKET_KEY_FILE,
+#if defined(USE_TIMERS)
+	SSL_SESSION_TICKET_KEY_ROTATION,
+#endif
+#if defined(__linux__)
+	SSL_KTLS,
+#endif
 
 #if defined(USE_LUA)
 	LUA_PRELOAD_FILE,
@@ -2128,10 +2251,15 @@ static const struct mg_option config_options[] = {
     {"run_as_user", MG_CONFIG_TYPE_STRING, NULL},
     {"tcp_nodelay", MG_CONFIG_TYPE_NUMBER, "0"},
     {"max_request_size", MG_CONFIG_TYPE_NUMBER, "16384"},
+    {"output_buffer_size", MG_CONFIG_TYPE_NUMBER, "0"},
     {"linger_timeout_ms", MG_CONFIG_TYPE_NUMBER, NULL},
     {"connection_queue", MG_CONFIG_TYPE_NUMBER, "20"},
+    {"connection_queue_high_water", MG_CONFIG_TYPE_NUMBER, "0"},
+    {"connection_overload_action", MG_CONFIG_TYPE_STRING, "503"},
+    {"connection_overload_retry_after", MG_CONFIG_TYPE_NUMBER, "1"},
     {"listen_backlog", MG_CONFIG_TYPE_NUMBER, "200"},
 #if defined(__linux__)
+    {"acceptor_threads", MG_CONFIG_TYPE_NUMBER, "1"},
     {"allow_sendfile_call", MG_CONFIG_TYPE_BOOLEAN, "yes"},
 #endif
 #if defined(_WIN32)
@@ -2141,19 +2269,39 @@ static const struct mg_option config_options[] = {
     {"enable_keep_alive", MG_CONFIG_TYPE_BOOLEAN, "no"},
     {"request_timeout_ms", MG_CONFIG_TYPE_NUMBER, "30000"},
     {"keep_alive_timeout_ms", MG_CONFIG_TYPE_NUMBER, "500"},
+#if defined(__linux__)
+    {"enable_keep_alive_parking", MG_CONFIG_TYPE_BOOLEAN, "no"},
+#endif
 #if defined(USE_WEBSOCKET)
     {"websocket_timeout_ms", MG_CONFIG_TYPE_NUMBER, NULL},
     {"enable_websocket_ping_pong", MG_CONFIG_TYPE_BOOLEAN, "no"},
 #endif
     {"decode_url", MG_CONFIG_TYPE_BOOLEAN, "yes"},
     {"decode_query_string", MG_CONFIG_TYPE_BOOLEAN, "no"},
+    {"static_file_stat_cache_size", MG_CONFIG_TYPE_NUMBER, "0"},
+    {"static_file_stat_cache_ttl_ms", MG_CONFIG_TYPE_NUMBER, "1000"},
+    {"static_file_memory_cache_size", MG_CONFIG_TYPE_NUMBER, "0"},
+#if defined(USE_ZLIB)
+    {"static_file_compression_level", MG_CONFIG_TYPE_NUMBER, "9"},
+    {"static_file_compression_cache_size", MG_CONFIG_TYPE_NUMBER, "0"},
+    {"static_file_compression_cache_directory",
+     MG_CONFIG_TYPE_DIRECTORY,
+     NULL},
+#endif
 #if defined(USE_LUA)
     {"lua_background_script", MG_CONFIG_TYPE_FILE, NULL},
     {"lua_background_script_params", MG_CONFIG_TYPE_STRING_LIST, NULL},
+    {"lua_state_pool_size", MG_CONFIG_TYPE_NUMBER, "0"},
+    {"lua_state_pool_reset", MG_CONFIG_TYPE_STRING, "env"},
 #endif
 #if defined(USE_HTTP2)
     {"enable_http2", MG_CONFIG_TYPE_BOOLEAN, "no"},
+    {"http2_stream_threads", MG_CONFIG_TYPE_NUMBER, "0"},
+    {"enable_http2_cleartext", MG_CONFIG_TYPE_BOOLEAN, "no"},
 #endif
+    {"access_log_buffer_size", MG_CONFIG_TYPE_NUMBER, "0"},
+    {"access_log_flush_interval_ms", MG_CONFIG_TYPE_NUMBER, "1000"},
+    {"auth_file_cache_size", MG_CONFIG_TYPE_NUMBER, "0"},
 
     /* Once for each domain */
     {"document_root", MG_CONFIG_TYPE_DIRECTORY, NULL},
@@ -2161,6 +2309,11 @@ static const struct mg_option config_options[] = {
     {"fallback_document_root", MG_CONFIG_TYPE_DIRECTORY, NULL},
 
     {"access_log_file", MG_CONFIG_TYPE_FILE, NULL},
+    {"access_log_format", MG_CONFIG_TYPE_STRING, "ncsa"},
+    {"access_log_fields",
+     MG_CONFIG_TYPE_STRING_LIST,
+     "remote_addr,remote_user,time,method,uri,query,http_version,status,"
+     "bytes_sent,referer,user_agent,duration_us"},
     {"error_log_file", MG_CONFIG_TYPE_FILE, NULL},
 
     {"cgi_pattern", MG_CONFIG_TYPE_EXT_PATTERN, "**.cgi$|**.pl$|**.php$"},
@@ -2240,6 +2393,13 @@ static const struct mg_option config_options[] = {
     {"ssl_protocol_version", MG_CONFIG_TYPE_NUMBER, "4"},
 
     {"ssl_short_trust", MG_CONFIG_TYPE_BOOLEAN, "no"},
+    {"ssl_session_ticket_key_file", MG_CONFIG_TYPE_FILE, NULL},
+#if defined(USE_TIMERS)
+    {"ssl_session_ticket_key_rotation", MG_CONFIG_TYPE_NUMBER, "0"},
+#endif
+#if defined(__linux__)
+    {"ssl_ktls", MG_CONFIG_TYPE_BOOLEAN, "no"},
+#endif
 
 #if defined(USE_LUA)
     {"lua_preload_file", MG_CONFIG_TYPE_FILE, NULL},
@@ -2293,6 +2453,15 @@ mg_static_assert((sizeof(config_options) / sizeof(config_options[0]))
 enum { REQUEST_HANDLER, WEBSOCKET_HANDLER, AUTH_HANDLER };
 
 
+struct mg_route_table; /* see route_table.inl */
+struct mg_acl;         /* see acl.inl */
+#if defined(USE_LUA)
+struct lua_state_pool; /* see mod_lua.inl */
+#endif
+#if defined(USE_HTTP2)
+struct mg_http2_workers; /* see http2.inl */
+#endif
+
 struct mg_handler_info {
 	/* Name/Pattern of the URI. */
 	char *uri;
@@ -2303,8 +2472,7 @@ struct mg_handler_info {
 
 	/* Handler for http/https or requests. */
 	mg_request_handler handler;
-	unsigned int refcount;
-	int removing;
+	volatile ptrdiff_t refcount; /* Requests using the handler */
 
 	/* Handler for ws/wss (websocket) requests. */
 	mg_websocket_connect_handler connect_handler;
@@ -2334,6 +2502,9 @@ enum {
 };
 
 
+/* Maximum number of fields in access_log_fields */
+#define ACCESS_LOG_MAX_FIELDS (32)
+
 struct mg_domain_context {
 	SSL_CTX *ssl_ctx;                 /* SSL context */
 	char *config[NUM_OPTIONS];        /* Civetweb configuration parameters */
@@ -2342,8 +2513,18 @@ struct mg_domain_context {
         char **websocket_roots;           /* argv-style NULL-terminated array of websocket-roots */
 #endif
 	struct mg_handler_info *handlers; /* linked list of uri handlers */
+
+	/* Compiled routing table for handlers (see route_table.inl) */
+	struct mg_route_table *routes[2];
+	volatile ptrdiff_t routes_gen;        /* Current table: routes[gen & 1] */
+	volatile ptrdiff_t routes_readers[2]; /* Lookups using routes[i] */
 	int64_t ssl_cert_last_mtime;
 
+	/* Parsed access_log_format and access_log_fields (see access_log.inl) */
+	unsigned char access_log_format;
+	unsigned char access_log_fields[ACCESS_LOG_MAX_FIELDS];
+	unsigned access_log_num_fields;
+
 	/* Server nonce */
 	uint64_t auth_nonce_mask;  /* Mask for all nonce values */
 	unsigned long nonce_count; /* Used nonces, used for authentication */
@@ -2416,6 +2597,68 @@ struct twebdav_lock {
 };
 
 
+#if defined(LOCKFREE_QUEUE)
+/* Element of the lock-free socket queue */
+struct mg_socket_queue_cell {
+	size_t seq; /* Position this cell may be written (seq == pos) or
+	               read (seq == pos + 1) at */
+	struct socket so;
+};
+
+
+/* Lock-free socket queue, see LOCKFREE_QUEUE below.
+ * Positions of producers and consumers are written by different threads,
+ * so they are kept in different cache lines. */
+struct mg_socket_queue {
+	struct mg_socket_queue_cell *cells; /* mask + 1 cells */
+	size_t mask;                        /* Power of two, minus 1 */
+	int sq_size;                        /* No of elements in socket queue */
+	char pad1[64];
+	size_t enqueue_pos; /* Next position to write (producers) */
+	char pad2[64];
+	size_t dequeue_pos; /* Next position to read (consumers) */
+	char pad3[64];
+	int sq_full;           /* Futex: incremented when a socket is produced
+	                          while worker threads are sleeping */
+	int sq_empty;          /* Futex: incremented when a socket is consumed
+	                          while producers are waiting for space */
+	int sleeping_workers;  /* Worker threads waiting on sq_full */
+	int sleeping_producers; /* Producers waiting on sq_empty */
+	int sq_blocked;        /* Status information: sq is full */
+	int idle_worker_thread_count; /* How many worker-threads of this queue
+	                                 are currently sitting around with
+	                                 nothing to do */
+#if defined(USE_SERVER_STATS)
+	int sq_max_fill;
+#endif /* USE_SERVER_STATS */
+};
+#elif !defined(ALTERNATIVE_QUEUE)
+/* Socket queue (sq): accepted sockets waiting for a worker thread.
+ * There is one queue per accept loop (see acceptor_threads), worker
+ * thread number i takes its sockets from queue (i % num_acceptors). */
+struct mg_socket_queue {
+	pthread_mutex_t mutex; /* Protects all elements of this queue */
+	struct socket *squeue; /* Ring buffer of sq_size elements */
+	volatile int sq_head;  /* Head of the socket queue */
+	volatile int sq_tail;  /* Tail of the socket queue */
+	pthread_cond_t sq_full;  /* Signaled when socket is produced */
+	pthread_cond_t sq_empty; /* Signaled when socket is consumed */
+	volatile int sq_blocked; /* Status information: sq is full */
+	int sq_size;             /* No of elements in socket queue */
+	unsigned int
+	    idle_worker_thread_count; /* How many worker-threads of this queue
+	                                 are currently sitting around with
+	                                 nothing to do */
+#if defined(USE_SERVER_STATS)
+	int sq_max_fill;
+#endif /* USE_SERVER_STATS */
+};
+#endif /* ALTERNATIVE_QUEUE */
+
+
+struct mg_acceptor; /* Additional accept loop, see acceptor_threads */
+
+
 struct mg_context {
 
 	/* Part 1 - Physical context:
@@ -2434,18 +2677,26 @@ struct mg_context {
 	struct mg_connection *worker_connections; /* The connection struct, pre-
 	                                           * allocated for each worker */
 
+	/* Compiled access_control_list (see acl.inl) */
+	struct mg_acl *acl[2];
+	volatile ptrdiff_t acl_gen;        /* Current list: acl[gen & 1] */
+	volatile ptrdiff_t acl_readers[2]; /* Lookups using acl[i] */
+
 #if defined(USE_SERVER_STATS)
 	volatile ptrdiff_t active_connections;
 	volatile ptrdiff_t max_active_connections;
 	volatile ptrdiff_t total_connections;
 	volatile ptrdiff_t total_requests;
+	volatile ptrdiff_t total_rejected; /* by admission control */
+	volatile ptrdiff_t max_request_arena; /* Peak per-request arena usage */
 	volatile int64_t total_data_read;
 	volatile int64_t total_data_written;
 #endif
 
 	/* Thread related */
 	stop_flag_t stop_flag;        /* Should we stop event loop */
-	pthread_mutex_t thread_mutex; /* Protects client_socks or queue */
+	pthread_mutex_t thread_mutex; /* Protects worker thread slots and
+	                               * client_socks */
 
 	pthread_t masterthreadid;            /* The master thread ID */
 	unsigned int cfg_max_worker_threads; /* How many worker-threads we are
@@ -2453,30 +2704,32 @@ struct mg_context {
 
 	unsigned int spawned_worker_threads; /* How many worker-threads currently
 	                                        exist (modified by master thread) */
-	unsigned int
-	    idle_worker_thread_count; /* How many worker-threads are currently
-	                                 sitting around with nothing to do */
-	/* Access to this value MUST be synchronized by thread_mutex */
 
 	pthread_t *worker_threadids;      /* The worker thread IDs */
 	unsigned long starter_thread_idx; /* thread index which called mg_start */
 
+	/* Accept loops: the master thread plus (num_acceptors - 1) acceptor
+	 * threads, each with its own SO_REUSEPORT listening sockets. */
+	unsigned int num_acceptors;
+	struct mg_acceptor *acceptors;
+
 	/* Connection to thread dispatching */
 #if defined(ALTERNATIVE_QUEUE)
+	unsigned int
+	    idle_worker_thread_count; /* How many worker-threads are currently
+	                                 sitting around with nothing to do */
+	/* Access to this value MUST be synchronized by thread_mutex */
 	struct socket *client_socks;
 	void **client_wait_events;
 #else
-	struct socket *squeue; /* Socket queue (sq) : accepted sockets waiting for a
-	                       worker thread */
-	volatile int sq_head;  /* Head of the socket queue */
-	volatile int sq_tail;  /* Tail of the socket queue */
-	pthread_cond_t sq_full;  /* Signaled when socket is produced */
-	pthread_cond_t sq_empty; /* Signaled when socket is consumed */
-	volatile int sq_blocked; /* Status information: sq is full */
-	int sq_size;             /* No of elements in socket queue */
-#if defined(USE_SERVER_STATS)
-	int sq_max_fill;
-#endif /* USE_SERVER_STATS */
+	struct mg_socket_queue *sq; /* One socket queue per accept loop */
+
+	/* Admission control: new connections are rejected while the socket
+	 * queue of their accept loop holds sq_high_water or more sockets. */
+	int sq_high_water;              /* 0 = disabled */
+	int overload_reset;             /* Reject by RST instead of 503 */
+	char overload_response[128];    /* Preformatted 503 response */
+	int overload_response_len;
 #endif /* ALTERNATIVE_QUEUE */
 
 	/* Memory related */
@@ -2498,11 +2751,42 @@ struct mg_context {
 	struct ttimers *timers;
 #endif
 
+#if defined(USE_SSL_TICKET_KEYS)
+	struct mg_ssl_ticket_keys *ticket_keys; /* Session ticket keys, or NULL
+	                                         * for keys of OpenSSL */
+#endif
+
+#if defined(__linux__)
+	struct mg_keep_alive_parking *parking; /* Idle keep-alive connections, or
+	                                        * NULL if parking is disabled */
+#endif
+
+#if !defined(NO_FILESYSTEMS)
+	struct mg_file_cache *file_cache; /* Static file metadata cache, or NULL
+	                                   * if the cache is disabled */
+	struct mg_memory_cache *memory_cache; /* Small static files, or NULL if
+	                                       * the cache is disabled */
+#if defined(USE_ZLIB)
+	struct mg_memory_cache *compression_cache; /* gzip variants of static
+	                                            * files, or NULL */
+#endif
+	struct mg_access_log *access_log; /* Asynchronous access log writer, or
+	                                   * NULL if the log is synchronous */
+	struct mg_auth_cache *auth_cache; /* Parsed passwords files, or NULL if
+	                                   * the cache is disabled */
+#endif
+
 	/* Lua specific: Background operations and shared websockets */
 #if defined(USE_LUA)
 	void *lua_background_state;   /* lua_State (here as void *) */
 	pthread_mutex_t lua_bg_mutex; /* Protect background state */
 	int lua_bg_log_available;     /* Use Lua background state for access log */
+	struct lua_state_pool *lua_pool; /* Lua states for scripts and pages, or
+	                                  * NULL if states are not reused */
+#endif
+#if defined(USE_HTTP2)
+	struct mg_http2_workers *http2_workers; /* Threads handling the streams
+	                                         * of HTTP/2 connections */
 #endif
 
 	int user_shutdown_notification_socket;   /* mg_stop() will close this
@@ -2557,14 +2841,36 @@ enum {
 
 
 #if defined(USE_HTTP2)
-#if !defined(HTTP2_DYN_TABLE_SIZE)
-#define HTTP2_DYN_TABLE_SIZE (256)
+/* Size of the HPACK dynamic tables in bytes (SETTINGS_HEADER_TABLE_SIZE) */
+#if !defined(HTTP2_HEADER_TABLE_SIZE)
+#define HTTP2_HEADER_TABLE_SIZE (4096)
 #endif
 
+struct mg_http2_stream; /* see http2.inl */
+
+/* HPACK dynamic table entry: name and value are stored in one allocation */
+struct mg_hpack_entry {
+	char *name;
+	const char *value;
+	uint32_t name_len;
+	uint32_t value_len;
+};
+
+/* HPACK dynamic table (RFC 7541, 2.3.2): a ring buffer, the newest entry
+ * is entry[first]. Every entry takes at least 32 bytes of max_size. */
+struct mg_hpack_table {
+	struct mg_hpack_entry entry[HTTP2_HEADER_TABLE_SIZE / 32];
+	unsigned first;
+	unsigned count;
+	uint32_t size;
+	uint32_t max_size;
+};
+
 struct mg_http2_connection {
 	uint32_t stream_id;
-	uint32_t dyn_table_size;
-	struct mg_header dyn_table[HTTP2_DYN_TABLE_SIZE];
+	struct mg_hpack_table dyn_table; /* Decoder table for request headers */
+	struct mg_http2_stream *stream; /* Stream of a request handler, NULL for
+	                                 * the physical connection */
 };
 #endif
 
@@ -2576,6 +2882,8 @@ struct mg_misc_socket_callback {
 	mg_misc_socket_data_handler handler_callback;
 };
 
+struct mg_arena_block; /* Per-request arena, see mg_request_alloc */
+
 struct mg_connection {
 	int connection_type; /* see CONNECTION_TYPE_* above */
 	int protocol_type;   /* see PROTOCOL_TYPE_*: 0=http/1.x, 1=ws, 2=http/2 */
@@ -2588,6 +2896,12 @@ struct mg_connection {
 	struct mg_request_info request_info;
 	struct mg_response_info response_info;
 
+	/* Position + 1 of the well-known headers (MG_HDR_*) in the request_info
+	 * or response_info headers, 0 if not present. The index is valid if
+	 * header_index_type equals connection_type. */
+	unsigned char header_index[MG_HDR_COUNT];
+	int header_index_type;
+
 	struct mg_context *phys_ctx;
 	struct mg_domain_context *dom_ctx;
 
@@ -2624,9 +2938,19 @@ struct mg_connection {
 	                           */
 	char *buf;                /* Buffer for received data */
 	char *path_info;          /* PATH_INFO part of the URL */
+	const char *handler_name; /* Handler of the request, for the access
+	                           * log, or NULL */
+	struct mg_arena_block *arena; /* Allocations freed with the request */
+	size_t arena_used;            /* Bytes allocated in the arena by the
+	                               * current request */
 
 	int must_close;       /* 1 if connection must be closed */
 	int accept_gzip;      /* 1 if gzip encoding is accepted */
+	unsigned short accept_encoding[CONTENT_CODING_COUNT]; /* q-values from
+	                       * Accept-Encoding (0 to 1000, 0 = not accepted) */
+#if defined(USE_ZSTD)
+	ZSTD_CCtx *chunk_zstd; /* Compression of mg_send_chunk data */
+#endif
 	int in_error_handler; /* 1 if in handler for user defined error
 	                       * pages */
 #if defined(USE_WEBSOCKET)
@@ -2647,11 +2971,20 @@ struct mg_connection {
 	int handled_requests; /* Number of requests handled by this connection
 	                       */
 	int buf_size;         /* Buffer size */
+	char *out_buf;        /* Output buffer (output_buffer_size) */
+	int out_buf_size;     /* Size of out_buf, 0 if there is none */
+	int out_len;          /* Data in out_buf, not yet sent */
+	int out_buffering;    /* 1 if mg_write collects data in out_buf */
+#if defined(USE_IO_URING)
+	int out_headers_only; /* out_buf only collects the response headers */
+#endif
 	int request_len;      /* Size of the request + headers in a buffer */
 	int data_len;         /* Total size of data in a buffer */
 	int status_code;      /* HTTP reply status code, e.g. 200 */
 	int throttle;         /* Throttling, bytes/sec. <= 0 means no
 	                       * throttle */
+	int access_log_async; /* 1 if log lines go to the access log writer
+	                       * thread (worker connections only) */
 
 	time_t last_throttle_time; /* Last time throttled data was sent */
 	int last_throttle_bytes;   /* Bytes sent this second */
@@ -2957,7 +3290,7 @@ is_file_opened(const struct mg_file_access *fileacc)
 		return 0;
 	}
 
-	return (fileacc->fp != NULL);
+	return ((fileacc->fp != NULL) || (fileacc->cached != NULL));
 }
 
 
@@ -2965,6 +3298,7 @@ is_file_opened(const struct mg_file_access *fileacc)
 static int mg_stat(const struct mg_connection *conn,
                    const char *path,
                    struct mg_file_stat *filep);
+static void mg_file_cache_release(struct mg_file_cache_entry *entry);
 
 
 /* Reject files with special characters (for Windows) */
@@ -3028,6 +3362,7 @@ mg_fopen(const struct mg_connection *conn,
 		return 0;
 	}
 	filep->access.fp = NULL;
+	filep->access.cached = NULL;
 
 	if (mg_path_suspicious(conn, path)) {
 		return 0;
@@ -3094,6 +3429,10 @@ mg_fclose(struct mg_file_access *fileacc)
 	if (fileacc != NULL) {
 		if (fileacc->fp != NULL) {
 			ret = fclose(fileacc->fp);
+		} else if (fileacc->cached != NULL) {
+			/* The file is kept open by the file cache */
+			mg_file_cache_release(fileacc->cached);
+			ret = 0;
 		}
 		/* reset all members of fileacc */
 		memset(fileacc, 0, sizeof(*fileacc));
@@ -3176,6 +3515,119 @@ mg_strdup(const char *str)
 }
 
 
+/* Per-request arena.
+ * Memory allocated by mg_request_alloc is valid until the request has
+ * been handled, there is no free function. Allocations are taken from
+ * a block of MG_REQUEST_ARENA_BLOCK_SIZE bytes, which is kept by the
+ * connection for the next request. Large allocations use a block of
+ * their own, freed at the end of the request. The arena is private to
+ * the connection, so no locking is required. */
+struct mg_arena_block {
+	struct mg_arena_block *next;
+	size_t size; /* Usable bytes following the (aligned) header */
+	size_t used;
+};
+
+#define ARENA_ALIGN (2 * sizeof(void *))
+#define ARENA_ROUND_UP(x) (((x) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+#define ARENA_HEADER_SIZE ARENA_ROUND_UP(sizeof(struct mg_arena_block))
+
+
+CIVETWEB_API void *
+mg_request_alloc(struct mg_connection *conn, size_t size)
+{
+	struct mg_arena_block *b;
+	size_t block_size;
+
+	if (conn == NULL) {
+		return NULL;
+	}
+	if (size > ((size_t)-1) - ARENA_HEADER_SIZE - ARENA_ALIGN) {
+		return NULL;
+	}
+	size = (size == 0) ? ARENA_ALIGN : ARENA_ROUND_UP(size);
+
+	b = conn->arena;
+	if ((b == NULL) || (b->size - b->used < size)) {
+		block_size = MG_REQUEST_ARENA_BLOCK_SIZE;
+		if (size > MG_REQUEST_ARENA_BLOCK_SIZE / 4) {
+			/* Large allocation: a block of its own, the current block
+			 * remains in use for small allocations */
+			block_size = size;
+		}
+		b = (struct mg_arena_block *)mg_malloc_ctx(ARENA_HEADER_SIZE
+		                                               + block_size,
+		                                           conn->phys_ctx);
+		if (b == NULL) {
+			return NULL;
+		}
+		b->size = block_size;
+		b->used = 0;
+		if ((block_size != MG_REQUEST_ARENA_BLOCK_SIZE)
+		    && (conn->arena != NULL)) {
+			b->next = conn->arena->next;
+			conn->arena->next = b;
+		} else {
+			b->next = conn->arena;
+			conn->arena = b;
+		}
+	}
+
+	b->used += size;
+	conn->arena_used += size;
+	return ((char *)b) + ARENA_HEADER_SIZE + b->used - size;
+}
+
+
+/* Copy a string to the per-request arena */
+static char *
+request_arena_strndup(struct mg_connection *conn, const char *ptr, size_t len)
+{
+	char *p = (char *)mg_request_alloc(conn, len + 1);
+
+	if (p != NULL) {
+		memcpy(p, ptr, len);
+		p[len] = 0;
+	}
+	return p;
+}
+
+
+/* Release all allocations of a request. One standard block is kept for
+ * the next request, all other blocks are freed. */
+static void
+request_arena_reset(struct mg_connection *conn)
+{
+	struct mg_arena_block *b = conn->arena, *next, *keep = NULL;
+
+	while (b != NULL) {
+		next = b->next;
+		if ((keep == NULL) && (b->size == MG_REQUEST_ARENA_BLOCK_SIZE)) {
+			keep = b;
+		} else {
+			mg_free(b);
+		}
+		b = next;
+	}
+	if (keep != NULL) {
+		keep->next = NULL;
+		keep->used = 0;
+	}
+	conn->arena = keep;
+	conn->arena_used = 0;
+}
+
+
+/* Free all memory of the arena, when the connection is freed */
+static void
+request_arena_free(struct mg_connection *conn)
+{
+	request_arena_reset(conn);
+	mg_free(conn->arena);
+	conn->arena = NULL;
+}
+
+
 static const char *
 mg_strcasestr(const char *big_str, const char *small_str)
 {
@@ -3944,6 +4396,94 @@ get_header(const struct mg_header *hdr, int num_hdr, const char *name)
 }
 
 
+/* Names of the well-known headers, in the order of MG_HDR_* */
+static const struct {
+	const char *name;
+	size_t len;
+} well_known_headers[MG_HDR_COUNT] = {
+    {"Accept", 6},
+    {"Accept-Encoding", 15},
+    {"Accept-Language", 15},
+    {"Access-Control-Request-Headers", 30},
+    {"Access-Control-Request-Method", 29},
+    {"Authorization", 13},
+    {"Cache-Control", 13},
+    {"Connection", 10},
+    {"Content-Length", 14},
+    {"Content-Range", 13},
+    {"Content-Type", 12},
+    {"Cookie", 6},
+    {"Depth", 5},
+    {"Destination", 11},
+    {"Expect", 6},
+    {"Host", 4},
+    {"If-Modified-Since", 17},
+    {"If-None-Match", 13},
+    {"Location", 8},
+    {"Origin", 6},
+    {"Overwrite", 9},
+    {"Range", 5},
+    {"Referer", 7},
+    {"Sec-WebSocket-Extensions", 24},
+    {"Sec-WebSocket-Key", 17},
+    {"Sec-WebSocket-Key1", 18},
+    {"Sec-WebSocket-Key2", 18},
+    {"Sec-WebSocket-Protocol", 22},
+    {"Sec-WebSocket-Version", 21},
+    {"Transfer-Encoding", 17},
+    {"Upgrade", 7},
+    {"User-Agent", 10},
+    {"X-Forwarded-For", 15}};
+
+
+/* Return the MG_HDR_* id of a header name, or -1 if it is not a
+ * well-known header */
+static int
+get_header_name_id(const char *name)
+{
+	size_t len = strlen(name);
+	int i;
+
+	for (i = 0; i < MG_HDR_COUNT; i++) {
+		/* Compare the length first, most names differ in length */
+		if ((well_known_headers[i].len == len)
+		    && !mg_strcasecmp(name, well_known_headers[i].name)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+
+/* Classify the request or response headers of a connection (depending on
+ * the connection type) once, for mg_get_header_id. Must be called after
+ * the headers have been parsed. */
+static void
+index_http_headers(struct mg_connection *conn)
+{
+	const struct mg_header *hdr;
+	int num_hdr, i, id;
+
+	if (conn->connection_type == CONNECTION_TYPE_RESPONSE) {
+		hdr = conn->response_info.http_headers;
+		num_hdr = conn->response_info.num_headers;
+	} else {
+		hdr = conn->request_info.http_headers;
+		num_hdr = conn->request_info.num_headers;
+	}
+
+	memset(conn->header_index, 0, sizeof(conn->header_index));
+	for (i = 0; i < num_hdr; i++) {
+		id = get_header_name_id(hdr[i].name);
+		if ((id >= 0) && (conn->header_index[id] == 0)) {
+			/* Keep the first one, like get_header */
+			conn->header_index[id] = (unsigned char)(i + 1);
+		}
+	}
+	conn->header_index_type = conn->connection_type;
+}
+
+
 /* Retrieve requested HTTP header multiple values, and return the number of
  * found occurrences */
 static int
@@ -3965,13 +4505,52 @@ get_req_headers(const struct mg_request_info *ri,
 }
 
 
+CIVETWEB_API const char *
+mg_get_header_id(const struct mg_connection *conn, int header_id)
+{
+	const struct mg_header *hdr;
+	int pos;
+
+	if (!conn || (header_id < 0) || (header_id >= MG_HDR_COUNT)) {
+		return NULL;
+	}
+
+	if (conn->connection_type == CONNECTION_TYPE_REQUEST) {
+		hdr = conn->request_info.http_headers;
+	} else if (conn->connection_type == CONNECTION_TYPE_RESPONSE) {
+		hdr = conn->response_info.http_headers;
+	} else {
+		return NULL;
+	}
+
+	if (conn->header_index_type != conn->connection_type) {
+		/* No index (yet) */
+		return get_header(hdr,
+		                  (conn->connection_type == CONNECTION_TYPE_REQUEST)
+		                      ? conn->request_info.num_headers
+		                      : conn->response_info.num_headers,
+		                  well_known_headers[header_id].name);
+	}
+
+	pos = conn->header_index[header_id];
+	return (pos > 0) ? hdr[pos - 1].value : NULL;
+}
+
+
 CIVETWEB_API const char *
 mg_get_header(const struct mg_connection *conn, const char *name)
 {
+	int id;
+
 	if (!conn) {
 		return NULL;
 	}
 
+	if ((conn->header_index_type == conn->connection_type)
+	    && ((id = get_header_name_id(name)) >= 0)) {
+		return mg_get_header_id(conn, id);
+	}
+
 	if (conn->connection_type == CONNECTION_TYPE_REQUEST) {
 		return get_header(conn->request_info.http_headers,
 		                  conn->request_info.num_headers,
@@ -4112,7 +4691,7 @@ should_keep_alive(const struct mg_connection *conn)
 	}
 
 	/* Check explicit wish of the client */
-	header = mg_get_header(conn, "Connection");
+	header = mg_get_header_id(conn, MG_HDR_CONNECTION);
 	if (header) {
 		/* If there is a connection header from the client, obey */
 		if (header_has_option(header, "keep-alive")) {
@@ -4264,7 +4843,7 @@ send_additional_header(struct mg_connection *conn)
 static void
 send_cors_header(struct mg_connection *conn)
 {
-	const char *origin_hdr = mg_get_header(conn, "Origin");
+	const char *origin_hdr = mg_get_header_id(conn, MG_HDR_ORIGIN);
 	const char *cors_orig_cfg =
 	    conn->dom_ctx->config[ACCESS_CONTROL_ALLOW_ORIGIN];
 	const char *cors_cred_cfg =
@@ -6161,6 +6740,11 @@ mg_poll(struct mg_pollfd *pfd,
 }
 
 
+#if defined(USE_IO_URING)
+#include "mod_io_uring.inl"
+#endif
+
+
 /* Write data to the IO channel - opened file descriptor, socket or SSL
  * descriptor.
  * Return value:
@@ -6180,6 +6764,10 @@ push_inner(struct mg_context *ctx,
 	uint64_t start = 0, now = 0, timeout_ns = 0;
 	int n, err;
 	unsigned ms_wait = SOCKET_TIMEOUT_QUANTUM; /* Sleep quantum in ms */
+#if defined(USE_IO_URING)
+	struct mg_uring *ring = NULL;
+	int uring_again = 0;
+#endif
 
 #if defined(_WIN32)
 	typedef int len_t;
@@ -6267,6 +6855,23 @@ push_inner(struct mg_context *ctx,
 			} else {
 				err = 0;
 			}
+#if defined(USE_IO_URING)
+		} else if ((ring != NULL) || ((ring = mg_uring_of_thread()) != NULL)) {
+			/* Send, or wait up to ms_wait until the socket is writable */
+			n = mg_uring_sock_io(
+			    ring, IORING_OP_SEND, sock, (void *)buf, len, (int)ms_wait);
+			err = (n < 0) ? -n : 0;
+			/* -EAGAIN: the socket is not writable, wait using poll */
+			uring_again = (n == -EAGAIN);
+			if ((n == -ETIME) || uring_again) {
+				err = 0;
+				n = 0;
+			}
+			if (n < 0) {
+				/* shutdown of the socket at client side */
+				return -2;
+			}
+#endif
 		} else {
 			n = (int)send(sock, buf, (len_t)len, MSG_NOSIGNAL);
 			err = (n < 0) ? ERRNO : 0;
@@ -6308,6 +6913,10 @@ push_inner(struct mg_context *ctx,
 			/* For files, just wait a fixed time.
 			 * Maybe it helps, maybe not. */
 			mg_sleep(5);
+#if defined(USE_IO_URING)
+		} else if ((ring != NULL) && !uring_again) {
+			/* io_uring already waited for the socket */
+#endif
 		} else {
 			/* For sockets, wait for the socket using poll */
 
@@ -6420,34 +7029,212 @@ push_all(struct mg_context *ctx,
 	return nwritten;
 }
 
-/** Returns a pointer to the mg_poll_fd array to pass to mg_poll() for the given mg_connection,
-  * or NULL on failure.
-  * On successful return, (*ret_num_pfds) will contain the number of valid mg_pollfd items that
-  * our returned pointer is pointing to.
-  */
-static struct mg_pollfd *
-mg_get_poll_fds_for_connection(struct mg_connection * conn,
-                               unsigned int * ret_num_pfds,
-                               short connection_fd_events_bits)
+
+/* Output buffer (output_buffer_size).
+ * While a HTTP/1.x request is handled, mg_write collects the response in
+ * conn->out_buf, so the status line, the headers and a small body are sent
+ * with one system call instead of one call per mg_printf. The buffer is
+ * sent when it is full, before reading from the client, by mg_flush and at
+ * the end of the request. */
+
+/* Send the data in the output buffer.
+ * If more is set, the kernel is told that more data follows (MSG_MORE),
+ * so the data can be coalesced with a following sendfile call.
+ * Return 0 on success, -1 on error. */
+static int
+out_buf_flush(struct mg_connection *conn, int more)
 {
-	struct mg_pollfd * ret = conn->basic_mg_poll_fds_array;
-	unsigned int num_pfds = 2;  /* We always have at least client.sock and thread_shutdown_notification_socket */
-	if (conn->num_misc_socket_callbacks > 0) {
-		num_pfds += conn->num_misc_socket_callbacks;
-		if (num_pfds != conn->custom_mg_poll_fds_array_size) {
-			struct mg_pollfd * new_fds = (struct mg_pollfd *)
-				mg_realloc_ctx(conn->custom_mg_poll_fds_array,
-		                        num_pfds * sizeof(conn->custom_mg_poll_fds_array[0]),
-		                        conn->phys_ctx);
-			if (new_fds == NULL) {
-				return NULL;  /* out of memory? */
-			}
-			conn->custom_mg_poll_fds_array = new_fds;
-			conn->custom_mg_poll_fds_array_size = num_pfds;
-		}
+	int len = conn->out_len;
+	int n = 0;
 
-		ret = conn->custom_mg_poll_fds_array;
-		for (unsigned int i = 0; i < conn->num_misc_socket_callbacks; i++) {
+	if (len <= 0) {
+		return 0;
+	}
+	conn->out_len = 0;
+
+#if defined(MSG_MORE)
+	if (more && (conn->ssl == NULL)) {
+		do {
+			n = (int)send(conn->client.sock,
+			              conn->out_buf,
+			              (size_t)len,
+			              MSG_MORE | MSG_NOSIGNAL);
+		} while ((n < 0) && (ERRNO == EINTR));
+		if (n < 0) {
+			if (!ERROR_TRY_AGAIN(ERRNO)) {
+				return -1;
+			}
+			n = 0;
+		}
+	}
+#else
+	(void)more;
+#endif
+
+	if ((n < len)
+	    && (push_all(conn->phys_ctx,
+	                 NULL,
+	                 conn->client.sock,
+	                 conn->ssl,
+	                 conn->out_buf + n,
+	                 len - n)
+	        != len - n)) {
+		return -1;
+	}
+	return 0;
+}
+
+
+/* Send the data in the output buffer, followed by len bytes of buf.
+ * Without TLS, both are sent with one system call.
+ * Return len on success, -1 on error. */
+static int
+out_buf_send_with(struct mg_connection *conn, const char *buf, int len)
+{
+	int total = len;
+
+#if !defined(_WIN32)
+	if (conn->ssl == NULL) {
+		/* Send the buffered data and the new data with one system call */
+		struct iovec iov[2];
+		struct msghdr msg;
+		ssize_t n;
+
+		iov[0].iov_base = conn->out_buf;
+		iov[0].iov_len = (size_t)conn->out_len;
+		iov[1].iov_base = (void *)buf;
+		iov[1].iov_len = (size_t)len;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = 2;
+		do {
+			n = sendmsg(conn->client.sock, &msg, MSG_NOSIGNAL);
+		} while ((n < 0) && (ERRNO == EINTR));
+		if (n < 0) {
+			if (!ERROR_TRY_AGAIN(ERRNO)) {
+				conn->out_len = 0;
+				return -1;
+			}
+			n = 0;
+		}
+
+		/* The socket buffer is full: send the rest the regular way */
+		if (n < conn->out_len) {
+			if (push_all(conn->phys_ctx,
+			             NULL,
+			             conn->client.sock,
+			             NULL,
+			             conn->out_buf + n,
+			             conn->out_len - (int)n)
+			    != conn->out_len - (int)n) {
+				conn->out_len = 0;
+				return -1;
+			}
+			n = 0;
+		} else {
+			n -= conn->out_len;
+		}
+		conn->out_len = 0;
+		if ((n < len)
+		    && (push_all(conn->phys_ctx,
+		                 NULL,
+		                 conn->client.sock,
+		                 NULL,
+		                 buf + n,
+		                 len - (int)n)
+		        != len - (int)n)) {
+			return -1;
+		}
+		return total;
+	}
+#endif
+
+	if ((out_buf_flush(conn, 0) != 0)
+	    || (push_all(conn->phys_ctx,
+	                 NULL,
+	                 conn->client.sock,
+	                 conn->ssl,
+	                 buf,
+	                 len)
+	        != len)) {
+		return -1;
+	}
+	return total;
+}
+
+
+/* Write data using the output buffer.
+ * Return len on success, -1 on error. */
+static int
+out_buf_write(struct mg_connection *conn, const char *buf, int len)
+{
+	int total = len;
+	int space;
+
+	if (len <= conn->out_buf_size - conn->out_len) {
+		memcpy(conn->out_buf + conn->out_len, buf, (size_t)len);
+		conn->out_len += len;
+		return total;
+	}
+
+	if ((conn->ssl == NULL) && (conn->out_len > 0)) {
+		return out_buf_send_with(conn, buf, len);
+	}
+
+	/* Fill the buffer and send it: for TLS, this is one full record */
+	if (conn->out_len > 0) {
+		space = conn->out_buf_size - conn->out_len;
+		memcpy(conn->out_buf + conn->out_len, buf, (size_t)space);
+		conn->out_len += space;
+		if (out_buf_flush(conn, 0) != 0) {
+			return -1;
+		}
+		buf += space;
+		len -= space;
+	}
+	if (len < conn->out_buf_size) {
+		memcpy(conn->out_buf, buf, (size_t)len);
+		conn->out_len = len;
+	} else if (push_all(conn->phys_ctx,
+	                    NULL,
+	                    conn->client.sock,
+	                    conn->ssl,
+	                    buf,
+	                    len)
+	           != len) {
+		return -1;
+	}
+	return total;
+}
+
+/** Returns a pointer to the mg_poll_fd array to pass to mg_poll() for the given mg_connection,
+  * or NULL on failure.
+  * On successful return, (*ret_num_pfds) will contain the number of valid mg_pollfd items that
+  * our returned pointer is pointing to.
+  */
+static struct mg_pollfd *
+mg_get_poll_fds_for_connection(struct mg_connection * conn,
+                               unsigned int * ret_num_pfds,
+                               short connection_fd_events_bits)
+{
+	struct mg_pollfd * ret = conn->basic_mg_poll_fds_array;
+	unsigned int num_pfds = 2;  /* We always have at least client.sock and thread_shutdown_notification_socket */
+	if (conn->num_misc_socket_callbacks > 0) {
+		num_pfds += conn->num_misc_socket_callbacks;
+		if (num_pfds != conn->custom_mg_poll_fds_array_size) {
+			struct mg_pollfd * new_fds = (struct mg_pollfd *)
+				mg_realloc_ctx(conn->custom_mg_poll_fds_array,
+		                        num_pfds * sizeof(conn->custom_mg_poll_fds_array[0]),
+		                        conn->phys_ctx);
+			if (new_fds == NULL) {
+				return NULL;  /* out of memory? */
+			}
+			conn->custom_mg_poll_fds_array = new_fds;
+			conn->custom_mg_poll_fds_array_size = num_pfds;
+		}
+
+		ret = conn->custom_mg_poll_fds_array;
+		for (unsigned int i = 0; i < conn->num_misc_socket_callbacks; i++) {
 			const struct mg_misc_socket_callback * cb = &conn->misc_socket_callbacks[i];
 			struct mg_pollfd * pfd = &ret[i+2];  /* the first two pfds are internal and will be set up separately at the end of this function */
 			pfd->fd = cb->sock_fd;
@@ -6497,6 +7284,9 @@ pull_inner(FILE *fp,
            double timeout)
 {
 	int nread, err = 0;
+#if defined(USE_IO_URING)
+	struct mg_uring *ring;
+#endif
 
 #if defined(_WIN32)
 	typedef int len_t;
@@ -6705,6 +7495,22 @@ pull_inner(FILE *fp,
 		}
 #endif
 
+#if defined(USE_IO_URING)
+	} else if ((conn->num_misc_socket_callbacks == 0)
+	           && ((ring = mg_uring_of_thread()) != NULL)) {
+		/* Wait for data and read it using one io_uring submission */
+		nread = mg_uring_recv(ring,
+		                      conn->client.sock,
+		                      buf,
+		                      len,
+		                      timeout,
+		                      &(conn->phys_ctx->stop_flag));
+		if (nread < 0) {
+			/* shutdown of the socket at client side, error or stop signal */
+			return -2;
+		}
+#endif
+
 	} else {
 
 		unsigned int num_pfds;
@@ -6931,8 +7737,21 @@ handle_request_stat_log(struct mg_connection *conn)
 	conn->conn_state = 4; /* processing */
 #endif
 
+	/* Collect the response in the output buffer (HTTP/1.x only) */
+	conn->out_buffering = (conn->out_buf != NULL)
+	                      && (conn->protocol_type == PROTOCOL_TYPE_HTTP1);
+#if defined(USE_IO_URING)
+	if (conn->out_headers_only) {
+		conn->out_buffering = 0;
+	}
+#endif
+
 	handle_request(conn);
 
+	conn->out_buffering = 0;
+	if (out_buf_flush(conn, 0) != 0) {
+		conn->must_close = 1;
+	}
 
 #if defined(USE_SERVER_STATS)
 	conn->conn_state = 5; /* processed */
@@ -6943,6 +7762,8 @@ handle_request_stat_log(struct mg_connection *conn)
 	mg_atomic_add64(&(conn->phys_ctx->total_data_read), conn->consumed_content);
 	mg_atomic_add64(&(conn->phys_ctx->total_data_written),
 	                conn->num_bytes_sent);
+	mg_atomic_max(&(conn->phys_ctx->max_request_arena),
+	              (ptrdiff_t)conn->arena_used);
 #endif
 
 	DEBUG_TRACE("%s", "handle_request done");
@@ -6956,10 +7777,11 @@ handle_request_stat_log(struct mg_connection *conn)
 
 
 #if defined(USE_HTTP2)
-#if defined(NO_SSL)
-#error "HTTP2 requires ALPN, ALPN requires SSL/TLS"
-#endif
+#if !defined(NO_SSL)
+/* HTTP/2 over TLS is negotiated using ALPN, without TLS only cleartext
+ * HTTP/2 with prior knowledge is available */
 #define USE_ALPN
+#endif
 #include "http2.inl"
 /* Not supported with HTTP/2 */
 #define HTTP1_only()                                                           \
@@ -6985,6 +7807,18 @@ mg_read(struct mg_connection *conn, void *buf, size_t len)
 	if (conn == NULL) {
 		return 0;
 	}
+#if defined(USE_HTTP2)
+	if (conn->http2.stream != NULL) {
+		/* Request body data of a HTTP/2 stream */
+		return http2_stream_read(conn, buf, len);
+	}
+#endif
+
+	/* The client might wait for the response sent up to now
+	 * (e.g., "100 Continue") */
+	if ((conn->out_len > 0) && (out_buf_flush(conn, 0) != 0)) {
+		return -1;
+	}
 
 	if (conn->is_chunked) {
 		size_t all_read = 0;
@@ -7156,8 +7990,41 @@ mg_write(struct mg_connection *conn, const void *buf, size_t len)
 	/* Mark connection as "data sent" */
 	conn->request_state = 10;
 #if defined(USE_HTTP2)
-	if (conn->protocol_type == PROTOCOL_TYPE_HTTP2) {
-		http2_data_frame_head(conn, len, 0);
+	if (conn->http2.stream != NULL) {
+		/* DATA frames are sent by the connection thread */
+		total = http2_stream_write(conn, (const char *)buf, len);
+		if (total > 0) {
+			conn->num_bytes_sent += total;
+		}
+		return total;
+	}
+#endif
+
+	if (conn->out_buffering) {
+		if (conn->throttle <= 0) {
+			total = out_buf_write(conn, (const char *)buf, (int)len);
+			if (total > 0) {
+				conn->num_bytes_sent += total;
+			}
+			return total;
+		}
+		/* Throttled connections are not buffered */
+		if (out_buf_flush(conn, 0) != 0) {
+			return -1;
+		}
+		conn->out_buffering = 0;
+	}
+#if defined(USE_IO_URING)
+	if ((conn->out_len > 0) && (conn->throttle <= 0)) {
+		/* Response headers collected by mg_response_header_send */
+		total = out_buf_send_with(conn, (const char *)buf, (int)len);
+		if (total > 0) {
+			conn->num_bytes_sent += total;
+		}
+		return total;
+	}
+	if ((conn->out_len > 0) && (out_buf_flush(conn, 0) != 0)) {
+		return -1;
 	}
 #endif
 
@@ -7220,11 +8087,21 @@ mg_write(struct mg_connection *conn, const void *buf, size_t len)
 }
 
 
-/* Send a chunk, if "Transfer-Encoding: chunked" is used */
 CIVETWEB_API int
-mg_send_chunk(struct mg_connection *conn,
-              const char *chunk,
-              unsigned int chunk_len)
+mg_flush(struct mg_connection *conn)
+{
+	if ((conn == NULL) || (conn->out_len <= 0)) {
+		return 0;
+	}
+	return out_buf_flush(conn, 0);
+}
+
+
+/* Send a chunk, if "Transfer-Encoding: chunked" is used */
+static int
+send_chunk_data(struct mg_connection *conn,
+                const char *chunk,
+                unsigned int chunk_len)
 {
 	char lenbuf[16];
 	size_t lenbuf_len;
@@ -7258,6 +8135,63 @@ mg_send_chunk(struct mg_connection *conn,
 }
 
 
+#if defined(USE_ZSTD)
+#include "mod_zstd.inl"
+#endif
+
+
+CIVETWEB_API int
+mg_send_chunk(struct mg_connection *conn,
+              const char *chunk,
+              unsigned int chunk_len)
+{
+#if defined(USE_ZSTD)
+	if ((conn != NULL) && (conn->chunk_zstd != NULL)) {
+		return zstd_send_chunk(conn, chunk, chunk_len);
+	}
+#endif
+	return send_chunk_data(conn, chunk, chunk_len);
+}
+
+
+CIVETWEB_API int
+mg_response_header_add_compression(struct mg_connection *conn)
+{
+#if defined(USE_ZSTD)
+	int ret;
+
+	if (conn == NULL) {
+		return -1;
+	}
+
+	/* The response depends on Accept-Encoding, even if not compressed */
+	ret = mg_response_header_add(conn, "Vary", "Accept-Encoding", -1);
+	if (ret < 0) {
+		return ret;
+	}
+	if (conn->accept_encoding[CONTENT_CODING_ZSTD] == 0) {
+		return 0;
+	}
+	if (!zstd_chunk_start(conn)) {
+		return -5;
+	}
+	ret = mg_response_header_add(conn,
+	                             "Content-Encoding",
+	                             content_codings[CONTENT_CODING_ZSTD].name,
+	                             -1);
+	if (ret < 0) {
+		ZSTD_freeCCtx(conn->chunk_zstd);
+		conn->chunk_zstd = NULL;
+		return ret;
+	}
+	return 1;
+#else
+	/* No compression library available */
+	return (conn == NULL) ? -1 : 0;
+#endif
+}
+
+
 #if defined(GCC_DIAGNOSTIC)
 /* This block forwards format strings to printf implementations,
  * so we need to disable the format-nonliteral warning. */
@@ -7869,6 +8803,20 @@ is_civetweb_webdav_method(const struct mg_connection *conn)
 }
 
 
+#if !defined(NO_FILESYSTEMS)
+/* Defined below, used by the file cache */
+static void
+construct_etag(char *buf, size_t buf_len, const struct mg_file_stat *filestat);
+static void
+get_mime_type(struct mg_connection *conn, const char *path, struct vec *vec);
+static void
+mg_memory_cache_invalidate(struct mg_context *ctx, const char *path);
+
+#include "file_cache.inl"
+#include "memory_cache.inl"
+#endif /* NO_FILESYSTEMS */
+
+
 #if !defined(NO_FILES)
 static int
 extention_matches_script(
@@ -7971,7 +8919,7 @@ substitute_index_file_aux(struct mg_connection *conn,
 		mg_strlcpy(path + n + 1, filename_vec.ptr, filename_vec.len + 1);
 
 		/* Does it exist? */
-		if (mg_stat(conn, path, filestat)) {
+		if (mg_stat_cached(conn, path, filestat)) {
 			/* Yes it does, break the loop */
 			found = 1;
 			break;
@@ -8043,6 +8991,155 @@ substitute_index_file(struct mg_connection *conn,
 #endif
 
 
+/* Parse a q-value ("0", "0.5", "1.000", ...) to an integer 0 to 1000 */
+static int
+parse_qvalue(const char *s)
+{
+	int q = 0, f = 100;
+
+	if (*s == '1') {
+		return 1000;
+	}
+	if (*s != '0') {
+		/* Invalid */
+		return 0;
+	}
+	s++;
+	if (*s == '.') {
+		s++;
+		while ((*s >= '0') && (*s <= '9') && (f > 0)) {
+			q += (*s - '0') * f;
+			f /= 10;
+			s++;
+		}
+	}
+	return q;
+}
+
+
+/* Parse the Accept-Encoding request header (RFC 9110, Section 12.5.3) and
+ * store the q-value of every known content coding in conn->accept_encoding.
+ * Codings not listed in the header get the q-value of "*", if present. */
+static void
+parse_accept_encoding(struct mg_connection *conn, const char *hdr)
+{
+	int listed[CONTENT_CODING_COUNT];
+	int any_q = -1, q, i;
+	const char *end, *p;
+	size_t len;
+
+	memset(listed, 0, sizeof(listed));
+	while (hdr != NULL) {
+		hdr += strspn(hdr, " \t,");
+		if (*hdr == 0) {
+			break;
+		}
+		len = strcspn(hdr, " \t,;");
+		end = hdr + strcspn(hdr, ",");
+
+		/* q is the only parameter defined for Accept-Encoding */
+		q = 1000;
+		p = hdr + len;
+		while (((p = strchr(p, ';')) != NULL) && (p < end)) {
+			p++;
+			p += strspn(p, " \t");
+			if (((*p == 'q') || (*p == 'Q')) && (p[1] == '=')) {
+				q = parse_qvalue(p + 2);
+			}
+		}
+
+		if ((len == 1) && (*hdr == '*')) {
+			any_q = q;
+		} else {
+			for (i = 0; i < CONTENT_CODING_COUNT; i++) {
+				if ((len == strlen(content_codings[i].name))
+				    && !mg_strncasecmp(hdr, content_codings[i].name, len)) {
+					break;
+				}
+			}
+			if ((i == CONTENT_CODING_COUNT) && (len == 6)
+			    && !mg_strncasecmp(hdr, "x-gzip", 6)) {
+				i = CONTENT_CODING_GZIP;
+			}
+			if (i < CONTENT_CODING_COUNT) {
+				conn->accept_encoding[i] = (unsigned short)q;
+				listed[i] = 1;
+			}
+		}
+		hdr = end;
+	}
+
+	for (i = 0; i < CONTENT_CODING_COUNT; i++) {
+		if (!listed[i]) {
+			if (any_q >= 0) {
+				conn->accept_encoding[i] = (unsigned short)any_q;
+			} else {
+				/* identity is acceptable, unless excluded explicitly */
+				conn->accept_encoding[i] =
+				    (i == CONTENT_CODING_IDENTITY) ? 1000 : 0;
+			}
+		}
+	}
+	conn->accept_gzip = (conn->accept_encoding[CONTENT_CODING_GZIP] > 0);
+}
+
+
+#if !defined(NO_FILESYSTEMS)
+/* Find a precompressed variant of a static file (path + ".br", ".zst" or
+ * ".gz") accepted by the client. The variant with the highest q-value is
+ * used; for equal q-values the first one in this order, since brotli and
+ * zstd files are usually smaller than gzip files.
+ * Return the content coding and the file name and status of the variant,
+ * or 0 if there is no variant. */
+static int
+find_precompressed_file(struct mg_connection *conn,
+                        const char *path,
+                        char *buf,
+                        size_t buf_len,
+                        struct mg_file_stat *filestat)
+{
+	static const int order[] = {CONTENT_CODING_BR,
+	                            CONTENT_CODING_ZSTD,
+	                            CONTENT_CODING_GZIP};
+	struct mg_file_stat file_stat;
+	int i, coding, truncated, best = 0;
+	unsigned best_q = 0;
+
+	for (i = 0; i < (int)(sizeof(order) / sizeof(order[0])); i++) {
+		coding = order[i];
+		if (conn->accept_encoding[coding] <= best_q) {
+			continue;
+		}
+		mg_snprintf(conn,
+		            &truncated,
+		            buf,
+		            buf_len,
+		            "%s%s",
+		            path,
+		            content_codings[coding].ext);
+		if (!truncated && mg_stat_cached(conn, buf, &file_stat)
+		    && !file_stat.is_directory) {
+			best = coding;
+			best_q = conn->accept_encoding[coding];
+			*filestat = file_stat;
+		}
+	}
+
+	if (best != 0) {
+		mg_snprintf(conn,
+		            NULL, /* length checked above */
+		            buf,
+		            buf_len,
+		            "%s%s",
+		            path,
+		            content_codings[best].ext);
+		filestat->encoding = best;
+	}
+	return best;
+}
+#endif
+
+
 static void
 interpret_uri(struct mg_connection *conn, /* in/out: request (must be valid) */
               char *filename,             /* out: filename */
@@ -8056,8 +9153,6 @@ interpret_uri(struct mg_connection *conn, /* in/out: request (must be valid) */
               int *is_template_text          /* out: SSI file or LSP file? */
 )
 {
-	char const *accept_encoding;
-
 #if !defined(NO_FILES)
 	const char *uri = conn->request_info.local_uri;
 	char **roots = conn->dom_ctx->document_roots;
@@ -8104,13 +9199,8 @@ interpret_uri(struct mg_connection *conn, /* in/out: request (must be valid) */
 	*is_websocket_request = 0;
 #endif /* USE_WEBSOCKET */
 
-	/* Step 4: Check if gzip encoded response is allowed */
-	conn->accept_gzip = 0;
-	if ((accept_encoding = mg_get_header(conn, "Accept-Encoding")) != NULL) {
-		if (strstr(accept_encoding, "gzip") != NULL) {
-			conn->accept_gzip = 1;
-		}
-	}
+	/* Step 4: The accepted content codings (compressed responses) have
+	 * already been checked in handle_request */
 
 #if !defined(NO_FILES)
 	/* Step 5: If there is no primary root directory, don't look for files. */
@@ -8164,7 +9254,7 @@ interpret_uri(struct mg_connection *conn, /* in/out: request (must be valid) */
 		/* Step 8: Check if the file exists at the server */
 		/* Local file path and name, corresponding to requested URI
 		 * is now stored in "filename" variable. */
-		if (mg_stat(conn, filename, filestat)) {
+		if (mg_stat_cached(conn, filename, filestat)) {
 			fileExists = 1;
 			break;
 		}
@@ -8229,7 +9319,8 @@ interpret_uri(struct mg_connection *conn, /* in/out: request (must be valid) */
 				} else {
 					/* Substitute file is a regular file */
 					*is_script_resource = 0;
-					*is_found = (mg_stat(conn, filename, filestat) ? 1 : 0);
+					*is_found =
+					    (mg_stat_cached(conn, filename, filestat) ? 1 : 0);
 				}
 			}
 			/* If there is no substitute file, the server could return
@@ -8238,30 +9329,18 @@ interpret_uri(struct mg_connection *conn, /* in/out: request (must be valid) */
 		return;
 	}
 
-	/* Step 9: Check for zipped files: */
+	/* Step 9: Check for precompressed files: */
 	/* If we can't find the actual file, look for the file
-	 * with the same name but a .gz extension. If we find it,
-	 * use that and set the gzipped flag in the file struct
-	 * to indicate that the response need to have the content-
-	 * encoding: gzip header.
+	 * with the same name but a .br, .zst or .gz extension. If we find
+	 * it, use that and set the encoding in the file struct to indicate
+	 * that the response need to have a content-encoding header.
 	 * We can only do this if the browser declares support. */
-	if (conn->accept_gzip) {
-		mg_snprintf(
-		    conn, &truncated, gz_path, sizeof(gz_path), "%s.gz", filename);
-
-		if (truncated) {
-			goto interpret_cleanup;
-		}
-
-		if (mg_stat(conn, gz_path, filestat)) {
-			if (filestat) {
-				filestat->is_gzipped = 1;
-				*is_found = 1;
-			}
-			/* Currently gz files can not be scripts. */
-			return;
-		}
-	}
+	if (find_precompressed_file(
+	        conn, filename, gz_path, sizeof(gz_path), filestat)) {
+		*is_found = 1;
+		/* Currently precompressed files can not be scripts. */
+		return;
+	}
 
 #if !defined(NO_CGI) || defined(USE_LUA) || defined(USE_DUKTAPE)
 	/* Step 10: Script resources may handle sub-resources */
@@ -8294,7 +9373,7 @@ interpret_uri(struct mg_connection *conn, /* in/out: request (must be valid) */
 			tmp_str[sep_pos] = 0;
 			if (tmp_str[0]) {
 				is_script = extention_matches_script(conn, tmp_str);
-				does_exist = mg_stat(conn, tmp_str, filestat);
+				does_exist = mg_stat_cached(conn, tmp_str, filestat);
 			}
 
 			if (does_exist && is_script) {
@@ -8383,6 +9462,9 @@ interpret_cleanup:
 }
 
 
+#include "http_scan.inl"
+
+
 /* Check whether full request is buffered. Return:
  * -1  if request or response is malformed
  *  0  if request or response is not yet fully buffered
@@ -8392,8 +9474,17 @@ get_http_header_len(const char *buf, int buflen)
 {
 	int i;
 	for (i = 0; i < buflen; i++) {
+		unsigned char c;
+
+		/* Only control characters (including \r and \n) need to be
+		 * checked, skip all others */
+		i = (int)(scan_chars(buf + i, buf + buflen, SCAN_CTRL) - buf);
+		if (i >= buflen) {
+			break;
+		}
+
 		/* Do an unsigned comparison in some conditions below */
-		const unsigned char c = (unsigned char)buf[i];
+		c = (unsigned char)buf[i];
 
 		if ((c < 128) && ((char)c != '\r') && ((char)c != '\n')
 		    && !isprint(c)) {
@@ -8911,51 +10002,33 @@ check_password_digest(const char *method,
 
 
 #if !defined(NO_FILESYSTEMS)
-/* Use the global passwords file, if specified by auth_gpass option,
- * or search for .htpasswd in the requested directory. */
-static void
-open_auth_file(struct mg_connection *conn,
-               const char *path,
-               struct mg_file *filep)
+/* Get the name of the passwords file for path: the global passwords file,
+ * if specified by auth_gpass option, or .htpasswd in the requested
+ * directory. Return 0 if the name does not fit into name. */
+static int
+get_auth_file_name(struct mg_connection *conn,
+                   const char *path,
+                   char *name,
+                   size_t name_len)
 {
+	struct mg_file_stat st;
+	const char *p, *e, *gpass;
+	int truncated = 1;
+
 	if ((conn != NULL) && (conn->dom_ctx != NULL)) {
-		char name[UTF8_PATH_MAX];
-		const char *p, *e,
-		    *gpass = conn->dom_ctx->config[GLOBAL_PASSWORDS_FILE];
-		int truncated;
+		gpass = conn->dom_ctx->config[GLOBAL_PASSWORDS_FILE];
 
 		if (gpass != NULL) {
 			/* Use global passwords file */
-			if (!mg_fopen(conn, gpass, MG_FOPEN_MODE_READ, filep)) {
-#if defined(DEBUG)
-				/* Use mg_cry_internal here, since gpass has been
-				 * configured. */
-				mg_cry_internal(conn, "fopen(%s): %s", gpass, strerror(ERRNO));
-#endif
-			}
-			/* Important: using local struct mg_file to test path for
-			 * is_directory flag. If filep is used, mg_stat() makes it
-			 * appear as if auth file was opened.
-			 * TODO(mid): Check if this is still required after rewriting
-			 * mg_stat */
-		} else if (mg_stat(conn, path, &filep->stat)
-		           && filep->stat.is_directory) {
+			mg_snprintf(conn, &truncated, name, name_len, "%s", gpass);
+		} else if (mg_stat(conn, path, &st) && st.is_directory) {
 			mg_snprintf(conn,
 			            &truncated,
 			            name,
-			            sizeof(name),
+			            name_len,
 			            "%s/%s",
 			            path,
 			            PASSWORDS_FILE_NAME);
-
-			if (truncated || !mg_fopen(conn, name, MG_FOPEN_MODE_READ, filep)) {
-#if defined(DEBUG)
-				/* Don't use mg_cry_internal here, but only a trace, since
-				 * this is a typical case. It will occur for every directory
-				 * without a password file. */
-				DEBUG_TRACE("fopen(%s): %s", name, strerror(ERRNO));
-#endif
-			}
 		} else {
 			/* Try to find .htpasswd in requested directory. */
 			for (p = path, e = p + strlen(p) - 1; e > p; e--) {
@@ -8966,22 +10039,14 @@ open_auth_file(struct mg_connection *conn,
 			mg_snprintf(conn,
 			            &truncated,
 			            name,
-			            sizeof(name),
+			            name_len,
 			            "%.*s/%s",
 			            (int)(e - p),
 			            p,
 			            PASSWORDS_FILE_NAME);
-
-			if (truncated || !mg_fopen(conn, name, MG_FOPEN_MODE_READ, filep)) {
-#if defined(DEBUG)
-				/* Don't use mg_cry_internal here, but only a trace, since
-				 * this is a typical case. It will occur for every directory
-				 * without a password file. */
-				DEBUG_TRACE("fopen(%s): %s", name, strerror(ERRNO));
-#endif
-			}
 		}
 	}
+	return !truncated;
 }
 #endif /* NO_FILESYSTEMS */
 
@@ -9011,7 +10076,7 @@ parse_auth_header(struct mg_connection *conn,
 	}
 
 	(void)memset(auth_header, 0, sizeof(*auth_header));
-	ah = mg_get_header(conn, "Authorization");
+	ah = mg_get_header_id(conn, MG_HDR_AUTHORIZATION);
 
 	if (ah == NULL) {
 		/* No Authorization header at all */
@@ -9162,7 +10227,109 @@ mg_fgets(char *buf, size_t size, struct mg_file *filep)
 #error Bad INITIAL_DEPTH for recursion, set to at least 1
 #endif
 
+/* Incremented by mg_modify_passwords_file: files modified within the same
+ * second cannot be detected by their modification time. */
+static volatile ptrdiff_t auth_file_generation = 0;
+
+
 #if !defined(NO_FILESYSTEMS)
+/* Line types of a passwords file, see auth_file_parse_line */
+enum { AUTH_LINE_SKIP, AUTH_LINE_ENTRY, AUTH_LINE_INCLUDE };
+
+
+/* Parse one line of a passwords file. The line in buf is modified.
+ * Return AUTH_LINE_ENTRY for a "user:domain:ha1" line (*user, *domain and
+ * *ha1 are set), AUTH_LINE_INCLUDE for an ":include=file" line (*user is the
+ * file name) and AUTH_LINE_SKIP for empty lines, comments and errors. */
+static int
+auth_file_parse_line(struct mg_connection *conn,
+                     char *buf,
+                     const char **user,
+                     const char **domain,
+                     const char **ha1)
+{
+	size_t l = strlen(buf);
+	char *p;
+
+	while (l > 0) {
+		if (isspace((unsigned char)buf[l - 1])
+		    || iscntrl((unsigned char)buf[l - 1])) {
+			l--;
+			buf[l] = 0;
+		} else
+			break;
+	}
+	if (l < 1) {
+		return AUTH_LINE_SKIP;
+	}
+
+	if (buf[0] == ':') {
+		/* user names may not contain a ':' and may not be empty,
+		 * so lines starting with ':' may be used for a special purpose
+		 */
+		if (buf[1] == '#') {
+			/* :# is a comment */
+			return AUTH_LINE_SKIP;
+		} else if (!strncmp(buf + 1, "include=", 8)) {
+			*user = buf + 9;
+			return AUTH_LINE_INCLUDE;
+		}
+		/* everything is invalid for the moment (might change in the
+		 * future) */
+		mg_cry_internal(conn, "syntax error in authorization file: %s", buf);
+		return AUTH_LINE_SKIP;
+	}
+
+	p = strchr(buf, ':');
+	if (p == NULL) {
+		mg_cry_internal(conn, "syntax error in authorization file: %s", buf);
+		return AUTH_LINE_SKIP;
+	}
+	*p = 0;
+	*domain = p + 1;
+
+	p = strchr(p + 1, ':');
+	if (p == NULL) {
+		mg_cry_internal(conn, "syntax error in authorization file: %s", buf);
+		return AUTH_LINE_SKIP;
+	}
+	*p = 0;
+	*ha1 = p + 1;
+	*user = buf;
+	return AUTH_LINE_ENTRY;
+}
+
+
+/* Check the credentials of a parsed Authorization header against the HA1
+ * of a passwords file entry. Return 1 if they match. */
+static int
+auth_check_ha1(const struct mg_connection *conn,
+               const struct auth_header *ah,
+               const char *domain,
+               const char *ha1)
+{
+	switch (ah->type) {
+	case 1: /* Basic */
+	{
+		char md5[33];
+		mg_md5(md5, ah->user, ":", domain, ":", ah->plain_password, NULL);
+		return 0 == strcmp(ha1, md5);
+	}
+	case 2: /* Digest */
+		return check_password_digest(conn->request_info.request_method,
+		                             ha1,
+		                             ah->uri,
+		                             ah->nonce,
+		                             ah->nc,
+		                             ah->cnonce,
+		                             ah->qop,
+		                             ah->response);
+	default: /* None/Other/Unknown */
+		return 0;
+	}
+}
+
+
 struct read_auth_file_struct {
 	struct mg_connection *conn;
 	struct auth_header auth_header;
@@ -9181,7 +10348,6 @@ read_auth_file(struct mg_file *filep,
 {
 	int is_authorized = 0;
 	struct mg_file fp;
-	size_t l;
 
 	if (!filep || !workdata || (0 == depth)) {
 		return 0;
@@ -9189,107 +10355,45 @@ read_auth_file(struct mg_file *filep,
 
 	/* Loop over passwords file */
 	while (mg_fgets(workdata->buf, sizeof(workdata->buf), filep) != NULL) {
-		l = strlen(workdata->buf);
-		while (l > 0) {
-			if (isspace((unsigned char)workdata->buf[l - 1])
-			    || iscntrl((unsigned char)workdata->buf[l - 1])) {
-				l--;
-				workdata->buf[l] = 0;
-			} else
-				break;
-		}
-		if (l < 1) {
-			continue;
-		}
-
-		workdata->f_user = workdata->buf;
-
-		if (workdata->f_user[0] == ':') {
-			/* user names may not contain a ':' and may not be empty,
-			 * so lines starting with ':' may be used for a special purpose
-			 */
-			if (workdata->f_user[1] == '#') {
-				/* :# is a comment */
-				continue;
-			} else if (!strncmp(workdata->f_user + 1, "include=", 8)) {
-				if (mg_fopen(workdata->conn,
-				             workdata->f_user + 9,
-				             MG_FOPEN_MODE_READ,
-				             &fp)) {
-					is_authorized = read_auth_file(&fp, workdata, depth - 1);
-					(void)mg_fclose(
-					    &fp.access); /* ignore error on read only file */
-
-					/* No need to continue processing files once we have a
-					 * match, since nothing will reset it back
-					 * to 0.
-					 */
-					if (is_authorized) {
-						return is_authorized;
-					}
-				} else {
-					mg_cry_internal(workdata->conn,
-					                "cannot open authorization file: %s",
-					                workdata->buf);
+		switch (auth_file_parse_line(workdata->conn,
+		                             workdata->buf,
+		                             &workdata->f_user,
+		                             &workdata->f_domain,
+		                             &workdata->f_ha1)) {
+		case AUTH_LINE_INCLUDE:
+			if (mg_fopen(workdata->conn,
+			             workdata->f_user,
+			             MG_FOPEN_MODE_READ,
+			             &fp)) {
+				is_authorized = read_auth_file(&fp, workdata, depth - 1);
+				(void)mg_fclose(&fp.access); /* ignore error on read only file */
+
+				/* No need to continue processing files once we have a
+				 * match, since nothing will reset it back
+				 * to 0.
+				 */
+				if (is_authorized) {
+					return is_authorized;
 				}
-				continue;
+			} else {
+				mg_cry_internal(workdata->conn,
+				                "cannot open authorization file: %s",
+				                workdata->buf);
 			}
-			/* everything is invalid for the moment (might change in the
-			 * future) */
-			mg_cry_internal(workdata->conn,
-			                "syntax error in authorization file: %s",
-			                workdata->buf);
-			continue;
-		}
-
-		workdata->f_domain = strchr(workdata->f_user, ':');
-		if (workdata->f_domain == NULL) {
-			mg_cry_internal(workdata->conn,
-			                "syntax error in authorization file: %s",
-			                workdata->buf);
-			continue;
-		}
-		*(char *)(workdata->f_domain) = 0;
-		(workdata->f_domain)++;
-
-		workdata->f_ha1 = strchr(workdata->f_domain, ':');
-		if (workdata->f_ha1 == NULL) {
-			mg_cry_internal(workdata->conn,
-			                "syntax error in authorization file: %s",
-			                workdata->buf);
-			continue;
-		}
-		*(char *)(workdata->f_ha1) = 0;
-		(workdata->f_ha1)++;
+			break;
 
-		if (!strcmp(workdata->auth_header.user, workdata->f_user)
-		    && !strcmp(workdata->domain, workdata->f_domain)) {
-			switch (workdata->auth_header.type) {
-			case 1: /* Basic */
-			{
-				char md5[33];
-				mg_md5(md5,
-				       workdata->f_user,
-				       ":",
-				       workdata->domain,
-				       ":",
-				       workdata->auth_header.plain_password,
-				       NULL);
-				return 0 == memcmp(workdata->f_ha1, md5, 33);
-			}
-			case 2: /* Digest */
-				return check_password_digest(
-				    workdata->conn->request_info.request_method,
-				    workdata->f_ha1,
-				    workdata->auth_header.uri,
-				    workdata->auth_header.nonce,
-				    workdata->auth_header.nc,
-				    workdata->auth_header.cnonce,
-				    workdata->auth_header.qop,
-				    workdata->auth_header.response);
-			default: /* None/Other/Unknown */
-				return 0;
+		case AUTH_LINE_ENTRY:
+			if (!strcmp(workdata->auth_header.user, workdata->f_user)
+			    && !strcmp(workdata->domain, workdata->f_domain)) {
+				return auth_check_ha1(workdata->conn,
+				                      &workdata->auth_header,
+				                      workdata->domain,
+				                      workdata->f_ha1);
 			}
+			break;
+
+		default:
+			break;
 		}
 	}
 
@@ -9297,27 +10401,51 @@ read_auth_file(struct mg_file *filep,
 }
 
 
-/* Authorize against the opened passwords file. Return 1 if authorized. */
+#include "auth_cache.inl"
+
+
+/* Authorize against the passwords file path.
+ * Return 1 if authorized, 0 if not and -1 if the file cannot be opened. */
 static int
-authorize(struct mg_connection *conn, struct mg_file *filep, const char *realm)
+authorize(struct mg_connection *conn, const char *path, const char *realm)
 {
 	struct read_auth_file_struct workdata;
+	struct mg_file file = STRUCT_FILE_INITIALIZER;
+	struct mg_auth_db *db = NULL;
 	char buf[MG_BUF_LEN];
+	int ret;
 
-	if (!conn || !conn->dom_ctx) {
+	if (!conn || !conn->dom_ctx || !path) {
 		return 0;
 	}
 
+	/* The cache does not need an open file. If the file cannot be loaded
+	 * into the cache (out of memory), read it directly. */
+	if (conn->phys_ctx->auth_cache != NULL) {
+		db = auth_cache_acquire(conn, path);
+		if ((db != NULL) && db->missing) {
+			/* No passwords file, known without opening it */
+			auth_db_release(db);
+			return -1;
+		}
+	}
+	if ((db == NULL) && !mg_fopen(conn, path, MG_FOPEN_MODE_READ, &file)) {
+		return -1;
+	}
+
 	memset(&workdata, 0, sizeof(workdata));
 	workdata.conn = conn;
 
 	if (!parse_auth_header(conn, buf, sizeof(buf), &workdata.auth_header)) {
-		return 0;
+		ret = 0;
+		goto authorize_done;
 	}
 
 	/* CGI needs it as REMOTE_USER */
 	conn->request_info.remote_user =
-	    mg_strdup_ctx(workdata.auth_header.user, conn->phys_ctx);
+	    request_arena_strndup(conn,
+	                          workdata.auth_header.user,
+	                          strlen(workdata.auth_header.user));
 
 	if (realm) {
 		workdata.domain = realm;
@@ -9325,7 +10453,23 @@ authorize(struct mg_connection *conn, struct mg_file *filep, const char *realm)
 		workdata.domain = conn->dom_ctx->config[AUTHENTICATION_DOMAIN];
 	}
 
-	return read_auth_file(filep, &workdata, INITIAL_DEPTH);
+	if (db != NULL) {
+		ret = auth_db_authorize(conn,
+		                        db,
+		                        &workdata.auth_header,
+		                        workdata.domain);
+	} else {
+		ret = read_auth_file(&file, &workdata, INITIAL_DEPTH);
+	}
+
+authorize_done:
+	if (db != NULL) {
+		auth_db_release(db);
+	}
+	if (is_file_opened(&file.access)) {
+		(void)mg_fclose(&file.access); /* ignore error on read only file */
+	}
+	return ret;
 }
 
 
@@ -9335,20 +10479,16 @@ mg_check_digest_access_authentication(struct mg_connection *conn,
                                       const char *realm,
                                       const char *filename)
 {
-	struct mg_file file = STRUCT_FILE_INITIALIZER;
 	int auth;
 
 	if (!conn || !filename) {
 		return -1;
 	}
-	if (!mg_fopen(conn, filename, MG_FOPEN_MODE_READ, &file)) {
+
+	auth = authorize(conn, filename, realm);
+	if (auth < 0) {
 		return -2;
 	}
-
-	auth = authorize(conn, &file, realm);
-
-	mg_fclose(&file.access);
-
 	return auth;
 }
 #endif /* NO_FILESYSTEMS */
@@ -9362,8 +10502,7 @@ check_authorization(struct mg_connection *conn, const char *path)
 	char fname[UTF8_PATH_MAX];
 	struct vec uri_vec, filename_vec;
 	const char *list;
-	struct mg_file file = STRUCT_FILE_INITIALIZER;
-	int authorized = 1, truncated;
+	int authorized = -1, truncated;
 
 	if (!conn || !conn->dom_ctx) {
 		return 0;
@@ -9381,7 +10520,7 @@ check_authorization(struct mg_connection *conn, const char *path)
 			            filename_vec.ptr);
 
 			if (truncated
-			    || !mg_fopen(conn, fname, MG_FOPEN_MODE_READ, &file)) {
+			    || ((authorized = authorize(conn, fname, NULL)) < 0)) {
 				mg_cry_internal(conn,
 				                "cannot open %s: %s",
 				                fname,
@@ -9391,16 +10530,21 @@ check_authorization(struct mg_connection *conn, const char *path)
 		}
 	}
 
-	if (!is_file_opened(&file.access)) {
-		open_auth_file(conn, path, &file);
-	}
-
-	if (is_file_opened(&file.access)) {
-		authorized = authorize(conn, &file, NULL);
-		(void)mg_fclose(&file.access); /* ignore error on read only file */
+	if ((authorized < 0)
+	    && get_auth_file_name(conn, path, fname, sizeof(fname))) {
+		authorized = authorize(conn, fname, NULL);
+#if defined(DEBUG)
+		if (authorized < 0) {
+			/* Don't use mg_cry_internal here, but only a trace, since
+			 * this is a typical case. It will occur for every directory
+			 * without a password file. */
+			DEBUG_TRACE("fopen(%s): %s", fname, strerror(ERRNO));
+		}
+#endif
 	}
 
-	return authorized;
+	/* No passwords file: access is granted */
+	return (authorized != 0);
 #else
 	(void)conn;
 	(void)path;
@@ -9477,13 +10621,10 @@ is_authorized_for_put(struct mg_connection *conn)
 	int ret = 0;
 
 	if (conn) {
-		struct mg_file file = STRUCT_FILE_INITIALIZER;
 		const char *passfile = conn->dom_ctx->config[PUT_DELETE_PASSWORDS_FILE];
 
-		if (passfile != NULL
-		    && mg_fopen(conn, passfile, MG_FOPEN_MODE_READ, &file)) {
-			ret = authorize(conn, &file, NULL);
-			(void)mg_fclose(&file.access); /* ignore error on read only file */
+		if (passfile != NULL) {
+			ret = (authorize(conn, passfile, NULL) == 1);
 		}
 	}
 
@@ -9650,6 +10791,7 @@ mg_modify_passwords_file_ha1(const char *fname,
 	if (fclose(fp) != 0) {
 		result = 0;
 	}
+	mg_atomic_inc(&auth_file_generation);
 
 	mg_free(temp_file);
 	return result;
@@ -10501,6 +11643,21 @@ handle_directory_request(struct mg_connection *conn, const char *dir)
 #endif /* NO_FILESYSTEMS */
 
 
+#if defined(__linux__)
+/* File descriptor of a file opened by mg_fopen or mg_fopen_cached */
+static int
+file_access_fd(const struct mg_file_access *fa)
+{
+#if !defined(NO_FILESYSTEMS)
+	if (fa->fp == NULL) {
+		return fa->cached->fd;
+	}
+#endif
+	return fileno(fa->fp);
+}
+#endif
+
+
 /* Send len bytes from the opened file to the client. */
 static void
 send_file_data(struct mg_connection *conn,
@@ -10512,6 +11669,10 @@ send_file_data(struct mg_connection *conn,
 	char buf[MG_BUF_LEN];
 	int to_read, num_read, num_written;
 	int64_t size;
+#if defined(USE_IO_URING)
+	struct mg_uring *ring = NULL;
+	int64_t uring_sent;
+#endif
 
 	if (!filep || !conn) {
 		return;
@@ -10522,18 +11683,41 @@ send_file_data(struct mg_connection *conn,
 	                                      : (int64_t)(filep->stat.size);
 	offset = (offset < 0) ? 0 : ((offset > size) ? size : offset);
 
-	if (len > 0 && filep->access.fp != NULL) {
+	if (len > 0 && is_file_opened(&filep->access)) {
 		/* file stored on disk */
+#if defined(USE_IO_URING)
+		if ((conn->ssl == 0) && (conn->throttle == 0) && !no_buffering
+#if defined(USE_HTTP2)
+		    && (conn->protocol_type != PROTOCOL_TYPE_HTTP2)
+#endif
+		) {
+			ring = mg_uring_of_thread();
+		}
+#endif
 #if defined(__linux__)
 		/* sendfile is only available for Linux */
 		if ((conn->ssl == 0) && (conn->throttle == 0)
+#if defined(USE_HTTP2)
+		    /* Streams of cleartext HTTP/2 send DATA frames */
+		    && (conn->protocol_type != PROTOCOL_TYPE_HTTP2)
+#endif
+#if defined(USE_IO_URING)
+		    /* Small files are sent by one io_uring submission, together
+		     * with the response headers */
+		    && ((ring == NULL) || (len > MG_URING_FILE_BATCH))
+#endif
 		    && (!mg_strcasecmp(conn->dom_ctx->config[ALLOW_SENDFILE_CALL],
 		                       "yes"))) {
 			off_t sf_offs = (off_t)offset;
 			ssize_t sf_sent;
-			int sf_file = fileno(filep->access.fp);
+			int sf_file = file_access_fd(&filep->access);
 			int loop_cnt = 0;
 
+			/* Buffered headers are coalesced with the file data */
+			if (out_buf_flush(conn, 1) != 0) {
+				return;
+			}
+
 			do {
 				/* 2147479552 (0x7FFFF000) is a limit found by experiment on
 				 * 64 bit Linux (2^31 minus one memory page of 4k?). */
@@ -10567,6 +11751,102 @@ send_file_data(struct mg_connection *conn,
 			 * e.g., for sending data from the output of a CGI process. */
 			offset = (int64_t)sf_offs;
 		}
+#endif
+#if defined(USE_KTLS)
+		/* With kernel TLS, the kernel encrypts the file data of
+		 * SSL_sendfile, so it is not copied to user space */
+		if ((conn->ssl != NULL) && (conn->throttle == 0)
+#if defined(USE_HTTP2)
+		    && (conn->protocol_type != PROTOCOL_TYPE_HTTP2)
+#endif
+#if !defined(NO_SSL_DL)
+		    && !tls_feature_missing[TLS_KTLS]
+#endif
+		    && !mg_strcasecmp(conn->phys_ctx->dd.config[SSL_KTLS], "yes")
+		    && (!mg_strcasecmp(conn->dom_ctx->config[ALLOW_SENDFILE_CALL],
+		                       "yes"))
+		    && BIO_get_ktls_send(SSL_get_wbio(conn->ssl))) {
+			int sf_file = file_access_fd(&filep->access);
+			ssize_t sf_sent;
+			int sf_err;
+			int timeout_ms = 0;
+			struct mg_pollfd pfd[1];
+
+			if (out_buf_flush(conn, 0) != 0) {
+				return;
+			}
+			if (conn->dom_ctx->config[REQUEST_TIMEOUT]) {
+				timeout_ms = atoi(conn->dom_ctx->config[REQUEST_TIMEOUT]);
+			}
+			if (timeout_ms <= 0) {
+				timeout_ms = atoi(config_options[REQUEST_TIMEOUT].default_value);
+			}
+
+			while (len > 0) {
+				size_t sf_tosend =
+				    (size_t)((len < 0x7FFFF000) ? len : 0x7FFFF000);
+				ERR_clear_error();
+				sf_sent = SSL_sendfile(
+				    conn->ssl, sf_file, (off_t)offset, sf_tosend, 0);
+				if (sf_sent <= 0) {
+					sf_err = SSL_get_error(conn->ssl, (int)sf_sent);
+					ERR_clear_error();
+					if (sf_err != SSL_ERROR_WANT_WRITE) {
+						/* The file can not be sent by sendfile: send the
+						 * rest with SSL_write */
+						break;
+					}
+					/* The socket buffer is full: wait until it is
+					 * writable, and keep sending without a copy */
+					pfd[0].fd = conn->client.sock;
+					pfd[0].events = POLLOUT;
+					if (mg_poll(pfd,
+					            1,
+					            timeout_ms,
+					            &(conn->phys_ctx->stop_flag),
+					            1)
+					    <= 0) {
+						/* Timeout, error or server stop */
+						conn->must_close = 1;
+						return;
+					}
+					continue;
+				}
+				len -= sf_sent;
+				offset += sf_sent;
+				conn->num_bytes_sent += sf_sent;
+			}
+			if (len == 0) {
+				return; /* OK */
+			}
+		}
+#endif
+#if defined(USE_IO_URING)
+		/* A small file, sendfile is not allowed, or the socket buffer is
+		 * full (the socket is in non-blocking mode): use batches of linked
+		 * read/send operations for the rest of the file. The output buffer
+		 * is sent by the first batch. */
+		if (ring != NULL) {
+			uring_sent =
+			    mg_uring_send_file(ring,
+			                       conn,
+			                       file_access_fd(&filep->access),
+			                       offset,
+			                       len);
+			if (uring_sent != -2) {
+				if (uring_sent > 0) {
+					conn->num_bytes_sent += uring_sent;
+				}
+				return;
+			}
+		}
+#endif
+#if !defined(_WIN32) && !defined(NO_FILESYSTEMS)
+		if (filep->access.fp == NULL) {
+			/* File descriptor of the file cache */
+			file_cache_send_data(conn, filep->access.cached, offset, len);
+			return;
+		}
 #endif
 		if ((offset > 0) && (fseeko(filep->access.fp, offset, SEEK_SET) != 0)) {
 			mg_cry_internal(conn,
@@ -10683,13 +11963,21 @@ handle_static_file_request(struct mg_connection *conn,
 	int n, truncated;
 	char gz_path[UTF8_PATH_MAX];
 	const char *encoding = 0;
-	int is_head_request;
+	int is_head_request, is_open;
+
+	/* The client accepts uncompressed content (not "identity;q=0") */
+	int identity_ok;
 
 #if defined(USE_ZLIB)
 	/* Compression is allowed, unless there is a reason not to use
 	 * compression. If the file is already compressed, too small or a
 	 * "range" request was made, on the fly compression is not possible. */
 	int allow_on_the_fly_compression = 1;
+
+	/* Compressed variant from the compression cache */
+	struct mg_file_stat gz_stat;
+	struct mg_memory_cache_entry *gz_entry = NULL;
+	int gz_cached = 0;
 #endif
 
 	if ((conn == NULL) || (conn->dom_ctx == NULL) || (filep == NULL)) {
@@ -10699,7 +11987,7 @@ handle_static_file_request(struct mg_connection *conn,
 	is_head_request = !strcmp(conn->request_info.request_method, "HEAD");
 
 	if (mime_type == NULL) {
-		get_mime_type(conn, path, &mime_vec);
+		get_cached_mime_type(conn, path, &mime_vec);
 	} else {
 		mime_vec.ptr = mime_type;
 		mime_vec.len = strlen(mime_type);
@@ -10725,11 +12013,25 @@ handle_static_file_request(struct mg_connection *conn,
 #endif
 
 	/* Check if there is a range header */
-	range_hdr = mg_get_header(conn, "Range");
+	range_hdr = mg_get_header_id(conn, MG_HDR_RANGE);
+
+	/* If the client does not accept uncompressed content, a compressed
+	 * variant is used for small files as well, and ranges (specified in
+	 * the uncompressed space) are ignored. */
+	identity_ok = (conn->accept_encoding[CONTENT_CODING_IDENTITY] > 0);
+	if (!identity_ok) {
+		range_hdr = NULL;
+	}
 
-	/* For gzipped files, add *.gz */
-	if (filep->stat.is_gzipped) {
-		mg_snprintf(conn, &truncated, gz_path, sizeof(gz_path), "%s.gz", path);
+	/* For precompressed files, add *.gz, *.br or *.zst */
+	if (filep->stat.encoding) {
+		mg_snprintf(conn,
+		            &truncated,
+		            gz_path,
+		            sizeof(gz_path),
+		            "%s%s",
+		            path,
+		            content_codings[filep->stat.encoding].ext);
 
 		if (truncated) {
 			mg_send_http_error(conn,
@@ -10740,25 +12042,23 @@ handle_static_file_request(struct mg_connection *conn,
 		}
 
 		path = gz_path;
-		encoding = "gzip";
+		encoding = content_codings[filep->stat.encoding].name;
 
 #if defined(USE_ZLIB)
 		/* File is already compressed. No "on the fly" compression. */
 		allow_on_the_fly_compression = 0;
 #endif
-	} else if ((conn->accept_gzip) && (range_hdr == NULL)
-	           && (filep->stat.size >= MG_FILE_COMPRESSION_SIZE_LIMIT)) {
+	} else if (((range_hdr == NULL)
+	            && (filep->stat.size >= MG_FILE_COMPRESSION_SIZE_LIMIT))
+	           || !identity_ok) {
 		struct mg_file_stat file_stat;
 
-		mg_snprintf(conn, &truncated, gz_path, sizeof(gz_path), "%s.gz", path);
-
-		if (!truncated && mg_stat(conn, gz_path, &file_stat)
-		    && !file_stat.is_directory) {
-			file_stat.is_gzipped = 1;
+		if (find_precompressed_file(
+		        conn, path, gz_path, sizeof(gz_path), &file_stat)) {
 			filep->stat = file_stat;
 			cl = (int64_t)filep->stat.size;
 			path = gz_path;
-			encoding = "gzip";
+			encoding = content_codings[file_stat.encoding].name;
 
 #if defined(USE_ZLIB)
 			/* File is already compressed. No "on the fly" compression. */
@@ -10767,7 +12067,80 @@ handle_static_file_request(struct mg_connection *conn,
 		}
 	}
 
-	if (!mg_fopen(conn, path, MG_FOPEN_MODE_READ, filep)) {
+	/* Do not compress small files. Small files do not benefit from file
+	 * compression, but there is still some overhead. */
+#if defined(USE_ZLIB)
+	if ((filep->stat.size < MG_FILE_COMPRESSION_SIZE_LIMIT) && identity_ok) {
+		/* File is below the size limit. */
+		allow_on_the_fly_compression = 0;
+	}
+
+	/* Use the compression cache instead of compressing every time. The
+	 * cached variant has a known size, so ranges are supported as well. */
+	if (allow_on_the_fly_compression) {
+		gz_cached = gzip_cache_get(conn,
+		                           path,
+		                           &filep->stat,
+		                           gz_path,
+		                           sizeof(gz_path),
+		                           &gz_stat,
+		                           &gz_entry);
+	}
+	if (gz_cached) {
+		/* Keep the modification time of the original file */
+		if (gz_cached == 2) {
+			path = gz_path;
+			gz_stat.last_modified = filep->stat.last_modified;
+			filep->stat = gz_stat;
+		} else {
+			filep->stat.size = (uint64_t)gz_entry->data_len;
+		}
+		cl = (int64_t)filep->stat.size;
+		encoding = "gzip";
+		allow_on_the_fly_compression = 0;
+	}
+#endif
+
+	/* No acceptable content coding available (RFC 9110, 12.5.3) */
+	if ((encoding == NULL) && !identity_ok
+#if defined(USE_ZLIB)
+	    && !allow_on_the_fly_compression
+#endif
+	) {
+		mg_send_http_error(conn,
+		                   406,
+		                   "%s",
+		                   "Error: No acceptable content coding available");
+		return;
+	}
+
+	/* Complete responses for small files may be in the memory cache */
+	if ((conn->phys_ctx->memory_cache != NULL) && (encoding == NULL)
+	    && (range_hdr == NULL) && (mime_type == NULL)
+	    && (additional_headers == NULL)
+#if defined(USE_ZLIB)
+	    && !allow_on_the_fly_compression
+#endif
+	    && memory_cache_send(
+	        conn, path, &filep->stat, &mime_vec, is_head_request)) {
+		return;
+	}
+
+#if defined(USE_ZLIB)
+
+	/* On the fly compression reads the file using fp, so it can not use
+	 * the file descriptor of the file cache */
+	if (allow_on_the_fly_compression) {
+		is_open = mg_fopen(conn, path, MG_FOPEN_MODE_READ, filep);
+	} else if (gz_entry != NULL) {
+		/* Send the compressed data from memory */
+		is_open = 1;
+	} else
+#endif
+	{
+		is_open = mg_fopen_cached(conn, path, filep);
+	}
+	if (!is_open) {
 		mg_send_http_error(conn,
 		                   500,
 		                   "Error: Cannot open file\nfopen(%s): %s",
@@ -10777,6 +12150,13 @@ handle_static_file_request(struct mg_connection *conn,
 	}
 
 	fclose_on_exec(&filep->access, conn);
+#if defined(USE_ZLIB)
+	if (gz_cached == 2) {
+		/* The status of a cached file is reloaded by mg_fopen_cached. Use
+		 * the modification time of the original file again. */
+		filep->stat.last_modified = gz_stat.last_modified;
+	}
+#endif
 
 	/* If "Range" request was made: parse header, send only selected part
 	 * of the file. */
@@ -10786,7 +12166,7 @@ handle_static_file_request(struct mg_connection *conn,
 	    && (r2 >= 0)) {
 		/* actually, range requests don't play well with a pre-gzipped
 		 * file (since the range is specified in the uncompressed space) */
-		if (filep->stat.is_gzipped) {
+		if (filep->stat.encoding) {
 			mg_send_http_error(
 			    conn,
 			    416, /* 416 = Range Not Satisfiable */
@@ -10814,18 +12194,15 @@ handle_static_file_request(struct mg_connection *conn,
 #endif
 	}
 
-	/* Do not compress small files. Small files do not benefit from file
-	 * compression, but there is still some overhead. */
-#if defined(USE_ZLIB)
-	if (filep->stat.size < MG_FILE_COMPRESSION_SIZE_LIMIT) {
-		/* File is below the size limit. */
-		allow_on_the_fly_compression = 0;
-	}
-#endif
-
 	/* Prepare Etag, and Last-Modified headers. */
 	gmt_time_string(lm, sizeof(lm), &filep->stat.last_modified);
-	construct_etag(etag, sizeof(etag), &filep->stat);
+	if ((filep->access.cached != NULL)
+	    && (filep->access.cached->stat.last_modified
+	        == filep->stat.last_modified)) {
+		mg_strlcpy(etag, filep->access.cached->etag, sizeof(etag));
+	} else {
+		construct_etag(etag, sizeof(etag), &filep->stat);
+	}
 
 	/* Create 2xx (200, 206) response */
 	mg_response_header_start(conn, conn->status_code);
@@ -10870,6 +12247,9 @@ handle_static_file_request(struct mg_connection *conn,
 	if (encoding) {
 		mg_response_header_add(conn, "Content-Encoding", encoding, -1);
 	}
+	/* Other clients may get a different content coding for this file, so
+	 * the uncompressed response depends on Accept-Encoding as well. */
+	mg_response_header_add(conn, "Vary", "Accept-Encoding", -1);
 	if (range[0] != 0) {
 		mg_response_header_add(conn, "Content-Range", range, -1);
 	}
@@ -10888,6 +12268,9 @@ handle_static_file_request(struct mg_connection *conn,
 		if (allow_on_the_fly_compression) {
 			/* Compress and send */
 			send_compressed_data(conn, filep);
+		} else if (gz_entry != NULL) {
+			/* Compressed data from the compression cache */
+			mg_write(conn, gz_entry->data + r1, (size_t)cl);
 		} else
 #endif
 		{
@@ -10895,6 +12278,12 @@ handle_static_file_request(struct mg_connection *conn,
 			send_file_data(conn, filep, r1, cl, 0); /* send static file */
 		}
 	}
+#if defined(USE_ZLIB)
+	if (gz_entry != NULL) {
+		memory_cache_release(gz_entry);
+		return;
+	}
+#endif
 	(void)mg_fclose(&filep->access); /* ignore error on read only file */
 }
 
@@ -10921,8 +12310,8 @@ is_not_modified(const struct mg_connection *conn,
                 const struct mg_file_stat *filestat)
 {
 	char etag[64];
-	const char *ims = mg_get_header(conn, "If-Modified-Since");
-	const char *inm = mg_get_header(conn, "If-None-Match");
+	const char *ims = mg_get_header_id(conn, MG_HDR_IF_MODIFIED_SINCE);
+	const char *inm = mg_get_header_id(conn, MG_HDR_IF_NONE_MATCH);
 	construct_etag(etag, sizeof(etag), filestat);
 
 	if (inm) {
@@ -10954,6 +12343,7 @@ handle_not_modified_static_file_request(struct mg_connection *conn,
 	send_additional_header(conn);
 	mg_response_header_add(conn, "Last-Modified", lm, -1);
 	mg_response_header_add(conn, "Etag", etag, -1);
+	mg_response_header_add(conn, "Vary", "Accept-Encoding", -1);
 
 	/* Send all headers */
 	mg_response_header_send(conn);
@@ -10991,7 +12381,7 @@ mg_send_mime_file2(struct mg_connection *conn,
 		return;
 	}
 
-	if (mg_stat(conn, path, &file.stat)) {
+	if (mg_stat_cached(conn, path, &file.stat)) {
 #if !defined(NO_CACHING)
 		if (is_not_modified(conn, &file.stat)) {
 			/* Send 304 "Not Modified" - this must not send any body data */
@@ -11130,16 +12520,15 @@ mg_store_body(struct mg_connection *conn, const char *path)
 /* Parse a buffer:
  * Forward the string pointer till the end of a word, then
  * terminate it and forward till the begin of the next word.
+ * The buffer must be terminated by a '\0' at end.
  */
 static int
-skip_to_end_of_word_and_terminate(char **ppw, int eol)
+skip_to_end_of_word_and_terminate(char **ppw, const char *end, int eol)
 {
-	/* Forward until a space is found - use isgraph here */
+	/* Forward until a space is found - like isgraph */
 	/* Extended ASCII characters are also treated as word characters. */
 	/* See http://www.cplusplus.com/reference/cctype/ */
-	while ((unsigned char)**ppw > 127 || isgraph((unsigned char)**ppw)) {
-		(*ppw)++;
-	}
+	*ppw = (char *)scan_chars(*ppw, end, SCAN_WORD_END);
 
 	/* Check end of word */
 	if (eol) {
@@ -11175,10 +12564,13 @@ skip_to_end_of_word_and_terminate(char **ppw, int eol)
 
 /* Parse HTTP headers from the given buffer, advance buf pointer
  * to the point where parsing stopped.
+ * The buffer must be terminated by a '\0' at end.
  * All parameters must be valid pointers (not NULL).
  * Return <0 on error. */
 static int
-parse_http_headers(char **buf, struct mg_header hdr[MG_MAX_HEADERS])
+parse_http_headers_until(char **buf,
+                         const char *end,
+                         struct mg_header hdr[MG_MAX_HEADERS])
 {
 	int i;
 	int num_headers = 0;
@@ -11187,9 +12579,7 @@ parse_http_headers(char **buf, struct mg_header hdr[MG_MAX_HEADERS])
 		char *dp = *buf;
 
 		/* Skip all ASCII characters (>SPACE, <127), to find a ':' */
-		while ((*dp != ':') && (*dp >= 33) && (*dp <= 126)) {
-			dp++;
-		}
+		dp = (char *)scan_chars(dp, end, SCAN_NAME_END);
 		if (dp == *buf) {
 			/* End of headers reached. */
 			break;
@@ -11219,9 +12609,7 @@ parse_http_headers(char **buf, struct mg_header hdr[MG_MAX_HEADERS])
 		hdr[i].value = dp;
 
 		/* Find end of line */
-		while ((*dp != 0) && (*dp != '\r') && (*dp != '\n')) {
-			dp++;
-		};
+		dp = (char *)scan_chars(dp, end, SCAN_EOL);
 
 		/* eliminate \r */
 		if (*dp == '\r') {
@@ -11257,6 +12645,17 @@ parse_http_headers(char **buf, struct mg_header hdr[MG_MAX_HEADERS])
 }
 
 
+/* Parse HTTP headers from the given '\0' terminated buffer, advance buf
+ * pointer to the point where parsing stopped.
+ * All parameters must be valid pointers (not NULL).
+ * Return <0 on error. */
+static int
+parse_http_headers(char **buf, struct mg_header hdr[MG_MAX_HEADERS])
+{
+	return parse_http_headers_until(buf, *buf + strlen(*buf), hdr);
+}
+
+
 struct mg_http_method_info {
 	const char *name;
 	int request_has_body;
@@ -11374,6 +12773,7 @@ parse_http_request(char *buf, int len, struct mg_request_info *ri)
 {
 	int request_length;
 	int init_skip = 0;
+	const char *end;
 
 	/* Reset attributes. DO NOT TOUCH is_ssl, remote_addr,
 	 * remote_port */
@@ -11406,6 +12806,7 @@ parse_http_request(char *buf, int len, struct mg_request_info *ri)
 		return request_length;
 	}
 	buf[request_length - 1] = '\0';
+	end = buf + request_length - 1;
 
 	if ((*buf == 0) || (*buf == '\r') || (*buf == '\n')) {
 		return -1;
@@ -11414,21 +12815,21 @@ parse_http_request(char *buf, int len, struct mg_request_info *ri)
 	/* The first word has to be the HTTP method */
 	ri->request_method = buf;
 
-	if (skip_to_end_of_word_and_terminate(&buf, 0) <= 0) {
+	if (skip_to_end_of_word_and_terminate(&buf, end, 0) <= 0) {
 		return -1;
 	}
 
 	/* The second word is the URI */
 	ri->request_uri = buf;
 
-	if (skip_to_end_of_word_and_terminate(&buf, 0) <= 0) {
+	if (skip_to_end_of_word_and_terminate(&buf, end, 0) <= 0) {
 		return -1;
 	}
 
 	/* Next would be the HTTP version */
 	ri->http_version = buf;
 
-	if (skip_to_end_of_word_and_terminate(&buf, 1) <= 0) {
+	if (skip_to_end_of_word_and_terminate(&buf, end, 1) <= 0) {
 		return -1;
 	}
 
@@ -11445,7 +12846,7 @@ parse_http_request(char *buf, int len, struct mg_request_info *ri)
 	}
 
 	/* Parse all HTTP headers */
-	ri->num_headers = parse_http_headers(&buf, ri->http_headers);
+	ri->num_headers = parse_http_headers_until(&buf, end, ri->http_headers);
 	if (ri->num_headers < 0) {
 		/* Error while parsing headers */
 		return -1;
@@ -11461,6 +12862,7 @@ parse_http_response(char *buf, int len, struct mg_response_info *ri)
 	int response_length;
 	int init_skip = 0;
 	char *tmp, *tmp2;
+	const char *end;
 	long l;
 
 	/* Initialize elements. */
@@ -11492,6 +12894,7 @@ parse_http_response(char *buf, int len, struct mg_response_info *ri)
 		return response_length;
 	}
 	buf[response_length - 1] = '\0';
+	end = buf + response_length - 1;
 
 	if ((*buf == 0) || (*buf == '\r') || (*buf == '\n')) {
 		return -1;
@@ -11510,14 +12913,14 @@ parse_http_response(char *buf, int len, struct mg_response_info *ri)
 	}
 	ri->http_version = buf;
 
-	if (skip_to_end_of_word_and_terminate(&buf, 0) <= 0) {
+	if (skip_to_end_of_word_and_terminate(&buf, end, 0) <= 0) {
 		return -1;
 	}
 
 	/* The second word is the status as a number */
 	tmp = buf;
 
-	if (skip_to_end_of_word_and_terminate(&buf, 0) <= 0) {
+	if (skip_to_end_of_word_and_terminate(&buf, end, 0) <= 0) {
 		return -1;
 	}
 
@@ -11546,7 +12949,7 @@ parse_http_response(char *buf, int len, struct mg_response_info *ri)
 	} while (isspace((unsigned char)*buf));
 
 	/* Parse all HTTP headers */
-	ri->num_headers = parse_http_headers(&buf, ri->http_headers);
+	ri->num_headers = parse_http_headers_until(&buf, end, ri->http_headers);
 	if (ri->num_headers < 0) {
 		/* Error while parsing headers */
 		return -1;
@@ -11649,7 +13052,7 @@ forward_body_data(struct mg_connection *conn, FILE *fp, SOCKET sock, SSL *ssl)
 		return 0;
 	}
 
-	expect = mg_get_header(conn, "Expect");
+	expect = mg_get_header_id(conn, MG_HDR_EXPECT);
 	DEBUG_ASSERT(fp != NULL);
 	if (!fp) {
 		mg_send_http_error(conn, 500, "%s", "Error: NULL File");
@@ -11759,9 +13162,10 @@ addenv(struct cgi_environment *env, const char *fmt, ...)
 	do {
 		/* Space for "\0\0" is always needed. */
 		if (space <= 2) {
-			/* Allocate new buffer */
+			/* Allocate new buffer (the old one is freed with the
+			 * request) */
 			n = env->buflen + CGI_ENVIRONMENT_SIZE;
-			added = (char *)mg_realloc_ctx(env->buf, n, env->conn->phys_ctx);
+			added = (char *)mg_request_alloc(env->conn, n);
 			if (!added) {
 				/* Out of memory */
 				mg_cry_internal(
@@ -11771,6 +13175,7 @@ addenv(struct cgi_environment *env, const char *fmt, ...)
 				return;
 			}
 			/* Retarget pointers */
+			memcpy(added, env->buf, env->bufused);
 			env->buf = added;
 			env->buflen = n;
 			for (i = 0, n = 0; i < env->varused; i++) {
@@ -11824,18 +13229,17 @@ prepare_cgi_environment(struct mg_connection *conn,
 	env->conn = conn;
 	env->buflen = CGI_ENVIRONMENT_SIZE;
 	env->bufused = 0;
-	env->buf = (char *)mg_malloc_ctx(env->buflen, conn->phys_ctx);
+	/* Both blocks are allocated in the per-request arena */
+	env->buf = (char *)mg_request_alloc(conn, env->buflen);
 	if (env->buf == NULL) {
 		mg_cry_internal(conn, "Not enough memory for environmental buffer");
 		return -1;
 	}
 	env->varlen = MAX_CGI_ENVIR_VARS;
 	env->varused = 0;
-	env->var =
-	    (char **)mg_malloc_ctx(env->varlen * sizeof(char *), conn->phys_ctx);
+	env->var = (char **)mg_request_alloc(conn, env->varlen * sizeof(char *));
 	if (env->var == NULL) {
 		mg_cry_internal(conn, "Not enough memory for environmental variables");
-		mg_free(env->buf);
 		return -1;
 	}
 
@@ -11902,13 +13306,13 @@ prepare_cgi_environment(struct mg_connection *conn,
 
 	addenv(env, "HTTPS=%s", (conn->ssl == NULL) ? "off" : "on");
 
-	if ((s = mg_get_header(conn, "Content-Type")) != NULL) {
+	if ((s = mg_get_header_id(conn, MG_HDR_CONTENT_TYPE)) != NULL) {
 		addenv(env, "CONTENT_TYPE=%s", s);
 	}
 	if (conn->request_info.query_string != NULL) {
 		addenv(env, "QUERY_STRING=%s", conn->request_info.query_string);
 	}
-	if ((s = mg_get_header(conn, "Content-Length")) != NULL) {
+	if ((s = mg_get_header_id(conn, MG_HDR_CONTENT_LENGTH)) != NULL) {
 		addenv(env, "CONTENT_LENGTH=%s", s);
 	}
 	if ((s = getenv("PATH")) != NULL) {
@@ -12002,6 +13406,9 @@ prepare_cgi_environment(struct mg_connection *conn,
 struct process_control_data {
 	pid_t pid;
 	ptrdiff_t references;
+#if defined(USE_TIMERS)
+	uint64_t timer_id; /* CGI timeout timer */
+#endif
 };
 
 static int
@@ -12061,6 +13468,7 @@ handle_cgi_request(struct mg_connection *conn,
 
 #if defined(USE_TIMERS)
 	double cgi_timeout;
+	int cgi_timer = 0;
 	if (conn->dom_ctx->config[CGI_TIMEOUT + cgi_config_idx]) {
 		/* Get timeout in seconds */
 		cgi_timeout =
@@ -12152,13 +13560,19 @@ handle_cgi_request(struct mg_connection *conn,
 		proc->references = 2;
 
 		// Start a timer for CGI
-		timer_add(conn->phys_ctx,
-		          cgi_timeout /* in seconds */,
-		          0.0,
-		          1,
-		          abort_cgi_process,
-		          (void *)proc,
-		          NULL);
+		if (timer_add2(conn->phys_ctx,
+		               cgi_timeout /* in seconds */,
+		               0.0,
+		               1,
+		               abort_cgi_process,
+		               (void *)proc,
+		               NULL,
+		               &proc->timer_id)
+		    == 0) {
+			cgi_timer = 1;
+		} else {
+			proc->references = 1;
+		}
 	}
 #endif
 
@@ -12320,16 +13734,29 @@ handle_cgi_request(struct mg_connection *conn,
 	/* Send chunk of data that may have been read after the headers */
 	mg_write(conn, buf + headers_len, (size_t)(data_len - headers_len));
 
+	/* Unbuffered CGI output must not wait in the output buffer */
+	if (no_buffering) {
+		conn->out_buffering = 0;
+		if (mg_flush(conn) != 0) {
+			goto done;
+		}
+	}
+
 	/* Read the rest of CGI output and send to the client */
 	DEBUG_TRACE("CGI: %s", "forward all data");
 	send_file_data(conn, &fout, 0, INT64_MAX, no_buffering); /* send CGI data */
 	DEBUG_TRACE("CGI: %s", "all data sent");
 
 done:
-	mg_free(blk.var);
-	mg_free(blk.buf);
-
+	/* blk.var and blk.buf are freed with the request */
 	if (pid != (pid_t)-1) {
+#if defined(USE_TIMERS)
+		/* The timeout timer does not need to run any more: release its
+		 * reference */
+		if (cgi_timer && (timer_cancel(conn->phys_ctx, proc->timer_id) == 0)) {
+			mg_atomic_dec(&proc->references);
+		}
+#endif
 		abort_cgi_process((void *)proc);
 	}
 
@@ -12407,6 +13834,8 @@ dav_mkcol(struct mg_connection *conn, const char *path)
 	rc = mg_mkdir(conn, path, 0755);
 	DEBUG_TRACE("mkdir %s: %i", path, rc);
 	if (rc == 0) {
+		mg_file_cache_invalidate(conn->phys_ctx, path);
+
 		/* Create 201 "Created" response */
 		mg_response_header_start(conn, 201);
 		send_static_cache_header(conn);
@@ -12463,8 +13892,8 @@ dav_move_file(struct mg_connection *conn, const char *path, int do_copy)
 	}
 
 	root = conn->dom_ctx->document_roots[0];
-	overwrite_hdr = mg_get_header(conn, "Overwrite");
-	destination_hdr = mg_get_header(conn, "Destination");
+	overwrite_hdr = mg_get_header_id(conn, MG_HDR_OVERWRITE);
+	destination_hdr = mg_get_header_id(conn, MG_HDR_DESTINATION);
 	if ((overwrite_hdr != NULL) && (toupper(overwrite_hdr[0]) == 'T')) {
 		do_overwrite = 1;
 	}
@@ -12597,6 +14026,9 @@ dav_move_file(struct mg_connection *conn, const char *path, int do_copy)
 #endif
 
 	if (rc == 0) {
+		mg_file_cache_invalidate(conn->phys_ctx, path);
+		mg_file_cache_invalidate(conn->phys_ctx, dest_path);
+
 		/* Create 204 "No Content" response */
 		mg_response_header_start(conn, 204);
 		mg_response_header_add(conn, "Content-Length", "0", -1);
@@ -12653,6 +14085,7 @@ put_file(struct mg_connection *conn, const char *path)
 		/* File should be created */
 		conn->status_code = 201;
 		rc = put_dir(conn, path);
+		mg_file_cache_invalidate(conn->phys_ctx, path);
 	}
 
 	if (rc == 0) {
@@ -12706,7 +14139,7 @@ put_file(struct mg_connection *conn, const char *path)
 	}
 
 	fclose_on_exec(&file.access, conn);
-	range = mg_get_header(conn, "Content-Range");
+	range = mg_get_header_id(conn, MG_HDR_CONTENT_RANGE);
 	r1 = r2 = 0;
 	if ((range != NULL) && parse_range_header(range, &r1, &r2) > 0) {
 		conn->status_code = 206; /* Partial content */
@@ -12732,6 +14165,7 @@ put_file(struct mg_connection *conn, const char *path)
 		 * one is "no space on disk", http 507. */
 		conn->status_code = 507;
 	}
+	mg_file_cache_invalidate(conn->phys_ctx, path);
 
 	/* Create response (status_code has been set before) */
 	mg_response_header_start(conn, conn->status_code);
@@ -12762,6 +14196,8 @@ delete_file(struct mg_connection *conn, const char *path)
 
 	if (de.file.is_directory) {
 		if (remove_directory(conn, path)) {
+			mg_file_cache_invalidate(conn->phys_ctx, path);
+
 			/* Delete is successful: Return 204 without content. */
 			mg_send_http_error(conn, 204, "%s", "");
 		} else {
@@ -12785,6 +14221,8 @@ delete_file(struct mg_connection *conn, const char *path)
 
 	/* Try to delete it. */
 	if (mg_remove(conn, path) == 0) {
+		mg_file_cache_invalidate(conn->phys_ctx, path);
+
 		/* Delete was successful: Return 204 without content. */
 		mg_response_header_start(conn, 204);
 		send_no_cache_header(conn);
@@ -13215,7 +14653,7 @@ handle_propfind(struct mg_connection *conn,
                 const char *path,
                 struct mg_file_stat *filep)
 {
-	const char *depth = mg_get_header(conn, "Depth");
+	const char *depth = mg_get_header_id(conn, MG_HDR_DEPTH);
 
 	if (!conn || !path || !filep || !conn->dom_ctx) {
 		return;
@@ -14130,10 +15568,16 @@ mg_websocket_client_write(struct mg_connection *conn,
                           size_t dataLen)
 {
 	int retval = -1;
-	char *masked_data =
-	    (char *)mg_malloc_ctx(((dataLen + 7) / 4) * 4, conn->phys_ctx);
+	uint32_t small_buf[MG_BUF_LEN / 32]; /* 32 bit aligned, for mask_data */
+	size_t masked_len = ((dataLen + 7) / 4) * 4;
+	char *masked_data = (char *)small_buf;
 	uint32_t masking_key = 0;
 
+	/* Client websockets have no request scope, so the per-request arena
+	 * can not be used: small frames are masked on the stack */
+	if (masked_len > sizeof(small_buf)) {
+		masked_data = (char *)mg_malloc_ctx(masked_len, conn->phys_ctx);
+	}
 	if (masked_data == NULL) {
 		/* Return -1 in an error case */
 		mg_cry_internal(conn,
@@ -14152,7 +15596,9 @@ mg_websocket_client_write(struct mg_connection *conn,
 
 	retval = mg_websocket_write_exec(
 	    conn, opcode, masked_data, dataLen, masking_key);
-	mg_free(masked_data);
+	if (masked_data != (char *)small_buf) {
+		mg_free(masked_data);
+	}
 
 	return retval;
 }
@@ -14169,8 +15615,8 @@ handle_websocket_request(struct mg_connection *conn,
                          mg_websocket_close_handler ws_close_handler,
                          void *cbData)
 {
-	const char *websock_key = mg_get_header(conn, "Sec-WebSocket-Key");
-	const char *version = mg_get_header(conn, "Sec-WebSocket-Version");
+	const char *websock_key = mg_get_header_id(conn, MG_HDR_SEC_WEBSOCKET_KEY);
+	const char *version = mg_get_header_id(conn, MG_HDR_SEC_WEBSOCKET_VERSION);
 	ptrdiff_t lua_websock = 0;
 
 #if !defined(USE_LUA)
@@ -14186,8 +15632,8 @@ handle_websocket_request(struct mg_connection *conn,
 		/* It could be the hixie draft version
 		 * (http://tools.ietf.org/html/draft-hixie-thewebsocketprotocol-76).
 		 */
-		const char *key1 = mg_get_header(conn, "Sec-WebSocket-Key1");
-		const char *key2 = mg_get_header(conn, "Sec-WebSocket-Key2");
+		const char *key1 = mg_get_header_id(conn, MG_HDR_SEC_WEBSOCKET_KEY1);
+		const char *key2 = mg_get_header_id(conn, MG_HDR_SEC_WEBSOCKET_KEY2);
 		char key3[8];
 
 		if ((key1 != NULL) && (key2 != NULL)) {
@@ -14324,6 +15770,12 @@ handle_websocket_request(struct mg_connection *conn,
 		return;
 	}
 
+	/* Websocket frames are sent immediately, also from other threads */
+	conn->out_buffering = 0;
+	if (out_buf_flush(conn, 0) != 0) {
+		return;
+	}
+
 	/* Step 6: Call the ready handler */
 	if (is_callback_resource) {
 		if (ws_ready_handler != NULL) {
@@ -14398,7 +15850,7 @@ should_switch_to_protocol(const struct mg_connection *conn)
 		return PROTOCOL_TYPE_HTTP1;
 	}
 
-	upgrade_to = mg_get_header(conn, "Upgrade");
+	upgrade_to = mg_get_header_id(conn, MG_HDR_UPGRADE);
 	if (upgrade_to == NULL) {
 		/* "Connection: Upgrade" without "Upgrade" Header --> Error */
 		return -1;
@@ -14423,8 +15875,16 @@ should_switch_to_protocol(const struct mg_connection *conn)
 }
 
 
+/* Parse a subnet "a.b.c.d[/bits]" or "[IPv6 address][/bits]" (if no_strict
+ * is set, the square brackets are optional). Store the address family, the
+ * address (in network byte order) and the number of prefix bits.
+ * Return 1 if ok, 0 if malformed. */
 static int
-parse_match_net(const struct vec *vec, const union usa *sa, int no_strict)
+parse_net(const struct vec *vec,
+          int no_strict,
+          int *family,
+          uint8_t addr[16],
+          unsigned *bits)
 {
 	int n;
 	unsigned int a, b, c, d, slash;
@@ -14445,14 +15905,13 @@ parse_match_net(const struct vec *vec, const union usa *sa, int no_strict)
 	if ((n > 0) && ((size_t)n == vec->len)) {
 		if ((a < 256) && (b < 256) && (c < 256) && (d < 256) && (slash < 33)) {
 			/* IPv4 format */
-			if (sa->sa.sa_family == AF_INET) {
-				uint32_t ip = ntohl(sa->sin.sin_addr.s_addr);
-				uint32_t net = ((uint32_t)a << 24) | ((uint32_t)b << 16)
-				               | ((uint32_t)c << 8) | (uint32_t)d;
-				uint32_t mask = slash ? (0xFFFFFFFFu << (32 - slash)) : 0;
-				return (ip & mask) == net;
-			}
-			return 0;
+			*family = AF_INET;
+			addr[0] = (uint8_t)a;
+			addr[1] = (uint8_t)b;
+			addr[2] = (uint8_t)c;
+			addr[3] = (uint8_t)d;
+			*bits = slash;
+			return 1;
 		}
 	}
 #if defined(USE_IPV6)
@@ -14496,28 +15955,12 @@ parse_match_net(const struct vec *vec, const union usa *sa, int no_strict)
 			}
 			if ((*p == '\0') && (c >= 2)) {
 				struct sockaddr_in6 sin6;
-				unsigned int i;
 
-				/* for strict validation, an actual IPv6 argument is needed */
-				if (sa->sa.sa_family != AF_INET6) {
-					return 0;
-				}
 				if (mg_inet_pton(AF_INET6, ad, &sin6, sizeof(sin6), 0)) {
 					/* IPv6 format */
-					for (i = 0; i < 16; i++) {
-						uint8_t ip = sa->sin6.sin6_addr.s6_addr[i];
-						uint8_t net = sin6.sin6_addr.s6_addr[i];
-						uint8_t mask = 0;
-
-						if (8 * i + 8 < slash) {
-							mask = 0xFFu;
-						} else if (8 * i < slash) {
-							mask = (uint8_t)(0xFFu << (8 * i + 8 - slash));
-						}
-						if ((ip & mask) != net) {
-							return 0;
-						}
-					}
+					*family = AF_INET6;
+					memcpy(addr, sin6.sin6_addr.s6_addr, 16);
+					*bits = slash;
 					return 1;
 				}
 			}
@@ -14528,7 +15971,50 @@ parse_match_net(const struct vec *vec, const union usa *sa, int no_strict)
 #endif
 
 	/* malformed */
-	return -1;
+	return 0;
+}
+
+
+/* Return 1 if sa is in the subnet vec, 0 if not, -1 if vec is malformed */
+static int
+parse_match_net(const struct vec *vec, const union usa *sa, int no_strict)
+{
+	uint8_t net[16];
+	unsigned slash, i;
+	int family;
+
+	if (!parse_net(vec, no_strict, &family, net, &slash)) {
+		return -1;
+	}
+	if (sa->sa.sa_family != family) {
+		return 0;
+	}
+	if (family == AF_INET) {
+		uint32_t ip = ntohl(sa->sin.sin_addr.s_addr);
+		uint32_t net4 = ((uint32_t)net[0] << 24) | ((uint32_t)net[1] << 16)
+		                | ((uint32_t)net[2] << 8) | (uint32_t)net[3];
+		uint32_t mask = slash ? (0xFFFFFFFFu << (32 - slash)) : 0;
+		return (ip & mask) == net4;
+	}
+#if defined(USE_IPV6)
+	for (i = 0; i < 16; i++) {
+		uint8_t ip = sa->sin6.sin6_addr.s6_addr[i];
+		uint8_t mask = 0;
+
+		if (8 * i + 8 < slash) {
+			mask = 0xFFu;
+		} else if (8 * i < slash) {
+			mask = (uint8_t)(0xFFu << (8 * i + 8 - slash));
+		}
+		if ((ip & mask) != net[i]) {
+			return 0;
+		}
+	}
+	return 1;
+#else
+	(void)i;
+	return 0;
+#endif
 }
 
 
@@ -14737,6 +16223,9 @@ redirect_to_https_port(struct mg_connection *conn, int port)
 }
 
 
+#include "route_table.inl"
+
+
 static void
 mg_set_handler_type(struct mg_context *phys_ctx,
                     struct mg_domain_context *dom_ctx,
@@ -14752,7 +16241,7 @@ mg_set_handler_type(struct mg_context *phys_ctx,
                     mg_authorization_handler auth_handler,
                     void *cbdata)
 {
-	struct mg_handler_info *tmp_rh, **lastref;
+	struct mg_handler_info *tmp_rh, *new_rh = NULL, **lastref;
 	size_t urilen = strlen(uri);
 
 	if (handler_type == WEBSOCKET_HANDLER) {
@@ -14816,110 +16305,93 @@ mg_set_handler_type(struct mg_context *phys_ctx,
 		return;
 	}
 
+	/* A new handler is created for an update as well: lookups do not use a
+	 * lock, so the handler must not be modified while it is in the
+	 * routing table. */
+	if (!is_delete_request) {
+		new_rh = (struct mg_handler_info *)
+		    mg_calloc_ctx(1, sizeof(struct mg_handler_info), phys_ctx);
+		if (new_rh != NULL) {
+			new_rh->uri = mg_strdup_ctx(uri, phys_ctx);
+			if (new_rh->uri == NULL) {
+				mg_free(new_rh);
+				new_rh = NULL;
+			}
+		}
+		if (new_rh == NULL) {
+			mg_cry_ctx_internal(phys_ctx,
+			                    "%s",
+			                    "Cannot create new request handler struct, OOM");
+			return;
+		}
+		new_rh->uri_len = urilen;
+		if (handler_type == REQUEST_HANDLER) {
+			new_rh->refcount = 0;
+			new_rh->handler = handler;
+		} else if (handler_type == WEBSOCKET_HANDLER) {
+			new_rh->subprotocols = subprotocols;
+			new_rh->connect_handler = connect_handler;
+			new_rh->ready_handler = ready_handler;
+			new_rh->data_handler = data_handler;
+			new_rh->close_handler = close_handler;
+		} else { /* AUTH_HANDLER */
+			new_rh->auth_handler = auth_handler;
+		}
+		new_rh->cbdata = cbdata;
+		new_rh->handler_type = handler_type;
+	}
+
 	mg_lock_context(phys_ctx);
 
 	/* first try to find an existing handler */
-	do {
-		lastref = &(dom_ctx->handlers);
-		for (tmp_rh = dom_ctx->handlers; tmp_rh != NULL;
-		     tmp_rh = tmp_rh->next) {
-			if (tmp_rh->handler_type == handler_type
-			    && (urilen == tmp_rh->uri_len) && !strcmp(tmp_rh->uri, uri)) {
-				if (!is_delete_request) {
-					/* update existing handler */
-					if (handler_type == REQUEST_HANDLER) {
-						/* Wait for end of use before updating */
-						if (tmp_rh->refcount) {
-							mg_unlock_context(phys_ctx);
-							mg_sleep(1);
-							mg_lock_context(phys_ctx);
-							/* tmp_rh might have been freed, search again. */
-							break;
-						}
-						/* Ok, the handler is no more use -> Update it */
-						tmp_rh->handler = handler;
-					} else if (handler_type == WEBSOCKET_HANDLER) {
-						tmp_rh->subprotocols = subprotocols;
-						tmp_rh->connect_handler = connect_handler;
-						tmp_rh->ready_handler = ready_handler;
-						tmp_rh->data_handler = data_handler;
-						tmp_rh->close_handler = close_handler;
-					} else { /* AUTH_HANDLER */
-						tmp_rh->auth_handler = auth_handler;
-					}
-					tmp_rh->cbdata = cbdata;
-				} else {
-					/* remove existing handler */
-					if (handler_type == REQUEST_HANDLER) {
-						/* Wait for end of use before removing */
-						if (tmp_rh->refcount) {
-							tmp_rh->removing = 1;
-							mg_unlock_context(phys_ctx);
-							mg_sleep(1);
-							mg_lock_context(phys_ctx);
-							/* tmp_rh might have been freed, search again. */
-							break;
-						}
-						/* Ok, the handler is no more used */
-					}
-					*lastref = tmp_rh->next;
-					mg_free(tmp_rh->uri);
-					mg_free(tmp_rh);
-				}
-				mg_unlock_context(phys_ctx);
-				return;
-			}
-			lastref = &(tmp_rh->next);
+	lastref = &(dom_ctx->handlers);
+	for (tmp_rh = dom_ctx->handlers; tmp_rh != NULL; tmp_rh = tmp_rh->next) {
+		if (tmp_rh->handler_type == handler_type
+		    && (urilen == tmp_rh->uri_len) && !strcmp(tmp_rh->uri, uri)) {
+			break;
 		}
-	} while (tmp_rh != NULL);
+		lastref = &(tmp_rh->next);
+	}
 
-	if (is_delete_request) {
+	if (new_rh != NULL) {
+		/* update existing handler (keep the position in the list), or
+		 * append a new one */
+		new_rh->next = (tmp_rh != NULL) ? tmp_rh->next : NULL;
+		*lastref = new_rh;
+	} else if (tmp_rh != NULL) {
+		/* remove existing handler */
+		*lastref = tmp_rh->next;
+	} else {
 		/* no handler to set, this was a remove request to a non-existing
 		 * handler */
 		mg_unlock_context(phys_ctx);
 		return;
 	}
 
-	tmp_rh =
-	    (struct mg_handler_info *)mg_calloc_ctx(1,
-	                                            sizeof(struct mg_handler_info),
-	                                            phys_ctx);
-	if (tmp_rh == NULL) {
+	if (!route_table_update(phys_ctx, dom_ctx)) {
+		/* Restore the list */
+		*lastref = tmp_rh;
 		mg_unlock_context(phys_ctx);
+		if (new_rh != NULL) {
+			mg_free(new_rh->uri);
+			mg_free(new_rh);
+		}
 		mg_cry_ctx_internal(phys_ctx,
 		                    "%s",
-		                    "Cannot create new request handler struct, OOM");
+		                    "Cannot create request handler routing table, OOM");
 		return;
 	}
-	tmp_rh->uri = mg_strdup_ctx(uri, phys_ctx);
-	if (!tmp_rh->uri) {
-		mg_unlock_context(phys_ctx);
+	mg_unlock_context(phys_ctx);
+
+	if (tmp_rh != NULL) {
+		/* The old handler is not in the routing table anymore. Wait for the
+		 * end of requests still using it before freeing it. */
+		while (tmp_rh->refcount > 0) {
+			mg_sleep(1);
+		}
+		mg_free(tmp_rh->uri);
 		mg_free(tmp_rh);
-		mg_cry_ctx_internal(phys_ctx,
-		                    "%s",
-		                    "Cannot create new request handler struct, OOM");
-		return;
 	}
-	tmp_rh->uri_len = urilen;
-	if (handler_type == REQUEST_HANDLER) {
-		tmp_rh->refcount = 0;
-		tmp_rh->removing = 0;
-		tmp_rh->handler = handler;
-	} else if (handler_type == WEBSOCKET_HANDLER) {
-		tmp_rh->subprotocols = subprotocols;
-		tmp_rh->connect_handler = connect_handler;
-		tmp_rh->ready_handler = ready_handler;
-		tmp_rh->data_handler = data_handler;
-		tmp_rh->close_handler = close_handler;
-	} else { /* AUTH_HANDLER */
-		tmp_rh->auth_handler = auth_handler;
-	}
-	tmp_rh->cbdata = cbdata;
-	tmp_rh->handler_type = handler_type;
-	tmp_rh->next = NULL;
-
-	*lastref = tmp_rh;
-	mg_unlock_context(phys_ctx);
 }
 
 
@@ -15034,65 +16506,41 @@ get_request_handler(struct mg_connection *conn,
 	if (request_info) {
 		const char *uri = request_info->local_uri;
 		size_t urilen = strlen(uri);
-		struct mg_handler_info *tmp_rh;
-		int step, matched;
+		struct mg_domain_context *dom_ctx;
+		const struct mg_route_table *table;
+		struct mg_handler_info *tmp_rh = NULL;
+		int slot;
 
 		if (!conn || !conn->phys_ctx || !conn->dom_ctx) {
 			return 0;
 		}
 
-		mg_lock_context(conn->phys_ctx);
-
-		for (step = 0; step < 3; step++) {
-			for (tmp_rh = conn->dom_ctx->handlers; tmp_rh != NULL;
-			     tmp_rh = tmp_rh->next) {
-				if (tmp_rh->handler_type != handler_type) {
-					continue;
-				}
-				if (step == 0) {
-					/* first try for an exact match */
-					matched = (tmp_rh->uri_len == urilen)
-					          && (strcmp(tmp_rh->uri, uri) == 0);
-				} else if (step == 1) {
-					/* next try for a partial match, we will accept
-					uri/something */
-					matched =
-					    (tmp_rh->uri_len < urilen)
-					    && (uri[tmp_rh->uri_len] == '/')
-					    && (memcmp(tmp_rh->uri, uri, tmp_rh->uri_len) == 0);
-				} else {
-					/* finally try for pattern match */
-					matched =
-					    match_prefix(tmp_rh->uri, tmp_rh->uri_len, uri) > 0;
-				}
-				if (matched) {
-					if (handler_type == WEBSOCKET_HANDLER) {
-						*subprotocols = tmp_rh->subprotocols;
-						*connect_handler = tmp_rh->connect_handler;
-						*ready_handler = tmp_rh->ready_handler;
-						*data_handler = tmp_rh->data_handler;
-						*close_handler = tmp_rh->close_handler;
-					} else if (handler_type == REQUEST_HANDLER) {
-						if (tmp_rh->removing) {
-							/* Treat as none found */
-							step = 2;
-							break;
-						}
-						*handler = tmp_rh->handler;
-						/* Acquire handler and give it back */
-						tmp_rh->refcount++;
-						*handler_info = tmp_rh;
-					} else { /* AUTH_HANDLER */
-						*auth_handler = tmp_rh->auth_handler;
-					}
-					*cbdata = tmp_rh->cbdata;
-					mg_unlock_context(conn->phys_ctx);
-					return 1;
-				}
+		/* Handlers are set for the server context and used for all
+		 * domains */
+		dom_ctx = &(conn->phys_ctx->dd);
+		table = route_table_acquire(dom_ctx, &slot);
+		if (table != NULL) {
+			tmp_rh = route_table_find(table, handler_type, uri, urilen);
+		}
+		if (tmp_rh != NULL) {
+			if (handler_type == WEBSOCKET_HANDLER) {
+				*subprotocols = tmp_rh->subprotocols;
+				*connect_handler = tmp_rh->connect_handler;
+				*ready_handler = tmp_rh->ready_handler;
+				*data_handler = tmp_rh->data_handler;
+				*close_handler = tmp_rh->close_handler;
+			} else if (handler_type == REQUEST_HANDLER) {
+				*handler = tmp_rh->handler;
+				/* Acquire handler and give it back */
+				mg_atomic_inc(&tmp_rh->refcount);
+				*handler_info = tmp_rh;
+			} else { /* AUTH_HANDLER */
+				*auth_handler = tmp_rh->auth_handler;
 			}
+			*cbdata = tmp_rh->cbdata;
 		}
-
-		mg_unlock_context(conn->phys_ctx);
+		route_table_release(dom_ctx, slot);
+		return (tmp_rh != NULL);
 	}
 	return 0; /* none found */
 }
@@ -15148,11 +16596,9 @@ static void
 release_handler_ref(struct mg_connection *conn,
                     struct mg_handler_info *handler_info)
 {
+	(void)conn;
 	if (handler_info != NULL) {
-		/* Use context lock for ref counter */
-		mg_lock_context(conn->phys_ctx);
-		handler_info->refcount--;
-		mg_unlock_context(conn->phys_ctx);
+		mg_atomic_dec(&handler_info->refcount);
 	}
 }
 
@@ -15191,6 +16637,10 @@ handle_request(struct mg_connection *conn)
 
 	/* 0. Reset internal state (required for HTTP/2 proxy) */
 	conn->request_state = 0;
+	conn->handler_name = NULL;
+
+	/* Check which compressed responses are allowed (Accept-Encoding) */
+	parse_accept_encoding(conn, mg_get_header_id(conn, MG_HDR_ACCEPT_ENCODING));
 
 	/* 1. get the request url */
 	/* 1.1. split into url and query string */
@@ -15238,9 +16688,11 @@ handle_request(struct mg_connection *conn)
 	 * possible. The fact that we cleaned the URI is stored in that the
 	 * pointer to ri->local_ur and ri->local_uri_raw are now different.
 	 * ri->local_uri_raw still points to memory allocated in
-	 * worker_thread_run(). ri->local_uri is private to the request so we
-	 * don't have to use preallocated memory here. */
-	tmp = mg_strdup(ri->local_uri_raw);
+	 * worker_thread_run(). ri->local_uri is private to the request, so it
+	 * is allocated in the per-request arena. */
+	tmp = request_arena_strndup(conn,
+	                            ri->local_uri_raw,
+	                            strlen(ri->local_uri_raw));
 	if (!tmp) {
 		/* Out of memory. We cannot do anything reasonable here. */
 		return;
@@ -15300,11 +16752,9 @@ handle_request(struct mg_connection *conn)
 		    conn->dom_ctx->config[ACCESS_CONTROL_ALLOW_METHODS];
 		const char *cors_orig_cfg =
 		    conn->dom_ctx->config[ACCESS_CONTROL_ALLOW_ORIGIN];
-		const char *cors_origin =
-		    get_header(ri->http_headers, ri->num_headers, "Origin");
-		const char *cors_acrm = get_header(ri->http_headers,
-		                                   ri->num_headers,
-		                                   "Access-Control-Request-Method");
+		const char *cors_origin = mg_get_header_id(conn, MG_HDR_ORIGIN);
+		const char *cors_acrm =
+		    mg_get_header_id(conn, MG_HDR_ACCESS_CONTROL_REQUEST_METHOD);
 		const char *cors_repl_asterisk_with_orig_cfg = 
 			conn->dom_ctx->config[REPLACE_ASTERISK_WITH_ORIGIN];
 		
@@ -15320,9 +16770,7 @@ handle_request(struct mg_connection *conn)
 			/* This is a valid CORS preflight, and the server is configured
 			 * to handle it automatically. */
 			const char *cors_acrh =
-			    get_header(ri->http_headers,
-			               ri->num_headers,
-			               "Access-Control-Request-Headers");
+			    mg_get_header_id(conn, MG_HDR_ACCESS_CONTROL_REQUEST_HEADERS);
 			const char *cors_cred_cfg =
 			    conn->dom_ctx->config[ACCESS_CONTROL_ALLOW_CREDENTIALS];
 			const char *cors_exphdr_cfg =
@@ -15411,6 +16859,12 @@ handle_request(struct mg_connection *conn)
 		is_callback_resource = 1;
 		is_script_resource = 1;
 		is_put_or_delete_request = is_put_or_delete_method(conn);
+		if (handler_info != NULL) {
+			/* The handler may be removed before the request is logged */
+			conn->handler_name = request_arena_strndup(conn,
+			                                           handler_info->uri,
+			                                           handler_info->uri_len);
+		}
 		/* Never handle a C callback according to File WebDav rules,
 		 * even if it is a webdav method */
 		is_webdav_request = 0; /* is_civetweb_webdav_method(conn); */
@@ -15421,6 +16875,7 @@ handle_request(struct mg_connection *conn)
 		 * addresses a file based resource (static content or Lua/cgi
 		 * scripts in the file system). */
 		is_callback_resource = 0;
+		conn->handler_name = NULL;
 		interpret_uri(conn,
 		              path,
 		              sizeof(path),
@@ -15520,7 +16975,6 @@ handle_request(struct mg_connection *conn)
 
 	/* 7. check if there are request handlers for this uri */
 	if (is_callback_resource) {
-		HTTP1_only();
 		if (!is_websocket_request) {
 			i = callback_handler(conn, callback_data);
 
@@ -15567,6 +17021,7 @@ handle_request(struct mg_connection *conn)
 				goto no_callback_resource;
 			}
 		} else {
+			HTTP1_only();
 #if defined(USE_WEBSOCKET)
 			handle_websocket_request(conn,
 			                         path,
@@ -15809,6 +17264,7 @@ handle_request(struct mg_connection *conn)
 		 * or send an "access denied" error. */
 		if (!mg_strcasecmp(conn->dom_ctx->config[ENABLE_DIRECTORY_LISTING],
 		                   "yes")) {
+			conn->handler_name = "directory";
 			handle_directory_request(conn, path);
 		} else {
 			mg_send_http_error(conn,
@@ -15831,6 +17287,7 @@ handle_request(struct mg_connection *conn)
 	}
 
 	/* 16. Static file - maybe cached */
+	conn->handler_name = "file";
 #if !defined(NO_CACHING)
 	if ((!conn->in_error_handler) && is_not_modified(conn, &file.stat)) {
 		/* Send 304 "Not Modified" - this must not send any body data */
@@ -15873,6 +17330,7 @@ handle_file_based_request(struct mg_connection *conn,
 		if (is_in_script_path(conn, path)) {
 			/* Lua server page: an SSI like page containing mostly plain
 			 * html code plus some tags with server generated contents. */
+			conn->handler_name = "lsp";
 			handle_lsp_request(conn, path, file, NULL);
 		} else {
 			/* Script was in an illegal path */
@@ -15886,6 +17344,7 @@ handle_file_based_request(struct mg_connection *conn,
 		if (is_in_script_path(conn, path)) {
 			/* Lua in-server module script: a CGI like script used to
 			 * generate the entire reply. */
+			conn->handler_name = "lua";
 			mg_exec_lua_script(conn, path, NULL);
 		} else {
 			/* Script was in an illegal path */
@@ -15901,6 +17360,7 @@ handle_file_based_request(struct mg_connection *conn,
 	    > 0) {
 		if (is_in_script_path(conn, path)) {
 			/* Call duktape to generate the page */
+			conn->handler_name = "duktape";
 			mg_exec_duktape_script(conn, path);
 		} else {
 			/* Script was in an illegal path */
@@ -15921,6 +17381,7 @@ handle_file_based_request(struct mg_connection *conn,
 			    > 0) {
 				if (is_in_script_path(conn, path)) {
 					/* CGI scripts may support all HTTP methods */
+					conn->handler_name = "cgi";
 					handle_cgi_request(conn, path, cgi_config_idx);
 				} else {
 					/* Script was in an illegal path */
@@ -15934,6 +17395,7 @@ handle_file_based_request(struct mg_connection *conn,
 
 	if (match_prefix_strlen(conn->dom_ctx->config[SSI_EXTENSIONS], path) > 0) {
 		if (is_in_script_path(conn, path)) {
+			conn->handler_name = "ssi";
 			handle_ssi_file_request(conn, path, file);
 		} else {
 			/* Script was in an illegal path */
@@ -15942,6 +17404,7 @@ handle_file_based_request(struct mg_connection *conn,
 		return;
 	}
 
+	conn->handler_name = "file";
 #if !defined(NO_CACHING)
 	if ((!conn->in_error_handler) && is_not_modified(conn, &file->stat)) {
 		/* Send 304 "Not Modified" - this must not send any body data */
@@ -16379,6 +17842,27 @@ set_ports_option(struct mg_context *phys_ctx)
 		}
 #endif
 
+#if defined(__linux__)
+		/* acceptor_threads: the acceptor threads open additional listening
+		 * sockets for the same address (see acceptors_init) */
+		if ((phys_ctx->num_acceptors > 1) && (ip_version != 99)
+		    && (setsockopt(so.sock,
+		                   SOL_SOCKET,
+		                   SO_REUSEPORT,
+		                   (SOCK_OPT_TYPE)&on,
+		                   sizeof(on))
+		        != 0)) {
+
+			mg_cry_ctx_internal(
+			    phys_ctx,
+			    "cannot set socket option SO_REUSEPORT (entry %i)",
+			    portsTotal);
+			closesocket(so.sock);
+			so.sock = INVALID_SOCKET;
+			continue;
+		}
+#endif
+
 #if defined(USE_X_DOM_SOCKET)
 		if (ip_version == 99) {
 			/* Unix domain socket */
@@ -16613,6 +18097,17 @@ header_val(const struct mg_connection *conn, const char *header)
 }
 
 
+#if !defined(NO_FILESYSTEMS)
+#include "access_log.inl"
+#else
+CIVETWEB_API void
+mg_reopen_log_files(struct mg_context *ctx)
+{
+	(void)ctx;
+}
+#endif
+
+
 #if defined(MG_EXTERNAL_FUNCTION_log_access)
 #include "external_log_access.inl"
 #elif !defined(NO_FILESYSTEMS)
@@ -16632,6 +18127,8 @@ log_access(const struct mg_connection *conn)
 
 	const char *referer;
 	const char *user_agent;
+	int queue_log, format, text_line = 0;
+	size_t log_len;
 
 	char log_buf[4096];
 
@@ -16672,8 +18169,8 @@ log_access(const struct mg_connection *conn)
 					return;
 				}
 				/* Copy test from Lua into log_buf */
-				if (len >= sizeof(log_buf)) {
-					len = sizeof(log_buf) - 1;
+				if (len >= sizeof(log_buf) - 1) {
+					len = sizeof(log_buf) - 2;
 				}
 				memcpy(log_buf, txt, len);
 				log_buf[len] = 0;
@@ -16685,7 +18182,12 @@ log_access(const struct mg_connection *conn)
 	}
 #endif
 
-	if (conn->dom_ctx->config[ACCESS_LOG_FILE] != NULL) {
+	/* Worker threads pass the line to the access log writer thread, if
+	 * access_log_buffer_size is set (see access_log.inl). */
+	queue_log = (conn->dom_ctx->config[ACCESS_LOG_FILE] != NULL)
+	            && access_log_is_async(conn);
+
+	if ((conn->dom_ctx->config[ACCESS_LOG_FILE] != NULL) && !queue_log) {
 		if (mg_fopen(conn,
 		             conn->dom_ctx->config[ACCESS_LOG_FILE],
 		             MG_FOPEN_MODE_APPEND,
@@ -16699,13 +18201,22 @@ log_access(const struct mg_connection *conn)
 
 	/* Log is written to a file and/or a callback. If both are not set,
 	 * executing the rest of the function is pointless. */
-	if ((fi.access.fp == NULL)
+	if ((fi.access.fp == NULL) && !queue_log
 	    && (conn->phys_ctx->callbacks.log_access == NULL)) {
 		return;
 	}
 
-	/* If we did not get a log message from Lua, create it here. */
-	if (!log_buf[0]) {
+	/* If we did not get a log message from Lua, create it here.
+	 * The log_access callback gets a text line for the binary format. */
+	format = conn->dom_ctx->access_log_format;
+	if (log_buf[0]) {
+		/* Lua log() lines are written as they are (as a record of their own
+		 * in the binary format) */
+		text_line = 1;
+	} else if (format == ACCESS_LOG_FORMAT_JSON) {
+		access_log_format_json(conn, log_buf, sizeof(log_buf) - 1);
+	} else if ((format == ACCESS_LOG_FORMAT_NCSA)
+	           || (conn->phys_ctx->callbacks.log_access != NULL)) {
 #if defined(REENTRANT_TIME)
 		localtime_r(&conn->conn_birth_time, tm);
 #else
@@ -16726,7 +18237,7 @@ log_access(const struct mg_connection *conn)
 		mg_snprintf(conn,
 		            NULL, /* Ignore truncation in access log */
 		            log_buf,
-		            sizeof(log_buf),
+		            sizeof(log_buf) - 1, /* space for '\n' */
 		            "%s - %s [%s] \"%s %s%s%s HTTP/%s\" %d %" INT64_FMT
 		            " %s %s",
 		            src_addr,
@@ -16754,11 +18265,26 @@ log_access(const struct mg_connection *conn)
 		}
 	}
 
+	if (!queue_log && (fi.access.fp == NULL)) {
+		return;
+	}
+
+	if ((format == ACCESS_LOG_FORMAT_BINARY) && text_line) {
+		log_len = access_log_format_binary_text(log_buf, sizeof(log_buf));
+	} else if (format == ACCESS_LOG_FORMAT_BINARY) {
+		log_len = access_log_format_binary(conn, log_buf, sizeof(log_buf));
+	} else {
+		log_len = strlen(log_buf);
+		log_buf[log_len++] = '\n';
+	}
+
 	/* Store in file */
-	if (fi.access.fp) {
+	if (queue_log) {
+		access_log_queue(conn, log_buf, log_len);
+	} else if (fi.access.fp) {
 		int ok = 1;
 		flockfile(fi.access.fp);
-		if (fprintf(fi.access.fp, "%s\n", log_buf) < 1) {
+		if (fwrite(log_buf, 1, log_len, fi.access.fp) != log_len) {
 			ok = 0;
 		}
 		if (fflush(fi.access.fp) != 0) {
@@ -16780,41 +18306,22 @@ log_access(const struct mg_connection *conn)
 #endif /* Externally provided function */
 
 
+#include "acl.inl"
+
+
 /* Verify given socket address against the ACL.
- * Return -1 if ACL is malformed, 0 if address is disallowed, 1 if allowed.
+ * Return 0 if address is disallowed, 1 if allowed.
  */
 static int
 check_acl(struct mg_context *phys_ctx, const union usa *sa)
 {
-	int allowed, flag, matched;
-	struct vec vec;
-
-	if (phys_ctx) {
-		const char *list = phys_ctx->dd.config[ACCESS_CONTROL_LIST];
-
-		/* If any ACL is set, deny by default */
-		allowed = (list == NULL) ? '+' : '-';
-
-		while ((list = next_option(list, &vec, NULL)) != NULL) {
-			flag = vec.ptr[0];
-			matched = -1;
-			if ((vec.len > 0) && ((flag == '+') || (flag == '-'))) {
-				vec.ptr++;
-				vec.len--;
-				matched = parse_match_net(&vec, sa, 1);
-			}
-			if (matched < 0) {
-				mg_cry_ctx_internal(phys_ctx, "subnet must be [+|-]IP-addr[/x]");
-				return -1;
-			}
-			if (matched) {
-				allowed = flag;
-			}
-		}
+	const struct mg_acl *acl;
+	int slot, allowed;
 
-		return allowed == '+';
-	}
-	return -1;
+	acl = acl_acquire(phys_ctx, &slot);
+	allowed = (acl == NULL) || acl_match(acl, sa);
+	acl_release(phys_ctx, slot);
+	return allowed;
 }
 
 
@@ -17763,9 +19270,13 @@ alpn_select_cb(SSL *ssl,
 	for (j = 0; alpn_proto_order[j] != NULL; j++) {
 		/* check all accepted protocols in this order */
 		const char *alpn_proto = alpn_proto_order[j];
-		/* search input for matching protocol */
-		for (i = 0; i < inlen; i++) {
-			if (!memcmp(in + i, alpn_proto, (unsigned char)alpn_proto[0])) {
+		/* search input for matching protocol (list of length prefixed
+		 * protocol names) */
+		for (i = 0; i < inlen; i += in[i] + 1u) {
+			if ((i + 1u + in[i] <= inlen)
+			    && !memcmp(in + i,
+			               alpn_proto,
+			               (unsigned char)alpn_proto[0] + 1u)) {
 				*out = in + i + 1;
 				*outlen = in[i];
 				tls->alpn_proto = alpn_proto;
@@ -17822,6 +19333,11 @@ init_alpn(struct mg_context *phys_ctx, struct mg_domain_context *dom_ctx)
 #endif
 
 
+#if defined(USE_SSL_TICKET_KEYS)
+#include "ssl_tickets.inl"
+#endif
+
+
 /* Setup SSL CTX as required by CivetWeb */
 static int
 init_ssl_ctx_impl(struct mg_context *phys_ctx,
@@ -17947,18 +19463,27 @@ init_ssl_ctx_impl(struct mg_context *phys_ctx,
 	}
 
 	/* Use some combination of start time, domain and port as a SSL
-	 * context ID. This should be unique on the current machine. */
+	 * context ID. This should be unique on the current machine.
+	 * Servers sharing a session ticket key file resume the sessions of
+	 * each other, so they use an ID derived from the domain only. */
 	md5_init(&md5state);
-	clock_gettime(CLOCK_MONOTONIC, &now_mt);
-	md5_append(&md5state, (const md5_byte_t *)&now_mt, sizeof(now_mt));
-	md5_append(&md5state,
-	           (const md5_byte_t *)phys_ctx->dd.config[LISTENING_PORTS],
-	           strlen(phys_ctx->dd.config[LISTENING_PORTS]));
 	md5_append(&md5state,
 	           (const md5_byte_t *)dom_ctx->config[AUTHENTICATION_DOMAIN],
 	           strlen(dom_ctx->config[AUTHENTICATION_DOMAIN]));
-	md5_append(&md5state, (const md5_byte_t *)phys_ctx, sizeof(*phys_ctx));
-	md5_append(&md5state, (const md5_byte_t *)dom_ctx, sizeof(*dom_ctx));
+#if defined(USE_SSL_TICKET_KEYS)
+	if (phys_ctx->dd.config[SSL_SESSION_TICKET_KEY_FILE] == NULL)
+#endif
+	{
+		clock_gettime(CLOCK_MONOTONIC, &now_mt);
+		md5_append(&md5state, (const md5_byte_t *)&now_mt, sizeof(now_mt));
+		md5_append(&md5state,
+		           (const md5_byte_t *)phys_ctx->dd.config[LISTENING_PORTS],
+		           strlen(phys_ctx->dd.config[LISTENING_PORTS]));
+		md5_append(&md5state,
+		           (const md5_byte_t *)phys_ctx,
+		           sizeof(*phys_ctx));
+		md5_append(&md5state, (const md5_byte_t *)dom_ctx, sizeof(*dom_ctx));
+	}
 	md5_finish(&md5state, ssl_context_id);
 
 	SSL_CTX_set_session_id_context(dom_ctx->ssl_ctx,
@@ -18052,6 +19577,37 @@ init_ssl_ctx_impl(struct mg_context *phys_ctx,
 		SSL_CTX_set_timeout(dom_ctx->ssl_ctx, (long)ssl_cache_timeout);
 	}
 
+#if defined(USE_SSL_TICKET_KEYS)
+	/* Session tickets with keys of the server */
+	if (!ssl_ticket_keys_init(phys_ctx, dom_ctx)) {
+		return 0;
+	}
+#endif
+
+#if defined(USE_KTLS)
+	/* OpenSSL uses kernel TLS if the kernel supports it for the cipher,
+	 * otherwise it silently keeps encrypting in user space. */
+	if (!mg_strcasecmp(phys_ctx->dd.config[SSL_KTLS], "yes")) {
+#if !defined(NO_SSL_DL)
+		if (tls_feature_missing[TLS_KTLS]) {
+			mg_cry_ctx_internal(phys_ctx,
+			                    "%s",
+			                    "Kernel TLS not supported by the TLS library");
+		} else
+#endif
+		{
+			SSL_CTX_set_options(dom_ctx->ssl_ctx, SSL_OP_ENABLE_KTLS);
+		}
+	}
+#elif defined(__linux__)
+	if ((dom_ctx == &(phys_ctx->dd))
+	    && !mg_strcasecmp(phys_ctx->dd.config[SSL_KTLS], "yes")) {
+		mg_cry_ctx_internal(phys_ctx,
+		                    "%s",
+		                    "Kernel TLS requires OpenSSL 3.0, ssl_ktls ignored");
+	}
+#endif
+
 #if defined(USE_ALPN)
 	/* Initialize ALPN only of TLS library (OpenSSL version) supports ALPN */
 #if !defined(NO_SSL_DL)
@@ -18249,14 +19805,8 @@ set_gpass_option(struct mg_context *phys_ctx, struct mg_domain_context *dom_ctx)
 static int
 set_acl_option(struct mg_context *phys_ctx)
 {
-	union usa sa;
-	memset(&sa, 0, sizeof(sa));
-#if defined(USE_IPV6)
-	sa.sin6.sin6_family = AF_INET6;
-#else
-	sa.sin.sin_family = AF_INET;
-#endif
-	return check_acl(phys_ctx, &sa) != -1;
+	/* No lock required: the server threads are not running yet */
+	return acl_update(phys_ctx, phys_ctx->dd.config[ACCESS_CONTROL_LIST]) == 0;
 }
 
 
@@ -18270,6 +19820,7 @@ reset_per_request_attributes(struct mg_connection *conn)
 	conn->num_bytes_sent = conn->consumed_content = 0;
 
 	conn->path_info = NULL;
+	conn->handler_name = NULL;
 	conn->status_code = -1;
 	conn->content_len = -1;
 	conn->is_chunked = 0;
@@ -18278,24 +19829,32 @@ reset_per_request_attributes(struct mg_connection *conn)
 	conn->request_state = 0;
 	conn->throttle = 0;
 	conn->accept_gzip = 0;
+	memset(conn->accept_encoding, 0, sizeof(conn->accept_encoding));
+	conn->accept_encoding[CONTENT_CODING_IDENTITY] = 1000;
+#if defined(USE_ZSTD)
+	if (conn->chunk_zstd != NULL) {
+		/* Response not terminated by mg_send_chunk(conn, "", 0) */
+		ZSTD_freeCCtx(conn->chunk_zstd);
+		conn->chunk_zstd = NULL;
+	}
+#endif
 
 	conn->response_info.content_length = conn->request_info.content_length = -1;
 	conn->response_info.http_version = conn->request_info.http_version = NULL;
 	conn->response_info.num_headers = conn->request_info.num_headers = 0;
+	conn->header_index_type = 0;
 	conn->response_info.status_text = NULL;
 	conn->response_info.status_code = 0;
 
 	conn->request_info.remote_user = NULL;
 	conn->request_info.request_method = NULL;
 	conn->request_info.request_uri = NULL;
-
-	/* Free cleaned local URI (if any) */
-	if (conn->request_info.local_uri != conn->request_info.local_uri_raw) {
-		mg_free((void *)conn->request_info.local_uri);
-		conn->request_info.local_uri = NULL;
-	}
 	conn->request_info.local_uri = NULL;
 
+	/* Free all memory allocated by the previous request (including the
+	 * cleaned local URI and the response header list) */
+	request_arena_reset(conn);
+
 #if defined(USE_SERVER_STATS)
 	conn->processing_time = 0;
 #endif
@@ -18493,6 +20052,13 @@ close_connection(struct mg_connection *conn)
 	mg_clear_misc_socket_callbacks(conn);
 	mg_set_user_connection_data(conn, NULL);
 
+#if defined(USE_ZSTD)
+	if (conn->chunk_zstd != NULL) {
+		ZSTD_freeCCtx(conn->chunk_zstd);
+		conn->chunk_zstd = NULL;
+	}
+#endif
+
 #if defined(USE_SERVER_STATS)
 	conn->conn_state = 7; /* closing */
 #endif
@@ -18578,6 +20144,11 @@ mg_close_connection(struct mg_connection *conn)
 
 	close_connection(conn);
 
+	if (conn->phys_ctx->context_type != CONTEXT_SERVER) {
+		/* Client connection: the connection structure is freed below */
+		request_arena_free(conn);
+	}
+
 #if !defined(NO_SSL) && !defined(USE_MBEDTLS)                                  \
     && !defined(USE_GNUTLS) // TODO: mbedTLS client
 	if (((conn->phys_ctx->context_type == CONTEXT_HTTP_CLIENT)
@@ -19277,6 +20848,19 @@ get_request(struct mg_connection *conn, char *ebuf, size_t ebuf_len, int *err)
 		return 0;
 	}
 
+#if defined(USE_HTTP2)
+	/* Cleartext HTTP/2 with prior knowledge: the connection preface starts
+	 * like a HTTP/1 request without headers (RFC 7540, 3.4 and 3.5). The
+	 * caller handles the connection as HTTP/2. */
+	if ((conn->handled_requests == 0) && !conn->client.is_ssl
+	    && (conn->request_len == 18) && !memcmp(conn->buf, http2_pri, 18)
+	    && !strcmp(conn->dom_ctx->config[ENABLE_HTTP2_CLEARTEXT], "yes")) {
+		conn->protocol_type = PROTOCOL_TYPE_HTTP2;
+		*err = 0;
+		return 0;
+	}
+#endif
+
 	if (parse_http_request(conn->buf, conn->buf_size, &conn->request_info)
 	    <= 0) {
 		mg_snprintf(conn,
@@ -19290,6 +20874,7 @@ get_request(struct mg_connection *conn, char *ebuf, size_t ebuf_len, int *err)
 	}
 
 	/* Message is a valid request */
+	index_http_headers(conn);
 
 	if (!switch_domain_context(conn)) {
 		mg_snprintf(conn,
@@ -19302,19 +20887,7 @@ get_request(struct mg_connection *conn, char *ebuf, size_t ebuf_len, int *err)
 		return 0;
 	}
 
-#if USE_ZLIB
-	if (((cl = get_header(conn->request_info.http_headers,
-	                      conn->request_info.num_headers,
-	                      "Accept-Encoding"))
-	     != NULL)
-	    && strstr(cl, "gzip")) {
-		conn->accept_gzip = 1;
-	}
-#endif
-	if (((cl = get_header(conn->request_info.http_headers,
-	                      conn->request_info.num_headers,
-	                      "Transfer-Encoding"))
-	     != NULL)
+	if (((cl = mg_get_header_id(conn, MG_HDR_TRANSFER_ENCODING)) != NULL)
 	    && mg_strcasecmp(cl, "identity")) {
 		if (mg_strcasecmp(cl, "chunked")) {
 			mg_snprintf(conn,
@@ -19328,10 +20901,7 @@ get_request(struct mg_connection *conn, char *ebuf, size_t ebuf_len, int *err)
 		}
 		conn->is_chunked = 1;
 		conn->content_len = 0; /* not yet read */
-	} else if ((cl = get_header(conn->request_info.http_headers,
-	                            conn->request_info.num_headers,
-	                            "Content-Length"))
-	           != NULL) {
+	} else if ((cl = mg_get_header_id(conn, MG_HDR_CONTENT_LENGTH)) != NULL) {
 		/* Request has content length set */
 		char *endptr = NULL;
 		conn->content_len = strtoll(cl, &endptr, 10);
@@ -19382,11 +20952,9 @@ get_response(struct mg_connection *conn, char *ebuf, size_t ebuf_len, int *err)
 	}
 
 	/* Message is a valid response */
+	index_http_headers(conn);
 
-	if (((cl = get_header(conn->response_info.http_headers,
-	                      conn->response_info.num_headers,
-	                      "Transfer-Encoding"))
-	     != NULL)
+	if (((cl = mg_get_header_id(conn, MG_HDR_TRANSFER_ENCODING)) != NULL)
 	    && mg_strcasecmp(cl, "identity")) {
 		if (mg_strcasecmp(cl, "chunked")) {
 			mg_snprintf(conn,
@@ -19400,10 +20968,7 @@ get_response(struct mg_connection *conn, char *ebuf, size_t ebuf_len, int *err)
 		}
 		conn->is_chunked = 1;
 		conn->content_len = 0; /* not yet read */
-	} else if ((cl = get_header(conn->response_info.http_headers,
-	                            conn->response_info.num_headers,
-	                            "Content-Length"))
-	           != NULL) {
+	} else if ((cl = mg_get_header_id(conn, MG_HDR_CONTENT_LENGTH)) != NULL) {
 		char *endptr = NULL;
 		conn->content_len = strtoll(cl, &endptr, 10);
 		if ((endptr == cl) || (conn->content_len < 0)) {
@@ -20006,6 +21571,11 @@ init_connection(struct mg_connection *conn)
 }
 
 
+#if defined(__linux__)
+static int park_connection(struct mg_connection *conn); /* forward declaration */
+#endif
+
+
 /* Process a connection - may handle multiple requests
  * using the same connection.
  * Must be called with a valid connection (conn  and
@@ -20019,11 +21589,18 @@ process_new_connection(struct mg_connection *conn)
 	char ebuf[100];
 	const char *hostend;
 	int reqerr, uri_type;
+	int parked = 0;
 
 #if defined(USE_SERVER_STATS)
-	ptrdiff_t mcon = mg_atomic_inc(&(conn->phys_ctx->active_connections));
-	mg_atomic_add(&(conn->phys_ctx->total_connections), 1);
-	mg_atomic_max(&(conn->phys_ctx->max_active_connections), mcon);
+	/* A connection resumed from keep-alive parking has already handled
+	 * requests and is still counted as active. A new one starts at 0. */
+	int resumed_requests = conn->handled_requests;
+
+	if (resumed_requests == 0) {
+		ptrdiff_t mcon = mg_atomic_inc(&(conn->phys_ctx->active_connections));
+		mg_atomic_add(&(conn->phys_ctx->total_connections), 1);
+		mg_atomic_max(&(conn->phys_ctx->max_active_connections), mcon);
+	}
 #endif
 
 	DEBUG_TRACE("Start processing connection from %s",
@@ -20040,6 +21617,18 @@ process_new_connection(struct mg_connection *conn)
 #endif
 
 		if (!get_request(conn, ebuf, sizeof(ebuf), &reqerr)) {
+#if defined(USE_HTTP2)
+			if (conn->protocol_type == PROTOCOL_TYPE_HTTP2) {
+				/* Cleartext HTTP/2: read the preface from the start of the
+				 * buffer, the connection is closed below */
+				conn->content_len = -1;
+				conn->is_chunked = 0;
+				conn->request_len = 0;
+				conn->consumed_content = 0;
+				process_new_http2_connection(conn);
+				break;
+			}
+#endif
 			/* The request sent by the client could not be understood by
 			 * the server, or it was incomplete or a timeout. Send an
 			 * error message and close the connection. */
@@ -20110,7 +21699,9 @@ process_new_connection(struct mg_connection *conn)
 				 * to HTTP/2 - but not if HTTP/2 is negotiated using ALPN.
 				 * Since most (all?) major browsers only support HTTP/2 using
 				 * ALPN, this is hard to test and very low priority.
-				 * Deactivate it (at least for now).
+				 * Deactivate it (at least for now): the request is answered
+				 * as HTTP/1.1. Cleartext HTTP/2 clients must use prior
+				 * knowledge (enable_http2_cleartext).
 				 */
 				conn->protocol_type = PROTOCOL_TYPE_HTTP1;
 			}
@@ -20137,12 +21728,8 @@ process_new_connection(struct mg_connection *conn)
 		/* Response complete. Free header buffer */
 		free_buffered_response_header_list(conn);
 
-		if (ri->remote_user != NULL) {
-			mg_free((void *)ri->remote_user);
-			/* Important! When having connections with and without auth
-			 * would cause double free and then crash */
-			ri->remote_user = NULL;
-		}
+		/* Allocated in the per-request arena */
+		ri->remote_user = NULL;
 
 		/* NOTE(lsm): order is important here. should_keep_alive() call
 		 * is using parsed request, which will be invalid after
@@ -20186,17 +21773,32 @@ process_new_connection(struct mg_connection *conn)
 			break;
 		}
 		conn->handled_requests++;
+
+#if defined(__linux__)
+		/* Instead of waiting for the next request in this worker thread,
+		 * hand an idle keep-alive connection over to the parking thread. */
+		if (keep_alive && park_connection(conn)) {
+			parked = 1;
+			break;
+		}
+#endif
 	} while (keep_alive);
 
-	DEBUG_TRACE("Done processing connection from %s (%f sec)",
+	DEBUG_TRACE("Done processing connection from %s (%f sec)%s",
 	            conn->request_info.remote_addr,
-	            difftime(time(NULL), conn->conn_birth_time));
+	            difftime(time(NULL), conn->conn_birth_time),
+	            (parked ? ", parked" : ""));
 
-	close_connection(conn);
+	if (!parked) {
+		close_connection(conn);
+	}
 
 #if defined(USE_SERVER_STATS)
-	mg_atomic_add(&(conn->phys_ctx->total_requests), conn->handled_requests);
-	mg_atomic_dec(&(conn->phys_ctx->active_connections));
+	mg_atomic_add(&(conn->phys_ctx->total_requests),
+	              conn->handled_requests - resumed_requests);
+	if (!parked) {
+		mg_atomic_dec(&(conn->phys_ctx->active_connections));
+	}
 #endif
 }
 
@@ -20204,19 +21806,29 @@ static int
 mg_start_worker_thread(struct mg_context *ctx,
                        int only_if_no_idle_threads); /* forward declaration */
 
+static void
+close_queued_socket(struct mg_context *ctx,
+                    struct socket *sp); /* forward declaration */
+
 #if defined(ALTERNATIVE_QUEUE)
 
+/* Accept loop adds accepted socket to one of the worker slots of its
+ * queue: worker slot i belongs to queue (i % num_acceptors). */
 static void
-produce_socket(struct mg_context *ctx, const struct socket *sp)
+produce_socket(struct mg_context *ctx,
+               const struct socket *sp,
+               unsigned int queue)
 {
 	unsigned int i;
+	struct socket so;
 
 	(void)mg_start_worker_thread(
 	    ctx, 1); /* will start a worker-thread only if there aren't currently
 	                any idle worker-threads */
 
 	while (!ctx->stop_flag) {
-		for (i = 0; i < ctx->spawned_worker_threads; i++) {
+		for (i = queue; i < ctx->spawned_worker_threads;
+		     i += ctx->num_acceptors) {
 			/* find a free worker slot and signal it */
 			if (ctx->client_socks[i].in_use == 2) {
 				(void)pthread_mutex_lock(&ctx->thread_mutex);
@@ -20235,8 +21847,8 @@ produce_socket(struct mg_context *ctx, const struct socket *sp)
 		mg_sleep(1);
 	}
 	/* must consume */
-	set_blocking_mode(sp->sock);
-	closesocket(sp->sock);
+	so = *sp;
+	close_queued_socket(ctx, &so);
 }
 
 
@@ -20264,8 +21876,7 @@ consume_socket(struct mg_context *ctx,
 		(void)pthread_mutex_unlock(&ctx->thread_mutex);
 		if (sp->in_use == 1) {
 			/* must consume */
-			set_blocking_mode(sp->sock);
-			closesocket(sp->sock);
+			close_queued_socket(ctx, sp);
 		}
 		return 0;
 	}
@@ -20280,101 +21891,1032 @@ consume_socket(struct mg_context *ctx,
 	return 0;
 }
 
-#else /* ALTERNATIVE_QUEUE */
+#elif defined(LOCKFREE_QUEUE)
 
-/* Worker threads take accepted socket from the queue */
-static int
-consume_socket(struct mg_context *ctx,
-               struct socket *sp,
-               int thread_index,
-               int counter_was_preincremented)
-{
-	(void)thread_index;
+/* Lock-free socket queue (LOCKFREE_QUEUE):
+ * A bounded multi-producer/multi-consumer ring buffer. Every cell carries
+ * a sequence number telling if it may be written or read in the current
+ * lap (D. Vyukov's bounded MPMC queue), so producers and consumers only
+ * synchronize by a compare-and-swap of their position.
+ * Idle worker threads sleep on a futex. A producer only does a system
+ * call if at least one worker thread is sleeping, and then it wakes up
+ * exactly one of them. In the same way, a producer waiting for a free
+ * cell (queue full) is woken up by the next consumer.
+ */
 
-	DEBUG_TRACE("%s", "going idle");
-	(void)pthread_mutex_lock(&ctx->thread_mutex);
-	if (counter_was_preincremented
-	    == 0) { /* first call only: the master-thread pre-incremented this
-		           before he spawned us */
-		ctx->idle_worker_thread_count++;
-	}
+static void
+mg_futex_wait(int *addr, int val)
+{
+	(void)syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
 
-	/* If the queue is empty, wait. We're idle at this point. */
-	while ((ctx->sq_head == ctx->sq_tail)
-	       && (STOP_FLAG_IS_ZERO(&ctx->stop_flag))) {
-		pthread_cond_wait(&ctx->sq_full, &ctx->thread_mutex);
-	}
 
-	/* If we're stopping, sq_head may be equal to sq_tail. */
-	if (ctx->sq_head > ctx->sq_tail) {
-		/* Copy socket from the queue and increment tail */
-		*sp = ctx->squeue[ctx->sq_tail % ctx->sq_size];
-		ctx->sq_tail++;
+static void
+mg_futex_wake(int *addr, int count)
+{
+	(void)syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
 
-		DEBUG_TRACE("grabbed socket %d, going busy", sp ? sp->sock : -1);
 
-		/* Wrap pointers if needed */
-		while (ctx->sq_tail > ctx->sq_size) {
-			ctx->sq_tail -= ctx->sq_size;
-			ctx->sq_head -= ctx->sq_size;
-		}
+/* Wake up count threads sleeping on futex, if sleeping is not 0. */
+static void
+socket_queue_notify(int *futex, int *sleeping, int count)
+{
+	/* Pairs with the fence in socket_queue_sleep: either the sleeping
+	 * thread sees the new queue state, or we see the sleeping thread. */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(sleeping, __ATOMIC_RELAXED) > 0) {
+		__atomic_add_fetch(futex, 1, __ATOMIC_SEQ_CST);
+		mg_futex_wake(futex, count);
 	}
+}
 
-	(void)pthread_cond_signal(&ctx->sq_empty);
-
-	ctx->idle_worker_thread_count--;
-	(void)pthread_mutex_unlock(&ctx->thread_mutex);
+
+static int
+socket_queue_filled(const struct mg_socket_queue *q)
+{
+	size_t head = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+	size_t tail = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+	return (head > tail) ? (int)(head - tail) : 0;
+}
+
+
+/* Add a socket to the queue. Returns 0 if the queue is full. */
+static int
+socket_queue_push(struct mg_socket_queue *q, const struct socket *sp)
+{
+	struct mg_socket_queue_cell *cell;
+	size_t pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+	ptrdiff_t dif;
+
+	for (;;) {
+		/* The ring buffer is rounded up to a power of two, but the
+		 * queue must not hold more than sq_size elements. */
+		if (pos - __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED)
+		    >= (size_t)q->sq_size) {
+			return 0;
+		}
+		cell = &q->cells[pos & q->mask];
+		dif = (ptrdiff_t)(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - pos);
+		if (dif == 0) {
+			if (__atomic_compare_exchange_n(&q->enqueue_pos,
+			                                &pos,
+			                                pos + 1,
+			                                1,
+			                                __ATOMIC_RELAXED,
+			                                __ATOMIC_RELAXED)) {
+				break;
+			}
+		} else if (dif < 0) {
+			return 0; /* cell of the previous lap not consumed yet */
+		} else {
+			pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+		}
+	}
+	cell->so = *sp;
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+
+/* Take a socket from the queue. Returns 0 if the queue is empty. */
+static int
+socket_queue_pop(struct mg_socket_queue *q, struct socket *sp)
+{
+	struct mg_socket_queue_cell *cell;
+	size_t pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+	ptrdiff_t dif;
+
+	for (;;) {
+		cell = &q->cells[pos & q->mask];
+		dif = (ptrdiff_t)(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE)
+		                  - (pos + 1));
+		if (dif == 0) {
+			if (__atomic_compare_exchange_n(&q->dequeue_pos,
+			                                &pos,
+			                                pos + 1,
+			                                1,
+			                                __ATOMIC_RELAXED,
+			                                __ATOMIC_RELAXED)) {
+				break;
+			}
+		} else if (dif < 0) {
+			return 0; /* empty */
+		} else {
+			pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+		}
+	}
+	*sp = cell->so;
+	__atomic_store_n(&cell->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+
+/* Announce to sleep on futex. Returns the futex value to wait for.
+ * The caller must check the queue state again before calling
+ * mg_futex_wait, and decrement *sleeping afterwards. */
+static int
+socket_queue_sleep(int *futex, int *sleeping)
+{
+	int val;
+	__atomic_add_fetch(sleeping, 1, __ATOMIC_SEQ_CST);
+	val = __atomic_load_n(futex, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	return val;
+}
+
+
+/* Count a new worker thread as idle worker of this queue. Returns -2
+ * instead, if only_if_no_idle_threads is set and there are more idle
+ * worker threads than queued sockets. */
+static int
+socket_queue_add_worker(struct mg_socket_queue *q,
+                        int only_if_no_idle_threads)
+{
+	if ((only_if_no_idle_threads)
+	    && (__atomic_load_n(&q->idle_worker_thread_count, __ATOMIC_RELAXED)
+	        > socket_queue_filled(q))) {
+		return -2;
+	}
+	__atomic_add_fetch(&q->idle_worker_thread_count, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+
+static void
+socket_queue_remove_worker(struct mg_socket_queue *q)
+{
+	__atomic_sub_fetch(&q->idle_worker_thread_count, 1, __ATOMIC_RELAXED);
+}
+
+
+/* Wake up all threads waiting for this queue (used to stop the server) */
+static void
+socket_queue_wakeup(struct mg_socket_queue *q)
+{
+	__atomic_add_fetch(&q->sq_full, 1, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&q->sq_empty, 1, __ATOMIC_SEQ_CST);
+	mg_futex_wake(&q->sq_full, INT_MAX);
+	mg_futex_wake(&q->sq_empty, INT_MAX);
+}
+
+
+/* Worker threads take accepted socket from the queue */
+static int
+consume_socket(struct mg_context *ctx,
+               struct socket *sp,
+               int thread_index,
+               int counter_was_preincremented)
+{
+	struct mg_socket_queue *q =
+	    &ctx->sq[(unsigned)thread_index % ctx->num_acceptors];
+	int got = 0;
+	int val;
+
+	DEBUG_TRACE("%s", "going idle");
+	if (counter_was_preincremented
+	    == 0) { /* first call only: the master-thread pre-incremented this
+		           before he spawned us */
+		__atomic_add_fetch(&q->idle_worker_thread_count, 1, __ATOMIC_RELAXED);
+	}
+
+	while (STOP_FLAG_IS_ZERO(&ctx->stop_flag)) {
+		if (socket_queue_pop(q, sp)) {
+			got = 1;
+			break;
+		}
+		/* Queue is empty: sleep until a socket is produced */
+		val = socket_queue_sleep(&q->sq_full, &q->sleeping_workers);
+		if (socket_queue_pop(q, sp)) {
+			got = 1;
+		} else if (STOP_FLAG_IS_ZERO(&ctx->stop_flag)) {
+			mg_futex_wait(&q->sq_full, val);
+		}
+		__atomic_sub_fetch(&q->sleeping_workers, 1, __ATOMIC_SEQ_CST);
+		if (got) {
+			break;
+		}
+	}
+
+	if (got) {
+		DEBUG_TRACE("grabbed socket %d, going busy", sp->sock);
+		/* A producer might wait for a free cell */
+		socket_queue_notify(&q->sq_empty, &q->sleeping_producers, 1);
+	}
+	__atomic_sub_fetch(&q->idle_worker_thread_count, 1, __ATOMIC_RELAXED);
+
+	if (got && !STOP_FLAG_IS_ZERO(&ctx->stop_flag)) {
+		/* must consume */
+		close_queued_socket(ctx, sp);
+		return 0;
+	}
+	return got;
+}
+
+
+/* Accept loop adds accepted socket to its queue */
+static void
+produce_socket(struct mg_context *ctx,
+               const struct socket *sp,
+               unsigned int queue)
+{
+	struct mg_socket_queue *q = &ctx->sq[queue];
+	int val;
+#if defined(USE_SERVER_STATS)
+	int queue_filled, max_fill;
+#endif
+
+	while (!socket_queue_push(q, sp)) {
+		if (!STOP_FLAG_IS_ZERO(&ctx->stop_flag)) {
+			/* must consume */
+			struct socket so = *sp;
+			close_queued_socket(ctx, &so);
+			return;
+		}
+		/* Queue is full: wait until a socket is consumed */
+		val = socket_queue_sleep(&q->sq_empty, &q->sleeping_producers);
+		if (socket_queue_filled(q) >= q->sq_size) {
+			/* Status information: All threads busy */
+			__atomic_store_n(&q->sq_blocked, 1, __ATOMIC_RELAXED);
+			if (STOP_FLAG_IS_ZERO(&ctx->stop_flag)) {
+				mg_futex_wait(&q->sq_empty, val);
+			}
+			__atomic_store_n(&q->sq_blocked, 0, __ATOMIC_RELAXED);
+		}
+		__atomic_sub_fetch(&q->sleeping_producers, 1, __ATOMIC_SEQ_CST);
+	}
+	DEBUG_TRACE("queued socket %d", sp->sock);
+
+	/* Wake up one sleeping worker thread, if there is any */
+	socket_queue_notify(&q->sq_full, &q->sleeping_workers, 1);
+
+#if defined(USE_SERVER_STATS)
+	queue_filled = socket_queue_filled(q);
+	max_fill = __atomic_load_n(&q->sq_max_fill, __ATOMIC_RELAXED);
+	while ((queue_filled > max_fill)
+	       && !__atomic_compare_exchange_n(&q->sq_max_fill,
+	                                       &max_fill,
+	                                       queue_filled,
+	                                       1,
+	                                       __ATOMIC_RELAXED,
+	                                       __ATOMIC_RELAXED)) {
+	}
+#endif
+
+	(void)mg_start_worker_thread(
+	    ctx, 1); /* will start a worker-thread only if there aren't currently
+	                any idle worker-threads */
+}
+
+
+/* Allocate one socket queue of queue_size elements per accept loop.
+ * Returns 1 on success. */
+static int
+init_socket_queues(struct mg_context *ctx, int queue_size)
+{
+	unsigned int i;
+	size_t n, cells = 1;
+	struct mg_socket_queue *q;
+
+	while (cells < (size_t)queue_size) {
+		cells *= 2;
+	}
+
+	ctx->sq = (struct mg_socket_queue *)
+	    mg_calloc_ctx(ctx->num_acceptors, sizeof(ctx->sq[0]), ctx);
+	if (ctx->sq == NULL) {
+		return 0;
+	}
+	for (i = 0; i < ctx->num_acceptors; i++) {
+		q = &ctx->sq[i];
+		q->cells = (struct mg_socket_queue_cell *)
+		    mg_calloc_ctx(cells, sizeof(q->cells[0]), ctx);
+		if (q->cells == NULL) {
+			return 0;
+		}
+		for (n = 0; n < cells; n++) {
+			q->cells[n].seq = n;
+		}
+		q->mask = cells - 1;
+		q->sq_size = queue_size;
+	}
+	return 1;
+}
+
+
+/* Close all sockets still in the queues. Called by the master thread
+ * when the server stops, after all producer and consumer threads have
+ * been joined. */
+static void
+drain_socket_queues(struct mg_context *ctx)
+{
+	unsigned int i;
+	struct socket so;
+
+	for (i = 0; i < ctx->num_acceptors; i++) {
+		while (socket_queue_pop(&ctx->sq[i], &so)) {
+			DEBUG_TRACE("closing queued socket %d", so.sock);
+			close_queued_socket(ctx, &so);
+		}
+	}
+}
+
+
+static void
+free_socket_queues(struct mg_context *ctx)
+{
+	unsigned int i;
+
+	if (ctx->sq == NULL) {
+		return;
+	}
+	for (i = 0; i < ctx->num_acceptors; i++) {
+		mg_free(ctx->sq[i].cells);
+	}
+	mg_free(ctx->sq);
+	ctx->sq = NULL;
+}
+
+#else /* ALTERNATIVE_QUEUE */
+
+static int
+socket_queue_filled(const struct mg_socket_queue *q)
+{
+	return q->sq_head - q->sq_tail;
+}
+
+
+/* Count a new worker thread as idle worker of this queue. Returns -2
+ * instead, if only_if_no_idle_threads is set and there are more idle
+ * worker threads than queued sockets. */
+static int
+socket_queue_add_worker(struct mg_socket_queue *q,
+                        int only_if_no_idle_threads)
+{
+	int ret = 0;
+
+	(void)pthread_mutex_lock(&q->mutex);
+	if ((only_if_no_idle_threads)
+	    && (q->idle_worker_thread_count > (unsigned)socket_queue_filled(q))) {
+		ret = -2;
+	} else {
+		q->idle_worker_thread_count++;
+	}
+	(void)pthread_mutex_unlock(&q->mutex);
+	return ret;
+}
+
+
+static void
+socket_queue_remove_worker(struct mg_socket_queue *q)
+{
+	(void)pthread_mutex_lock(&q->mutex);
+	q->idle_worker_thread_count--;
+	(void)pthread_mutex_unlock(&q->mutex);
+}
+
+
+/* Wake up all threads waiting for this queue (used to stop the server) */
+static void
+socket_queue_wakeup(struct mg_socket_queue *q)
+{
+	(void)pthread_mutex_lock(&q->mutex);
+	pthread_cond_broadcast(&q->sq_full);
+	pthread_cond_broadcast(&q->sq_empty);
+	(void)pthread_mutex_unlock(&q->mutex);
+}
+
+
+/* Worker threads take accepted socket from the queue */
+static int
+consume_socket(struct mg_context *ctx,
+               struct socket *sp,
+               int thread_index,
+               int counter_was_preincremented)
+{
+	struct mg_socket_queue *q =
+	    &ctx->sq[(unsigned)thread_index % ctx->num_acceptors];
+
+	DEBUG_TRACE("%s", "going idle");
+	(void)pthread_mutex_lock(&q->mutex);
+	if (counter_was_preincremented
+	    == 0) { /* first call only: the master-thread pre-incremented this
+		           before he spawned us */
+		q->idle_worker_thread_count++;
+	}
+
+	/* If the queue is empty, wait. We're idle at this point. */
+	while ((q->sq_head == q->sq_tail)
+	       && (STOP_FLAG_IS_ZERO(&ctx->stop_flag))) {
+		pthread_cond_wait(&q->sq_full, &q->mutex);
+	}
+
+	/* If we're stopping, sq_head may be equal to sq_tail. Sockets still
+	 * in the queue are closed by drain_socket_queues. */
+	if ((q->sq_head > q->sq_tail) && STOP_FLAG_IS_ZERO(&ctx->stop_flag)) {
+		/* Copy socket from the queue and increment tail */
+		*sp = q->squeue[q->sq_tail % q->sq_size];
+		q->sq_tail++;
+
+		DEBUG_TRACE("grabbed socket %d, going busy", sp ? sp->sock : -1);
+
+		/* Wrap pointers if needed */
+		while (q->sq_tail > q->sq_size) {
+			q->sq_tail -= q->sq_size;
+			q->sq_head -= q->sq_size;
+		}
+	}
+
+	(void)pthread_cond_signal(&q->sq_empty);
+
+	q->idle_worker_thread_count--;
+	(void)pthread_mutex_unlock(&q->mutex);
 
 	return STOP_FLAG_IS_ZERO(&ctx->stop_flag);
 }
 
 
-/* Master thread adds accepted socket to a queue */
+/* Accept loop adds accepted socket to its queue */
+static void
+produce_socket(struct mg_context *ctx,
+               const struct socket *sp,
+               unsigned int queue)
+{
+	struct mg_socket_queue *q = &ctx->sq[queue];
+	int queue_filled;
+
+	(void)pthread_mutex_lock(&q->mutex);
+
+	queue_filled = q->sq_head - q->sq_tail;
+
+	/* If the queue is full, wait */
+	while (STOP_FLAG_IS_ZERO(&ctx->stop_flag)
+	       && (queue_filled >= q->sq_size)) {
+		q->sq_blocked = 1; /* Status information: All threads busy */
+#if defined(USE_SERVER_STATS)
+		if (queue_filled > q->sq_max_fill) {
+			q->sq_max_fill = queue_filled;
+		}
+#endif
+		(void)pthread_cond_wait(&q->sq_empty, &q->mutex);
+		q->sq_blocked = 0; /* Not blocked now */
+		queue_filled = q->sq_head - q->sq_tail;
+	}
+
+	if (queue_filled < q->sq_size) {
+		/* Copy socket to the queue and increment head */
+		q->squeue[q->sq_head % q->sq_size] = *sp;
+		q->sq_head++;
+		DEBUG_TRACE("queued socket %d", sp ? sp->sock : -1);
+	} else {
+		/* Stopping: must consume */
+		struct socket so = *sp;
+		close_queued_socket(ctx, &so);
+	}
+
+	queue_filled = q->sq_head - q->sq_tail;
+#if defined(USE_SERVER_STATS)
+	if (queue_filled > q->sq_max_fill) {
+		q->sq_max_fill = queue_filled;
+	}
+#endif
+
+	(void)pthread_cond_signal(&q->sq_full);
+	(void)pthread_mutex_unlock(&q->mutex);
+
+	(void)mg_start_worker_thread(
+	    ctx, 1); /* will start a worker-thread only if there aren't currently
+	                any idle worker-threads */
+}
+
+
+/* Allocate one socket queue of queue_size elements per accept loop.
+ * Returns 1 on success. On failure, the queues already initialized are
+ * released by free_socket_queues. */
+static int
+init_socket_queues(struct mg_context *ctx, int queue_size)
+{
+	unsigned int i;
+	struct mg_socket_queue *q;
+
+	ctx->sq = (struct mg_socket_queue *)
+	    mg_calloc_ctx(ctx->num_acceptors, sizeof(ctx->sq[0]), ctx);
+	if (ctx->sq == NULL) {
+		return 0;
+	}
+	for (i = 0; i < ctx->num_acceptors; i++) {
+		q = &ctx->sq[i];
+		q->squeue = (struct socket *)
+		    mg_calloc_ctx((unsigned)queue_size, sizeof(struct socket), ctx);
+		if (q->squeue == NULL) {
+			return 0;
+		}
+		if (0 != pthread_mutex_init(&q->mutex, &pthread_mutex_attr)) {
+			mg_free(q->squeue);
+			q->squeue = NULL;
+			return 0;
+		}
+		(void)pthread_cond_init(&q->sq_empty, NULL);
+		(void)pthread_cond_init(&q->sq_full, NULL);
+		q->sq_size = queue_size;
+	}
+	return 1;
+}
+
+
+/* Close all sockets still in the queues. Called by the master thread
+ * when the server stops, after all producer and consumer threads have
+ * been joined. */
+static void
+drain_socket_queues(struct mg_context *ctx)
+{
+	unsigned int i;
+	struct mg_socket_queue *q;
+
+	for (i = 0; i < ctx->num_acceptors; i++) {
+		q = &ctx->sq[i];
+		while (q->sq_head > q->sq_tail) {
+			DEBUG_TRACE("closing queued socket %d",
+			            q->squeue[q->sq_tail % q->sq_size].sock);
+			close_queued_socket(ctx, &q->squeue[q->sq_tail % q->sq_size]);
+			q->sq_tail++;
+		}
+	}
+}
+
+
+static void
+free_socket_queues(struct mg_context *ctx)
+{
+	unsigned int i;
+
+	if (ctx->sq == NULL) {
+		return;
+	}
+	/* A queue is completely initialized if squeue is set */
+	for (i = 0; (i < ctx->num_acceptors) && (ctx->sq[i].squeue != NULL);
+	     i++) {
+		(void)pthread_cond_destroy(&ctx->sq[i].sq_empty);
+		(void)pthread_cond_destroy(&ctx->sq[i].sq_full);
+		(void)pthread_mutex_destroy(&ctx->sq[i].mutex);
+		mg_free(ctx->sq[i].squeue);
+	}
+	mg_free(ctx->sq);
+	ctx->sq = NULL;
+}
+#endif /* ALTERNATIVE_QUEUE */
+
+
+#if defined(__linux__)
+/* Keep-alive parking (enable_keep_alive_parking):
+ * Instead of blocking a worker thread until the next request of an idle
+ * keep-alive connection arrives (or keep_alive_timeout_ms expires), the
+ * socket is registered in an epoll set owned by a dedicated parking thread.
+ * Once the next request bytes arrive, the connection is queued again using
+ * produce_socket, like a newly accepted connection. Idle connections are
+ * closed by the parking thread when the keep alive timeout expires. */
+
+#if !defined(MG_PARKING_EVENTS)
+#define MG_PARKING_EVENTS (64) /* epoll events handled per wakeup */
+#endif
+
+
+/* A kept-alive connection waiting for its next request */
+struct mg_parked_connection {
+	struct socket client;   /* Client socket */
+	void *conn_data;        /* User connection data */
+	time_t conn_birth_time; /* Time when the connection was established */
+	int handled_requests;   /* Requests already handled (always > 0) */
+	struct timespec expire; /* Monotonic time to close an idle connection */
+
+	/* Doubly linked list, ordered by expire time */
+	struct mg_parked_connection *prev;
+	struct mg_parked_connection *next;
+};
+
+
+struct mg_keep_alive_parking {
+	int epoll_fd;          /* Parked client sockets */
+	pthread_t threadid;    /* Parking thread */
+	pthread_mutex_t mutex; /* Protects the list and the closed flag */
+	struct mg_parked_connection *first;
+	struct mg_parked_connection *last;
+	unsigned parked_count; /* Number of elements in the list */
+	int closed;            /* Set when the parking thread stops */
+	int timeout_ms;        /* keep_alive_timeout_ms */
+};
+
+
+static void
+parking_unlink(struct mg_keep_alive_parking *pk,
+               struct mg_parked_connection *pc)
+{
+	(void)epoll_ctl(pk->epoll_fd, EPOLL_CTL_DEL, pc->client.sock, NULL);
+
+	if (pc->prev) {
+		pc->prev->next = pc->next;
+	} else {
+		pk->first = pc->next;
+	}
+	if (pc->next) {
+		pc->next->prev = pc->prev;
+	} else {
+		pk->last = pc->prev;
+	}
+	pc->prev = pc->next = NULL;
+	pk->parked_count--;
+}
+
+
+/* Called by a worker thread after a request has been handled completely.
+ * Return value:
+ *   1 .. the connection has been moved to the parking thread and must not
+ *        be used by the caller anymore
+ *   0 .. the connection can not be parked, continue in the worker thread */
+static int
+park_connection(struct mg_connection *conn)
+{
+	struct mg_keep_alive_parking *pk = conn->phys_ctx->parking;
+	struct mg_parked_connection *pc;
+	struct epoll_event ev;
+	int ok;
+
+	if ((pk == NULL) || (conn->data_len != 0) || (conn->ssl != NULL)
+	    || (conn->num_misc_socket_callbacks > 0)) {
+		/* Parking is disabled, the next (pipelined) request is already
+		 * buffered, or the connection state can not be moved to a
+		 * different thread. */
+		return 0;
+	}
+
+	pc = (struct mg_parked_connection *)mg_calloc_ctx(1,
+	                                                  sizeof(*pc),
+	                                                  conn->phys_ctx);
+	if (pc == NULL) {
+		return 0;
+	}
+	pc->client = conn->client;
+	pc->client.parked = NULL;
+	pc->conn_data = conn->request_info.conn_data;
+	pc->conn_birth_time = conn->conn_birth_time;
+	pc->handled_requests = conn->handled_requests;
+	clock_gettime(CLOCK_MONOTONIC, &pc->expire);
+	pc->expire.tv_sec += pk->timeout_ms / 1000;
+	pc->expire.tv_nsec += (long)(pk->timeout_ms % 1000) * 1000000L;
+	if (pc->expire.tv_nsec >= 1000000000L) {
+		pc->expire.tv_nsec -= 1000000000L;
+		pc->expire.tv_sec++;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLRDHUP;
+	ev.data.ptr = pc;
+
+	/* All connections use the same timeout, so appending keeps the list
+	 * ordered. The socket is added to the epoll set while holding the lock,
+	 * so the parking thread will always find it in the list. */
+	(void)pthread_mutex_lock(&pk->mutex);
+	ok = !pk->closed
+	     && (epoll_ctl(pk->epoll_fd, EPOLL_CTL_ADD, pc->client.sock, &ev)
+	         == 0);
+	if (ok) {
+		pc->prev = pk->last;
+		if (pk->last) {
+			pk->last->next = pc;
+		} else {
+			pk->first = pc;
+		}
+		pk->last = pc;
+		pk->parked_count++;
+	}
+	(void)pthread_mutex_unlock(&pk->mutex);
+
+	if (!ok) {
+		mg_free(pc);
+		return 0;
+	}
+
+	/* The socket and the user connection data are owned by the parking
+	 * thread now. */
+	conn->client.sock = INVALID_SOCKET;
+	conn->request_info.conn_data = NULL;
+	return 1;
+}
+
+
+/* Called by a worker thread for a socket taken from the queue, instead of
+ * init_connection. Restores the state saved by park_connection. */
+static void
+resume_parked_connection(struct mg_connection *conn)
+{
+	struct mg_parked_connection *pc = conn->client.parked;
+
+	conn->client.parked = NULL;
+	conn->conn_birth_time = pc->conn_birth_time;
+	conn->data_len = 0;
+	conn->handled_requests = pc->handled_requests;
+	conn->connection_type = CONNECTION_TYPE_INVALID;
+	conn->request_info.acceptedWebSocketSubprotocol = NULL;
+	mg_clear_misc_socket_callbacks(conn);
+	mg_set_user_connection_data(conn, pc->conn_data);
+
+#if defined(USE_SERVER_STATS)
+	conn->conn_state = 2; /* init */
+#endif
+
+	mg_free(pc);
+}
+
+
+/* Close a parked connection from the parking thread. fc is a connection
+ * object owned by the parking thread. */
+static void
+close_parked_connection(struct mg_connection *fc,
+                        struct mg_parked_connection *pc)
+{
+	fc->client = pc->client;
+	fc->conn_birth_time = pc->conn_birth_time;
+	fc->handled_requests = pc->handled_requests;
+	fc->request_info.remote_port = ntohs(USA_IN_PORT_UNSAFE(&fc->client.rsa));
+	fc->request_info.server_port = ntohs(USA_IN_PORT_UNSAFE(&fc->client.lsa));
+	sockaddr_to_string(fc->request_info.remote_addr,
+	                   sizeof(fc->request_info.remote_addr),
+	                   &fc->client.rsa);
+	mg_set_user_connection_data(fc, pc->conn_data);
+
+	DEBUG_TRACE("Closing parked connection from %s",
+	            fc->request_info.remote_addr);
+	close_connection(fc);
+
+#if defined(USE_SERVER_STATS)
+	mg_atomic_dec(&(fc->phys_ctx->active_connections));
+#endif
+	mg_free(pc);
+}
+
+
+static void
+parking_thread_run(struct mg_context *ctx)
+{
+	struct mg_keep_alive_parking *pk = ctx->parking;
+	struct epoll_event events[MG_PARKING_EVENTS];
+	struct mg_parked_connection *pc, *ready, *expired;
+	struct mg_workerTLS tls;
+	struct mg_connection fc;
+	struct timespec now;
+	double remaining;
+	int i, n, wait_ms;
+	unsigned int queue = 0;
+
+	mg_set_thread_name("parking");
+
+	tls.is_master = 0;
+	tls.thread_idx = (unsigned)mg_atomic_inc(&thread_idx_max);
+	tls.alpn_proto = NULL;
+#if defined(USE_IO_URING)
+	tls.uring = NULL;
+#endif
+	pthread_setspecific(sTlsKey, &tls);
+
+	if (ctx->callbacks.init_thread) {
+		/* Parking thread is an internal helper thread (type 2) */
+		tls.user_ptr = ctx->callbacks.init_thread(ctx, 2);
+	} else {
+		tls.user_ptr = NULL;
+	}
+
+	/* Connection object used to close idle connections */
+	fake_connection(&fc, ctx);
+	fc.tls_user_ptr = tls.user_ptr;
+	fc.request_info.user_data = ctx->user_data;
+	(void)pthread_mutex_init(&fc.mutex, &pthread_mutex_attr);
+
+	while (STOP_FLAG_IS_ZERO(&ctx->stop_flag)) {
+
+		/* Wait until the oldest connection expires, or at most one socket
+		 * timeout quantum. */
+		wait_ms = SOCKET_TIMEOUT_QUANTUM;
+		if (pk->timeout_ms < wait_ms) {
+			wait_ms = pk->timeout_ms;
+		}
+		(void)pthread_mutex_lock(&pk->mutex);
+		if (pk->first) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			remaining = mg_difftimespec(&pk->first->expire, &now);
+			if (remaining < 0.0) {
+				wait_ms = 0;
+			} else if (remaining * 1000.0 < (double)wait_ms) {
+				wait_ms = (int)(remaining * 1000.0) + 1;
+			}
+		}
+		(void)pthread_mutex_unlock(&pk->mutex);
+
+		n = epoll_wait(pk->epoll_fd, events, MG_PARKING_EVENTS, wait_ms);
+		if ((n < 0) && !ERROR_TRY_AGAIN(ERRNO)) {
+			mg_cry_ctx_internal(ctx, "epoll_wait failed: %s", strerror(ERRNO));
+			break;
+		}
+
+		/* Collect all connections with data (or a closed socket) and all
+		 * expired connections. They can not be handled while holding the
+		 * lock, since produce_socket may block until a worker is
+		 * available, and workers need the lock to park connections. */
+		ready = expired = NULL;
+		(void)pthread_mutex_lock(&pk->mutex);
+		for (i = 0; i < n; i++) {
+			pc = (struct mg_parked_connection *)events[i].data.ptr;
+			if (pc == NULL) {
+				/* thread_shutdown_notification_socket */
+				continue;
+			}
+			parking_unlink(pk, pc);
+			pc->next = ready;
+			ready = pc;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		while ((pk->first != NULL)
+		       && (mg_difftimespec(&pk->first->expire, &now) <= 0.0)) {
+			pc = pk->first;
+			parking_unlink(pk, pc);
+			pc->next = expired;
+			expired = pc;
+		}
+		(void)pthread_mutex_unlock(&pk->mutex);
+
+		while (ready != NULL) {
+			pc = ready;
+			ready = pc->next;
+			pc->next = NULL;
+			if (STOP_FLAG_IS_ZERO(&ctx->stop_flag)) {
+				/* Dispatch to a worker thread, like a new connection.
+				 * Resumed connections are spread over all queues. */
+				struct socket so = pc->client;
+				so.parked = pc;
+				produce_socket(ctx, &so, queue);
+				queue = (queue + 1) % ctx->num_acceptors;
+			} else {
+				close_parked_connection(&fc, pc);
+			}
+		}
+		while (expired != NULL) {
+			pc = expired;
+			expired = pc->next;
+			close_parked_connection(&fc, pc);
+		}
+	}
+
+	/* Server is stopping: do not accept any more connections and close all
+	 * parked ones. */
+	(void)pthread_mutex_lock(&pk->mutex);
+	pk->closed = 1;
+	expired = NULL;
+	while (pk->first != NULL) {
+		pc = pk->first;
+		parking_unlink(pk, pc);
+		pc->next = expired;
+		expired = pc;
+	}
+	(void)pthread_mutex_unlock(&pk->mutex);
+	while (expired != NULL) {
+		pc = expired;
+		expired = pc->next;
+		close_parked_connection(&fc, pc);
+	}
+
+	pthread_mutex_destroy(&fc.mutex);
+
+	if (ctx->callbacks.exit_thread) {
+		ctx->callbacks.exit_thread(ctx, 2, tls.user_ptr);
+	}
+
+	pthread_setspecific(sTlsKey, NULL);
+
+	DEBUG_TRACE("%s", "exiting");
+}
+
+
+static void *
+parking_thread(void *thread_func_param)
+{
+	struct sigaction sa;
+
+	/* Ignore SIGPIPE */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &sa, NULL);
+
+	parking_thread_run((struct mg_context *)thread_func_param);
+	return NULL;
+}
+
+
+/* Create the epoll set and start the parking thread, if
+ * enable_keep_alive_parking is set. Returns 0 on success (also if
+ * parking is not enabled). */
+static int
+parking_init(struct mg_context *ctx)
+{
+	struct mg_keep_alive_parking *pk;
+	struct epoll_event ev;
+	int timeout_ms;
+
+	ctx->parking = NULL;
+	if (mg_strcasecmp(ctx->dd.config[ENABLE_KEEP_ALIVE_PARKING], "yes")
+	    || mg_strcasecmp(ctx->dd.config[ENABLE_KEEP_ALIVE], "yes")) {
+		return 0;
+	}
+	timeout_ms = atoi(ctx->dd.config[KEEP_ALIVE_TIMEOUT]);
+	if (timeout_ms <= 0) {
+		/* Idle connections are closed immediately anyway */
+		return 0;
+	}
+
+	pk = (struct mg_keep_alive_parking *)mg_calloc_ctx(1, sizeof(*pk), ctx);
+	if (pk == NULL) {
+		return -1;
+	}
+	pk->timeout_ms = timeout_ms;
+	pk->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (pk->epoll_fd < 0) {
+		mg_free(pk);
+		return -1;
+	}
+
+	/* mg_stop will wake up epoll_wait, like mg_poll in the master thread */
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	(void)epoll_ctl(pk->epoll_fd,
+	                EPOLL_CTL_ADD,
+	                ctx->thread_shutdown_notification_socket,
+	                &ev);
+
+	if (0 != pthread_mutex_init(&pk->mutex, &pthread_mutex_attr)) {
+		close(pk->epoll_fd);
+		mg_free(pk);
+		return -1;
+	}
+
+	ctx->parking = pk;
+	if (mg_start_thread_with_id(parking_thread, ctx, &pk->threadid) != 0) {
+		ctx->parking = NULL;
+		pthread_mutex_destroy(&pk->mutex);
+		close(pk->epoll_fd);
+		mg_free(pk);
+		return -1;
+	}
+	return 0;
+}
+
+
+/* Called by the master thread when the server stops, after the stop flag
+ * has been set. */
 static void
-produce_socket(struct mg_context *ctx, const struct socket *sp)
+parking_exit(struct mg_context *ctx)
 {
-	int queue_filled;
+	if (ctx->parking) {
+		mg_join_thread(ctx->parking->threadid);
+	}
+}
 
-	(void)pthread_mutex_lock(&ctx->thread_mutex);
 
-	queue_filled = ctx->sq_head - ctx->sq_tail;
+/* Called by free_context, after all threads have been stopped. */
+static void
+parking_free(struct mg_context *ctx)
+{
+	struct mg_keep_alive_parking *pk = ctx->parking;
 
-	/* If the queue is full, wait */
-	while (STOP_FLAG_IS_ZERO(&ctx->stop_flag)
-	       && (queue_filled >= ctx->sq_size)) {
-		ctx->sq_blocked = 1; /* Status information: All threads busy */
-#if defined(USE_SERVER_STATS)
-		if (queue_filled > ctx->sq_max_fill) {
-			ctx->sq_max_fill = queue_filled;
-		}
-#endif
-		(void)pthread_cond_wait(&ctx->sq_empty, &ctx->thread_mutex);
-		ctx->sq_blocked = 0; /* Not blocked now */
-		queue_filled = ctx->sq_head - ctx->sq_tail;
+	if (pk) {
+		DEBUG_ASSERT(pk->first == NULL);
+		pthread_mutex_destroy(&pk->mutex);
+		close(pk->epoll_fd);
+		mg_free(pk);
+		ctx->parking = NULL;
 	}
+}
+#endif /* __linux__ */
 
-	if (queue_filled < ctx->sq_size) {
-		/* Copy socket to the queue and increment head */
-		ctx->squeue[ctx->sq_head % ctx->sq_size] = *sp;
-		ctx->sq_head++;
-		DEBUG_TRACE("queued socket %d", sp ? sp->sock : -1);
-	}
 
-	queue_filled = ctx->sq_head - ctx->sq_tail;
-#if defined(USE_SERVER_STATS)
-	if (queue_filled > ctx->sq_max_fill) {
-		ctx->sq_max_fill = queue_filled;
+/* Close a socket taken from a socket queue while the server stops.
+ * A connection resumed from parking still owns its parking state. */
+static void
+close_queued_socket(struct mg_context *ctx, struct socket *sp)
+{
+#if defined(__linux__)
+	struct mg_connection fc;
+
+	if (sp->parked != NULL) {
+		fake_connection(&fc, ctx);
+		fc.request_info.user_data = ctx->user_data;
+		(void)pthread_mutex_init(&fc.mutex, &pthread_mutex_attr);
+		close_parked_connection(&fc, sp->parked);
+		pthread_mutex_destroy(&fc.mutex);
+		return;
 	}
 #endif
-
-	(void)pthread_cond_signal(&ctx->sq_full);
-	(void)pthread_mutex_unlock(&ctx->thread_mutex);
-
-	(void)mg_start_worker_thread(
-	    ctx, 1); /* will start a worker-thread only if there aren't currently
-	                any idle worker-threads */
+	set_blocking_mode(sp->sock);
+	closesocket(sp->sock);
 }
-#endif /* ALTERNATIVE_QUEUE */
 
 
 static void
@@ -20384,6 +22926,7 @@ worker_thread_run(struct mg_connection *conn)
 	int thread_index;
 	struct mg_workerTLS tls;
 	int first_call_to_consume_socket = 1;
+	int out_buf_size;
 
 	mg_set_thread_name("worker");
 
@@ -20392,6 +22935,9 @@ worker_thread_run(struct mg_connection *conn)
 #if defined(_WIN32)
 	tls.pthread_cond_helper_mutex = CreateEvent(NULL, FALSE, FALSE, NULL);
 #endif
+#if defined(USE_IO_URING)
+	tls.uring = NULL;
+#endif
 
 	/* Initialize thread local storage before calling any callback */
 	pthread_setspecific(sTlsKey, &tls);
@@ -20429,8 +22975,25 @@ worker_thread_run(struct mg_connection *conn)
 	}
 	conn->buf_size = (int)ctx->max_request_size;
 
+	/* Optional output buffer for responses */
+	out_buf_size = atoi(ctx->dd.config[OUTPUT_BUFFER_SIZE]);
+	if (out_buf_size > 0) {
+		conn->out_buf = (char *)mg_malloc_ctx((size_t)out_buf_size, ctx);
+		if (conn->out_buf == NULL) {
+			mg_cry_ctx_internal(
+			    ctx,
+			    "Out of memory: Cannot allocate output buffer for worker %i",
+			    thread_index);
+		} else {
+			conn->out_buf_size = out_buf_size;
+		}
+	}
+
 	conn->dom_ctx = &(ctx->dd); /* Use default domain and default host */
 
+	/* Each worker has a ring buffer in the asynchronous access log */
+	conn->access_log_async = (ctx->access_log != NULL);
+
 	conn->tls_user_ptr = tls.user_ptr; /* store ptr for quick access */
 
 	conn->request_info.user_data = ctx->user_data;
@@ -20439,10 +23002,26 @@ worker_thread_run(struct mg_connection *conn)
 	 */
 	if (0 != pthread_mutex_init(&conn->mutex, &pthread_mutex_attr)) {
 		mg_free(conn->buf);
+		mg_free(conn->out_buf);
 		mg_cry_ctx_internal(ctx, "%s", "Cannot create mutex");
 		return;
 	}
 
+#if defined(USE_IO_URING)
+	/* NULL if io_uring is not available: use poll and recv/send */
+	tls.uring = mg_uring_create(ctx);
+	if ((tls.uring != NULL) && (conn->out_buf == NULL)) {
+		/* Without output_buffer_size, the output buffer collects the
+		 * response headers only (see mg_response_header_send) */
+		conn->out_buf =
+		    (char *)mg_malloc_ctx(MG_URING_HEADER_BUF_SIZE, ctx);
+		if (conn->out_buf != NULL) {
+			conn->out_buf_size = MG_URING_HEADER_BUF_SIZE;
+			conn->out_headers_only = 1;
+		}
+	}
+#endif
+
 #if defined(USE_SERVER_STATS)
 	conn->conn_state = 1; /* not consumed */
 #endif
@@ -20542,7 +23121,11 @@ worker_thread_run(struct mg_connection *conn)
 					conn->content_len =
 					    -1;               /* content length is not predefined */
 					conn->is_chunked = 0; /* HTTP2 is never chunked */
+					/* Nothing buffered from a previous connection */
+					conn->request_len = 0;
+					conn->consumed_content = 0;
 					process_new_http2_connection(conn);
+					close_connection(conn);
 				} else
 #endif
 				{
@@ -20578,7 +23161,15 @@ worker_thread_run(struct mg_connection *conn)
 
 		} else {
 			/* process HTTP connection */
-			init_connection(conn);
+#if defined(__linux__)
+			if (conn->client.parked != NULL) {
+				/* next request of a parked keep-alive connection */
+				resume_parked_connection(conn);
+			} else
+#endif
+			{
+				init_connection(conn);
+			}
 			conn->connection_type = CONNECTION_TYPE_REQUEST;
 			/* Start with HTTP, WS will be an "upgrade" request later */
 			conn->protocol_type = PROTOCOL_TYPE_HTTP1;
@@ -20601,6 +23192,9 @@ worker_thread_run(struct mg_connection *conn)
 	pthread_setspecific(sTlsKey, NULL);
 #if defined(_WIN32)
 	CloseHandle(tls.pthread_cond_helper_mutex);
+#endif
+#if defined(USE_IO_URING)
+	mg_uring_destroy(tls.uring);
 #endif
 	pthread_mutex_destroy(&conn->mutex);
 
@@ -20608,12 +23202,13 @@ worker_thread_run(struct mg_connection *conn)
 	conn->buf_size = 0;
 	mg_free(conn->buf);
 	conn->buf = NULL;
+	conn->out_buf_size = 0;
+	mg_free(conn->out_buf);
+	conn->out_buf = NULL;
 
-	/* Free cleaned URI (if any) */
-	if (conn->request_info.local_uri != conn->request_info.local_uri_raw) {
-		mg_free((void *)conn->request_info.local_uri);
-		conn->request_info.local_uri = NULL;
-	}
+	/* Free the per-request arena (including the cleaned URI) */
+	request_arena_free(conn);
+	conn->request_info.local_uri = NULL;
 
 #if defined(USE_SERVER_STATS)
 	conn->conn_state = 9; /* done */
@@ -20649,10 +23244,72 @@ worker_thread(void *thread_func_param)
 #endif /* _WIN32 */
 
 
+#if !defined(ALTERNATIVE_QUEUE)
+/* Admission control: Check if the socket queue of an accept loop is
+ * above the configured high water mark. */
+static int
+connection_queue_overloaded(const struct mg_context *ctx, unsigned int queue)
+{
+	return (ctx->sq_high_water > 0)
+	       && (socket_queue_filled(&ctx->sq[queue]) >= ctx->sq_high_water);
+}
+
+
+/* Admission control: Reject a freshly accepted connection without
+ * handing it to a worker thread. Plain HTTP connections get the
+ * preformatted "503 Service Unavailable" response (if there is room in
+ * the socket send buffer, which is empty for a new connection), TLS
+ * connections and connection_overload_action "reset" get a TCP RST. */
+static void
+reject_overloaded_connection(struct mg_context *ctx,
+                             SOCKET sock,
+                             int is_ssl)
+{
+	char buf[256];
+	struct linger linger;
+
+#if defined(_WIN32)
+	typedef int len_t;
+#else
+	typedef size_t len_t;
+#endif
+
+	set_non_blocking_mode(sock);
+	if (!ctx->overload_reset && !is_ssl) {
+		(void)send(sock,
+		           ctx->overload_response,
+		           (len_t)ctx->overload_response_len,
+		           MSG_NOSIGNAL);
+		shutdown(sock, SHUTDOWN_WR);
+
+		/* Discard request data already received: closing a socket with
+		 * unread data sends a RST, and the client might lose the
+		 * response. */
+		(void)recv(sock, buf, sizeof(buf), 0);
+	} else {
+		linger.l_onoff = 1;
+		linger.l_linger = 0;
+		(void)setsockopt(sock,
+		                 SOL_SOCKET,
+		                 SO_LINGER,
+		                 (SOCK_OPT_TYPE)&linger,
+		                 sizeof(linger));
+	}
+	closesocket(sock);
+
+#if defined(USE_SERVER_STATS)
+	mg_atomic_inc(&ctx->total_rejected);
+#endif
+}
+#endif /* ALTERNATIVE_QUEUE */
+
+
 /* This is an internal function, thus all arguments are expected to be
  * valid - a NULL check is not required. */
 static void
-accept_new_connection(const struct socket *listener, struct mg_context *ctx)
+accept_new_connection(const struct socket *listener,
+                      struct mg_context *ctx,
+                      unsigned int queue)
 {
 	struct socket so;
 	char src_addr[IP_ADDR_STR_LEN];
@@ -20670,6 +23327,11 @@ accept_new_connection(const struct socket *listener, struct mg_context *ctx)
 		                    "%s is not allowed to connect",
 		                    src_addr);
 		closesocket(so.sock);
+#if !defined(ALTERNATIVE_QUEUE)
+	} else if (connection_queue_overloaded(ctx, queue)) {
+		DEBUG_TRACE("Rejected socket %d: queue overloaded", (int)so.sock);
+		reject_overloaded_connection(ctx, so.sock, listener->is_ssl);
+#endif
 	} else {
 		/* Put so socket structure into the queue */
 		DEBUG_TRACE("Accepted socket %d", (int)so.sock);
@@ -20705,41 +23367,366 @@ accept_new_connection(const struct socket *listener, struct mg_context *ctx)
 				    strerror(ERRNO));
 			}
 		}
-#endif
+#endif
+
+		/* Disable TCP Nagle's algorithm. Normally TCP packets are coalesced
+		 * to effectively fill up the underlying IP packet payload and
+		 * reduce the overhead of sending lots of small buffers. However
+		 * this hurts the server's throughput (ie. operations per second)
+		 * when HTTP 1.1 persistent connections are used and the responses
+		 * are relatively small (eg. less than 1400 bytes).
+		 */
+		if ((ctx->dd.config[CONFIG_TCP_NODELAY] != NULL)
+		    && (!strcmp(ctx->dd.config[CONFIG_TCP_NODELAY], "1"))) {
+			if (set_tcp_nodelay(&so, 1) != 0) {
+				mg_cry_ctx_internal(
+				    ctx,
+				    "setsockopt(IPPROTO_TCP TCP_NODELAY) failed: %s",
+				    strerror(ERRNO));
+			}
+		}
+
+		/* The "non blocking" property should already be
+		 * inherited from the parent socket. Set it for
+		 * non-compliant socket implementations. */
+		set_non_blocking_mode(so.sock);
+
+		so.in_use = 0;
+		produce_socket(ctx, &so, queue);
+	}
+}
+
+
+/* Accept loop of the master thread and of the acceptor threads:
+ * Poll the listening sockets, and add all accepted connections to the
+ * socket queue of this accept loop. Runs until the server is stopped.
+ * pfd must have room for num_listeners + 1 elements. */
+static void
+accept_loop(struct mg_context *ctx,
+            const struct socket *listeners,
+            struct mg_pollfd *pfd,
+            unsigned int num_listeners,
+            unsigned int queue)
+{
+	unsigned int i;
+	int pollres;
+
+	while (STOP_FLAG_IS_ZERO(&ctx->stop_flag)) {
+		for (i = 0; i < num_listeners; i++) {
+			pfd[i].fd = listeners[i].sock;
+			pfd[i].events = POLLIN;
+		}
+
+		/* We listen on this socket just so that mg_stop() can cause mg_poll()
+		 * to return ASAP. Don't worry, we did allocate an extra slot at the end
+		 * of pfd[] just to hold this
+		 */
+		pfd[num_listeners].fd = ctx->thread_shutdown_notification_socket;
+		pfd[num_listeners].events = POLLIN;
+
+		pollres = mg_poll(pfd,
+		                  num_listeners
+		                      + 1, // +1 for the thread_shutdown_notification_socket
+		                  SOCKET_TIMEOUT_QUANTUM,
+		                  &(ctx->stop_flag),
+		                  0);
+		if (pollres > 0) {
+			for (i = 0; i < num_listeners; i++) {
+				/* NOTE(lsm): on QNX, poll() returns POLLRDNORM after the
+				 * successful poll, and POLLIN is defined as
+				 * (POLLRDNORM | POLLRDBAND)
+				 * Therefore, we're checking pfd[i].revents & POLLIN, not
+				 * pfd[i].revents == POLLIN. */
+				if (STOP_FLAG_IS_ZERO(&ctx->stop_flag)
+				    && (pfd[i].revents & POLLIN)) {
+					accept_new_connection(&listeners[i], ctx, queue);
+				}
+			}
+		} else if (pollres == 0) {
+			/* timeout: server is idling? */
+
+			//TODO: call_user_over_ctx(ctx, 0, MG_IDLE_MASTER);
+		} else {
+			/* Error or stop signal */
+			break;
+		}
+	}
+}
+
+
+#if defined(__linux__)
+/* Multiple accept loops (acceptor_threads):
+ * Every TCP listening socket of the master thread is opened with
+ * SO_REUSEPORT, and each acceptor thread binds its own copy of it.
+ * The kernel distributes new connections over all listening sockets of
+ * a port, so the accept loops do not share any lock: each of them adds
+ * the connections to its own socket queue, served by its own subset of
+ * the worker threads. Unix domain sockets are only handled by the
+ * master thread. */
+struct mg_acceptor {
+	struct mg_context *ctx;
+	unsigned int idx;   /* Index of the socket queue (1 .. num_acceptors-1) */
+	pthread_t threadid; /* Acceptor thread */
+	struct socket *listening_sockets; /* SO_REUSEPORT copies */
+	struct mg_pollfd *listening_socket_fds;
+	unsigned int num_listening_sockets;
+};
+
+
+/* Open another listening socket for the address of an SO_REUSEPORT
+ * listener of the master thread. Returns INVALID_SOCKET on error. */
+static SOCKET
+open_reuseport_socket(struct mg_context *ctx, const struct socket *listener)
+{
+	SOCKET sock;
+	int on = 1;
+	socklen_t len;
+	long backlog = strtol(ctx->dd.config[LISTEN_BACKLOG_SIZE], NULL, 10);
+#if defined(USE_IPV6)
+	int v6only = 0;
+	socklen_t v6len = sizeof(v6only);
+#endif
+
+	sock = socket(listener->lsa.sa.sa_family, SOCK_STREAM, 6 /* TCP */);
+	if (sock == INVALID_SOCKET) {
+		return INVALID_SOCKET;
+	}
+	if ((setsockopt(
+	         sock, SOL_SOCKET, SO_REUSEADDR, (SOCK_OPT_TYPE)&on, sizeof(on))
+	     != 0)
+	    || (setsockopt(
+	            sock, SOL_SOCKET, SO_REUSEPORT, (SOCK_OPT_TYPE)&on, sizeof(on))
+	        != 0)) {
+		closesocket(sock);
+		return INVALID_SOCKET;
+	}
+
+#if defined(USE_IPV6)
+	if (listener->lsa.sa.sa_family == AF_INET6) {
+		/* Use the same IPV6_V6ONLY setting as the original socket */
+		if ((getsockopt(listener->sock,
+		                IPPROTO_IPV6,
+		                IPV6_V6ONLY,
+		                (void *)&v6only,
+		                &v6len)
+		     != 0)
+		    || (setsockopt(sock,
+		                   IPPROTO_IPV6,
+		                   IPV6_V6ONLY,
+		                   (void *)&v6only,
+		                   sizeof(v6only))
+		        != 0)) {
+			closesocket(sock);
+			return INVALID_SOCKET;
+		}
+		len = sizeof(listener->lsa.sin6);
+	} else
+#endif
+	{
+		len = sizeof(listener->lsa.sin);
+	}
+
+	/* lsa already contains the port number actually used, also if the
+	 * port was chosen by the operating system. */
+	if ((bind(sock, &listener->lsa.sa, len) != 0)
+	    || (listen(sock, (int)backlog) != 0)) {
+		closesocket(sock);
+		return INVALID_SOCKET;
+	}
+
+	set_close_on_exec(sock, NULL, ctx);
+	return sock;
+}
+
+
+static void
+acceptor_thread_run(struct mg_acceptor *acc)
+{
+	struct mg_context *ctx = acc->ctx;
+	struct mg_workerTLS tls;
+
+	mg_set_thread_name("accept");
+
+	tls.is_master = 0;
+	tls.thread_idx = (unsigned)mg_atomic_inc(&thread_idx_max);
+	tls.alpn_proto = NULL;
+#if defined(USE_IO_URING)
+	tls.uring = NULL;
+#endif
+	pthread_setspecific(sTlsKey, &tls);
+
+	if (ctx->callbacks.init_thread) {
+		/* Acceptor thread is an internal helper thread (type 2) */
+		tls.user_ptr = ctx->callbacks.init_thread(ctx, 2);
+	} else {
+		tls.user_ptr = NULL;
+	}
+
+	accept_loop(ctx,
+	            acc->listening_sockets,
+	            acc->listening_socket_fds,
+	            acc->num_listening_sockets,
+	            acc->idx);
+
+	if (ctx->callbacks.exit_thread) {
+		ctx->callbacks.exit_thread(ctx, 2, tls.user_ptr);
+	}
+	pthread_setspecific(sTlsKey, NULL);
+}
+
+
+static void *
+acceptor_thread(void *thread_func_param)
+{
+	acceptor_thread_run((struct mg_acceptor *)thread_func_param);
+	return NULL;
+}
+
+
+/* Open the listening sockets of all acceptor threads. This is done
+ * directly after set_ports_option, so errors abort mg_start.
+ * Returns 0 on success. */
+static int
+acceptors_init(struct mg_context *ctx)
+{
+	struct mg_acceptor *acc;
+	unsigned int i, k;
+
+	if (ctx->num_acceptors < 2) {
+		return 0;
+	}
+
+	ctx->acceptors = (struct mg_acceptor *)
+	    mg_calloc_ctx(ctx->num_acceptors, sizeof(ctx->acceptors[0]), ctx);
+	if (ctx->acceptors == NULL) {
+		return -1;
+	}
+
+	/* Element 0 is the master thread: it uses ctx->listening_sockets */
+	for (k = 1; k < ctx->num_acceptors; k++) {
+		acc = &ctx->acceptors[k];
+		acc->ctx = ctx;
+		acc->idx = k;
+		acc->listening_sockets = (struct socket *)mg_calloc_ctx(
+		    ctx->num_listening_sockets + 1, sizeof(struct socket), ctx);
+		acc->listening_socket_fds = (struct mg_pollfd *)mg_calloc_ctx(
+		    ctx->num_listening_sockets + 1, sizeof(struct mg_pollfd), ctx);
+		if ((acc->listening_sockets == NULL)
+		    || (acc->listening_socket_fds == NULL)) {
+			mg_cry_ctx_internal(ctx, "%s", "Out of memory");
+			return -1;
+		}
+
+		for (i = 0; i < ctx->num_listening_sockets; i++) {
+			const struct socket *listener = &ctx->listening_sockets[i];
+			struct socket *so =
+			    &acc->listening_sockets[acc->num_listening_sockets];
+
+			if ((listener->sock == INVALID_SOCKET)
+			    || ((listener->lsa.sa.sa_family != AF_INET)
+			        && (listener->lsa.sa.sa_family != AF_INET6))) {
+				continue;
+			}
+			*so = *listener;
+			so->sock = open_reuseport_socket(ctx, listener);
+			if (so->sock == INVALID_SOCKET) {
+				mg_cry_ctx_internal(ctx,
+				                    "cannot open listening socket for "
+				                    "acceptor thread %u: %d (%s)",
+				                    k,
+				                    (int)ERRNO,
+				                    strerror(errno));
+				return -1;
+			}
+			acc->num_listening_sockets++;
+		}
+	}
+	return 0;
+}
+
+
+static void
+acceptor_close_sockets(struct mg_acceptor *acc)
+{
+	unsigned int i;
+
+	for (i = 0; i < acc->num_listening_sockets; i++) {
+		closesocket(acc->listening_sockets[i].sock);
+		acc->listening_sockets[i].sock = INVALID_SOCKET;
+	}
+	acc->num_listening_sockets = 0;
+}
+
+
+/* Start the acceptor threads. If a thread cannot be started, its
+ * listening sockets are closed, so the kernel will distribute new
+ * connections to the remaining accept loops. */
+static void
+acceptors_start(struct mg_context *ctx)
+{
+	struct mg_acceptor *acc;
+	unsigned int k;
+
+	if (ctx->acceptors == NULL) {
+		return;
+	}
+	for (k = 1; k < ctx->num_acceptors; k++) {
+		acc = &ctx->acceptors[k];
+		if (mg_start_thread_with_id(acceptor_thread, acc, &acc->threadid)
+		    != 0) {
+			mg_cry_ctx_internal(ctx,
+			                    "Cannot start acceptor thread %u: %d",
+			                    k,
+			                    (int)ERRNO);
+			acc->threadid = 0;
+			acceptor_close_sockets(acc);
+		}
+	}
+}
 
-		/* Disable TCP Nagle's algorithm. Normally TCP packets are coalesced
-		 * to effectively fill up the underlying IP packet payload and
-		 * reduce the overhead of sending lots of small buffers. However
-		 * this hurts the server's throughput (ie. operations per second)
-		 * when HTTP 1.1 persistent connections are used and the responses
-		 * are relatively small (eg. less than 1400 bytes).
-		 */
-		if ((ctx->dd.config[CONFIG_TCP_NODELAY] != NULL)
-		    && (!strcmp(ctx->dd.config[CONFIG_TCP_NODELAY], "1"))) {
-			if (set_tcp_nodelay(&so, 1) != 0) {
-				mg_cry_ctx_internal(
-				    ctx,
-				    "setsockopt(IPPROTO_TCP TCP_NODELAY) failed: %s",
-				    strerror(ERRNO));
-			}
+
+/* Stop all acceptor threads (the stop flag must already be set) */
+static void
+acceptors_exit(struct mg_context *ctx)
+{
+	unsigned int k;
+
+	if (ctx->acceptors == NULL) {
+		return;
+	}
+	for (k = 1; k < ctx->num_acceptors; k++) {
+		if (ctx->acceptors[k].threadid != 0) {
+			mg_join_thread(ctx->acceptors[k].threadid);
+			ctx->acceptors[k].threadid = 0;
 		}
+		acceptor_close_sockets(&ctx->acceptors[k]);
+	}
+}
 
-		/* The "non blocking" property should already be
-		 * inherited from the parent socket. Set it for
-		 * non-compliant socket implementations. */
-		set_non_blocking_mode(so.sock);
 
-		so.in_use = 0;
-		produce_socket(ctx, &so);
+static void
+acceptors_free(struct mg_context *ctx)
+{
+	unsigned int k;
+
+	if (ctx->acceptors == NULL) {
+		return;
 	}
+	for (k = 1; k < ctx->num_acceptors; k++) {
+		acceptor_close_sockets(&ctx->acceptors[k]);
+		mg_free(ctx->acceptors[k].listening_sockets);
+		mg_free(ctx->acceptors[k].listening_socket_fds);
+	}
+	mg_free(ctx->acceptors);
+	ctx->acceptors = NULL;
 }
+#endif /* __linux__ */
 
 
 static void
 master_thread_run(struct mg_context *ctx)
 {
 	struct mg_workerTLS tls;
-	struct mg_pollfd *pfd;
 	unsigned int i;
 	unsigned int workerthreadcount;
 
@@ -20815,48 +23802,11 @@ master_thread_run(struct mg_context *ctx)
 	ctx->start_time = time(NULL);
 
 	/* Server accept loop */
-	pfd = ctx->listening_socket_fds;
-	while (STOP_FLAG_IS_ZERO(&ctx->stop_flag)) {
-		for (i = 0; i < ctx->num_listening_sockets; i++) {
-			pfd[i].fd = ctx->listening_sockets[i].sock;
-			pfd[i].events = POLLIN;
-		}
-
-		/* We listen on this socket just so that mg_stop() can cause mg_poll()
-		 * to return ASAP. Don't worry, we did allocate an extra slot at the end
-		 * of listening_socket_fds[] just to hold this
-		 */
-		pfd[ctx->num_listening_sockets].fd =
-		    ctx->thread_shutdown_notification_socket;
-		pfd[ctx->num_listening_sockets].events = POLLIN;
-
-		int pollres = mg_poll(pfd,
-		            ctx->num_listening_sockets
-		                + 1, // +1 for the thread_shutdown_notification_socket
-		            SOCKET_TIMEOUT_QUANTUM,
-		            &(ctx->stop_flag),
-		            0);
-		if (pollres > 0) {
-			for (i = 0; i < ctx->num_listening_sockets; i++) {
-				/* NOTE(lsm): on QNX, poll() returns POLLRDNORM after the
-				 * successful poll, and POLLIN is defined as
-				 * (POLLRDNORM | POLLRDBAND)
-				 * Therefore, we're checking pfd[i].revents & POLLIN, not
-				 * pfd[i].revents == POLLIN. */
-				if (STOP_FLAG_IS_ZERO(&ctx->stop_flag)
-				    && (pfd[i].revents & POLLIN)) {
-					accept_new_connection(&ctx->listening_sockets[i], ctx);
-				}
-			}
-		} else if (pollres == 0) {
-			/* timeout: server is idling? */
-
-			//TODO: call_user_over_ctx(ctx, 0, MG_IDLE_MASTER);
-		} else {
-			/* Error or stop signal */
-			break;
-		}
-	}
+	accept_loop(ctx,
+	            ctx->listening_sockets,
+	            ctx->listening_socket_fds,
+	            ctx->num_listening_sockets,
+	            0);
 
 	/* Here stop_flag is 1 - Initiate shutdown. */
 	DEBUG_TRACE("%s", "stopping workers");
@@ -20864,15 +23814,27 @@ master_thread_run(struct mg_context *ctx)
 	/* Stop signal received: somebody called mg_stop. Quit. */
 	close_all_listening_sockets(ctx);
 
-	/* Wakeup workers that are waiting for connections to handle. */
+	/* Wakeup workers that are waiting for connections to handle, and
+	 * acceptor threads waiting for a free queue element. */
 #if defined(ALTERNATIVE_QUEUE)
 	for (i = 0; i < ctx->spawned_worker_threads; i++) {
 		event_signal(ctx->client_wait_events[i]);
 	}
 #else
-	(void)pthread_mutex_lock(&ctx->thread_mutex);
-	pthread_cond_broadcast(&ctx->sq_full);
-	(void)pthread_mutex_unlock(&ctx->thread_mutex);
+	for (i = 0; i < ctx->num_acceptors; i++) {
+		socket_queue_wakeup(&ctx->sq[i]);
+	}
+#endif
+
+#if defined(__linux__)
+	/* Acceptor threads may still start worker threads */
+	acceptors_exit(ctx);
+#endif
+
+#if defined(__linux__)
+	/* The parking thread may still start worker threads, so it must be
+	 * stopped before joining the workers. */
+	parking_exit(ctx);
 #endif
 
 	/* Join all worker threads to avoid leaking threads. */
@@ -20883,6 +23845,22 @@ master_thread_run(struct mg_context *ctx)
 		}
 	}
 
+#if !defined(ALTERNATIVE_QUEUE)
+	/* No thread uses the queues any more: close the sockets accepted or
+	 * resumed from parking, but never handled by a worker. */
+	drain_socket_queues(ctx);
+#endif
+
+#if defined(USE_HTTP2)
+	/* Stream handlers of HTTP/2 connections (all connections are closed) */
+	http2_workers_exit(ctx);
+#endif
+
+#if !defined(NO_FILESYSTEMS)
+	/* Write the remaining access log lines of all workers */
+	access_log_exit(ctx);
+#endif
+
 #if defined(USE_LUA)
 	/* Free Lua state of lua background task */
 	if (ctx->lua_background_state) {
@@ -21074,6 +24052,35 @@ free_context(struct mg_context *ctx)
 	 */
 	(void)pthread_mutex_destroy(&ctx->thread_mutex);
 
+#if defined(__linux__)
+	parking_free(ctx);
+#endif
+
+	acl_free(ctx->acl[0]);
+	acl_free(ctx->acl[1]);
+
+#if !defined(NO_FILESYSTEMS)
+	access_log_free(ctx);
+	mg_auth_cache_free(ctx->auth_cache);
+	mg_file_cache_free(ctx->file_cache);
+	mg_memory_cache_free(ctx->memory_cache);
+#if defined(USE_ZLIB)
+	mg_memory_cache_free(ctx->compression_cache);
+#endif
+#endif
+
+#if defined(USE_LUA)
+	lua_pool_free(ctx->lua_pool);
+#endif
+
+#if defined(USE_HTTP2)
+	http2_workers_free(ctx);
+#endif
+
+#if defined(USE_SSL_TICKET_KEYS)
+	ssl_ticket_keys_free(ctx);
+#endif
+
 #if defined(ALTERNATIVE_QUEUE)
 	mg_free(ctx->client_socks);
 	if (ctx->client_wait_events != NULL) {
@@ -21083,9 +24090,10 @@ free_context(struct mg_context *ctx)
 		mg_free(ctx->client_wait_events);
 	}
 #else
-	(void)pthread_cond_destroy(&ctx->sq_empty);
-	(void)pthread_cond_destroy(&ctx->sq_full);
-	mg_free(ctx->squeue);
+	free_socket_queues(ctx);
+#endif
+#if defined(__linux__)
+	acceptors_free(ctx);
 #endif
 
 	/* Destroy other context global data structures mutex */
@@ -21125,6 +24133,8 @@ free_context(struct mg_context *ctx)
 		mg_free(tmp_rh->uri);
 		mg_free(tmp_rh);
 	}
+	route_table_free(ctx->dd.routes[0]);
+	route_table_free(ctx->dd.routes[1]);
 
 #if defined(USE_MBEDTLS)
 	if (ctx->dd.ssl_ctx != NULL) {
@@ -21367,20 +24377,32 @@ mg_socketpair(int *sockA, int *sockB)
 static int
 mg_start_worker_thread(struct mg_context *ctx, int only_if_no_idle_threads)
 {
-	const unsigned int i = ctx->spawned_worker_threads;
+	unsigned int i;
+	int ret;
+#if !defined(ALTERNATIVE_QUEUE)
+	struct mg_socket_queue *q;
+#endif
+
+	/* spawned_worker_threads only grows, so a stale value read here
+	 * without lock is checked again below. Once all worker threads are
+	 * running, producers do not need to take thread_mutex at all. */
+	if (ctx->spawned_worker_threads >= ctx->cfg_max_worker_threads) {
+		return -1;
+	}
+
+	/* Sockets may be produced by the master thread and by the keep-alive
+	 * parking thread, so the slot table is only modified while holding
+	 * thread_mutex. */
+	(void)pthread_mutex_lock(&ctx->thread_mutex);
+	i = ctx->spawned_worker_threads;
 	if (i >= ctx->cfg_max_worker_threads) {
+		(void)pthread_mutex_unlock(&ctx->thread_mutex);
 		return -1; /* Oops, we hit our worker-thread limit!  No more worker
 		              threads, ever! */
 	}
 
-	(void)pthread_mutex_lock(&ctx->thread_mutex);
 #if defined(ALTERNATIVE_QUEUE)
 	if ((only_if_no_idle_threads) && (ctx->idle_worker_thread_count > 0)) {
-#else
-	if ((only_if_no_idle_threads)
-	    && (ctx->idle_worker_thread_count
-	        > (unsigned)(ctx->sq_head - ctx->sq_tail))) {
-#endif
 		(void)pthread_mutex_unlock(&ctx->thread_mutex);
 		return -2; /* There are idle threads available, so no need to spawn a
 		              new worker thread now */
@@ -21388,21 +24410,35 @@ mg_start_worker_thread(struct mg_context *ctx, int only_if_no_idle_threads)
 	ctx->idle_worker_thread_count++; /* we do this here to avoid a race
 	                                    condition while the thread is starting
 	                                    up */
-	(void)pthread_mutex_unlock(&ctx->thread_mutex);
+#else
+	/* The new worker thread will serve this queue. It is counted as idle
+	 * thread here to avoid a race condition while the thread is starting
+	 * up */
+	q = &ctx->sq[i % ctx->num_acceptors];
+	if (socket_queue_add_worker(q, only_if_no_idle_threads) != 0) {
+		(void)pthread_mutex_unlock(&ctx->thread_mutex);
+		return -2; /* There are idle threads available, so no need to spawn a
+		              new worker thread now */
+	}
+#endif
 
 	ctx->worker_connections[i].phys_ctx = ctx;
-	int ret = mg_start_thread_with_id(worker_thread,
-	                                  &ctx->worker_connections[i],
-	                                  &ctx->worker_threadids[i]);
+	ret = mg_start_thread_with_id(worker_thread,
+	                              &ctx->worker_connections[i],
+	                              &ctx->worker_threadids[i]);
 	if (ret == 0) {
 		ctx->spawned_worker_threads++; /* note that we've filled another slot in
 		                                  the table */
 		DEBUG_TRACE("Started worker_thread #%i", ctx->spawned_worker_threads);
 	} else {
-		(void)pthread_mutex_lock(&ctx->thread_mutex);
-		ctx->idle_worker_thread_count--; /* whoops, roll-back on error */
-		(void)pthread_mutex_unlock(&ctx->thread_mutex);
+		/* whoops, roll-back on error */
+#if defined(ALTERNATIVE_QUEUE)
+		ctx->idle_worker_thread_count--;
+#else
+		socket_queue_remove_worker(q);
+#endif
 	}
+	(void)pthread_mutex_unlock(&ctx->thread_mutex);
 	return ret;
 }
 
@@ -21414,6 +24450,12 @@ mg_start2(struct mg_init_data *init, struct mg_error_data *error)
 	int idx, ok, prespawnthreadcount, workerthreadcount;
 	unsigned int i;
 	int itmp;
+#if !defined(ALTERNATIVE_QUEUE)
+	int retry_after, bad_option = -1;
+#endif
+#if !defined(NO_FILESYSTEMS)
+	int cache_ttl;
+#endif
 	void (*exit_callback)(const struct mg_context *ctx) = 0;
 	const char **options =
 	    ((init != NULL) ? (init->configuration_options) : (NULL));
@@ -21479,11 +24521,6 @@ mg_start2(struct mg_init_data *init, struct mg_error_data *error)
 	pthread_setspecific(sTlsKey, &tls);
 
 	ok = (0 == pthread_mutex_init(&ctx->thread_mutex, &pthread_mutex_attr));
-#if !defined(ALTERNATIVE_QUEUE)
-	ok &= (0 == pthread_cond_init(&ctx->sq_empty, NULL));
-	ok &= (0 == pthread_cond_init(&ctx->sq_full, NULL));
-	ctx->sq_blocked = 0;
-#endif
 	ok &= (0 == pthread_mutex_init(&ctx->nonce_mutex, &pthread_mutex_attr));
 #if defined(USE_LUA)
 	ok &= (0 == pthread_mutex_init(&ctx->lua_bg_mutex, &pthread_mutex_attr));
@@ -21585,114 +24622,414 @@ mg_start2(struct mg_init_data *init, struct mg_error_data *error)
 		DEBUG_TRACE("[%s] -> [%s]", name, value);
 	}
 
-	/* Set default value if needed */
-	for (i = 0; config_options[i].name != NULL; i++) {
-		default_value = config_options[i].default_value;
-		if ((ctx->dd.config[i] == NULL) && (default_value != NULL)) {
-			ctx->dd.config[i] = mg_strdup_ctx(default_value, ctx);
+	/* Set default value if needed */
+	for (i = 0; config_options[i].name != NULL; i++) {
+		default_value = config_options[i].default_value;
+		if ((ctx->dd.config[i] == NULL) && (default_value != NULL)) {
+			ctx->dd.config[i] = mg_strdup_ctx(default_value, ctx);
+		}
+	}
+
+	/* Request size option */
+	itmp = atoi(ctx->dd.config[MAX_REQUEST_SIZE]);
+	if (itmp < 1024) {
+		mg_cry_ctx_internal(ctx,
+		                    "%s too small",
+		                    config_options[MAX_REQUEST_SIZE].name);
+		if (error != NULL) {
+			error->code = MG_ERROR_DATA_CODE_INVALID_OPTION;
+			error->code_sub = (unsigned)MAX_REQUEST_SIZE;
+			mg_snprintf(NULL,
+			            NULL, /* No truncation check for error buffers */
+			            error->text,
+			            error->text_buffer_size,
+			            "Invalid configuration option value: %s",
+			            config_options[MAX_REQUEST_SIZE].name);
+		}
+
+		free_context(ctx);
+		pthread_setspecific(sTlsKey, NULL);
+		return NULL;
+	}
+	ctx->max_request_size = (unsigned)itmp;
+
+	/* Worker thread count option */
+	workerthreadcount = atoi(ctx->dd.config[NUM_THREADS]);
+	prespawnthreadcount = atoi(ctx->dd.config[PRESPAWN_THREADS]);
+
+	if ((prespawnthreadcount < 0)
+	    || (prespawnthreadcount > workerthreadcount)) {
+		prespawnthreadcount =
+		    workerthreadcount; /* can't prespawn more than all of them! */
+	}
+
+	if ((workerthreadcount > MAX_WORKER_THREADS) || (workerthreadcount <= 0)) {
+		if (workerthreadcount <= 0) {
+			mg_cry_ctx_internal(ctx, "%s", "Invalid number of worker threads");
+		} else {
+			mg_cry_ctx_internal(ctx, "%s", "Too many worker threads");
+		}
+		if (error != NULL) {
+			error->code = MG_ERROR_DATA_CODE_INVALID_OPTION;
+			error->code_sub = NUM_THREADS;
+			mg_snprintf(NULL,
+			            NULL, /* No truncation check for error buffers */
+			            error->text,
+			            error->text_buffer_size,
+			            "Invalid configuration option value: %s",
+			            config_options[NUM_THREADS].name);
+		}
+
+		free_context(ctx);
+		pthread_setspecific(sTlsKey, NULL);
+		return NULL;
+	}
+
+	/* Number of accept loops */
+	ctx->num_acceptors = 1;
+#if defined(__linux__)
+	itmp = atoi(ctx->dd.config[ACCEPTOR_THREADS]);
+	if ((itmp < 1) || (itmp > workerthreadcount)) {
+		mg_cry_ctx_internal(ctx, "%s", "Invalid number of acceptor threads");
+		if (error != NULL) {
+			error->code = MG_ERROR_DATA_CODE_INVALID_OPTION;
+			error->code_sub = ACCEPTOR_THREADS;
+			mg_snprintf(NULL,
+			            NULL, /* No truncation check for error buffers */
+			            error->text,
+			            error->text_buffer_size,
+			            "Invalid configuration option value: %s",
+			            config_options[ACCEPTOR_THREADS].name);
+		}
+
+		free_context(ctx);
+		pthread_setspecific(sTlsKey, NULL);
+		return NULL;
+	}
+	ctx->num_acceptors = (unsigned)itmp;
+	if (ctx->num_acceptors > 1) {
+		/* Worker threads are assigned to the socket queues of the accept
+		 * loops by their index, so all of them are started at once. */
+		prespawnthreadcount = workerthreadcount;
+	}
+#endif
+
+	/* Queue length */
+#if !defined(ALTERNATIVE_QUEUE)
+	itmp = atoi(ctx->dd.config[CONNECTION_QUEUE_SIZE]);
+	if (itmp < 1) {
+		mg_cry_ctx_internal(ctx,
+		                    "%s too small",
+		                    config_options[CONNECTION_QUEUE_SIZE].name);
+		if (error != NULL) {
+			error->code = MG_ERROR_DATA_CODE_INVALID_OPTION;
+			error->code_sub = CONNECTION_QUEUE_SIZE;
+			mg_snprintf(NULL,
+			            NULL, /* No truncation check for error buffers */
+			            error->text,
+			            error->text_buffer_size,
+			            "Invalid configuration option value: %s",
+			            config_options[CONNECTION_QUEUE_SIZE].name);
+		}
+
+		free_context(ctx);
+		pthread_setspecific(sTlsKey, NULL);
+		return NULL;
+	}
+	if (!init_socket_queues(ctx, itmp)) {
+		mg_cry_ctx_internal(ctx,
+		                    "Out of memory: Cannot allocate %s",
+		                    config_options[CONNECTION_QUEUE_SIZE].name);
+		if (error != NULL) {
+			error->code = MG_ERROR_DATA_CODE_OUT_OF_MEMORY;
+			error->code_sub = (unsigned)itmp * (unsigned)sizeof(struct socket)
+			                  * ctx->num_acceptors;
+			mg_snprintf(NULL,
+			            NULL, /* No truncation check for error buffers */
+			            error->text,
+			            error->text_buffer_size,
+			            "Out of memory: Cannot allocate %s",
+			            config_options[CONNECTION_QUEUE_SIZE].name);
+		}
+
+		free_context(ctx);
+		pthread_setspecific(sTlsKey, NULL);
+		return NULL;
+	}
+
+	/* Admission control */
+	ctx->sq_high_water = atoi(ctx->dd.config[CONNECTION_QUEUE_HIGH_WATER]);
+	ctx->overload_reset =
+	    !mg_strcasecmp(ctx->dd.config[CONNECTION_OVERLOAD_ACTION], "reset");
+	retry_after = atoi(ctx->dd.config[CONNECTION_OVERLOAD_RETRY_AFTER]);
+	if ((ctx->sq_high_water < 0) || (ctx->sq_high_water > itmp)) {
+		bad_option = CONNECTION_QUEUE_HIGH_WATER;
+	} else if (!ctx->overload_reset
+	           && strcmp(ctx->dd.config[CONNECTION_OVERLOAD_ACTION], "503")) {
+		bad_option = CONNECTION_OVERLOAD_ACTION;
+	} else if ((retry_after < 0) || (retry_after > 86400)) {
+		bad_option = CONNECTION_OVERLOAD_RETRY_AFTER;
+	}
+	if (bad_option >= 0) {
+		mg_cry_ctx_internal(ctx,
+		                    "Invalid value for %s",
+		                    config_options[bad_option].name);
+		if (error != NULL) {
+			error->code = MG_ERROR_DATA_CODE_INVALID_OPTION;
+			error->code_sub = (unsigned)bad_option;
+			mg_snprintf(NULL,
+			            NULL, /* No truncation check for error buffers */
+			            error->text,
+			            error->text_buffer_size,
+			            "Invalid configuration option value: %s",
+			            config_options[bad_option].name);
 		}
+
+		free_context(ctx);
+		pthread_setspecific(sTlsKey, NULL);
+		return NULL;
 	}
+	mg_snprintf(NULL,
+	            NULL,
+	            ctx->overload_response,
+	            sizeof(ctx->overload_response),
+	            "HTTP/1.1 503 Service Unavailable\r\n"
+	            "Retry-After: %i\r\n"
+	            "Content-Length: 0\r\n"
+	            "Connection: close\r\n\r\n",
+	            retry_after);
+	ctx->overload_response_len = (int)strlen(ctx->overload_response);
+#endif
 
-	/* Request size option */
-	itmp = atoi(ctx->dd.config[MAX_REQUEST_SIZE]);
-	if (itmp < 1024) {
+#if !defined(NO_FILESYSTEMS)
+	/* Access log format */
+	idx = access_log_parse_format(&(ctx->dd));
+	if (idx >= 0) {
 		mg_cry_ctx_internal(ctx,
-		                    "%s too small",
-		                    config_options[MAX_REQUEST_SIZE].name);
+		                    "Invalid value for %s",
+		                    config_options[idx].name);
 		if (error != NULL) {
 			error->code = MG_ERROR_DATA_CODE_INVALID_OPTION;
-			error->code_sub = (unsigned)MAX_REQUEST_SIZE;
+			error->code_sub = (unsigned)idx;
 			mg_snprintf(NULL,
 			            NULL, /* No truncation check for error buffers */
 			            error->text,
 			            error->text_buffer_size,
 			            "Invalid configuration option value: %s",
-			            config_options[MAX_REQUEST_SIZE].name);
+			            config_options[idx].name);
 		}
 
 		free_context(ctx);
 		pthread_setspecific(sTlsKey, NULL);
 		return NULL;
 	}
-	ctx->max_request_size = (unsigned)itmp;
 
-	/* Queue length */
-#if !defined(ALTERNATIVE_QUEUE)
-	itmp = atoi(ctx->dd.config[CONNECTION_QUEUE_SIZE]);
-	if (itmp < 1) {
+	/* Static file metadata cache */
+	itmp = atoi(ctx->dd.config[STATIC_FILE_STAT_CACHE_SIZE]);
+	cache_ttl = atoi(ctx->dd.config[STATIC_FILE_STAT_CACHE_TTL]);
+	if ((itmp < 0) || (cache_ttl < 0)) {
+		idx = (itmp < 0) ? STATIC_FILE_STAT_CACHE_SIZE
+		                 : STATIC_FILE_STAT_CACHE_TTL;
 		mg_cry_ctx_internal(ctx,
-		                    "%s too small",
-		                    config_options[CONNECTION_QUEUE_SIZE].name);
+		                    "Invalid value for %s",
+		                    config_options[idx].name);
 		if (error != NULL) {
 			error->code = MG_ERROR_DATA_CODE_INVALID_OPTION;
-			error->code_sub = CONNECTION_QUEUE_SIZE;
+			error->code_sub = (unsigned)idx;
 			mg_snprintf(NULL,
 			            NULL, /* No truncation check for error buffers */
 			            error->text,
 			            error->text_buffer_size,
 			            "Invalid configuration option value: %s",
-			            config_options[CONNECTION_QUEUE_SIZE].name);
+			            config_options[idx].name);
 		}
 
 		free_context(ctx);
 		pthread_setspecific(sTlsKey, NULL);
 		return NULL;
 	}
-	ctx->squeue =
-	    (struct socket *)mg_calloc((unsigned int)itmp, sizeof(struct socket));
-	if (ctx->squeue == NULL) {
+	if (itmp > 0) {
+		ctx->file_cache =
+		    mg_file_cache_create(ctx, (unsigned)itmp, (unsigned)cache_ttl);
+		if (ctx->file_cache == NULL) {
+			mg_cry_ctx_internal(ctx,
+			                    "Out of memory: Cannot allocate %s",
+			                    config_options[STATIC_FILE_STAT_CACHE_SIZE].name);
+			if (error != NULL) {
+				error->code = MG_ERROR_DATA_CODE_OUT_OF_MEMORY;
+				error->code_sub = (unsigned)itmp;
+				mg_snprintf(NULL,
+				            NULL, /* No truncation check for error buffers */
+				            error->text,
+				            error->text_buffer_size,
+				            "Out of memory: Cannot allocate %s",
+				            config_options[STATIC_FILE_STAT_CACHE_SIZE].name);
+			}
+
+			free_context(ctx);
+			pthread_setspecific(sTlsKey, NULL);
+			return NULL;
+		}
+	}
+
+	/* Cache for parsed passwords files */
+	itmp = atoi(ctx->dd.config[AUTH_FILE_CACHE_SIZE]);
+	if (itmp < 0) {
 		mg_cry_ctx_internal(ctx,
-		                    "Out of memory: Cannot allocate %s",
-		                    config_options[CONNECTION_QUEUE_SIZE].name);
+		                    "Invalid value for %s",
+		                    config_options[AUTH_FILE_CACHE_SIZE].name);
 		if (error != NULL) {
-			error->code = MG_ERROR_DATA_CODE_OUT_OF_MEMORY;
-			error->code_sub = (unsigned)itmp * (unsigned)sizeof(struct socket);
+			error->code = MG_ERROR_DATA_CODE_INVALID_OPTION;
+			error->code_sub = (unsigned)AUTH_FILE_CACHE_SIZE;
 			mg_snprintf(NULL,
 			            NULL, /* No truncation check for error buffers */
 			            error->text,
 			            error->text_buffer_size,
-			            "Out of memory: Cannot allocate %s",
-			            config_options[CONNECTION_QUEUE_SIZE].name);
+			            "Invalid configuration option value: %s",
+			            config_options[AUTH_FILE_CACHE_SIZE].name);
 		}
 
 		free_context(ctx);
 		pthread_setspecific(sTlsKey, NULL);
 		return NULL;
 	}
-	ctx->sq_size = itmp;
-#endif
+	if (itmp > 0) {
+		ctx->auth_cache = mg_auth_cache_create(ctx, (unsigned)itmp);
+		if (ctx->auth_cache == NULL) {
+			mg_cry_ctx_internal(ctx,
+			                    "Out of memory: Cannot allocate %s",
+			                    config_options[AUTH_FILE_CACHE_SIZE].name);
+			if (error != NULL) {
+				error->code = MG_ERROR_DATA_CODE_OUT_OF_MEMORY;
+				error->code_sub = (unsigned)itmp;
+				mg_snprintf(NULL,
+				            NULL, /* No truncation check for error buffers */
+				            error->text,
+				            error->text_buffer_size,
+				            "Out of memory: Cannot allocate %s",
+				            config_options[AUTH_FILE_CACHE_SIZE].name);
+			}
 
-	/* Worker thread count option */
-	workerthreadcount = atoi(ctx->dd.config[NUM_THREADS]);
-	prespawnthreadcount = atoi(ctx->dd.config[PRESPAWN_THREADS]);
+			free_context(ctx);
+			pthread_setspecific(sTlsKey, NULL);
+			return NULL;
+		}
+	}
 
-	if ((prespawnthreadcount < 0)
-	    || (prespawnthreadcount > workerthreadcount)) {
-		prespawnthreadcount =
-		    workerthreadcount; /* can't prespawn more than all of them! */
+	/* Memory cache for small static files */
+	itmp = atoi(ctx->dd.config[STATIC_FILE_MEMORY_CACHE_SIZE]);
+	if (itmp < 0) {
+		mg_cry_ctx_internal(ctx,
+		                    "Invalid value for %s",
+		                    config_options[STATIC_FILE_MEMORY_CACHE_SIZE].name);
+		if (error != NULL) {
+			error->code = MG_ERROR_DATA_CODE_INVALID_OPTION;
+			error->code_sub = (unsigned)STATIC_FILE_MEMORY_CACHE_SIZE;
+			mg_snprintf(NULL,
+			            NULL, /* No truncation check for error buffers */
+			            error->text,
+			            error->text_buffer_size,
+			            "Invalid configuration option value: %s",
+			            config_options[STATIC_FILE_MEMORY_CACHE_SIZE].name);
+		}
+
+		free_context(ctx);
+		pthread_setspecific(sTlsKey, NULL);
+		return NULL;
+	}
+#if !defined(NO_RESPONSE_BUFFERING)
+	/* The header lines of cached responses are collected using the
+	 * response header buffer */
+	if (itmp > 0) {
+		ctx->memory_cache = mg_memory_cache_create(ctx, (size_t)itmp);
+		if (ctx->memory_cache == NULL) {
+			mg_cry_ctx_internal(
+			    ctx,
+			    "Out of memory: Cannot allocate %s",
+			    config_options[STATIC_FILE_MEMORY_CACHE_SIZE].name);
+			if (error != NULL) {
+				error->code = MG_ERROR_DATA_CODE_OUT_OF_MEMORY;
+				error->code_sub = (unsigned)itmp;
+				mg_snprintf(NULL,
+				            NULL, /* No truncation check for error buffers */
+				            error->text,
+				            error->text_buffer_size,
+				            "Out of memory: Cannot allocate %s",
+				            config_options[STATIC_FILE_MEMORY_CACHE_SIZE].name);
+			}
+
+			free_context(ctx);
+			pthread_setspecific(sTlsKey, NULL);
+			return NULL;
+		}
 	}
+#endif
 
-	if ((workerthreadcount > MAX_WORKER_THREADS) || (workerthreadcount <= 0)) {
-		if (workerthreadcount <= 0) {
-			mg_cry_ctx_internal(ctx, "%s", "Invalid number of worker threads");
-		} else {
-			mg_cry_ctx_internal(ctx, "%s", "Too many worker threads");
+#if defined(USE_ZLIB)
+	/* Compression of static files */
+	itmp = atoi(ctx->dd.config[STATIC_FILE_COMPRESSION_CACHE_SIZE]);
+	idx = -1;
+	if ((atoi(ctx->dd.config[STATIC_FILE_COMPRESSION_LEVEL]) < 1)
+	    || (atoi(ctx->dd.config[STATIC_FILE_COMPRESSION_LEVEL]) > 9)) {
+		idx = STATIC_FILE_COMPRESSION_LEVEL;
+	} else if (itmp < 0) {
+		idx = STATIC_FILE_COMPRESSION_CACHE_SIZE;
+	} else if (ctx->dd.config[STATIC_FILE_COMPRESSION_CACHE_DIR] != NULL) {
+		struct mg_file_stat dir_stat;
+		struct mg_connection fc;
+		if (!mg_stat(fake_connection(&fc, ctx),
+		             ctx->dd.config[STATIC_FILE_COMPRESSION_CACHE_DIR],
+		             &dir_stat)
+		    || !dir_stat.is_directory) {
+			idx = STATIC_FILE_COMPRESSION_CACHE_DIR;
 		}
+	}
+	if (idx >= 0) {
+		mg_cry_ctx_internal(ctx,
+		                    "Invalid value for %s",
+		                    config_options[idx].name);
 		if (error != NULL) {
 			error->code = MG_ERROR_DATA_CODE_INVALID_OPTION;
-			error->code_sub = NUM_THREADS;
+			error->code_sub = (unsigned)idx;
 			mg_snprintf(NULL,
 			            NULL, /* No truncation check for error buffers */
 			            error->text,
 			            error->text_buffer_size,
 			            "Invalid configuration option value: %s",
-			            config_options[NUM_THREADS].name);
+			            config_options[idx].name);
 		}
 
 		free_context(ctx);
 		pthread_setspecific(sTlsKey, NULL);
 		return NULL;
 	}
+	if ((itmp > 0)
+	    && (ctx->dd.config[STATIC_FILE_COMPRESSION_CACHE_DIR] == NULL)) {
+		ctx->compression_cache = mg_memory_cache_create(ctx, (size_t)itmp);
+		if (ctx->compression_cache == NULL) {
+			mg_cry_ctx_internal(
+			    ctx,
+			    "Out of memory: Cannot allocate %s",
+			    config_options[STATIC_FILE_COMPRESSION_CACHE_SIZE].name);
+			if (error != NULL) {
+				error->code = MG_ERROR_DATA_CODE_OUT_OF_MEMORY;
+				error->code_sub = (unsigned)itmp;
+				mg_snprintf(
+				    NULL,
+				    NULL, /* No truncation check for error buffers */
+				    error->text,
+				    error->text_buffer_size,
+				    "Out of memory: Cannot allocate %s",
+				    config_options[STATIC_FILE_COMPRESSION_CACHE_SIZE].name);
+			}
+
+			free_context(ctx);
+			pthread_setspecific(sTlsKey, NULL);
+			return NULL;
+		}
+	}
+#endif
+#endif
 
 #if !defined(NO_FILES)
 	ctx->dd.document_roots = mg_setup_document_roots_vector(ctx, &ctx->dd,
@@ -21740,6 +25077,56 @@ mg_start2(struct mg_init_data *init, struct mg_error_data *error)
 	get_system_name(&ctx->systemName);
 
 #if defined(USE_LUA)
+	/* Pool of Lua states for Lua scripts and Lua server pages */
+	itmp = atoi(ctx->dd.config[LUA_STATE_POOL_SIZE]);
+	if ((itmp < 0)
+	    || (strcmp(ctx->dd.config[LUA_STATE_POOL_RESET], "env")
+	        && strcmp(ctx->dd.config[LUA_STATE_POOL_RESET], "gc"))) {
+		int opt = (itmp < 0) ? LUA_STATE_POOL_SIZE : LUA_STATE_POOL_RESET;
+		mg_cry_ctx_internal(ctx,
+		                    "Invalid value for %s",
+		                    config_options[opt].name);
+		if (error != NULL) {
+			error->code = MG_ERROR_DATA_CODE_INVALID_OPTION;
+			error->code_sub = (unsigned)opt;
+			mg_snprintf(NULL,
+			            NULL, /* No truncation check for error buffers */
+			            error->text,
+			            error->text_buffer_size,
+			            "Invalid configuration option value: %s",
+			            config_options[opt].name);
+		}
+
+		free_context(ctx);
+		pthread_setspecific(sTlsKey, NULL);
+		return NULL;
+	}
+	if (itmp > 0) {
+		ctx->lua_pool = lua_pool_create(
+		    ctx,
+		    (unsigned)itmp,
+		    !strcmp(ctx->dd.config[LUA_STATE_POOL_RESET], "gc"));
+		if (ctx->lua_pool == NULL) {
+			mg_cry_ctx_internal(ctx,
+			                    "Out of memory: Cannot allocate %s",
+			                    config_options[LUA_STATE_POOL_SIZE].name);
+			if (error != NULL) {
+				error->code = MG_ERROR_DATA_CODE_OUT_OF_MEMORY;
+				error->code_sub = (unsigned)itmp;
+				mg_snprintf(NULL,
+				            NULL, /* No truncation check for error buffers */
+				            error->text,
+				            error->text_buffer_size,
+				            "Out of memory: Cannot allocate %s",
+				            config_options[LUA_STATE_POOL_SIZE].name);
+			}
+
+			free_context(ctx);
+			pthread_setspecific(sTlsKey, NULL);
+			return NULL;
+		}
+	}
+
 	/* If a Lua background script has been configured, start it. */
 	ctx->lua_bg_log_available = 0;
 	if (ctx->dd.config[LUA_BACKGROUND_SCRIPT] != NULL) {
@@ -21895,7 +25282,11 @@ mg_start2(struct mg_init_data *init, struct mg_error_data *error)
 	}
 #endif
 
-	if (!set_ports_option(ctx)) {
+	if (!set_ports_option(ctx)
+#if defined(__linux__)
+	    || (acceptors_init(ctx) != 0)
+#endif
+	) {
 		const char *err_msg = "Failed to setup server ports";
 		/* Fatal error - abort start. */
 		mg_cry_ctx_internal(ctx, "%s", err_msg);
@@ -22110,6 +25501,30 @@ mg_start2(struct mg_init_data *init, struct mg_error_data *error)
 			            err_msg);
 		}
 
+		free_context(ctx);
+		pthread_setspecific(sTlsKey, NULL);
+		return NULL;
+	}
+#if defined(USE_SSL_TICKET_KEYS)
+	(void)ssl_ticket_keys_start_rotation(ctx);
+#endif
+#endif
+
+#if defined(USE_HTTP2)
+	if (http2_workers_create(ctx) != 0) {
+		const char *err_msg = "Error creating HTTP/2 stream workers";
+		mg_cry_ctx_internal(ctx, "%s", err_msg);
+
+		if (error != NULL) {
+			error->code = MG_ERROR_DATA_CODE_OUT_OF_MEMORY;
+			mg_snprintf(NULL,
+			            NULL, /* No truncation check for error buffers */
+			            error->text,
+			            error->text_buffer_size,
+			            "%s",
+			            err_msg);
+		}
+
 		free_context(ctx);
 		pthread_setspecific(sTlsKey, NULL);
 		return NULL;
@@ -22126,6 +25541,17 @@ mg_start2(struct mg_init_data *init, struct mg_error_data *error)
 	ctx->callbacks.exit_context = exit_callback;
 	ctx->context_type = CONTEXT_SERVER; /* server context */
 
+#if !defined(NO_FILESYSTEMS)
+	/* Start the access log writer thread (if enabled), before the worker
+	 * threads using it */
+	if (access_log_init(ctx) != 0) {
+		/* Not fatal: the access log is written synchronously */
+		mg_cry_ctx_internal(ctx,
+		                    "Cannot start access log writer: error %ld",
+		                    (long)ERRNO);
+	}
+#endif
+
 	/* Start worker threads */
 	for (i = 0; (int)i < prespawnthreadcount; i++) {
 		/* worker_thread sets up the other fields */
@@ -22165,6 +25591,9 @@ mg_start2(struct mg_init_data *init, struct mg_error_data *error)
 					    error_no);
 				}
 
+#if !defined(NO_FILESYSTEMS)
+				access_log_exit(ctx);
+#endif
 				free_context(ctx);
 				pthread_setspecific(sTlsKey, NULL);
 				return NULL;
@@ -22173,6 +25602,20 @@ mg_start2(struct mg_init_data *init, struct mg_error_data *error)
 		}
 	}
 
+#if defined(__linux__)
+	/* Start keep-alive parking thread (if enabled) */
+	if (parking_init(ctx) != 0) {
+		/* Not fatal: idle keep-alive connections will wait in a worker
+		 * thread, like without parking. */
+		mg_cry_ctx_internal(ctx,
+		                    "Cannot start keep-alive parking: error %ld",
+		                    (long)ERRNO);
+	}
+
+	/* Start additional accept loops (acceptor_threads) */
+	acceptors_start(ctx);
+#endif
+
 	/* Start master (listening) thread */
 	mg_start_thread_with_id(master_thread, ctx, &ctx->masterthreadid);
 
@@ -22340,7 +25783,7 @@ mg_start_domain2(struct mg_context *ctx,
 		}
 	}
 
-	new_dom->handlers = ctx->dd.handlers;
+	new_dom->handlers = NULL; /* handlers of ctx->dd are used */
 	new_dom->next = NULL;
 	new_dom->nonce_count = 0;
 	new_dom->auth_nonce_mask = get_random() ^ (get_random() << 31);
@@ -22349,6 +25792,27 @@ mg_start_domain2(struct mg_context *ctx,
 	new_dom->shared_lua_websockets = NULL;
 #endif
 
+#if !defined(NO_FILESYSTEMS)
+	idx = access_log_parse_format(new_dom);
+	if (idx >= 0) {
+		mg_cry_ctx_internal(ctx,
+		                    "Invalid value for %s",
+		                    config_options[idx].name);
+		if (error != NULL) {
+			error->code = MG_ERROR_DATA_CODE_INVALID_OPTION;
+			error->code_sub = (unsigned)idx;
+			mg_snprintf(NULL,
+			            NULL, /* No truncation check for error buffers */
+			            error->text,
+			            error->text_buffer_size,
+			            "Invalid option value: %s",
+			            config_options[idx].name);
+		}
+		mg_free_dom(new_dom);
+		return -2;
+	}
+#endif
+
 #if !defined(NO_SSL) && !defined(USE_MBEDTLS) && !defined(USE_GNUTLS)
 	if (!init_ssl_ctx(ctx, new_dom)) {
 		/* Init SSL failed */
@@ -22937,29 +26401,49 @@ mg_get_context_info(const struct mg_context *ctx, char *buffer, int buflen)
 		            eol);
 		context_info_length += mg_str_append(&buffer, end, block);
 
-		/* Queue information */
+		/* Queue information: sum of the queues of all accept loops,
+		 * except for the high water mark that applies to every queue */
 #if !defined(ALTERNATIVE_QUEUE)
-		mg_snprintf(NULL,
-		            NULL,
-		            block,
-		            sizeof(block),
-		            ",%s\"queue\" : {%s"
-		            "\"length\" : %i,%s"
-		            "\"filled\" : %i,%s"
-		            "\"maxFilled\" : %i,%s"
-		            "\"full\" : %s%s"
-		            "}",
-		            eol,
-		            eol,
-		            ctx->sq_size,
-		            eol,
-		            ctx->sq_head - ctx->sq_tail,
-		            eol,
-		            ctx->sq_max_fill,
-		            eol,
-		            (ctx->sq_blocked ? "true" : "false"),
-		            eol);
-		context_info_length += mg_str_append(&buffer, end, block);
+		if (ctx->sq != NULL) {
+			int sq_size = 0, sq_filled = 0, sq_max_fill = 0, sq_blocked = 0;
+			unsigned int i;
+			for (i = 0; i < ctx->num_acceptors; i++) {
+				sq_size += ctx->sq[i].sq_size;
+				sq_filled += socket_queue_filled(&ctx->sq[i]);
+				sq_max_fill += ctx->sq[i].sq_max_fill;
+				sq_blocked |= ctx->sq[i].sq_blocked;
+			}
+			mg_snprintf(NULL,
+			            NULL,
+			            block,
+			            sizeof(block),
+			            ",%s\"queue\" : {%s"
+			            "\"acceptors\" : %u,%s"
+			            "\"length\" : %i,%s"
+			            "\"filled\" : %i,%s"
+			            "\"maxFilled\" : %i,%s"
+			            "\"highWater\" : %i,%s"
+			            "\"rejected\" : %lu,%s"
+			            "\"full\" : %s%s"
+			            "}",
+			            eol,
+			            eol,
+			            ctx->num_acceptors,
+			            eol,
+			            sq_size,
+			            eol,
+			            sq_filled,
+			            eol,
+			            sq_max_fill,
+			            eol,
+			            ctx->sq_high_water,
+			            eol,
+			            (unsigned long)ctx->total_rejected,
+			            eol,
+			            (sq_blocked ? "true" : "false"),
+			            eol);
+			context_info_length += mg_str_append(&buffer, end, block);
+		}
 #endif
 
 		/* Requests information */
@@ -22968,14 +26452,149 @@ mg_get_context_info(const struct mg_context *ctx, char *buffer, int buflen)
 		            block,
 		            sizeof(block),
 		            ",%s\"requests\" : {%s"
-		            "\"total\" : %lu%s"
+		            "\"total\" : %lu,%s"
+		            "\"maxArena\" : %lu%s"
 		            "}",
 		            eol,
 		            eol,
 		            (unsigned long)ctx->total_requests,
+		            eol,
+		            (unsigned long)ctx->max_request_arena,
 		            eol);
 		context_info_length += mg_str_append(&buffer, end, block);
 
+		/* Static file metadata cache */
+#if !defined(NO_FILESYSTEMS)
+		if (ctx->file_cache != NULL) {
+			unsigned fc_entries, fc_open;
+			unsigned long fc_hits, fc_misses;
+			file_cache_get_stats(
+			    ctx->file_cache, &fc_entries, &fc_open, &fc_hits, &fc_misses);
+			mg_snprintf(NULL,
+			            NULL,
+			            block,
+			            sizeof(block),
+			            ",%s\"fileCache\" : {%s"
+			            "\"entries\" : %u,%s"
+			            "\"openFiles\" : %u,%s"
+			            "\"hits\" : %lu,%s"
+			            "\"misses\" : %lu%s"
+			            "}",
+			            eol,
+			            eol,
+			            fc_entries,
+			            eol,
+			            fc_open,
+			            eol,
+			            fc_hits,
+			            eol,
+			            fc_misses,
+			            eol);
+			context_info_length += mg_str_append(&buffer, end, block);
+		}
+		{
+			/* Memory caches for static files */
+			static const char *mc_names[2] = {"memoryCache",
+			                                  "compressionCache"};
+			struct mg_memory_cache *mc_list[2];
+			int mc_idx;
+
+			mc_list[0] = ctx->memory_cache;
+#if defined(USE_ZLIB)
+			mc_list[1] = ctx->compression_cache;
+#else
+			mc_list[1] = NULL;
+#endif
+			for (mc_idx = 0; mc_idx < 2; mc_idx++) {
+				struct mg_memory_cache *mc = mc_list[mc_idx];
+				unsigned mc_entries;
+				uint64_t mc_size;
+				unsigned long mc_hits, mc_misses, mc_evictions;
+
+				if (mc == NULL) {
+					continue;
+				}
+				memory_cache_get_stats(mc,
+				                       &mc_entries,
+				                       &mc_size,
+				                       &mc_hits,
+				                       &mc_misses,
+				                       &mc_evictions);
+				mg_snprintf(NULL,
+				            NULL,
+				            block,
+				            sizeof(block),
+				            ",%s\"%s\" : {%s"
+				            "\"entries\" : %u,%s"
+				            "\"size\" : %" UINT64_FMT ",%s"
+				            "\"hits\" : %lu,%s"
+				            "\"misses\" : %lu,%s"
+				            "\"evictions\" : %lu%s"
+				            "}",
+				            eol,
+				            mc_names[mc_idx],
+				            eol,
+				            mc_entries,
+				            eol,
+				            mc_size,
+				            eol,
+				            mc_hits,
+				            eol,
+				            mc_misses,
+				            eol,
+				            mc_evictions,
+				            eol);
+				context_info_length += mg_str_append(&buffer, end, block);
+			}
+		}
+#if defined(ACCESS_LOG_ASYNC)
+		if (ctx->access_log != NULL) {
+			unsigned long al_lines, al_dropped;
+			access_log_get_stats(ctx->access_log, &al_lines, &al_dropped);
+			mg_snprintf(NULL,
+			            NULL,
+			            block,
+			            sizeof(block),
+			            ",%s\"accessLog\" : {%s"
+			            "\"lines\" : %lu,%s"
+			            "\"dropped\" : %lu%s"
+			            "}",
+			            eol,
+			            eol,
+			            al_lines,
+			            eol,
+			            al_dropped,
+			            eol);
+			context_info_length += mg_str_append(&buffer, end, block);
+		}
+#endif
+#endif
+#if defined(USE_LUA)
+		if (ctx->lua_pool != NULL) {
+			unsigned lp_idle;
+			unsigned long lp_created, lp_reused;
+			lua_pool_get_stats(ctx->lua_pool, &lp_idle, &lp_created, &lp_reused);
+			mg_snprintf(NULL,
+			            NULL,
+			            block,
+			            sizeof(block),
+			            ",%s\"luaStatePool\" : {%s"
+			            "\"idle\" : %u,%s"
+			            "\"created\" : %lu,%s"
+			            "\"reused\" : %lu%s"
+			            "}",
+			            eol,
+			            eol,
+			            lp_idle,
+			            eol,
+			            lp_created,
+			            eol,
+			            lp_reused,
+			            eol);
+			context_info_length += mg_str_append(&buffer, end, block);
+		}
+#endif
+
 		/* Data information */
 		total_data_read =
 		    mg_atomic_add64((volatile int64_t *)&ctx->total_data_read, 0);
@@ -23337,7 +26956,8 @@ mg_get_connection_info(const struct mg_context *ctx,
 		            sizeof(block),
 		            "%s%s\"data\" : {%s"
 		            "\"read\" : %" INT64_FMT ",%s"
-		            "\"written\" : %" INT64_FMT "%s"
+		            "\"written\" : %" INT64_FMT ",%s"
+		            "\"arena\" : %lu%s"
 		            "}",
 		            (connection_info_length > 1 ? "," : ""),
 		            eol,
@@ -23345,6 +26965,8 @@ mg_get_connection_info(const struct mg_context *ctx,
 		            conn->consumed_content,
 		            eol,
 		            conn->num_bytes_sent,
+		            eol,
+		            (unsigned long)conn->arena_used,
 		            eol);
 		connection_info_length += mg_str_append(&buffer, end, block);
 	}
@@ -23505,6 +27127,13 @@ mg_init_library(unsigned features)
 				strcpy(all_methods, http_methods[i].name);
 			}
 		}
+
+		/* Select the character scanner for the HTTP parser */
+		scan_init();
+#if defined(USE_HTTP2)
+		/* Build the HPACK Huffman coding tables */
+		hpack_init();
+#endif
 	}
 
 #if defined(USE_LUA)
@@ -0,0 +1,573 @@
+/* file_cache.inl
+ *
+ * Metadata cache for static files.
+ *
+ * Serving a static file takes several file system calls: stat for the
+ * requested path (and for index files and *.gz variants), then open,
+ * fcntl and close. If static_file_stat_cache_size is set, the results are
+ * kept in a bounded hash table, keyed by the resolved file path. Each
+ * entry holds the file status, the Etag, the MIME type and (not on
+ * Windows) an open file descriptor. Paths that do not exist are cached as
+ * well, so looking for index files and *.gz variants costs no system call
+ * either.
+ *
+ * The table is split into shards with one mutex each. Entries expire after
+ * static_file_stat_cache_ttl_ms, files modified by a PUT, DELETE, MKCOL,
+ * MOVE or COPY request of this server are removed immediately (for a
+ * directory, together with all entries below it).
+ *
+ * This file is part of the CivetWeb project.
+ */
+
+#if defined(NO_FILESYSTEMS)
+#error "This file must only be included, if NO_FILESYSTEMS is not set"
+#endif
+
+/* Number of shards, must be a power of 2 */
+#if !defined(MG_FILE_CACHE_SHARDS)
+#define MG_FILE_CACHE_SHARDS (16)
+#endif
+
+mg_static_assert((MG_FILE_CACHE_SHARDS & (MG_FILE_CACHE_SHARDS - 1)) == 0,
+                 "MG_FILE_CACHE_SHARDS must be a power of 2");
+
+
+struct mg_file_cache_shard;
+
+struct mg_file_cache_entry {
+	struct mg_file_cache_entry *hash_next;
+	struct mg_file_cache_entry *lru_prev; /* more recently used */
+	struct mg_file_cache_entry *lru_next; /* less recently used */
+	struct mg_file_cache_shard *shard;
+	uint64_t expire; /* mg_get_current_time_ns(), 0 = never */
+	uint32_t hash;
+	int refs;     /* Users of this entry */
+	int unlinked; /* Removed from the shard: free with the last reference */
+
+	/* Set when the entry is created, constant afterwards */
+	int found; /* 0 = path does not exist */
+	struct mg_file_stat stat;
+	char etag[64];
+
+	/* Set later, protected by the shard mutex */
+	int fd; /* Open regular file, or -1 */
+	const struct mg_domain_context *mime_dom; /* mime is valid for this
+	                                           * domain only */
+	struct vec mime;
+
+	char path[1]; /* Allocated together with the entry */
+};
+
+struct mg_file_cache_shard {
+	pthread_mutex_t mutex;
+	struct mg_file_cache_entry **buckets;
+	uint32_t bucket_mask;
+	struct mg_file_cache_entry lru; /* List head, lru.lru_next is the most
+	                                 * recently used entry */
+	unsigned count;
+	unsigned max_count;
+	uint64_t ttl_ns; /* 0 = entries do not expire */
+	unsigned long hits;
+	unsigned long misses;
+};
+
+struct mg_file_cache {
+	struct mg_file_cache_shard shard[MG_FILE_CACHE_SHARDS];
+};
+
+
+static uint32_t
+file_cache_hash(const char *path)
+{
+	/* FNV-1a */
+	uint32_t h = 2166136261u;
+	while (*path) {
+		h ^= (uint8_t)*path++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+
+/* Check if path is dir, or a path below the directory dir */
+static int
+file_cache_path_is_below(const char *path, const char *dir, size_t dir_len)
+{
+	if (strncmp(path, dir, dir_len)) {
+		return 0;
+	}
+	return (path[dir_len] == 0) || (path[dir_len] == '/')
+	       || ((dir_len > 0) && (dir[dir_len - 1] == '/'));
+}
+
+
+static struct mg_file_cache_shard *
+file_cache_shard(struct mg_file_cache *fc, uint32_t hash)
+{
+	/* The lower bits select the bucket */
+	return &fc->shard[(hash >> 24) & (MG_FILE_CACHE_SHARDS - 1)];
+}
+
+
+static void
+file_cache_entry_free(struct mg_file_cache_entry *e)
+{
+#if !defined(_WIN32)
+	if (e->fd >= 0) {
+		close(e->fd);
+	}
+#endif
+	mg_free(e);
+}
+
+
+/* Remove an entry from its shard. The shard mutex must be locked. */
+static void
+file_cache_unlink(struct mg_file_cache_shard *s, struct mg_file_cache_entry *e)
+{
+	struct mg_file_cache_entry **pp = &s->buckets[e->hash & s->bucket_mask];
+
+	while (*pp != e) {
+		pp = &(*pp)->hash_next;
+	}
+	*pp = e->hash_next;
+	e->lru_prev->lru_next = e->lru_next;
+	e->lru_next->lru_prev = e->lru_prev;
+	s->count--;
+
+	if (e->refs == 0) {
+		file_cache_entry_free(e);
+	} else {
+		e->unlinked = 1;
+	}
+}
+
+
+/* Find a valid entry and mark it as most recently used. Expired entries
+ * are removed. The shard mutex must be locked. */
+static struct mg_file_cache_entry *
+file_cache_find(struct mg_file_cache_shard *s,
+                uint32_t hash,
+                const char *path,
+                uint64_t now)
+{
+	struct mg_file_cache_entry *e = s->buckets[hash & s->bucket_mask];
+
+	while ((e != NULL) && ((e->hash != hash) || strcmp(e->path, path))) {
+		e = e->hash_next;
+	}
+	if (e == NULL) {
+		return NULL;
+	}
+	if ((e->expire != 0) && (now >= e->expire)) {
+		file_cache_unlink(s, e);
+		return NULL;
+	}
+
+	if (s->lru.lru_next != e) {
+		e->lru_prev->lru_next = e->lru_next;
+		e->lru_next->lru_prev = e->lru_prev;
+		e->lru_prev = &s->lru;
+		e->lru_next = s->lru.lru_next;
+		s->lru.lru_next->lru_prev = e;
+		s->lru.lru_next = e;
+	}
+	return e;
+}
+
+
+/* Add a new entry, evict the least recently used one if the shard is
+ * full. The shard mutex must be locked. */
+static void
+file_cache_insert(struct mg_file_cache_shard *s, struct mg_file_cache_entry *e)
+{
+	struct mg_file_cache_entry **bucket = &s->buckets[e->hash & s->bucket_mask];
+
+	while (s->count >= s->max_count) {
+		file_cache_unlink(s, s->lru.lru_prev);
+	}
+
+	e->hash_next = *bucket;
+	*bucket = e;
+	e->lru_prev = &s->lru;
+	e->lru_next = s->lru.lru_next;
+	s->lru.lru_next->lru_prev = e;
+	s->lru.lru_next = e;
+	s->count++;
+}
+
+
+/* Get the entry for path with an additional reference. If there is no
+ * entry and load is set, a new one is created using mg_stat.
+ * Returns NULL if there is no entry (or not enough memory). */
+static struct mg_file_cache_entry *
+file_cache_get(struct mg_file_cache *fc,
+               const struct mg_connection *conn,
+               const char *path,
+               int load)
+{
+	uint32_t hash = file_cache_hash(path);
+	struct mg_file_cache_shard *s = file_cache_shard(fc, hash);
+	struct mg_file_cache_entry *e, *new_entry;
+	struct mg_file_stat filestat;
+	uint64_t now = mg_get_current_time_ns();
+	size_t path_len;
+	int found;
+
+	pthread_mutex_lock(&s->mutex);
+	e = file_cache_find(s, hash, path, now);
+	if (e != NULL) {
+		e->refs++;
+		s->hits++;
+	} else if (load) {
+		s->misses++;
+	}
+	pthread_mutex_unlock(&s->mutex);
+	if ((e != NULL) || !load) {
+		return e;
+	}
+
+	/* Not in the cache: call stat without holding the lock */
+	found = mg_stat(conn, path, &filestat);
+
+	path_len = strlen(path);
+	new_entry = (struct mg_file_cache_entry *)
+	    mg_calloc_ctx(1, sizeof(*new_entry) + path_len, conn->phys_ctx);
+	if (new_entry == NULL) {
+		return NULL;
+	}
+	new_entry->shard = s;
+	new_entry->expire = (s->ttl_ns > 0) ? (now + s->ttl_ns) : 0;
+	new_entry->hash = hash;
+	new_entry->refs = 1;
+	new_entry->found = found;
+	new_entry->stat = filestat;
+	new_entry->fd = -1;
+	memcpy(new_entry->path, path, path_len + 1);
+	if (found) {
+		construct_etag(new_entry->etag, sizeof(new_entry->etag), &filestat);
+	}
+
+	pthread_mutex_lock(&s->mutex);
+	e = file_cache_find(s, hash, path, now);
+	if (e != NULL) {
+		/* Another thread has been faster */
+		e->refs++;
+	} else {
+		file_cache_insert(s, new_entry);
+	}
+	pthread_mutex_unlock(&s->mutex);
+
+	if (e != NULL) {
+		mg_free(new_entry);
+		return e;
+	}
+	return new_entry;
+}
+
+
+static void
+mg_file_cache_release(struct mg_file_cache_entry *e)
+{
+	struct mg_file_cache_shard *s = e->shard;
+	int do_free;
+
+	pthread_mutex_lock(&s->mutex);
+	e->refs--;
+	do_free = (e->unlinked && (e->refs == 0));
+	pthread_mutex_unlock(&s->mutex);
+
+	if (do_free) {
+		file_cache_entry_free(e);
+	}
+}
+
+
+/* Free the cache. No other thread must use it anymore. */
+static void
+mg_file_cache_free(struct mg_file_cache *fc)
+{
+	struct mg_file_cache_entry *e, *next;
+	int i;
+
+	if (fc == NULL) {
+		return;
+	}
+	for (i = 0; i < MG_FILE_CACHE_SHARDS; i++) {
+		struct mg_file_cache_shard *s = &fc->shard[i];
+		for (e = s->lru.lru_next; e != &s->lru; e = next) {
+			next = e->lru_next;
+			file_cache_entry_free(e);
+		}
+		mg_free(s->buckets);
+		pthread_mutex_destroy(&s->mutex);
+	}
+	mg_free(fc);
+}
+
+
+static struct mg_file_cache *
+mg_file_cache_create(struct mg_context *ctx,
+                     unsigned max_entries,
+                     unsigned ttl_ms)
+{
+	struct mg_file_cache *fc;
+	unsigned max_count, num_buckets;
+	int i;
+
+	(void)ctx; /* unused, if memory statistics are disabled */
+	fc = (struct mg_file_cache *)mg_calloc_ctx(1, sizeof(*fc), ctx);
+	if (fc == NULL) {
+		return NULL;
+	}
+
+	max_count = (max_entries + MG_FILE_CACHE_SHARDS - 1) / MG_FILE_CACHE_SHARDS;
+	num_buckets = 1;
+	while (num_buckets < max_count) {
+		num_buckets <<= 1;
+	}
+
+	for (i = 0; i < MG_FILE_CACHE_SHARDS; i++) {
+		struct mg_file_cache_shard *s = &fc->shard[i];
+		pthread_mutex_init(&s->mutex, &pthread_mutex_attr);
+		s->buckets = (struct mg_file_cache_entry **)
+		    mg_calloc_ctx(num_buckets, sizeof(s->buckets[0]), ctx);
+		s->bucket_mask = num_buckets - 1;
+		s->lru.lru_next = s->lru.lru_prev = &s->lru;
+		s->max_count = max_count;
+		s->ttl_ns = (uint64_t)ttl_ms * 1000000u;
+	}
+	for (i = 0; i < MG_FILE_CACHE_SHARDS; i++) {
+		if (fc->shard[i].buckets == NULL) {
+			mg_file_cache_free(fc);
+			return NULL;
+		}
+	}
+	return fc;
+}
+
+
+/* Remove path and all entries below it (if path is a directory) from the
+ * cache and from the memory cache, after it has been modified.
+ * Entries below path are in all shards, so every shard is searched. */
+static void
+mg_file_cache_invalidate(struct mg_context *ctx, const char *path)
+{
+	struct mg_file_cache_shard *s;
+	struct mg_file_cache_entry *e, *next;
+	size_t path_len;
+	int i;
+
+	mg_memory_cache_invalidate(ctx, path);
+	if ((ctx == NULL) || (ctx->file_cache == NULL) || (path == NULL)) {
+		return;
+	}
+	path_len = strlen(path);
+
+	for (i = 0; i < MG_FILE_CACHE_SHARDS; i++) {
+		s = &ctx->file_cache->shard[i];
+		pthread_mutex_lock(&s->mutex);
+		for (e = s->lru.lru_next; e != &s->lru; e = next) {
+			next = e->lru_next;
+			if (file_cache_path_is_below(e->path, path, path_len)) {
+				file_cache_unlink(s, e);
+			}
+		}
+		pthread_mutex_unlock(&s->mutex);
+	}
+}
+
+
+/* Like mg_stat, but use the file cache if it is enabled */
+static int
+mg_stat_cached(const struct mg_connection *conn,
+               const char *path,
+               struct mg_file_stat *filep)
+{
+	struct mg_file_cache_entry *e;
+	int found;
+
+	if ((conn == NULL) || (conn->phys_ctx->file_cache == NULL)
+	    || (filep == NULL)) {
+		return mg_stat(conn, path, filep);
+	}
+	if (mg_path_suspicious(conn, path)) {
+		memset(filep, 0, sizeof(*filep));
+		return 0;
+	}
+
+	e = file_cache_get(conn->phys_ctx->file_cache, conn, path, 1);
+	if (e == NULL) {
+		return mg_stat(conn, path, filep);
+	}
+	*filep = e->stat;
+	found = e->found;
+	mg_file_cache_release(e);
+	return found;
+}
+
+
+/* Like mg_fopen(conn, path, MG_FOPEN_MODE_READ, filep), but use the file
+ * descriptor of the file cache if it is enabled. In this case,
+ * filep->access.fp is NULL and filep->access.cached holds a reference to
+ * the cache entry until mg_fclose is called. The descriptor is shared by
+ * all threads, so it must only be used with explicit offsets (sendfile,
+ * pread). */
+static int
+mg_fopen_cached(const struct mg_connection *conn,
+                const char *path,
+                struct mg_file *filep)
+{
+#if !defined(_WIN32)
+	struct mg_file_cache_entry *e = NULL;
+	struct stat st;
+	int fd;
+
+	if ((conn != NULL) && (conn->phys_ctx->file_cache != NULL)
+	    && (filep != NULL) && !mg_path_suspicious(conn, path)) {
+		e = file_cache_get(conn->phys_ctx->file_cache, conn, path, 1);
+	}
+	if ((e != NULL) && e->found && !e->stat.is_directory) {
+		pthread_mutex_lock(&e->shard->mutex);
+		fd = e->fd;
+		pthread_mutex_unlock(&e->shard->mutex);
+
+		if (fd < 0) {
+#if defined(O_CLOEXEC)
+			fd = open(path, O_RDONLY | O_CLOEXEC);
+#else
+			fd = open(path, O_RDONLY);
+			if (fd >= 0) {
+				set_close_on_exec(fd, conn, NULL);
+			}
+#endif
+			/* Keep only regular files that still match the cached status
+			 * (no pipes, devices, or files modified after stat) */
+			if ((fd >= 0)
+			    && ((fstat(fd, &st) != 0) || !S_ISREG(st.st_mode)
+			        || ((uint64_t)st.st_size != e->stat.size)
+			        || (st.st_mtime != e->stat.last_modified))) {
+				close(fd);
+				fd = -1;
+			}
+			if (fd >= 0) {
+				pthread_mutex_lock(&e->shard->mutex);
+				if (e->fd < 0) {
+					e->fd = fd;
+				} else {
+					/* Opened by another thread in the meantime */
+					close(fd);
+					fd = e->fd;
+				}
+				pthread_mutex_unlock(&e->shard->mutex);
+			}
+		}
+
+		if (fd >= 0) {
+			filep->stat = e->stat;
+			filep->access.fp = NULL;
+			filep->access.cached = e;
+			return 1;
+		}
+	}
+	if (e != NULL) {
+		mg_file_cache_release(e);
+	}
+#endif /* !_WIN32 */
+
+	return mg_fopen(conn, path, MG_FOPEN_MODE_READ, filep);
+}
+
+
+#if !defined(_WIN32)
+/* Send part of a file opened by mg_fopen_cached, if sendfile can not be
+ * used */
+static void
+file_cache_send_data(struct mg_connection *conn,
+                     const struct mg_file_cache_entry *e,
+                     int64_t offset,
+                     int64_t len)
+{
+	char buf[MG_BUF_LEN];
+	ssize_t num_read;
+	size_t to_read;
+
+	while (len > 0) {
+		to_read = (len > (int64_t)sizeof(buf)) ? sizeof(buf) : (size_t)len;
+		num_read = pread(e->fd, buf, to_read, (off_t)offset);
+		if ((num_read < 0) && (ERRNO == EINTR)) {
+			continue;
+		}
+		if ((num_read <= 0)
+		    || (mg_write(conn, buf, (size_t)num_read) != (int)num_read)) {
+			break;
+		}
+		offset += num_read;
+		len -= num_read;
+	}
+}
+#endif
+
+
+/* get_mime_type, using the result stored in the cache entry of path */
+static void
+get_cached_mime_type(struct mg_connection *conn,
+                     const char *path,
+                     struct vec *vec)
+{
+	struct mg_file_cache_entry *e = NULL;
+	int found = 0;
+
+	if ((conn != NULL) && (conn->phys_ctx->file_cache != NULL)) {
+		e = file_cache_get(conn->phys_ctx->file_cache, conn, path, 0);
+	}
+	if (e != NULL) {
+		pthread_mutex_lock(&e->shard->mutex);
+		if (e->mime_dom == conn->dom_ctx) {
+			*vec = e->mime;
+			found = 1;
+		}
+		pthread_mutex_unlock(&e->shard->mutex);
+	}
+
+	if (!found) {
+		get_mime_type(conn, path, vec);
+		if (e != NULL) {
+			pthread_mutex_lock(&e->shard->mutex);
+			e->mime = *vec;
+			e->mime_dom = conn->dom_ctx;
+			pthread_mutex_unlock(&e->shard->mutex);
+		}
+	}
+	if (e != NULL) {
+		mg_file_cache_release(e);
+	}
+}
+
+
+#if defined(USE_SERVER_STATS)
+static void
+file_cache_get_stats(struct mg_file_cache *fc,
+                     unsigned *entries,
+                     unsigned *open_files,
+                     unsigned long *hits,
+                     unsigned long *misses)
+{
+	struct mg_file_cache_entry *e;
+	int i;
+
+	*entries = *open_files = 0;
+	*hits = *misses = 0;
+	for (i = 0; i < MG_FILE_CACHE_SHARDS; i++) {
+		struct mg_file_cache_shard *s = &fc->shard[i];
+		pthread_mutex_lock(&s->mutex);
+		*entries += s->count;
+		*hits += s->hits;
+		*misses += s->misses;
+		for (e = s->lru.lru_next; e != &s->lru; e = e->lru_next) {
+			*open_files += (e->fd >= 0) ? 1 : 0;
+		}
+		pthread_mutex_unlock(&s->mutex);
+	}
+}
+#endif
@@ -386,7 +386,7 @@ mg_handle_form_request(struct mg_connection *conn,
 		return field_count;
 	}
 
-	content_type = mg_get_header(conn, "Content-Type");
+	content_type = mg_get_header_id(conn, MG_HDR_CONTENT_TYPE);
 
 	if (!content_type
 	    || !mg_strncasecmp(content_type,
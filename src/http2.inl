@@ -27,7 +27,8 @@ static struct mg_header hpack_predefined[62] = {{NULL, NULL},
                                                 {":status", "404"},
                                                 {":status", "500"},
                                                 {"accept-charset", NULL},
-                                                {"accept-encoding", NULL},
+                                                {"accept-encoding",
+                                                 "gzip, deflate"},
                                                 {"accept-language", NULL},
                                                 {"accept-ranges", NULL},
                                                 {"accept", NULL},
@@ -601,49 +602,226 @@ struct {
     {(uint8_t)256, 30, 0x3fffffff} /* filling/termination */
 };
 
-/* highest value with 5, 6, 7, ... 28, 29, 30 and all (32) bits */
-uint32_t hpack_huff_end_code[] = {0x9,       0x2d,       0x7b,       0xfd,
-                                  0,         0x3fc,      0x7fc,      0xffb,
-                                  0x1ffd,    0x3ffd,     0x7ffe,     0,
-                                  0,         0,          0x7fff2,    0xfffed,
-                                  0x1fffe8,  0x3fffeb,   0x7ffff4,   0xfffff5,
-                                  0x1ffffef, 0x3ffffee,  0x7fffff0,  0xffffffe,
-                                  0,         0x3ffffffe, 0xFFFFFFFFu};
+/* Huffman coding tables, built from hpack_huff_dec by hpack_init.
+ *
+ * The decoder is a state machine that consumes 4 bits per step. A state is
+ * an inner node of the Huffman tree (0 is the root); a transition records
+ * the symbol completed on the way (a 4 bit step completes at most one
+ * symbol, since the shortest code has 5 bits), the node reached, and
+ * whether the input may end there: the bits since the last symbol must be
+ * a prefix of EOS, i.e. all ones and at most 7 bits (RFC 7541, 5.2). */
+#define HPACK_HUFF_SYM (1)    /* a symbol has been completed */
+#define HPACK_HUFF_ACCEPT (2) /* the string may end here */
+#define HPACK_HUFF_FAIL (4)   /* EOS in the string */
+
+struct hpack_huff_step {
+	uint8_t next;
+	uint8_t flags;
+	uint8_t sym;
+};
+
+static struct hpack_huff_step hpack_huff_fsm[256][16];
+
+/* Encoder: code and code length for every octet */
+static uint32_t hpack_huff_code[256];
+static uint8_t hpack_huff_bits[256];
+
 
-/* lowest index with 5, 6, 7, ... 28, 29, 30 and all (32) bits */
-uint8_t hpack_huff_start_index[] = {0,   10,  36,  68,  0,   74,  79, 82,  84,
-                                    90,  92,  0,   0,   0,   95,  98, 106, 119,
-                                    145, 174, 186, 190, 205, 224, 0,  253, 0};
+static void
+hpack_init(void)
+{
+	/* Children of the inner nodes for bit 0 and 1: an inner node (>0,
+	 * the root is never a child), or a leaf (-1 - symbol, EOS is 256) */
+	int16_t tree[256][2];
+	uint8_t depth[256], eos_prefix[256];
+	struct hpack_huff_step *step;
+	int num_nodes = 1;
+	int i, b, bit, sym, node, child, state, v;
+
+	memset(tree, 0, sizeof(tree));
+	depth[0] = 0;
+	eos_prefix[0] = 1;
+
+	for (i = 0; i <= 256; i++) {
+		sym = (i == 256) ? 256 : hpack_huff_dec[i].decoded;
+		node = 0;
+		for (b = hpack_huff_dec[i].bitcount - 1; b > 0; b--) {
+			bit = (int)((hpack_huff_dec[i].encoded >> b) & 1u);
+			if (tree[node][bit] == 0) {
+				tree[node][bit] = (int16_t)num_nodes;
+				depth[num_nodes] = (uint8_t)(depth[node] + 1);
+				eos_prefix[num_nodes] =
+				    (uint8_t)(eos_prefix[node] && bit && (depth[node] < 7));
+				num_nodes++;
+			}
+			node = tree[node][bit];
+		}
+		tree[node][hpack_huff_dec[i].encoded & 1u] = (int16_t)(-1 - sym);
+		if (sym < 256) {
+			hpack_huff_code[sym] = hpack_huff_dec[i].encoded;
+			hpack_huff_bits[sym] = hpack_huff_dec[i].bitcount;
+		}
+	}
+	DEBUG_ASSERT(num_nodes == 256);
+
+	for (state = 0; state < 256; state++) {
+		for (v = 0; v < 16; v++) {
+			step = &hpack_huff_fsm[state][v];
+			step->flags = 0;
+			step->sym = 0;
+			node = state;
+			for (b = 3; b >= 0; b--) {
+				child = tree[node][(v >> b) & 1];
+				if (child > 0) {
+					node = child;
+				} else if (child == -1 - 256) {
+					step->flags = HPACK_HUFF_FAIL;
+					break;
+				} else {
+					step->flags |= HPACK_HUFF_SYM;
+					step->sym = (uint8_t)(-1 - child);
+					node = 0;
+				}
+			}
+			step->next = (uint8_t)node;
+			if (!(step->flags & HPACK_HUFF_FAIL) && eos_prefix[node]) {
+				step->flags |= HPACK_HUFF_ACCEPT;
+			}
+		}
+	}
+}
+
+
+/* Decode the Huffman encoded string src of len bytes to dst, which must
+ * hold len * 8 / 5 bytes. Return the decoded length, or -1 if src is not a
+ * valid encoding. */
+static int
+hpack_huff_decode(char *dst, const uint8_t *src, int len)
+{
+	const struct hpack_huff_step *step;
+	uint8_t state = 0;
+	uint8_t flags = HPACK_HUFF_ACCEPT;
+	int i, n = 0;
+
+	for (i = 0; i < len; i++) {
+		step = &hpack_huff_fsm[state][src[i] >> 4];
+		if (step->flags & HPACK_HUFF_SYM) {
+			dst[n++] = (char)step->sym;
+		}
+		flags = step->flags;
+		step = &hpack_huff_fsm[step->next][src[i] & 0x0F];
+		if (step->flags & HPACK_HUFF_SYM) {
+			dst[n++] = (char)step->sym;
+		}
+		if ((flags | step->flags) & HPACK_HUFF_FAIL) {
+			return -1;
+		}
+		state = step->next;
+		flags = step->flags;
+	}
+	return (flags & HPACK_HUFF_ACCEPT) ? n : -1;
+}
+
+
+/* Length of str in bytes after Huffman encoding */
+static size_t
+hpack_huff_len(const char *str, size_t len)
+{
+	size_t i, bits = 0;
+
+	for (i = 0; i < len; i++) {
+		bits += hpack_huff_bits[(uint8_t)str[i]];
+	}
+	return (bits + 7) / 8;
+}
+
+
+/* Huffman encode str to dst. Return the length written to dst. */
+static size_t
+hpack_huff_encode(uint8_t *dst, const char *str, size_t len)
+{
+	uint64_t acc = 0;
+	unsigned bits = 0;
+	size_t i, n = 0;
+	uint8_t c;
+
+	for (i = 0; i < len; i++) {
+		c = (uint8_t)str[i];
+		acc = (acc << hpack_huff_bits[c]) | hpack_huff_code[c];
+		bits += hpack_huff_bits[c];
+		while (bits >= 8) {
+			bits -= 8;
+			dst[n++] = (uint8_t)(acc >> bits);
+		}
+	}
+	if (bits > 0) {
+		/* Pad with the most significant bits of EOS */
+		dst[n++] = (uint8_t)((acc << (8 - bits)) | (0xFFu >> bits));
+	}
+	return n;
+}
 
 
 /* Function to decode an integer from a HPACK encoded block */
 /* Integers have a variable size encoding, according to the RFC.
  * The integer starts at index *i, idx_mask masks the available bits in
  * the first byte. The index *i is advanced until the end of the
- * encoded integer.
+ * encoded integer. Return 0 if ok, -1 if the integer exceeds the block
+ * (max_i) or 32 bits.
  */
-static uint64_t
+static int
 hpack_getnum(const uint8_t *buf,
              int *i,
+             int max_i,
              uint8_t idx_mask,
-             struct mg_context *ctx)
+             uint64_t *num)
 {
-	uint64_t num = (buf[*i] & idx_mask);
-
-	(void)ctx;
+	uint32_t M = 0;
 
-	if (num == idx_mask) {
+	if (*i >= max_i) {
+		return -1;
+	}
+	*num = (buf[*i] & idx_mask);
+	if (*num == idx_mask) {
 		/* Algorithm from https://tools.ietf.org/html/rfc7541#section-5.1 */
-		uint32_t M = 0;
 		do {
 			(*i)++;
-			num = num + ((buf[*i] & 0x7F) << M);
+			if ((*i >= max_i) || (M > 28)) {
+				return -1;
+			}
+			*num += (uint64_t)(buf[*i] & 0x7F) << M;
 			M += 7;
 		} while ((buf[*i] & 0x80) == 0x80);
+		if (*num > 0xFFFFFFFFu) {
+			return -1;
+		}
 	}
 
 	(*i)++;
-	return num;
+	return 0;
+}
+
+
+/* Encode num with the prefix bits of the first byte (RFC 7541, 5.1) and
+ * return the length. idx_mask masks the available bits in the first
+ * byte. */
+static int
+hpack_putnum(uint8_t *buf, uint8_t prefix, uint8_t idx_mask, uint32_t num)
+{
+	int n = 1;
+
+	if (num < idx_mask) {
+		buf[0] = (uint8_t)(prefix | num);
+		return 1;
+	}
+	buf[0] = (uint8_t)(prefix | idx_mask);
+	num -= idx_mask;
+	while (num >= 0x80) {
+		buf[n++] = (uint8_t)(0x80 | (num & 0x7F));
+		num >>= 7;
+	}
+	buf[n++] = (uint8_t)num;
+	return n;
 }
 
 
@@ -657,169 +835,226 @@ static char *
 hpack_decode(const uint8_t *buf, int *i, int max_i, struct mg_context *ctx)
 {
 	uint64_t byte_len64;
-	int byte_len;
-	int bit_len;
-	uint8_t is_huff = ((buf[*i] & 0x80) == 0x80);
+	size_t byte_len;
+	int str_len;
+	uint8_t is_huff;
+	char *result;
 
-	/* Get length of string in bytes */
-	byte_len64 = hpack_getnum(buf, i, 0x7f, ctx);
-	if (byte_len64 > 1024) {
-		/* TODO */
+	(void)ctx; /* only used for memory debugging */
+
+	if (*i >= max_i) {
 		return NULL;
 	}
-	byte_len = (int)byte_len64;
-	bit_len = byte_len * 8;
+	is_huff = ((buf[*i] & 0x80) == 0x80);
 
-	/* check size */
-	if ((*i) + byte_len > max_i) {
+	/* Get length of string in bytes */
+	if ((hpack_getnum(buf, i, max_i, 0x7f, &byte_len64) != 0)
+	    || (byte_len64 > (uint64_t)(max_i - *i))) {
 		return NULL;
 	}
+	/* Not more than max_i, so it fits in an int */
+	byte_len = (size_t)byte_len64;
 
 	/* Now read the string */
 	if (!is_huff) {
 		/* Not huffman encoded: Copy directly */
-		char *result = (char *)mg_malloc_ctx(byte_len + 1, ctx);
-		if (result) {
-			memcpy(result, buf + (*i), byte_len);
-			result[byte_len] = 0;
+		result = (char *)mg_malloc_ctx(byte_len + 1, ctx);
+		if (result == NULL) {
+			return NULL;
 		}
-		(*i) += byte_len;
-		return result;
-
+		memcpy(result, buf + (*i), byte_len);
+		str_len = (int)byte_len;
 	} else {
-		/* Huffman encoded: need to decode bitwise */
-		const uint8_t *pData =
-		    buf + (*i);           /* begin pointer of bit input string */
-		int bitRead = 0;          /* number of encoded bits read */
-		uint32_t bytesStored = 0; /* number of decoded bytes stored */
-		uint8_t str[2048];        /* storage buffer for decoded string */
-
-		for (;;) {
-			uint32_t accu = 0; /* accu register: collect bits */
-			uint8_t bc = 0;    /* number of bits collected */
-			int n;
-
-			/* Collect bits in this loop, until we have a valid huff code in
-			 * accu */
-			do {
-				accu <<= 1;
-				accu |= (pData[bitRead / 8] >> (7 - (bitRead & 7))) & 1;
-				bitRead++;
-				bc++;
-				if (bitRead > bit_len) {
-					/* We used all bits. Return the decoded string. */
-					str[bytesStored] = 0; /* Terminate string */
-					(*i) += byte_len;     /* Advance parsing index */
-					return mg_strdup_ctx((char *)str,
-					                     ctx); /* Return a string copy */
-				}
-			} while ((bc < 5) || (accu > hpack_huff_end_code[bc - 5]));
-
-			/* Find matching code in huffman encoding table */
-			for (n = hpack_huff_start_index[bc - 5]; n < 256; n++) {
-				if (accu == hpack_huff_dec[n].encoded) {
-					str[bytesStored] = hpack_huff_dec[n].decoded;
-					bytesStored++;
-					break;
-				}
-			}
-			if (bytesStored == sizeof(str)) {
-				/* too long */
-				return 0;
-			}
+		/* Huffman encoded: the shortest code has 5 bits */
+		result = (char *)mg_malloc_ctx(byte_len * 8 / 5 + 1, ctx);
+		if (result == NULL) {
+			return NULL;
+		}
+		str_len = hpack_huff_decode(result, buf + (*i), (int)byte_len);
+		if (str_len < 0) {
+			mg_free(result);
+			return NULL;
 		}
 	}
+	result[str_len] = 0;
+	(*i) += (int)byte_len;
+	return result;
 }
 
 
-static void
-append_bits(uint8_t *target,
-            uint32_t offset,
-            uint32_t value,
-            uint8_t value_bits)
+/* Encode a string literal, Huffman encoded if this is shorter (RFC 7541,
+ * 5.2). Return the length. */
+static int
+hpack_put_string(uint8_t *buf, const char *str, size_t len)
 {
-	uint32_t offset_bytes = offset / 8;
-	uint32_t offset_bits = offset % 8;
-	uint32_t remaining_bits, ac;
+	size_t huff_len = hpack_huff_len(str, len);
+	int n;
 
-	value &= ~(0xFFFFFFFF << value_bits);
+	if (huff_len < len) {
+		n = hpack_putnum(buf, 0x80, 0x7F, (uint32_t)huff_len);
+		return n + (int)hpack_huff_encode(buf + n, str, len);
+	}
+	n = hpack_putnum(buf, 0x00, 0x7F, (uint32_t)len);
+	memcpy(buf + n, str, len);
+	return n + (int)len;
+}
 
-	remaining_bits = 8 - offset_bits;
 
-	if (value_bits <= remaining_bits) {
-		ac = value << (remaining_bits - value_bits);
-		target[offset_bytes] |= ac;
-		return;
+/* Dynamic table (RFC 7541, 2.3.2 and 4): used for the request headers
+ * received on a connection (in struct mg_http2_connection) and for the
+ * response headers sent on it (in struct mg_http2_session) */
+#define HPACK_TABLE_ENTRIES (HTTP2_HEADER_TABLE_SIZE / 32)
+
+
+/* Remove the oldest entries until the table size is at most size */
+static void
+hpack_table_evict(struct mg_hpack_table *table, uint32_t size)
+{
+	struct mg_hpack_entry *e;
+
+	while (table->size > size) {
+		e = &table->entry[(table->first + table->count - 1)
+		                  % HPACK_TABLE_ENTRIES];
+		table->size -= e->name_len + e->value_len + 32;
+		mg_free(e->name);
+		e->name = NULL;
+		e->value = NULL;
+		table->count--;
 	}
+}
 
-	ac = value >> (value_bits - remaining_bits);
-	target[offset_bytes] |= ac;
-	append_bits(target,
-	            offset + remaining_bits,
-	            value,
-	            value_bits - remaining_bits);
+
+/* Set the maximum table size (at most HTTP2_HEADER_TABLE_SIZE) */
+static void
+hpack_table_resize(struct mg_hpack_table *table, uint32_t max_size)
+{
+	table->max_size = max_size;
+	hpack_table_evict(table, max_size);
 }
 
 
+/* Add an entry to the table (RFC 7541, 4.4). Return 0 if out of memory. */
 static int
-hpack_encode(uint8_t *store, const char *load, int lower)
+hpack_table_add(struct mg_hpack_table *table,
+                const char *name,
+                uint32_t name_len,
+                const char *value,
+                uint32_t value_len,
+                struct mg_context *ctx)
 {
-	uint32_t nohuff_len = strlen(load);
-
-	uint32_t len_bits = 0;
-	uint32_t len_bytes;
-	uint32_t spare_bits;
-	uint32_t i;
-
-	memset(store, 0, nohuff_len + 1);
-
-	for (i = 0; i < nohuff_len; i++) {
-		uint8_t b = (uint8_t)((char)(lower ? tolower(load[i]) : load[i]));
-		int idx;
-
-		for (idx = 0; idx <= 255; idx++) {
-			if (hpack_huff_dec[idx].decoded == b) {
-				append_bits((uint8_t *)store + 1,
-				            len_bits,
-				            hpack_huff_dec[idx].encoded,
-				            hpack_huff_dec[idx].bitcount);
-				len_bits += hpack_huff_dec[idx].bitcount;
-				break;
-			}
-		}
+	uint32_t size = name_len + value_len + 32;
+	struct mg_hpack_entry *e;
+	char *p;
+
+	(void)ctx; /* unused, if memory statistics are disabled */
+	if (size > table->max_size) {
+		/* Adding an entry larger than the table empties the table */
+		hpack_table_evict(table, 0);
+		return 1;
 	}
-
-	len_bytes = (len_bits + 7) / 8;
-	spare_bits = len_bytes * 8 - len_bits;
-	if (spare_bits) {
-		append_bits((uint8_t *)store + 1, len_bits, 0xFFFFFFFF, spare_bits);
+	p = (char *)mg_malloc_ctx(name_len + value_len + 2, ctx);
+	if (p == NULL) {
+		return 0;
 	}
+	hpack_table_evict(table, table->max_size - size);
+
+	memcpy(p, name, name_len);
+	p[name_len] = 0;
+	memcpy(p + name_len + 1, value, value_len);
+	p[name_len + 1 + value_len] = 0;
+
+	table->first =
+	    (table->first + HPACK_TABLE_ENTRIES - 1) % HPACK_TABLE_ENTRIES;
+	e = &table->entry[table->first];
+	e->name = p;
+	e->value = p + name_len + 1;
+	e->name_len = name_len;
+	e->value_len = value_len;
+	table->count++;
+	table->size += size;
+	return 1;
+}
 
-	if (len_bytes >= 127) {
-		// TODO: Shift string and encode len in more bytes
-		return 0;
+
+/* Get the dynamic table entry with the index idx (62 is the newest entry).
+ * Return NULL, if there is no such entry. */
+static const struct mg_hpack_entry *
+hpack_table_get(const struct mg_hpack_table *table, uint64_t idx)
+{
+	if ((idx < 62) || ((idx - 62) >= table->count)) {
+		return NULL;
 	}
-	*store = 0x80 + (uint8_t)len_bytes;
+	return &table->entry[(table->first + (unsigned)(idx - 62))
+	                     % HPACK_TABLE_ENTRIES];
+}
+
 
-	if ((len_bytes >= nohuff_len) && (0)) {
-		*store = (uint8_t)nohuff_len;
-		if (lower) {
-			for (i = 1; i <= nohuff_len; i++) {
-				store[i] = tolower(load[i]);
+/* Encode a header field with the encoder table (RFC 7541, 6). name must be
+ * lower case. Return the length. */
+static int
+hpack_encode_field(struct mg_hpack_table *table,
+                   uint8_t *buf,
+                   const char *name,
+                   const char *value,
+                   struct mg_context *ctx)
+{
+	uint32_t name_len = (uint32_t)strlen(name);
+	uint32_t value_len = (uint32_t)strlen(value);
+	uint32_t name_idx = 0;
+	const struct mg_hpack_entry *e;
+	unsigned k;
+	int j, n;
+
+	/* Look for a full match, and for a match of the name */
+	for (j = 1; j <= 61; j++) {
+		if ((hpack_predefined[j].name[0] == name[0])
+		    && !strcmp(hpack_predefined[j].name, name)) {
+			if ((hpack_predefined[j].value != NULL)
+			    && !strcmp(hpack_predefined[j].value, value)) {
+				return hpack_putnum(buf, 0x80, 0x7F, (uint32_t)j);
+			}
+			if (name_idx == 0) {
+				name_idx = (uint32_t)j;
+			}
+		}
+	}
+	for (k = 0; k < table->count; k++) {
+		e = &table->entry[(table->first + k) % HPACK_TABLE_ENTRIES];
+		if ((e->name_len == name_len) && !memcmp(e->name, name, name_len)) {
+			if ((e->value_len == value_len)
+			    && !memcmp(e->value, value, value_len)) {
+				return hpack_putnum(buf, 0x80, 0x7F, 62 + k);
+			}
+			if (name_idx == 0) {
+				name_idx = 62 + k;
 			}
-		} else {
-			memcpy(store + 1, load, nohuff_len);
 		}
-		return nohuff_len + 1;
-	} else {
-		/*
-		int i = 0;
-		char *test = hpack_decode(store, &i, NULL);
-		i = i; // breakpoint for debugging / testing
-		*/
 	}
 
-	return len_bytes + 1;
+	if (!strcmp(name, "authorization") || !strcmp(name, "set-cookie")
+	    || !strcmp(name, "proxy-authorization")) {
+		/* Sensitive values: never indexed, not even by intermediaries */
+		n = hpack_putnum(buf, 0x10, 0x0F, name_idx);
+	} else if (((name_len + value_len + 32) > (table->max_size / 4 * 3))
+	           || !strcmp(name, "content-length") || !strcmp(name, "etag")
+	           || !strcmp(name, "date") || !strcmp(name, "last-modified")
+	           || !strcmp(name, "content-range")
+	           || !strcmp(name, "location")) {
+		/* Large, changing (date) or rarely repeated values: without indexing */
+		n = hpack_putnum(buf, 0x00, 0x0F, name_idx);
+	} else {
+		/* Incremental indexing. The name index refers to the table before
+		 * the entry is added. If there is no memory, the entry is sent
+		 * without indexing, so both tables remain equal. */
+		n = hpack_putnum(buf, 0x40, 0x3F, name_idx);
+		if (!hpack_table_add(table, name, name_len, value, value_len, ctx)) {
+			n = hpack_putnum(buf, 0x00, 0x0F, name_idx);
+		}
+	}
+	if (name_idx == 0) {
+		n += hpack_put_string(buf + n, name, name_len);
+	}
+	return n + hpack_put_string(buf + n, value, value_len);
 }
 
 
@@ -828,6 +1063,30 @@ hpack_encode(uint8_t *store, const char *load, int lower)
 /***********************************************************************/
 
 
+/* Streams handled at the same time on one connection
+ * (SETTINGS_MAX_CONCURRENT_STREAMS) */
+#if !defined(HTTP2_MAX_CONCURRENT_STREAMS)
+#define HTTP2_MAX_CONCURRENT_STREAMS (100)
+#endif
+
+/* Response data of a stream buffered for the connection thread. If the
+ * buffer is full, mg_write waits. */
+#if !defined(HTTP2_STREAM_BUFFER_SIZE)
+#define HTTP2_STREAM_BUFFER_SIZE (32768)
+#endif
+
+/* Flow control window of the server (default of RFC 7540, 6.9.2). This is
+ * also the size of the request body buffer of a stream. */
+#define HTTP2_INITIAL_WINDOW_SIZE (65535)
+
+/* Largest frame received and sent (SETTINGS_MAX_FRAME_SIZE) */
+#define HTTP2_MAX_FRAME_SIZE (16384)
+
+/* The connection thread collects frames of all streams and sends them
+ * with one write */
+#define HTTP2_WRITE_BUFFER_SIZE (4 * (HTTP2_MAX_FRAME_SIZE + 9))
+
+
 static const char http2_pri[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
 static const unsigned char http2_pri_len = 24; /* = strlen(http2_pri) */
 
@@ -888,7 +1147,12 @@ const struct http2_settings http2_default_settings =
     {4096, 1, UINT32_MAX, 65535, 16384, UINT32_MAX};
 
 const struct http2_settings http2_civetweb_server_settings =
-    {4096, 0, 100, 65535, 16384, 65535};
+    {HTTP2_HEADER_TABLE_SIZE,
+     0,
+     HTTP2_MAX_CONCURRENT_STREAMS,
+     HTTP2_INITIAL_WINDOW_SIZE,
+     HTTP2_MAX_FRAME_SIZE,
+     65535};
 
 
 enum {
@@ -923,27 +1187,27 @@ http2_send_settings(struct mg_connection *conn,
 	mg_xwrite(conn, &id, 2);
 	mg_xwrite(conn, &data, 4);
 
-	id = htons(1);
+	id = htons(2);
 	data = htonl(set->settings_enable_push);
 	mg_xwrite(conn, &id, 2);
 	mg_xwrite(conn, &data, 4);
 
-	id = htons(1);
+	id = htons(3);
 	data = htonl(set->settings_max_concurrent_streams);
 	mg_xwrite(conn, &id, 2);
 	mg_xwrite(conn, &data, 4);
 
-	id = htons(1);
+	id = htons(4);
 	data = htonl(set->settings_initial_window_size);
 	mg_xwrite(conn, &id, 2);
 	mg_xwrite(conn, &data, 4);
 
-	id = htons(1);
+	id = htons(5);
 	data = htonl(set->settings_max_frame_size);
 	mg_xwrite(conn, &id, 2);
 	mg_xwrite(conn, &data, 4);
 
-	id = htons(1);
+	id = htons(6);
 	data = htonl(set->settings_max_header_list_size);
 	mg_xwrite(conn, &id, 2);
 	mg_xwrite(conn, &data, 4);
@@ -952,298 +1216,1081 @@ http2_send_settings(struct mg_connection *conn,
 }
 
 
+/* Streams.
+ * The thread of a HTTP/2 connection reads and writes all frames. The
+ * request of a stream is handled by a stream worker thread (see
+ * http2_workers_create), using a connection structure of its own with
+ * conn->http2.stream set: mg_write appends to the output buffer of the
+ * stream, mg_read takes the request body from its input buffer. The
+ * connection thread sends the output of all streams, interleaving the
+ * DATA frames as allowed by the flow control windows of the peer.
+ * All fields of a stream are protected by the lock of its session. */
+struct mg_http2_session;
+
+static int mg_socketpair(int *sockA, int *sockB); /* see civetweb.c */
+
+struct mg_http2_stream {
+	uint32_t id;
+	struct mg_http2_session *session;
+	struct mg_connection *conn;   /* Connection of the request handler */
+	struct mg_http2_stream *next; /* Queue of the stream workers */
+
+	int64_t send_window; /* Flow control window of the peer */
+	char *headers;       /* Response headers "name\0value\0...", not sent */
+	int headers_len;
+	int headers_max;    /* Upper bound of the encoded HEADERS block */
+	int headers_queued; /* Response headers have been queued */
+	int status;         /* Response status code */
+	char *out;          /* Ring buffer for response data, not sent yet */
+	int out_pos;
+	int out_len;
+
+	char *in; /* Ring buffer for request body data, not read yet */
+	int in_pos;
+	int in_len;
+	int64_t in_window;   /* Flow control window of the server */
+	uint32_t in_unacked; /* Read, but not released by WINDOW_UPDATE yet */
+	int in_end;          /* END_STREAM received */
+
+	int done;          /* Request handler finished */
+	int reset;         /* RST_STREAM received or sent */
+	int send_rst;      /* RST_STREAM with rst_code must be sent */
+	uint32_t rst_code; /* see HTTP2_ERR_* */
+	int end_sent;      /* END_STREAM sent */
+};
+
+struct mg_http2_session {
+	struct mg_connection *conn; /* Physical connection */
+	pthread_mutex_t lock;
+	pthread_cond_t cond; /* Buffer or state of a stream changed */
+	int wake[2];         /* Handlers wake up the connection thread */
+	int wake_pending;
+	int closed;   /* Connection closed: handlers stop reading and writing */
+	int handlers; /* Streams dispatched, but not done */
+	struct mg_http2_stream *streams[HTTP2_MAX_CONCURRENT_STREAMS];
+	unsigned num_streams;
+	unsigned next_stream; /* Round robin position of the writer */
+	uint32_t last_stream_id;
+	int64_t send_window;     /* Connection flow control window of the peer */
+	uint32_t initial_window; /* SETTINGS_INITIAL_WINDOW_SIZE of the peer */
+	uint32_t recv_unacked;   /* Connection level: received, not released */
+	char *wbuf;              /* Frames collected for one write */
+	struct mg_hpack_table enc; /* Encoder table for response headers */
+	int enc_size_update;       /* Signal the encoder table size */
+};
+
+
+static void
+http2_frame_head(uint8_t *head,
+                 uint32_t len,
+                 uint8_t type,
+                 uint8_t flags,
+                 uint32_t stream_id)
+{
+	head[0] = (uint8_t)((len & 0xFF0000u) >> 16);
+	head[1] = (uint8_t)((len & 0xFF00u) >> 8);
+	head[2] = (uint8_t)(len & 0xFFu);
+	head[3] = type;
+	head[4] = flags;
+	head[5] = (uint8_t)((stream_id & 0x7F000000u) >> 24);
+	head[6] = (uint8_t)((stream_id & 0xFF0000u) >> 16);
+	head[7] = (uint8_t)((stream_id & 0xFF00u) >> 8);
+	head[8] = (uint8_t)(stream_id & 0xFFu);
+}
+
+
+static void
+http2_put_u32(uint8_t *p, uint32_t val)
+{
+	p[0] = (uint8_t)((val & 0xFF000000u) >> 24);
+	p[1] = (uint8_t)((val & 0xFF0000u) >> 16);
+	p[2] = (uint8_t)((val & 0xFF00u) >> 8);
+	p[3] = (uint8_t)(val & 0xFFu);
+}
+
+
+/* Frame with a four byte payload (WINDOW_UPDATE, RST_STREAM) */
+static void
+http2_frame_u32(uint8_t *frame,
+                uint8_t type,
+                uint32_t stream_id,
+                uint32_t val)
+{
+	http2_frame_head(frame, 4, type, 0, stream_id);
+	http2_put_u32(frame + 9, val);
+}
+
+
+/* Wake up the connection thread. The session lock must be held. */
+static void
+http2_wake(struct mg_http2_session *hs)
+{
+	if (!hs->wake_pending) {
+		hs->wake_pending = 1;
+		(void)send(hs->wake[1], "", 1, MSG_NOSIGNAL);
+	}
+}
+
+
+/* Wait for a change of the stream state for at most request_timeout_ms.
+ * The session lock must be held. Return 0 on timeout. */
+static int
+http2_wait(struct mg_http2_session *hs, const struct timespec *abstime)
+{
+	struct timespec now;
+
+	pthread_cond_timedwait(&hs->cond, &hs->lock, abstime);
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (now.tv_sec < abstime->tv_sec)
+	       || ((now.tv_sec == abstime->tv_sec)
+	           && (now.tv_nsec < abstime->tv_nsec));
+}
+
+
+static void
+http2_timeout(const struct mg_connection *conn, struct timespec *abstime)
+{
+	int ms = 0;
+
+	if (conn->dom_ctx->config[REQUEST_TIMEOUT]) {
+		ms = atoi(conn->dom_ctx->config[REQUEST_TIMEOUT]);
+	}
+	if (ms <= 0) {
+		ms = atoi(config_options[REQUEST_TIMEOUT].default_value);
+	}
+	clock_gettime(CLOCK_REALTIME, abstime);
+	abstime->tv_sec += ms / 1000;
+	abstime->tv_nsec += (long)(ms % 1000) * 1000000L;
+	if (abstime->tv_nsec >= 1000000000L) {
+		abstime->tv_sec++;
+		abstime->tv_nsec -= 1000000000L;
+	}
+}
+
+
+/* mg_write for a stream: append to the output buffer. Wait, if the buffer
+ * is full. Return len, or -1 if the stream has been reset, the connection
+ * is closed, the peer does not receive data within request_timeout_ms or
+ * no response header has been sent. */
+static int
+http2_stream_write(struct mg_connection *conn, const char *buf, size_t len)
+{
+	struct mg_http2_stream *s = conn->http2.stream;
+	struct mg_http2_session *hs = s->session;
+	struct timespec abstime;
+	size_t total = 0;
+	int n, end;
+
+	if (len > INT_MAX) {
+		return -1;
+	}
+	http2_timeout(conn, &abstime);
+
+	pthread_mutex_lock(&hs->lock);
+	if ((s->out == NULL) && (len > 0)) {
+		s->out = (char *)mg_malloc_ctx(HTTP2_STREAM_BUFFER_SIZE, conn->phys_ctx);
+	}
+	if (!s->headers_queued && !s->reset && !s->send_rst && (len > 0)) {
+		/* HTTP/2 responses must use mg_response_header_*. A handler
+		 * writing a HTTP/1.x response by itself needs HTTP/1.1. */
+		DEBUG_TRACE("HTTP2 stream %u written without response header",
+		            s->id);
+		s->send_rst = 1;
+		s->rst_code = HTTP2_ERR_HTTP_1_1_REQUIRED;
+		http2_wake(hs);
+	}
+	while (total < len) {
+		if ((s->out == NULL) || hs->closed || s->reset || s->send_rst
+		    || !s->headers_queued) {
+			DEBUG_TRACE("HTTP2 cannot write to stream %u", s->id);
+			break;
+		}
+		if (s->out_len == HTTP2_STREAM_BUFFER_SIZE) {
+			if (!http2_wait(hs, &abstime)) {
+				break;
+			}
+			continue;
+		}
+
+		/* Copy up to the end of the free space or of the ring */
+		end = (s->out_pos + s->out_len) % HTTP2_STREAM_BUFFER_SIZE;
+		n = (end >= s->out_pos) ? (HTTP2_STREAM_BUFFER_SIZE - end)
+		                        : (s->out_pos - end);
+		if ((size_t)n > (len - total)) {
+			n = (int)(len - total);
+		}
+		memcpy(s->out + end, buf + total, (size_t)n);
+		s->out_len += n;
+		total += (size_t)n;
+		http2_wake(hs);
+	}
+	pthread_mutex_unlock(&hs->lock);
+
+	return (total == len) ? (int)len : -1;
+}
+
+
+/* mg_read for a stream: read request body data. Wait until len bytes or
+ * the end of the stream have been received. Return the number of bytes
+ * read, or -1 on error. */
+static int
+http2_stream_read(struct mg_connection *conn, void *buf, size_t len)
+{
+	struct mg_http2_stream *s = conn->http2.stream;
+	struct mg_http2_session *hs = s->session;
+	struct timespec abstime;
+	int total = 0, n, error = 0;
+
+	if ((conn->content_len >= 0)
+	    && ((int64_t)len > conn->content_len - conn->consumed_content)) {
+		len = (size_t)(conn->content_len - conn->consumed_content);
+	}
+	http2_timeout(conn, &abstime);
+
+	pthread_mutex_lock(&hs->lock);
+	while ((size_t)total < len) {
+		if (s->in_len == 0) {
+			if (s->in_end) {
+				break;
+			}
+			if (hs->closed || s->reset || !http2_wait(hs, &abstime)) {
+				error = 1;
+				break;
+			}
+			continue;
+		}
+		n = HTTP2_INITIAL_WINDOW_SIZE - s->in_pos;
+		if (n > s->in_len) {
+			n = s->in_len;
+		}
+		if ((size_t)n > (len - (size_t)total)) {
+			n = (int)(len - (size_t)total);
+		}
+		memcpy((char *)buf + total, s->in + s->in_pos, (size_t)n);
+		s->in_pos = (s->in_pos + n) % HTTP2_INITIAL_WINDOW_SIZE;
+		s->in_len -= n;
+		total += n;
+
+		/* Let the peer send more data */
+		s->in_unacked += (uint32_t)n;
+		if (!s->in_end
+		    && (s->in_unacked >= (HTTP2_INITIAL_WINDOW_SIZE / 2))) {
+			http2_wake(hs);
+		}
+	}
+	pthread_mutex_unlock(&hs->lock);
+
+	if ((total == 0) && error) {
+		return -1;
+	}
+	conn->consumed_content += total;
+	return total;
+}
+
+
+/* Queue the response headers: list holds name and value of every header
+ * as nul terminated strings, max is the maximum size of the encoded block.
+ * The HEADERS block is encoded by the connection thread, in the order the
+ * blocks are sent (RFC 7541, 2.2). Return 1 on success. list is freed in
+ * any case. */
+static int
+http2_stream_queue_headers(struct mg_connection *conn,
+                           char *list,
+                           int len,
+                           int max)
+{
+	struct mg_http2_stream *s = conn->http2.stream;
+	struct mg_http2_session *hs = s->session;
+	int ok;
+
+	pthread_mutex_lock(&hs->lock);
+	ok = !hs->closed && !s->reset && !s->send_rst && !s->headers_queued;
+	if (ok) {
+		s->headers = list;
+		s->headers_len = len;
+		s->headers_max = max;
+		s->status = conn->status_code;
+		s->headers_queued = 1;
+		list = NULL;
+		http2_wake(hs);
+	}
+	pthread_mutex_unlock(&hs->lock);
+	mg_free(list);
+
+	return ok;
+}
+
+
+/* Reset the stream of a request handler with error_id (HTTP2_ERR_*) */
+static void
+http2_stream_reset(struct mg_connection *conn, uint32_t error_id)
+{
+	struct mg_http2_stream *s = conn->http2.stream;
+	struct mg_http2_session *hs = s->session;
+
+	pthread_mutex_lock(&hs->lock);
+	if (!s->reset && !s->send_rst && !s->end_sent) {
+		s->send_rst = 1;
+		s->rst_code = error_id;
+		http2_wake(hs);
+	}
+	pthread_mutex_unlock(&hs->lock);
+}
+
+
+/* Header fields that must not be sent in HTTP/2 (RFC 7540, 8.1.2.2) */
+static int
+http2_is_connection_header(const char *name)
+{
+	return !mg_strcasecmp(name, "Connection")
+	       || !mg_strcasecmp(name, "Keep-Alive")
+	       || !mg_strcasecmp(name, "Proxy-Connection")
+	       || !mg_strcasecmp(name, "Transfer-Encoding")
+	       || !mg_strcasecmp(name, "Upgrade");
+}
+
+
 static int
 http2_send_response_headers(struct mg_connection *conn)
 {
-	unsigned char http2_header_frame[9] = {0, 0, 0, 1, 4, 0, 0, 0, 0};
-	uint8_t header_bin[1024];
-	uint16_t header_len = 0;
+	const struct mg_header *h = conn->response_info.http_headers;
+	char date[64];
+	char *list, *p;
+	size_t size, len;
 	int has_date = 0;
-	int has_connection_header = 0;
-	int i, ok;
+	int num_fields = 1; /* :status */
+	int i, max, ok;
 
 	if ((conn->status_code < 100) || (conn->status_code > 999)) {
 		/* Invalid status: Set status to "Internal Server Error" */
 		conn->status_code = 500;
 	}
 
-	switch (conn->status_code) {
-	case 200:
-		header_bin[header_len++] = 0x88;
-		break;
-	case 204:
-		header_bin[header_len++] = 0x89;
-		break;
-	case 206:
-		header_bin[header_len++] = 0x8A;
-		break;
-	case 304:
-		header_bin[header_len++] = 0x8B;
-		break;
-	case 400:
-		header_bin[header_len++] = 0x8C;
-		break;
-	case 404:
-		header_bin[header_len++] = 0x8D;
-		break;
-	case 500:
-		header_bin[header_len++] = 0x8E;
-		break;
-	default:
-		header_bin[header_len++] = 0x48;
-		header_bin[header_len++] = 0x03;
-		header_bin[header_len++] = 0x30 + (conn->status_code / 100);
-		header_bin[header_len++] = 0x30 + ((conn->status_code / 10) % 10);
-		header_bin[header_len++] = 0x30 + (conn->status_code % 10);
-		break;
-	}
-
-	/* Add all headers */
+	/* Size of the header list */
+	size = 0;
 	for (i = 0; i < conn->response_info.num_headers; i++) {
-		uint16_t predef = 0;
-		uint16_t j;
-
-		/* Filter headers not valid in HTTP/2 */
-		if (!mg_strcasecmp("Connection",
-		                   conn->response_info.http_headers[i].name)) {
-			has_connection_header = 1;
+		if ((h[i].name[0] == 0) || http2_is_connection_header(h[i].name)) {
 			continue; /* do not send */
 		}
-
-		/* Check if this header is known in HPACK (static table index 15 to 61)
-		 * see https://tools.ietf.org/html/rfc7541#appendix-A */
-		for (j = 15; j <= 61; j++) {
-			if (!mg_strcasecmp(hpack_predefined[j].name,
-			                   conn->response_info.http_headers[i].name)) {
-				predef = j;
-				break;
-			}
+		if (!mg_strcasecmp("Date", h[i].name)) {
+			has_date = 1;
 		}
+		size += strlen(h[i].name) + strlen(h[i].value) + 2;
+		num_fields++;
+	}
 
-		if (predef) {
-			/* Predefined header found */
-			header_bin[header_len++] = 0x40 + predef;
-		} else {
-			/* Rare header, do not index */
-			header_bin[header_len++] = 0x10;
-			j = hpack_encode(header_bin + header_len,
-			                 conn->response_info.http_headers[i].name,
-			                 1);
-			header_len += j;
+	/* Add required headers, if they have not been set */
+	if (!has_date) {
+		time_t curtime = time(NULL);
+		gmt_time_string(date, sizeof(date), &curtime);
+		size += 5 + strlen(date) + 1;
+		num_fields++;
+	}
+
+	/* Every field takes at most 10 bytes more than name and value, plus a
+	 * table size update. The block must fit into one HEADERS frame. */
+	if ((size + 10u * (unsigned)num_fields + 6u) > HTTP2_MAX_FRAME_SIZE) {
+		DEBUG_TRACE("HTTP2 response header too large: stream %u",
+		            conn->http2.stream_id);
+		return 0;
+	}
+	max = (int)size + 10 * num_fields + 6;
+
+	list = (char *)mg_malloc_ctx(size + 1, conn->phys_ctx);
+	if (list == NULL) {
+		return 0;
+	}
+	p = list;
+	for (i = 0; i < conn->response_info.num_headers; i++) {
+		if ((h[i].name[0] == 0) || http2_is_connection_header(h[i].name)) {
+			continue;
+		}
+		/* Header names are lower case in HTTP/2 */
+		for (len = 0; h[i].name[len] != 0; len++) {
+			*p++ = (char)tolower((unsigned char)h[i].name[len]);
 		}
+		*p++ = 0;
+		len = strlen(h[i].value) + 1;
+		memcpy(p, h[i].value, len);
+		p += len;
+	}
+	if (!has_date) {
+		memcpy(p, "date", 5);
+		p += 5;
+		len = strlen(date) + 1;
+		memcpy(p, date, len);
+		p += len;
+	}
 
-		j = hpack_encode(header_bin + header_len,
-		                 conn->response_info.http_headers[i].value,
-		                 0);
-		header_len += j;
+	/* The HEADERS frame is sent by the connection thread */
+	ok = http2_stream_queue_headers(conn, list, (int)(p - list), max);
+	if (ok) {
+		DEBUG_TRACE("HTTP2 response header queued: stream %u",
+		            conn->http2.stream_id);
+	} else {
+		DEBUG_TRACE("HTTP2 response header sending error: stream %u",
+		            conn->http2.stream_id);
+	}
 
-		/* Mark required headers as sent */
-		if (!mg_strcasecmp("Date", conn->response_info.http_headers[i].name)) {
-			has_date = 1;
+	return ok;
+}
+
+
+static void
+http2_send_window(struct mg_connection *conn,
+                  uint32_t stream_id,
+                  uint32_t window_size)
+{
+	unsigned char http2_window_frame[9] = {0, 0, 4, 8, 0, 0, 0, 0, 0};
+	uint32_t data = htonl(window_size);
+
+	DEBUG_TRACE("HTTP2 send window_size: stream %u, error %u",
+	            stream_id,
+	            window_size);
+
+	http2_window_frame[5] = (stream_id & 0xFF000000u) >> 24;
+	http2_window_frame[6] = (stream_id & 0xFF0000u) >> 16;
+	http2_window_frame[7] = (stream_id & 0xFF00u) >> 8;
+	http2_window_frame[8] = (stream_id & 0xFFu);
+	mg_xwrite(conn, http2_window_frame, 9);
+	mg_xwrite(conn, &data, 4);
+}
+
+
+static void
+http2_reset_stream(struct mg_connection *conn,
+                   uint32_t stream_id,
+                   uint32_t error_id)
+{
+	unsigned char http2_reset_frame[9] = {0, 0, 4, 3, 0, 0, 0, 0, 0};
+	uint32_t val = htonl(error_id);
+
+	DEBUG_TRACE("HTTP2 send reset: stream %u, error %u", stream_id, error_id);
+
+	http2_reset_frame[5] = (stream_id & 0xFF000000u) >> 24;
+	http2_reset_frame[6] = (stream_id & 0xFF0000u) >> 16;
+	http2_reset_frame[7] = (stream_id & 0xFF00u) >> 8;
+	http2_reset_frame[8] = (stream_id & 0xFFu);
+	mg_xwrite(conn, http2_reset_frame, 9);
+	mg_xwrite(conn, &val, 4);
+}
+
+
+static void
+http2_must_use_http1(struct mg_connection *conn)
+{
+	DEBUG_TRACE("HTTP2 not available for this URL (%s)", conn->path_info);
+	http2_stream_reset(conn, HTTP2_ERR_HTTP_1_1_REQUIRED);
+}
+
+
+/* The HTTP2 implementation collects request headers as array of dynamically
+ * allocated string values. This array must be freed once the request is
+ * handled.
+ * This is different to the HTTP/1.x implementation: For HTTP/1.x, the header
+ * list is implemented as pointers into an existing buffer, so free must not
+ * be called for HTTP/1.x.
+ * Thus free_buffered_request_header_list is in mod_http2.inl.
+ */
+#if defined(DEBUG)
+static int mem_h_count = 0;
+#define CHECK_LEAK_HDR_ALLOC(ptr)                                              \
+	DEBUG_TRACE("H NEW %p (%i): %s", ptr, ++mem_h_count, (const char *)ptr)
+#define CHECK_LEAK_HDR_FREE(ptr)                                               \
+	DEBUG_TRACE("H DEL %p (%i): %s", ptr, --mem_h_count, (const char *)ptr)
+#else
+#define CHECK_LEAK_HDR_ALLOC(ptr)
+#define CHECK_LEAK_HDR_FREE(ptr)
+#endif
+
+
+/* Internal function to free request header list.
+ * Not to be confused with the response header list.
+ */
+static void
+free_buffered_request_header_list(struct mg_connection *conn)
+{
+	while (conn->request_info.num_headers > 0) {
+		conn->request_info.num_headers--;
+
+		CHECK_LEAK_HDR_FREE(
+		    conn->request_info.http_headers[conn->request_info.num_headers]
+		        .name);
+		CHECK_LEAK_HDR_FREE(
+		    conn->request_info.http_headers[conn->request_info.num_headers]
+		        .value);
+
+		mg_free((void *)conn->request_info
+		            .http_headers[conn->request_info.num_headers]
+		            .name);
+		conn->request_info.http_headers[conn->request_info.num_headers].name =
+		    0;
+		mg_free((void *)conn->request_info
+		            .http_headers[conn->request_info.num_headers]
+		            .value);
+		conn->request_info.http_headers[conn->request_info.num_headers].value =
+		    0;
+	}
+}
+
+
+/* Create the stream for a HEADERS frame. The request headers decoded into
+ * the physical connection are moved to the connection of the stream. */
+static struct mg_http2_stream *
+http2_stream_create(struct mg_http2_session *hs, uint32_t id, int end_stream)
+{
+	struct mg_connection *conn = hs->conn;
+	struct mg_http2_stream *s;
+	struct mg_connection *sc;
+	const char *cl;
+
+	s = (struct mg_http2_stream *)mg_calloc_ctx(1, sizeof(*s), conn->phys_ctx);
+	sc = (struct mg_connection *)mg_calloc_ctx(1,
+	                                           sizeof(*sc),
+	                                           conn->phys_ctx);
+	if ((s == NULL) || (sc == NULL)
+	    || (0 != pthread_mutex_init(&sc->mutex, &pthread_mutex_attr))) {
+		mg_free(s);
+		mg_free(sc);
+		return NULL;
+	}
+
+	s->id = id;
+	s->session = hs;
+	s->conn = sc;
+	s->send_window = hs->initial_window;
+	s->in_window = HTTP2_INITIAL_WINDOW_SIZE;
+	s->in_end = end_stream;
+
+	sc->connection_type = CONNECTION_TYPE_REQUEST;
+	sc->protocol_type = PROTOCOL_TYPE_HTTP2;
+	sc->http2.stream = s;
+	sc->http2.stream_id = id;
+	sc->phys_ctx = conn->phys_ctx;
+	sc->dom_ctx = conn->dom_ctx;
+	sc->ssl = conn->ssl; /* Only for is_ssl checks: never used for I/O */
+	sc->client = conn->client;
+	sc->conn_birth_time = conn->conn_birth_time;
+	sc->req_time = conn->req_time;
+	sc->request_info = conn->request_info;
+	sc->status_code = conn->status_code;
+
+	/* The header strings belong to the stream now */
+	conn->request_info.num_headers = 0;
+	conn->request_info.request_method = NULL;
+	conn->request_info.request_uri = NULL;
+	conn->request_info.local_uri = NULL;
+	conn->request_info.local_uri_raw = NULL;
+	conn->status_code = 0;
+
+	index_http_headers(sc);
+	if ((cl = mg_get_header_id(sc, MG_HDR_CONTENT_LENGTH)) != NULL) {
+		sc->content_len = strtoll(cl, NULL, 10);
+		sc->request_info.content_length = sc->content_len;
+	} else {
+		/* The body ends with the stream */
+		sc->content_len = (end_stream ? 0 : -1);
+	}
+
+	hs->streams[hs->num_streams++] = s;
+	return s;
+}
+
+
+static void
+http2_stream_free(struct mg_http2_stream *s)
+{
+	struct mg_connection *sc = s->conn;
+
+	free_buffered_response_header_list(sc);
+	free_buffered_request_header_list(sc);
+	request_arena_free(sc);
+	pthread_mutex_destroy(&sc->mutex);
+	mg_free(sc);
+	mg_free(s->headers);
+	mg_free(s->out);
+	mg_free(s->in);
+	mg_free(s);
+}
+
+
+static struct mg_http2_stream *
+http2_find_stream(struct mg_http2_session *hs, uint32_t id)
+{
+	unsigned i;
+
+	for (i = 0; i < hs->num_streams; i++) {
+		if (hs->streams[i]->id == id) {
+			return hs->streams[i];
 		}
 	}
+	return NULL;
+}
 
-	/* Add required headers, if they have not been sent yet */
-	if (!has_date) {
-		/* Create header frame */
-		char date[64];
-		uint8_t date_len;
-		time_t curtime = time(NULL);
 
-		gmt_time_string(date, sizeof(date), &curtime);
-		date_len = (uint8_t)strlen(date);
+/* Handle the request of a stream in a stream worker thread */
+static void
+http2_handle_stream(struct mg_http2_stream *s)
+{
+	struct mg_http2_session *hs = s->session;
+	struct mg_connection *conn = s->conn;
+	int closed;
+
+	pthread_mutex_lock(&hs->lock);
+	closed = hs->closed;
+	pthread_mutex_unlock(&hs->lock);
+
+	if (!closed) {
+		DEBUG_TRACE("HTTP2 handle_request (stream %u)", s->id);
+		handle_request_stat_log(conn);
+		DEBUG_TRACE("HTTP2 handle_request done (stream %u)", s->id);
+	}
+	free_buffered_response_header_list(conn);
+	free_buffered_request_header_list(conn);
+	conn->request_info.local_uri = NULL;
+	conn->request_info.remote_user = NULL;
+	request_arena_reset(conn);
+
+	/* The connection thread sends the rest and frees the stream */
+	pthread_mutex_lock(&hs->lock);
+	if (!s->headers_queued && !s->reset && !s->send_rst) {
+		/* No response header: the handler does not support HTTP/2 */
+		s->send_rst = 1;
+		s->rst_code = HTTP2_ERR_HTTP_1_1_REQUIRED;
+	}
+	s->done = 1;
+	hs->handlers--;
+	http2_wake(hs);
+	pthread_cond_broadcast(&hs->cond);
+	pthread_mutex_unlock(&hs->lock);
+}
+
+
+/* Stream worker threads.
+ * The threads are shared by all HTTP/2 connections of a server. They are
+ * started when streams are waiting and no thread is idle, up to
+ * http2_stream_threads (default: num_threads). */
+struct mg_http2_workers {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct mg_http2_stream *head; /* Streams waiting for a thread */
+	struct mg_http2_stream *tail;
+	unsigned queued;
+	unsigned idle;
+	pthread_t *threads;
+	unsigned num_threads;
+	unsigned max_threads;
+	int stop;
+};
 
-		header_bin[header_len++] =
-		    0x61; /* "Date" predefined HPACK index 33 (0x21) + 0x40 */
-		header_bin[header_len++] = date_len;
-		memcpy(header_bin + header_len, date, date_len);
-		header_len += date_len;
+
+static void
+http2_stream_worker_run(struct mg_context *ctx)
+{
+	struct mg_http2_workers *w = ctx->http2_workers;
+	struct mg_workerTLS tls;
+	struct mg_http2_stream *s;
+
+	mg_set_thread_name("http2");
+
+	tls.is_master = 0;
+	tls.thread_idx = (unsigned)mg_atomic_inc(&thread_idx_max);
+	tls.alpn_proto = NULL;
+#if defined(_WIN32)
+	tls.pthread_cond_helper_mutex = CreateEvent(NULL, FALSE, FALSE, NULL);
+#endif
+#if defined(USE_IO_URING)
+	tls.uring = NULL;
+#endif
+	pthread_setspecific(sTlsKey, &tls);
+
+	/* Stream workers handle requests like worker threads */
+	if (ctx->callbacks.init_thread) {
+		tls.user_ptr = ctx->callbacks.init_thread(ctx, 1);
+	} else {
+		tls.user_ptr = NULL;
 	}
 
-	http2_header_frame[1] = (header_len & 0xFF00) >> 8;
-	http2_header_frame[2] = (header_len & 0xFF);
+	pthread_mutex_lock(&w->lock);
+	for (;;) {
+		while ((w->head == NULL) && !w->stop) {
+			w->idle++;
+			pthread_cond_wait(&w->cond, &w->lock);
+			w->idle--;
+		}
+		s = w->head;
+		if (s == NULL) {
+			break;
+		}
+		w->head = s->next;
+		if (w->head == NULL) {
+			w->tail = NULL;
+		}
+		w->queued--;
+		pthread_mutex_unlock(&w->lock);
 
-	http2_header_frame[5] = (conn->http2.stream_id & 0xFF000000u) >> 24;
-	http2_header_frame[6] = (conn->http2.stream_id & 0xFF0000u) >> 16;
-	http2_header_frame[7] = (conn->http2.stream_id & 0xFF00u) >> 8;
-	http2_header_frame[8] = (conn->http2.stream_id & 0xFFu);
+		s->conn->tls_user_ptr = tls.user_ptr;
+		http2_handle_stream(s);
 
-	/* Send header frame */
-	ok = 1;
-	if (mg_xwrite(conn, http2_header_frame, 9) != 9) {
-		ok = 0;
-	} else if (mg_xwrite(conn, header_bin, header_len) != header_len) {
-		ok = 0;
+		pthread_mutex_lock(&w->lock);
 	}
-	if (ok) {
-		DEBUG_TRACE("HTTP2 response header sent: stream %u",
-		            conn->http2.stream_id);
+	pthread_mutex_unlock(&w->lock);
+
+	if (ctx->callbacks.exit_thread) {
+		ctx->callbacks.exit_thread(ctx, 1, tls.user_ptr);
+	}
+#if defined(_WIN32)
+	CloseHandle(tls.pthread_cond_helper_mutex);
+#endif
+	pthread_setspecific(sTlsKey, NULL);
+}
+
+
+#if defined(_WIN32)
+static unsigned __stdcall http2_stream_worker(void *thread_func_param)
+{
+	http2_stream_worker_run((struct mg_context *)thread_func_param);
+	return 0;
+}
+#else
+static void *
+http2_stream_worker(void *thread_func_param)
+{
+#if !defined(__ZEPHYR__)
+	struct sigaction sa;
+
+	/* Ignore SIGPIPE */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &sa, NULL);
+#endif
+
+	http2_stream_worker_run((struct mg_context *)thread_func_param);
+	return NULL;
+}
+#endif
+
+
+/* Return 0 on success, -1 if out of memory */
+static int
+http2_workers_create(struct mg_context *ctx)
+{
+	struct mg_http2_workers *w;
+	int n = atoi(ctx->dd.config[HTTP2_STREAM_THREADS]);
+
+	if (n <= 0) {
+		n = (int)ctx->cfg_max_worker_threads;
+	}
+	w = (struct mg_http2_workers *)mg_calloc_ctx(1, sizeof(*w), ctx);
+	if (w == NULL) {
+		return -1;
+	}
+	w->threads = (pthread_t *)mg_calloc_ctx((size_t)n, sizeof(pthread_t), ctx);
+	if (w->threads == NULL) {
+		mg_free(w);
+		return -1;
+	}
+	w->max_threads = (unsigned)n;
+	if ((0 != pthread_mutex_init(&w->lock, &pthread_mutex_attr))
+	    || (0 != pthread_cond_init(&w->cond, NULL))) {
+		mg_free(w->threads);
+		mg_free(w);
+		return -1;
+	}
+	ctx->http2_workers = w;
+	return 0;
+}
+
+
+/* Queue a stream for a stream worker. Return 0 on success, -1 if no
+ * thread is available. */
+static int
+http2_dispatch(struct mg_context *ctx, struct mg_http2_stream *s)
+{
+	struct mg_http2_workers *w = ctx->http2_workers;
+	int ret = 0;
+
+	pthread_mutex_lock(&w->lock);
+	if ((w->queued >= w->idle) && (w->num_threads < w->max_threads)) {
+		if (mg_start_thread_with_id(http2_stream_worker,
+		                            ctx,
+		                            &w->threads[w->num_threads])
+		    == 0) {
+			w->num_threads++;
+		} else {
+			mg_cry_ctx_internal(ctx,
+			                    "Cannot start HTTP/2 stream thread: error %ld",
+			                    (long)ERRNO);
+		}
+	}
+	if (w->num_threads == 0) {
+		ret = -1;
 	} else {
-		DEBUG_TRACE("HTTP2 response header sending error: stream %u",
-		            conn->http2.stream_id);
+		s->next = NULL;
+		if (w->tail != NULL) {
+			w->tail->next = s;
+		} else {
+			w->head = s;
+		}
+		w->tail = s;
+		w->queued++;
+		pthread_cond_signal(&w->cond);
 	}
-
-	(void)has_connection_header; /* ignore for the moment */
-
-	return ok;
+	pthread_mutex_unlock(&w->lock);
+	return ret;
 }
 
 
+/* Stop the stream worker threads. Called after all worker threads (the
+ * threads of the HTTP/2 connections) have finished. */
 static void
-http2_data_frame_head(struct mg_connection *conn,
-                      uint32_t frame_size,
-                      int is_final)
+http2_workers_exit(struct mg_context *ctx)
 {
-	unsigned char http2_data_frame[9];
-	uint32_t stream_id = conn->http2.stream_id;
-
-	http2_data_frame[0] = (frame_size & 0xFF0000) >> 16;
-	http2_data_frame[1] = (frame_size & 0xFF00) >> 8;
-	http2_data_frame[2] = (frame_size & 0xFF);
+	struct mg_http2_workers *w = ctx->http2_workers;
+	unsigned i;
 
-	http2_data_frame[3] = 0; /* frame type "DATA" */
-	http2_data_frame[4] = (is_final ? 1 : 0);
-
-	http2_data_frame[5] = (stream_id & 0xFF000000u) >> 24;
-	http2_data_frame[6] = (stream_id & 0xFF0000u) >> 16;
-	http2_data_frame[7] = (stream_id & 0xFF00u) >> 8;
-	http2_data_frame[8] = (stream_id & 0xFFu);
-
-	DEBUG_TRACE("HTTP2 begin data frame: stream %u, frame_size %u (final: %i)",
-	            stream_id,
-	            frame_size,
-	            is_final);
+	if (w == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&w->lock);
+	w->stop = 1;
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->lock);
 
-	mg_xwrite(conn, http2_data_frame, 9);
+	for (i = 0; i < w->num_threads; i++) {
+		mg_join_thread(w->threads[i]);
+	}
+	w->num_threads = 0;
 }
 
 
 static void
-http2_send_window(struct mg_connection *conn,
-                  uint32_t stream_id,
-                  uint32_t window_size)
+http2_workers_free(struct mg_context *ctx)
 {
-	unsigned char http2_window_frame[9] = {0, 0, 4, 8, 0, 0, 0, 0, 0};
-	uint32_t data = htonl(window_size);
-
-	DEBUG_TRACE("HTTP2 send window_size: stream %u, error %u",
-	            stream_id,
-	            window_size);
-
-	http2_window_frame[5] = (stream_id & 0xFF000000u) >> 24;
-	http2_window_frame[6] = (stream_id & 0xFF0000u) >> 16;
-	http2_window_frame[7] = (stream_id & 0xFF00u) >> 8;
-	http2_window_frame[8] = (stream_id & 0xFFu);
-	mg_xwrite(conn, http2_window_frame, 9);
-	mg_xwrite(conn, &data, 4);
+	struct mg_http2_workers *w = ctx->http2_workers;
+
+	if (w != NULL) {
+		pthread_mutex_destroy(&w->lock);
+		pthread_cond_destroy(&w->cond);
+		mg_free(w->threads);
+		mg_free(w);
+		ctx->http2_workers = NULL;
+	}
 }
 
 
-static void
-http2_reset_stream(struct mg_connection *conn,
-                   uint32_t stream_id,
-                   uint32_t error_id)
+/* Encode the HEADERS block of a response to dst (at least s->headers_max
+ * bytes). Blocks must be encoded in the order they are sent, since they
+ * modify the encoder table. Return the length. */
+static int
+http2_encode_headers(struct mg_http2_session *hs,
+                     struct mg_http2_stream *s,
+                     uint8_t *dst)
 {
-	unsigned char http2_reset_frame[9] = {0, 0, 4, 3, 0, 0, 0, 0, 0};
-	uint32_t val = htonl(error_id);
+	struct mg_context *ctx = hs->conn->phys_ctx;
+	const char *name, *value;
+	char status[4];
+	int pos = 0, n = 0;
+
+	if (hs->enc_size_update) {
+		/* Dynamic Table Size Update (RFC 7541, 6.3) */
+		n += hpack_putnum(dst, 0x20, 0x1F, hs->enc.max_size);
+		hs->enc_size_update = 0;
+	}
 
-	DEBUG_TRACE("HTTP2 send reset: stream %u, error %u", stream_id, error_id);
+	mg_snprintf(NULL, NULL, status, sizeof(status), "%d", s->status);
+	n += hpack_encode_field(&hs->enc, dst + n, ":status", status, ctx);
 
-	http2_reset_frame[5] = (stream_id & 0xFF000000u) >> 24;
-	http2_reset_frame[6] = (stream_id & 0xFF0000u) >> 16;
-	http2_reset_frame[7] = (stream_id & 0xFF00u) >> 8;
-	http2_reset_frame[8] = (stream_id & 0xFFu);
-	mg_xwrite(conn, http2_reset_frame, 9);
-	mg_xwrite(conn, &val, 4);
+	while (pos < s->headers_len) {
+		name = s->headers + pos;
+		value = name + strlen(name) + 1;
+		pos = (int)(value - s->headers) + (int)strlen(value) + 1;
+		n += hpack_encode_field(&hs->enc, dst + n, name, value, ctx);
+	}
+	DEBUG_ASSERT(n <= s->headers_max);
+	return n;
 }
 
 
-static void
-http2_must_use_http1(struct mg_connection *conn)
+/* Append the next frame of stream s to dst, if any can be sent. Return the
+ * frame size or 0. The session lock must be held. */
+static int
+http2_stream_next_frame(struct mg_http2_session *hs,
+                        struct mg_http2_stream *s,
+                        uint8_t *dst,
+                        int space)
 {
-	DEBUG_TRACE("HTTP2 not available for this URL (%s)", conn->path_info);
-	http2_reset_stream(conn, conn->http2.stream_id, 0xd);
-}
+	int64_t n;
+	int end, part;
 
+	if (s->send_rst) {
+		if (space < 13) {
+			return 0;
+		}
+		http2_frame_u32(dst, 3, s->id, s->rst_code);
+		s->send_rst = 0;
+		s->reset = 1;
+		s->out_len = 0;
+		return 13;
+	}
+	if (s->reset || s->end_sent) {
+		return 0;
+	}
 
-/* The HTTP2 implementation collects request headers as array of dynamically
- * allocated string values. This array must be freed once the request is
- * handled.
- * This is different to the HTTP/1.x implementation: For HTTP/1.x, the header
- * list is implemented as pointers into an existing buffer, so free must not
- * be called for HTTP/1.x.
- * Thus free_buffered_request_header_list is in mod_http2.inl.
- */
-#if defined(DEBUG)
-static int mem_h_count = 0;
-static int mem_d_count = 0;
-#define CHECK_LEAK_HDR_ALLOC(ptr)                                              \
-	DEBUG_TRACE("H NEW %p (%i): %s", ptr, ++mem_h_count, (const char *)ptr)
-#define CHECK_LEAK_HDR_FREE(ptr)                                               \
-	DEBUG_TRACE("H DEL %p (%i): %s", ptr, --mem_h_count, (const char *)ptr)
-#define CHECK_LEAK_DYN_ALLOC(ptr)                                              \
-	DEBUG_TRACE("D NEW %p (%i): %s", ptr, ++mem_d_count, (const char *)ptr)
-#define CHECK_LEAK_DYN_FREE(ptr)                                               \
-	DEBUG_TRACE("D DEL %p (%i): %s", ptr, --mem_d_count, (const char *)ptr)
-#else
-#define CHECK_LEAK_HDR_ALLOC(ptr)
-#define CHECK_LEAK_HDR_FREE(ptr)
-#define CHECK_LEAK_DYN_ALLOC(ptr)
-#define CHECK_LEAK_DYN_FREE(ptr)
-#endif
+	/* Release request body data read by the handler */
+	if (!s->in_end && (s->in_unacked >= (HTTP2_INITIAL_WINDOW_SIZE / 2))) {
+		if (space < 13) {
+			return 0;
+		}
+		http2_frame_u32(dst, 8, s->id, s->in_unacked);
+		s->in_window += s->in_unacked;
+		s->in_unacked = 0;
+		return 13;
+	}
+
+	if (s->headers != NULL) {
+		if (space < (9 + s->headers_max)) {
+			return 0;
+		}
+		end = s->done && (s->out_len == 0);
+		n = http2_encode_headers(hs, s, dst + 9);
+		/* END_HEADERS, END_STREAM if there is no data */
+		http2_frame_head(dst, (uint32_t)n, 1, (uint8_t)(end ? 5 : 4), s->id);
+		mg_free(s->headers);
+		s->headers = NULL;
+		s->end_sent = end;
+		return 9 + (int)n;
+	}
+	if (!s->headers_queued) {
+		return 0;
+	}
+
+	/* DATA frame, as large as the flow control windows allow */
+	n = s->out_len;
+	if (n > (space - 9)) {
+		n = space - 9;
+	}
+	if (n > HTTP2_MAX_FRAME_SIZE) {
+		n = HTTP2_MAX_FRAME_SIZE;
+	}
+	if (n > s->send_window) {
+		n = s->send_window;
+	}
+	if (n > hs->send_window) {
+		n = hs->send_window;
+	}
+	if (n < 0) {
+		n = 0;
+	}
+	end = s->done && (n == s->out_len);
+	if (((n == 0) && !end) || (space < 9)) {
+		return 0;
+	}
 
+	http2_frame_head(dst, (uint32_t)n, 0, (uint8_t)(end ? 1 : 0), s->id);
+	part = HTTP2_STREAM_BUFFER_SIZE - s->out_pos;
+	if (part > (int)n) {
+		part = (int)n;
+	}
+	memcpy(dst + 9, s->out + s->out_pos, (size_t)part);
+	memcpy(dst + 9 + part, s->out, (size_t)(n - part));
+	s->out_pos = (s->out_pos + (int)n) % HTTP2_STREAM_BUFFER_SIZE;
+	s->out_len -= (int)n;
+	s->send_window -= n;
+	hs->send_window -= n;
+	s->end_sent = end;
+	return 9 + (int)n;
+}
 
-/* The dynamic header table may be resized on a HTTP2 client request.
- * A tablesize=0 will free all memory.
- */
-static void
-purge_dynamic_header_table(struct mg_connection *conn, uint32_t tableSize)
+
+/* Single writer: send the frames of all streams, one frame per stream in
+ * turn, and free finished streams. Return 0, or -1 on a write error. */
+static int
+http2_send_streams(struct mg_http2_session *hs)
 {
-	DEBUG_TRACE("HTTP2 dynamic header table set to %u", tableSize);
-	while (conn->http2.dyn_table_size > tableSize) {
-		conn->http2.dyn_table_size--;
+	struct mg_http2_stream *s;
+	unsigned i, k, num;
+	int len, n, progress;
 
-		CHECK_LEAK_DYN_FREE(
-		    conn->http2.dyn_table[conn->http2.dyn_table_size].name);
-		CHECK_LEAK_DYN_FREE(
-		    conn->http2.dyn_table[conn->http2.dyn_table_size].value);
+	for (;;) {
+		len = 0;
+		pthread_mutex_lock(&hs->lock);
+		hs->wake_pending = 0;
+		do {
+			progress = 0;
+			num = hs->num_streams;
+			for (k = 0; k < num; k++) {
+				i = (hs->next_stream + k) % num;
+				n = http2_stream_next_frame(hs,
+				                            hs->streams[i],
+				                            (uint8_t *)hs->wbuf + len,
+				                            HTTP2_WRITE_BUFFER_SIZE - len);
+				if (n > 0) {
+					len += n;
+					progress = 1;
+				}
+			}
+			if (num > 0) {
+				hs->next_stream = (hs->next_stream + 1) % num;
+			}
+		} while (progress && (len < (HTTP2_WRITE_BUFFER_SIZE - 9)));
+
+		/* A stream is closed, when the handler is done and the last frame
+		 * has been sent */
+		for (i = 0; i < hs->num_streams;) {
+			s = hs->streams[i];
+			if (s->done && !s->send_rst && (s->end_sent || s->reset)) {
+				hs->streams[i] = hs->streams[--hs->num_streams];
+				http2_stream_free(s);
+			} else {
+				i++;
+			}
+		}
+		if (len > 0) {
+			/* Space in the output buffers */
+			pthread_cond_broadcast(&hs->cond);
+		}
+		pthread_mutex_unlock(&hs->lock);
 
-		mg_free((void *)conn->http2.dyn_table[conn->http2.dyn_table_size].name);
-		conn->http2.dyn_table[conn->http2.dyn_table_size].name = 0;
-		mg_free(
-		    (void *)conn->http2.dyn_table[conn->http2.dyn_table_size].value);
-		conn->http2.dyn_table[conn->http2.dyn_table_size].value = 0;
+		if (len == 0) {
+			return 0;
+		}
+		if (mg_xwrite(hs->conn, hs->wbuf, len) != len) {
+			return -1;
+		}
 	}
 }
 
 
-/* Internal function to free request header list.
- * Not to be confused with the response header list.
- */
 static void
-free_buffered_request_header_list(struct mg_connection *conn)
+http2_send_goaway(struct mg_connection *conn,
+                  uint32_t last_stream_id,
+                  uint32_t error_id)
 {
-	while (conn->request_info.num_headers > 0) {
-		conn->request_info.num_headers--;
+	uint8_t frame[17];
 
-		CHECK_LEAK_HDR_FREE(
-		    conn->request_info.http_headers[conn->request_info.num_headers]
-		        .name);
-		CHECK_LEAK_HDR_FREE(
-		    conn->request_info.http_headers[conn->request_info.num_headers]
-		        .value);
+	http2_frame_head(frame, 8, 7, 0, 0);
+	http2_put_u32(frame + 9, last_stream_id);
+	http2_put_u32(frame + 13, error_id);
+	mg_xwrite(conn, frame, sizeof(frame));
+}
 
-		mg_free((void *)conn->request_info
-		            .http_headers[conn->request_info.num_headers]
-		            .name);
-		conn->request_info.http_headers[conn->request_info.num_headers].name =
-		    0;
-		mg_free((void *)conn->request_info
-		            .http_headers[conn->request_info.num_headers]
-		            .value);
-		conn->request_info.http_headers[conn->request_info.num_headers].value =
-		    0;
+
+/* Data from the client can be read without waiting */
+static int
+http2_input_pending(struct mg_connection *conn)
+{
+	if (((int64_t)conn->data_len - (int64_t)conn->request_len
+	     - conn->consumed_content)
+	    > 0) {
+		return 1;
+	}
+#if !defined(NO_SSL)
+	if ((conn->ssl != NULL) && (SSL_pending(conn->ssl) > 0)) {
+		return 1;
 	}
+#endif
+	return 0;
 }
 
 
@@ -1260,7 +2307,15 @@ handle_http2(struct mg_connection *conn)
 	int bytes_read;
 	uint8_t *buf;
 	int my_settings_accepted = 0;
-	const char *my_hpack_headers[128];
+	struct mg_http2_session hs;
+	struct mg_http2_stream *s;
+	struct mg_pollfd pfd[2];
+	uint8_t frame[13];
+	char drain[16];
+	int timeout_ms = 0;
+	uint32_t goaway_error = HTTP2_ERR_NO_ERROR;
+	int peer_closed = 0;
+	unsigned i;
 
 	struct http2_settings client_settings = http2_default_settings;
 	struct http2_settings server_settings = http2_default_settings;
@@ -1269,18 +2324,43 @@ handle_http2(struct mg_connection *conn)
 	http2_send_settings(conn, &http2_civetweb_server_settings);
 	// http2_send_window(conn, 0, /* 0x3fff0001 */ 1024*1024);
 
-	/* initialize hpack header table with predefined header fields */
-	memset((void *)my_hpack_headers, 0, sizeof(my_hpack_headers));
-	memcpy((void *)my_hpack_headers,
-	       hpack_predefined,
-	       sizeof(hpack_predefined));
+	/* HPACK decoder table (SETTINGS_HEADER_TABLE_SIZE sent above) */
+	conn->http2.dyn_table.max_size = HTTP2_HEADER_TABLE_SIZE;
+
+	/* Stream table */
+	memset(&hs, 0, sizeof(hs));
+	hs.conn = conn;
+	hs.send_window = 65535;
+	hs.initial_window = client_settings.settings_initial_window_size;
+	/* HPACK encoder table: 4096 bytes until the peer sets a size */
+	hs.enc.max_size = client_settings.settings_header_table_size;
+	if (hs.enc.max_size > HTTP2_HEADER_TABLE_SIZE) {
+		hs.enc.max_size = HTTP2_HEADER_TABLE_SIZE;
+	}
+	hs.wbuf = (char *)mg_malloc_ctx(HTTP2_WRITE_BUFFER_SIZE, conn->phys_ctx);
+	if ((hs.wbuf == NULL) || (mg_socketpair(&hs.wake[0], &hs.wake[1]) != 0)) {
+		DEBUG_TRACE("%s", "Cannot create HTTP2 session");
+		mg_free(hs.wbuf);
+		return;
+	}
+	set_non_blocking_mode(hs.wake[0]);
+	set_non_blocking_mode(hs.wake[1]);
+	pthread_mutex_init(&hs.lock, &pthread_mutex_attr);
+	pthread_cond_init(&hs.cond, NULL);
+
+	if (conn->dom_ctx->config[REQUEST_TIMEOUT]) {
+		timeout_ms = atoi(conn->dom_ctx->config[REQUEST_TIMEOUT]);
+	}
+	if (timeout_ms <= 0) {
+		timeout_ms = atoi(config_options[REQUEST_TIMEOUT].default_value);
+	}
 
 	buf = (uint8_t *)mg_malloc_ctx(server_settings.settings_max_frame_size,
 	                               conn->phys_ctx);
 	if (!buf) {
 		/* Out of memory */
 		DEBUG_TRACE("%s", "Out of memory for HTTP2 frame");
-		return;
+		goto clean_http2;
 	}
 
 	for (;;) {
@@ -1294,9 +2374,46 @@ handle_http2(struct mg_connection *conn)
 		conn->conn_state = 3; /* HTTP/2 ready */
 #endif
 
+		/* Send the output of the streams */
+		if (http2_send_streams(&hs) != 0) {
+			DEBUG_TRACE("%s", "HTTP2 write error");
+			peer_closed = 1;
+			goto clean_http2;
+		}
+
+		/* Wait for the next frame or for output of a stream */
+		if (!http2_input_pending(conn)) {
+			int ret;
+
+			pfd[0].fd = conn->client.sock;
+			pfd[0].events = POLLIN;
+			pfd[1].fd = hs.wake[0];
+			pfd[1].events = POLLIN;
+			ret = mg_poll(pfd, 2, timeout_ms, &(conn->phys_ctx->stop_flag), 0);
+			if (ret < 0) {
+				goto clean_http2;
+			}
+			if ((ret > 0) && (pfd[1].revents & POLLIN)) {
+				while (recv(hs.wake[0], drain, sizeof(drain), 0) > 0)
+					;
+			}
+			if ((ret == 0) && (hs.num_streams == 0)) {
+				/* Idle connection */
+				DEBUG_TRACE("%s", "HTTP2 connection timeout");
+				goto clean_http2;
+			}
+			if ((ret == 0) || !(pfd[0].revents & (POLLIN | POLLHUP | POLLERR))) {
+				continue;
+			}
+		}
+
 		bytes_read = mg_read(conn, http2_frame_head, sizeof(http2_frame_head));
 		if (bytes_read != sizeof(http2_frame_head)) {
 			/* TODO: errormsg */
+			if (bytes_read <= 0) {
+				/* Connection closed by the peer */
+				peer_closed = 1;
+			}
 			goto clean_http2;
 		}
 
@@ -1310,6 +2427,7 @@ handle_http2(struct mg_connection *conn)
 		                        + ((uint32_t)http2_frame_head[6] * 0x10000u)
 		                        + ((uint32_t)http2_frame_head[7] * 0x100u)
 		                        + ((uint32_t)http2_frame_head[8]);
+		http2_frame_stream_id &= 0x7FFFFFFFu; /* reserved bit */
 
 		frame_is_end_stream = (0 != (http2_frame_flags & 0x01));
 		frame_is_end_headers = (0 != (http2_frame_flags & 0x04));
@@ -1320,6 +2438,7 @@ handle_http2(struct mg_connection *conn)
 			/* TODO: Error Message */
 			DEBUG_TRACE("HTTP2 frame too large (%lu)",
 			            (unsigned long)http2_frame_size);
+			goaway_error = HTTP2_ERR_FRAME_SIZE_ERROR;
 			goto clean_http2;
 		}
 		bytes_read = mg_read(conn, buf, http2_frame_size);
@@ -1343,120 +2462,214 @@ handle_http2(struct mg_connection *conn)
 
 		case 0: /* DATA */
 		{
-			/* TODO */
-			DEBUG_TRACE("%s", "HTTP2 DATA frame?");
+			uint32_t padding = 0;
+			uint32_t pos = 0;
+			int n, end;
+
+			if (frame_is_padded && (http2_frame_size > 0)) {
+				padding = buf[0];
+				pos = 1;
+			}
+			if ((http2_frame_stream_id == 0)
+			    || (pos + padding > http2_frame_size)) {
+				goaway_error = HTTP2_ERR_PROTOCOL_ERROR;
+				goto clean_http2;
+			}
+
+			/* The whole frame counts for flow control. Data of the
+			 * connection is released when it is stored for the stream. */
+			hs.recv_unacked += http2_frame_size;
+			if (hs.recv_unacked >= (HTTP2_INITIAL_WINDOW_SIZE / 2)) {
+				http2_frame_u32(frame, 8, 0, hs.recv_unacked);
+				mg_xwrite(conn, frame, 13);
+				hs.recv_unacked = 0;
+			}
+
+			pthread_mutex_lock(&hs.lock);
+			s = http2_find_stream(&hs, http2_frame_stream_id);
+			if ((s == NULL) || s->in_end) {
+				pthread_mutex_unlock(&hs.lock);
+				DEBUG_TRACE("HTTP2 DATA for closed stream %u",
+				            http2_frame_stream_id);
+				http2_reset_stream(conn,
+				                   http2_frame_stream_id,
+				                   HTTP2_ERR_STREAM_CLOSED);
+				break;
+			}
+			if ((int64_t)http2_frame_size > s->in_window) {
+				/* The peer ignores the window */
+				if (!s->reset) {
+					s->send_rst = 1;
+					s->rst_code = HTTP2_ERR_FLOW_CONTROL_ERROR;
+				}
+				pthread_cond_broadcast(&hs.cond);
+				pthread_mutex_unlock(&hs.lock);
+				break;
+			}
+			s->in_window -= http2_frame_size;
+			s->in_unacked += (pos + padding); /* never read */
+			if ((s->in == NULL) && (http2_frame_size > pos + padding)) {
+				s->in = (char *)mg_malloc_ctx(HTTP2_INITIAL_WINDOW_SIZE,
+				                              conn->phys_ctx);
+			}
+			if (s->in != NULL) {
+				/* The window guarantees enough space */
+				n = (int)(http2_frame_size - pos - padding);
+				end = (s->in_pos + s->in_len) % HTTP2_INITIAL_WINDOW_SIZE;
+				if (n > HTTP2_INITIAL_WINDOW_SIZE - end) {
+					memcpy(s->in + end,
+					       buf + pos,
+					       (size_t)(HTTP2_INITIAL_WINDOW_SIZE - end));
+					memcpy(s->in,
+					       buf + pos + (HTTP2_INITIAL_WINDOW_SIZE - end),
+					       (size_t)(n - (HTTP2_INITIAL_WINDOW_SIZE - end)));
+				} else {
+					memcpy(s->in + end, buf + pos, (size_t)n);
+				}
+				s->in_len += n;
+			} else if (http2_frame_size > pos + padding) {
+				s->send_rst = 1;
+				s->rst_code = HTTP2_ERR_INTERNAL_ERROR;
+			}
+			if (frame_is_end_stream) {
+				s->in_end = 1;
+			}
+			pthread_cond_broadcast(&hs.cond);
+			pthread_mutex_unlock(&hs.lock);
 		} break;
 
 		case 1: /* HEADERS */
 		{
-			int i = 0;
+			int pos = 0;
 			uint8_t padding = 0;
 			uint32_t dependency = 0;
 			uint8_t weight = 0;
 			uint8_t exclusive = 0;
+			int block_end;
 
 			/* Request start time */
 			clock_gettime(CLOCK_MONOTONIC, &(conn->req_time));
 
 			if (frame_is_padded) {
-				padding = buf[i];
-				i++;
+				padding = buf[pos];
+				pos++;
 				DEBUG_TRACE("HTTP2 frame padded by %u bytes", padding);
 			}
 			if (frame_is_priority) {
-				uint32_t val = ((uint32_t)buf[0 + i] * 0x1000000u)
-				               + ((uint32_t)buf[1 + i] * 0x10000u)
-				               + ((uint32_t)buf[2 + i] * 0x100u)
-				               + ((uint32_t)buf[3 + i]);
+				uint32_t val = ((uint32_t)buf[0 + pos] * 0x1000000u)
+				               + ((uint32_t)buf[1 + pos] * 0x10000u)
+				               + ((uint32_t)buf[2 + pos] * 0x100u)
+				               + ((uint32_t)buf[3 + pos]);
 				dependency = (val & 0x7FFFFFFFu);
 				exclusive = ((val & 0x80000000u) != 0);
-				weight = buf[4 + i];
-				i += 5;
+				weight = buf[4 + pos];
+				pos += 5;
 				DEBUG_TRACE(
 				    "HTTP2 frame weight %u, dependency %u (exclusive: %i)",
 				    weight,
 				    dependency,
 				    exclusive);
 			}
+			if (pos + (int)padding > (int)http2_frame_size) {
+				goaway_error = HTTP2_ERR_PROTOCOL_ERROR;
+				goto clean_http2;
+			}
+
+			/* Priorities are not used */
+			(void)dependency;
+			(void)weight;
+			(void)exclusive;
 
 			conn->request_info.num_headers = 0;
+			conn->header_index_type = 0;
+
+			/* Errors decoding the header block are connection errors,
+			 * since the decoder table may differ from the peer's now */
+			goaway_error = HTTP2_ERR_COMPRESSION_ERROR;
+			block_end = (int)http2_frame_size - (int)padding;
 
-			while (i < (int)http2_frame_size - (int)padding) {
+			while (pos < block_end) {
 				const char *key = 0;
 				const char *val = 0;
 				uint8_t idx_mask = 0;
 				uint8_t value_known = 0;
 				uint8_t indexing = 0;
 				uint64_t idx = 0;
+				const struct mg_hpack_entry *entry;
 
 				/* Classify next entry by checking the bit mask */
-				if ((buf[i] & 0x80u) == 0x80u) {
+				if ((buf[pos] & 0x80u) == 0x80u) {
 					/* Indexed Header Field Representation:
 					 * https://tools.ietf.org/html/rfc7541#section-6.1 */
 					idx_mask = 0x7fu;
 					value_known = 1;
 
-				} else if ((buf[i] & 0xC0u) == 0x40u) {
+				} else if ((buf[pos] & 0xC0u) == 0x40u) {
 					/* Literal Header Field with Incremental Indexing:
 					 * https://tools.ietf.org/html/rfc7541#section-6.2.1 */
 					idx_mask = 0x3fu;
 					indexing = 1;
 
-				} else if ((buf[i] & 0xF0u) == 0x00u) {
+				} else if ((buf[pos] & 0xF0u) == 0x00u) {
 					/* Literal Header Field without Indexing:
 					 * https://tools.ietf.org/html/rfc7541#section-6.2.2 */
 					idx_mask = 0x0fu;
 
-				} else if ((buf[i] & 0xF0u) == 0x10u) {
+				} else if ((buf[pos] & 0xF0u) == 0x10u) {
 					/* Literal Header Field Never Indexed:
 					 * https://tools.ietf.org/html/rfc7541#section-6.2.3 */
 					idx_mask = 0x0fu;
 
-				} else if ((buf[i] & 0xE0u) == 0x20u) {
+				} else if ((buf[pos] & 0xE0u) == 0x20u) {
 					uint64_t tableSize;
 					/* Dynamic Table Size Update:
 					 * https://tools.ietf.org/html/rfc7541#section-6.3 */
 					idx_mask = 0x1fu;
-					tableSize = hpack_getnum(buf, &i, idx_mask, conn->phys_ctx);
-
-					/* TODO: check if tablesize > allowed table size */
+					if ((hpack_getnum(buf, &pos, block_end, idx_mask, &tableSize)
+					     != 0)
+					    || (tableSize > HTTP2_HEADER_TABLE_SIZE)) {
+						DEBUG_TRACE("%s", "HTTP2 invalid header table size");
+						goto clean_http2;
+					}
 
 					/* Purge additional table entries */
-					purge_dynamic_header_table(conn, (uint32_t)tableSize);
+					DEBUG_TRACE("HTTP2 dynamic header table set to %u",
+					            (unsigned)tableSize);
+					hpack_table_resize(&conn->http2.dyn_table,
+					                   (uint32_t)tableSize);
 
 					/* Process next frame */
 					continue;
 
 				} else {
-					DEBUG_TRACE("HTTP2 unknown start pattern %02x", buf[i]);
+					DEBUG_TRACE("HTTP2 unknown start pattern %02x", buf[pos]);
 					goto clean_http2;
 				}
 
 				/* Get the header name table index */
-				idx = hpack_getnum(buf, &i, idx_mask, conn->phys_ctx);
+				if (hpack_getnum(buf, &pos, block_end, idx_mask, &idx) != 0) {
+					DEBUG_TRACE("%s", "HTTP2 index decoding error");
+					goto clean_http2;
+				}
+				entry = hpack_table_get(&conn->http2.dyn_table, idx);
 
 				/* Get Header name "key" */
-				if (idx == 0) {
+				if ((idx == 0) && !value_known) {
 					/* Index 0: Header name encoded in following bytes */
-					key =
-					    hpack_decode(buf, &i, (int)bytes_read, conn->phys_ctx);
+					key = hpack_decode(buf, &pos, block_end, conn->phys_ctx);
 					CHECK_LEAK_HDR_ALLOC(key);
 					if (!key) {
 						DEBUG_TRACE("%s", "HTTP2 key decoding error");
 						goto clean_http2;
 					}
-				} else if (/*(idx >= 15) &&*/ (idx <= 61)) {
+				} else if ((idx >= 1) && (idx <= 61)) {
 					/* Take key name from predefined header table */
 					key = mg_strdup_ctx(hpack_predefined[idx].name,
 					                    conn->phys_ctx); /* leak? */
 					CHECK_LEAK_HDR_ALLOC(key);
-				} else if ((idx >= 62)
-				           && ((idx - 61) <= conn->http2.dyn_table_size)) {
+				} else if (entry != NULL) {
 					/* Take from dynamic header table */
-					uint32_t local_table_idx = (uint32_t)idx - 62;
-					key = mg_strdup_ctx(
-					    conn->http2.dyn_table[local_table_idx].name,
-					    conn->phys_ctx);
+					key = mg_strdup_ctx(entry->name, conn->phys_ctx);
 					CHECK_LEAK_HDR_ALLOC(key);
 				} else {
 					/* protocol violation */
@@ -1483,12 +2696,8 @@ handle_http2(struct mg_connection *conn)
 							mg_free((void *)key);
 							goto clean_http2;
 						}
-					} else if ((idx >= 62)
-					           && ((idx - 61) <= conn->http2.dyn_table_size)) {
-						uint32_t local_table_idx = (uint32_t)idx - 62;
-						val = mg_strdup_ctx(
-						    conn->http2.dyn_table[local_table_idx].value,
-						    conn->phys_ctx);
+					} else if (entry != NULL) {
+						val = mg_strdup_ctx(entry->value, conn->phys_ctx);
 						CHECK_LEAK_HDR_ALLOC(val);
 					} else {
 						/* protocol violation */
@@ -1503,10 +2712,7 @@ handle_http2(struct mg_connection *conn)
 
 				} else {
 					/* Read value from HTTP2 stream */
-					val = hpack_decode(buf,
-					                   &i,
-					                   (int)bytes_read,
-					                   conn->phys_ctx); /* leak? */
+					val = hpack_decode(buf, &pos, block_end, conn->phys_ctx);
 					CHECK_LEAK_HDR_ALLOC(val);
 					if (!val) {
 						DEBUG_TRACE("%s", "HTTP2 value decoding error");
@@ -1515,42 +2721,27 @@ handle_http2(struct mg_connection *conn)
 					}
 
 					if (indexing) {
-						/* Add to index */
-						if (conn->http2.dyn_table_size
-						    >= HTTP2_DYN_TABLE_SIZE) {
-							/* Too many elements */
-							DEBUG_TRACE("HTTP2 index table is full (key: %s, "
-							            "value: %s)",
-							            key,
-							            val);
-
+						/* Add to table of dynamic headers */
+						if ((key == NULL)
+						    || !hpack_table_add(&conn->http2.dyn_table,
+						                        key,
+						                        (uint32_t)strlen(key),
+						                        val,
+						                        (uint32_t)strlen(val),
+						                        conn->phys_ctx)) {
+							/* Out of memory: the table cannot follow the
+							 * peer's table any more */
+							DEBUG_TRACE("%s", "HTTP2 cannot index header");
 							CHECK_LEAK_HDR_FREE(key);
 							CHECK_LEAK_HDR_FREE(val);
-
 							mg_free((void *)key);
 							mg_free((void *)val);
+							goaway_error = HTTP2_ERR_INTERNAL_ERROR;
 							goto clean_http2;
 						}
-
-						/* Add to table of dynamic headers */
-						conn->http2.dyn_table[conn->http2.dyn_table_size].name =
-						    mg_strdup_ctx(key, conn->phys_ctx); /* leak */
-						conn->http2.dyn_table[conn->http2.dyn_table_size]
-						    .value =
-						    mg_strdup_ctx(val, conn->phys_ctx); /* leak */
-
-						CHECK_LEAK_DYN_ALLOC(
-						    conn->http2.dyn_table[conn->http2.dyn_table_size]
-						        .name);
-						CHECK_LEAK_DYN_ALLOC(
-						    conn->http2.dyn_table[conn->http2.dyn_table_size]
-						        .value);
-
-						conn->http2.dyn_table_size++;
-
-						DEBUG_TRACE("HTTP2 new dynamic header table entry %i "
+						DEBUG_TRACE("HTTP2 new dynamic header table entry %u "
 						            "(key: %s, value: %s)",
-						            (int)conn->http2.dyn_table_size,
+						            conn->http2.dyn_table.count,
 						            key,
 						            val);
 					}
@@ -1602,39 +2793,108 @@ handle_http2(struct mg_connection *conn)
 				}
 			}
 
+			goaway_error = HTTP2_ERR_NO_ERROR;
+
 			/* stream id */
 			conn->http2.stream_id = http2_frame_stream_id;
 
-			/* header parsed */
-			DEBUG_TRACE("HTTP2 handle_request (stream %u)",
-			            http2_frame_stream_id);
-			handle_request_stat_log(conn);
-
-			/* Send "final" frame */
-			DEBUG_TRACE("HTTP2 handle_request done (stream %u)",
-			            http2_frame_stream_id);
-			http2_data_frame_head(conn, 0, 1);
-			free_buffered_response_header_list(conn);
-			free_buffered_request_header_list(conn);
+			pthread_mutex_lock(&hs.lock);
+			s = http2_find_stream(&hs, http2_frame_stream_id);
+			if (s != NULL) {
+				/* Trailer of a request */
+				if (frame_is_end_stream) {
+					s->in_end = 1;
+					pthread_cond_broadcast(&hs.cond);
+				}
+				pthread_mutex_unlock(&hs.lock);
+				free_buffered_request_header_list(conn);
+				break;
+			}
+			if (((http2_frame_stream_id & 1u) == 0)
+			    || (http2_frame_stream_id <= hs.last_stream_id)) {
+				/* Streams of the client have increasing odd numbers */
+				pthread_mutex_unlock(&hs.lock);
+				free_buffered_request_header_list(conn);
+				goaway_error = HTTP2_ERR_PROTOCOL_ERROR;
+				goto clean_http2;
+			}
+			hs.last_stream_id = http2_frame_stream_id;
+			s = NULL;
+			if (hs.num_streams < HTTP2_MAX_CONCURRENT_STREAMS) {
+				s = http2_stream_create(&hs,
+				                        http2_frame_stream_id,
+				                        frame_is_end_stream);
+			}
+			if ((s != NULL) && (http2_dispatch(conn->phys_ctx, s) == 0)) {
+				/* The request is handled by a stream worker */
+				hs.handlers++;
+				pthread_mutex_unlock(&hs.lock);
+			} else {
+				/* Too many streams, out of memory or no thread */
+				if (s != NULL) {
+					hs.streams[--hs.num_streams] = NULL;
+				}
+				pthread_mutex_unlock(&hs.lock);
+				if (s != NULL) {
+					http2_stream_free(s);
+				} else {
+					free_buffered_request_header_list(conn);
+				}
+				http2_reset_stream(conn,
+				                   http2_frame_stream_id,
+				                   HTTP2_ERR_REFUSED_STREAM);
+			}
+			request_arena_reset(conn);
 		} break;
 
 		case 2: /* PRIORITY */
 		{
-			uint32_t dependStream =
+			uint32_t dependStream;
+			uint8_t weight;
+
+			if (http2_frame_size != 5) {
+				goaway_error = HTTP2_ERR_FRAME_SIZE_ERROR;
+				goto clean_http2;
+			}
+			dependStream =
 			    ((uint32_t)buf[0] * 0x1000000u) + ((uint32_t)buf[1] * 0x10000u)
 			    + ((uint32_t)buf[2] * 0x100u) + ((uint32_t)buf[3]);
-			uint8_t weight = buf[4];
+			weight = buf[4];
 			DEBUG_TRACE("HTTP2 priority %u dependent stream %u",
 			            weight,
 			            dependStream);
+			(void)dependStream;
+			(void)weight;
 		} break;
 
 		case 3: /* RST_STREAM */
 		{
-			uint32_t errorId =
+			uint32_t errorId;
+
+			if (http2_frame_size != 4) {
+				goaway_error = HTTP2_ERR_FRAME_SIZE_ERROR;
+				goto clean_http2;
+			}
+			if (http2_frame_stream_id == 0) {
+				goaway_error = HTTP2_ERR_PROTOCOL_ERROR;
+				goto clean_http2;
+			}
+			errorId =
 			    ((uint32_t)buf[0] * 0x1000000u) + ((uint32_t)buf[1] * 0x10000u)
 			    + ((uint32_t)buf[2] * 0x100u) + ((uint32_t)buf[3]);
 			DEBUG_TRACE("HTTP2 reset with error %u", errorId);
+			(void)errorId;
+
+			/* The handler stops at the next mg_read or mg_write */
+			pthread_mutex_lock(&hs.lock);
+			s = http2_find_stream(&hs, http2_frame_stream_id);
+			if (s != NULL) {
+				s->reset = 1;
+				s->send_rst = 0;
+				s->out_len = 0;
+				pthread_cond_broadcast(&hs.cond);
+			}
+			pthread_mutex_unlock(&hs.lock);
 		} break;
 
 		case 4: /* SETTINGS */
@@ -1649,19 +2909,29 @@ handle_http2(struct mg_connection *conn)
 				my_settings_accepted++;
 				DEBUG_TRACE("%s", "CivetWeb settings confirmed by peer");
 			} else {
-				int i;
-				for (i = 0; i < (int)http2_frame_size; i += 6) {
+				int pos;
+				unsigned j;
+				for (pos = 0; pos + 6 <= (int)http2_frame_size; pos += 6) {
 					uint16_t id =
-					    ((uint16_t)buf[i] * 0x100u) + ((uint16_t)buf[i + 1]);
-					uint32_t val = ((uint32_t)buf[i + 2] * 0x1000000u)
-					               + ((uint32_t)buf[i + 3] * 0x10000u)
-					               + ((uint32_t)buf[i + 4] * 0x100u)
-					               + ((uint32_t)buf[i + 5]);
+					    ((uint16_t)buf[pos] * 0x100u) + ((uint16_t)buf[pos + 1]);
+					uint32_t val = ((uint32_t)buf[pos + 2] * 0x1000000u)
+					               + ((uint32_t)buf[pos + 3] * 0x10000u)
+					               + ((uint32_t)buf[pos + 4] * 0x100u)
+					               + ((uint32_t)buf[pos + 5]);
 					switch (id) {
 					case 1:
 						client_settings.settings_header_table_size = val;
 						DEBUG_TRACE("Received settings header_table_size: %u",
 						            val);
+						/* The encoder may use a smaller table than the peer
+						 * allows, but has to signal the size */
+						if (val > HTTP2_HEADER_TABLE_SIZE) {
+							val = HTTP2_HEADER_TABLE_SIZE;
+						}
+						if (val != hs.enc.max_size) {
+							hpack_table_resize(&hs.enc, val);
+							hs.enc_size_update = 1;
+						}
 						break;
 					case 2:
 						client_settings.settings_enable_push = (val != 0);
@@ -1677,6 +2947,16 @@ handle_http2(struct mg_connection *conn)
 						client_settings.settings_initial_window_size = val;
 						DEBUG_TRACE("Received settings initial_window_size: %u",
 						            val);
+
+						/* The change applies to all open streams
+						 * (RFC 7540, 6.9.2) */
+						pthread_mutex_lock(&hs.lock);
+						for (j = 0; j < hs.num_streams; j++) {
+							hs.streams[j]->send_window +=
+							    (int64_t)val - (int64_t)hs.initial_window;
+						}
+						hs.initial_window = val;
+						pthread_mutex_unlock(&hs.lock);
 						break;
 					case 5:
 						client_settings.settings_max_frame_size = val;
@@ -1718,34 +2998,86 @@ handle_http2(struct mg_connection *conn)
 
 		case 7: /* GOAWAY */
 		{
-			uint32_t lastStream =
+			uint32_t lastStream;
+			uint32_t errorId;
+			uint32_t debugDataLen;
+			char *debugData;
+
+			if (http2_frame_size < 8) {
+				goaway_error = HTTP2_ERR_FRAME_SIZE_ERROR;
+				goto clean_http2;
+			}
+			lastStream =
 			    ((uint32_t)buf[0] * 0x1000000u) + ((uint32_t)buf[1] * 0x10000u)
 			    + ((uint32_t)buf[2] * 0x100u) + ((uint32_t)buf[3]);
-			uint32_t errorId =
+			errorId =
 			    ((uint32_t)buf[4] * 0x1000000u) + ((uint32_t)buf[5] * 0x10000u)
 			    + ((uint32_t)buf[6] * 0x100u) + ((uint32_t)buf[7]);
-			; /* followed by debug data */
-			uint32_t debugDataLen = http2_frame_size - 8;
-			char *debugData = (char *)buf + 8;
+			/* followed by debug data */
+			debugDataLen = http2_frame_size - 8;
+			debugData = (char *)buf + 8;
 
 			DEBUG_TRACE("HTTP2 goaway stream %u, error %u (%.*s)",
 			            lastStream,
 			            errorId,
 			            debugDataLen,
 			            debugData);
-
+			(void)lastStream;
+			(void)errorId;
+			(void)debugDataLen;
+			(void)debugData;
 		} break;
 
 		case 8: /* WINDOW_UPDATE */
 		{
-			uint32_t val = ((uint32_t)buf[0] * 0x1000000u)
-			               + ((uint32_t)buf[1] * 0x10000u)
-			               + ((uint32_t)buf[2] * 0x100u) + ((uint32_t)buf[3]);
+			uint32_t val;
+
+			if (http2_frame_size != 4) {
+				goaway_error = HTTP2_ERR_FRAME_SIZE_ERROR;
+				goto clean_http2;
+			}
+			val = ((uint32_t)buf[0] * 0x1000000u) + ((uint32_t)buf[1] * 0x10000u)
+			      + ((uint32_t)buf[2] * 0x100u) + ((uint32_t)buf[3]);
 			http_window_length = (val & 0x7FFFFFFFu);
 
 			DEBUG_TRACE("HTTP2 window update stream %u, length %u",
 			            http2_frame_stream_id,
 			            http_window_length);
+
+			if (http_window_length == 0) {
+				/* A zero increment is an error (RFC 7540, 6.9) */
+				if (http2_frame_stream_id == 0) {
+					goaway_error = HTTP2_ERR_PROTOCOL_ERROR;
+					goto clean_http2;
+				}
+				pthread_mutex_lock(&hs.lock);
+				s = http2_find_stream(&hs, http2_frame_stream_id);
+				if ((s != NULL) && !s->reset) {
+					s->send_rst = 1;
+					s->rst_code = HTTP2_ERR_PROTOCOL_ERROR;
+				}
+				pthread_mutex_unlock(&hs.lock);
+				break;
+			}
+
+			/* The writer may send more DATA. A window must not exceed
+			 * 2^31-1 (RFC 7540, 6.9.1). */
+			pthread_mutex_lock(&hs.lock);
+			if (http2_frame_stream_id == 0) {
+				hs.send_window += http_window_length;
+			} else if ((s = http2_find_stream(&hs, http2_frame_stream_id))
+			           != NULL) {
+				s->send_window += http_window_length;
+				if ((s->send_window > 0x7FFFFFFF) && !s->reset) {
+					s->send_rst = 1;
+					s->rst_code = HTTP2_ERR_FLOW_CONTROL_ERROR;
+				}
+			}
+			pthread_mutex_unlock(&hs.lock);
+			if (hs.send_window > 0x7FFFFFFF) {
+				goaway_error = HTTP2_ERR_FLOW_CONTROL_ERROR;
+				goto clean_http2;
+			}
 		} break;
 
 		case 9: /* CONTINUATION */
@@ -1759,107 +3091,37 @@ handle_http2(struct mg_connection *conn)
 		}
 
 		/* not used in the moment */
-		(void)frame_is_end_stream;
 		(void)frame_is_end_headers;
 		(void)client_settings;
 	}
 
 clean_http2:
-	DEBUG_TRACE("%s", "HTTP2 free buffer, connection handler finished");
-	mg_free(buf);
-}
-
-
-#if 0
-static void
-HPACK_TEST()
-{
-	uint64_t test;
-
-	for (test = 0;; test++) {
-		char in[32] = {0};
-		uint8_t out[32] = {0};
-		char *check;
-		int i;
-		int l;
-
-		memcpy(in, &test, sizeof(test));
-		l = hpack_encode(out, in, 0);
-		i = 0;
-		check = hpack_decode(out, &i, NULL);
-
-		if (strcmp(in, check)) {
-			printf("Error\n");
-		}
-		mg_free(check);
-	}
-}
-
-static void
-HPACK_TABLE_TEST()
-{
-	int i;
-
-	uint32_t hpack_huff_end_code_expected[32] = { 0 };
-	uint8_t hpack_huff_start_index_expected[32] = { 0 };
-	int reverse_map[256] = { 0 };
-
-	for (i = 0; i < 256; i++) {
-		reverse_map[i] = -1;
-	}
-
-	for (i = 0; i < 256; i++) {
-		uint8_t bits = hpack_huff_dec[i].bitcount;
-		uint8_t dec = hpack_huff_dec[i].decoded;
-		if (bits > hpack_huff_dec[i + 1].bitcount) {
-			ck_abort_msg("hpack_huff_dec disorder at index %i", i);
-		}
-		if (hpack_huff_dec[i].encoded & (0xFFFFFFFFul << bits)) {
-			ck_abort_msg("hpack_huff_dec bits inconsistent at index %i", i);
-		}
-		if ((bits < 5) || (bits > 30)) {
-			ck_abort_msg("hpack_huff_dec bits out of range at index %i", i);
-		}
-		if (reverse_map[dec] != -1) {
-			ck_abort_msg("hpack_huff_dec duplicate: %i", hpack_huff_dec[i].decoded);
-		}
-		reverse_map[dec] = i;
-
-		hpack_huff_end_code_expected[bits - 5] = hpack_huff_dec[i].encoded;
-	}
-
-	for (i = 255; i >= 0; i--) {
-		uint8_t bits = hpack_huff_dec[i].bitcount;
-		hpack_huff_start_index_expected[bits - 5] = i;
-	}
-
-	for (i = 0; i < 256; i++) {
-		if (reverse_map[i] == -1) {
-			ck_abort_msg("reverse map at %i missing", i);
-		}
+	/* Stop all handlers of this connection and wait for them */
+	DEBUG_TRACE("%s", "HTTP2 closing, waiting for stream handlers");
+	pthread_mutex_lock(&hs.lock);
+	hs.closed = 1;
+	pthread_cond_broadcast(&hs.cond);
+	while (hs.handlers > 0) {
+		pthread_cond_wait(&hs.cond, &hs.lock);
 	}
-
-	i = sizeof(hpack_huff_start_index) / sizeof(hpack_huff_start_index[0]);
-	if (i != 27) {
-		ck_abort_msg("hpack_huff_start_index size error: ", i);
-	}
-
-	i = sizeof(hpack_huff_end_code) / sizeof(hpack_huff_end_code[0]);
-	if (i != 27) {
-		ck_abort_msg("hpack_huff_end_code size error: ", i);
+	pthread_mutex_unlock(&hs.lock);
+	if (!peer_closed) {
+		http2_send_goaway(conn, hs.last_stream_id, goaway_error);
 	}
 
-	for (i = 0; i < 27; i++) {
-		if (hpack_huff_start_index_expected[i] != hpack_huff_start_index[i]) {
-			ck_abort_msg("hpack_huff_start_index error at %i", i);
-		}
-		if (hpack_huff_end_code_expected[i] != hpack_huff_end_code[i]) {
-			ck_abort_msg("hpack_huff_end_code error at %i", i);
-		}
+	for (i = 0; i < hs.num_streams; i++) {
+		http2_stream_free(hs.streams[i]);
 	}
+	closesocket(hs.wake[0]);
+	closesocket(hs.wake[1]);
+	pthread_cond_destroy(&hs.cond);
+	pthread_mutex_destroy(&hs.lock);
+	mg_free(hs.wbuf);
+	hpack_table_evict(&hs.enc, 0);
 
+	DEBUG_TRACE("%s", "HTTP2 free buffer, connection handler finished");
+	mg_free(buf);
 }
-#endif
 
 
 static void
@@ -1880,6 +3142,6 @@ process_new_http2_connection(struct mg_connection *conn)
 		DEBUG_TRACE("%s", "Free remaining HTTP2 header memory");
 		free_buffered_response_header_list(conn);
 		free_buffered_request_header_list(conn);
-		purge_dynamic_header_table(conn, 0);
+		hpack_table_evict(&conn->http2.dyn_table, 0);
 	}
 }
@@ -0,0 +1,231 @@
+/* Copyright (c) 2026 the Civetweb developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Character scanner for the HTTP request/response parser.
+ *
+ * scan_chars(p, end, cls) returns a pointer to the first character in
+ * [p, end) belonging to the character class cls, or end if there is none.
+ * The parser only needs to look at these "stop" characters, all other
+ * characters are skipped in blocks of 16 (SSE4.2) or 32 (AVX2) bytes.
+ * The implementation is selected at runtime (scan_init), the scalar
+ * implementation is used for short strings, on other CPUs and if NO_SIMD
+ * is defined. Data beyond end is never read. */
+
+/* SCAN_X86 and <immintrin.h> are set/included by civetweb.c */
+#if defined(SCAN_X86)
+#define SCAN_TARGET(x) __attribute__((target(x)))
+#endif
+
+
+/* Character classes: the scan stops at the first character of the class */
+enum {
+	SCAN_CTRL,     /* Control characters 0x00-0x1F and 0x7F */
+	SCAN_WORD_END, /* Control characters and space */
+	SCAN_NAME_END, /* ':' and everything except 0x21-0x7E */
+	SCAN_EOL,      /* '\0', '\r' and '\n' */
+	SCAN_CLASS_COUNT
+};
+
+
+/* Three inclusive byte ranges [lo, hi] for every character class, in the
+ * format used by SSE4.2 PCMPESTRI. Classes with less ranges repeat one. */
+#define SCAN_NUM_RANGES (3)
+static const unsigned char scan_ranges[SCAN_CLASS_COUNT][16] = {
+    {0x00, 0x1F, 0x7F, 0x7F, 0x7F, 0x7F},
+    {0x00, 0x20, 0x7F, 0x7F, 0x7F, 0x7F},
+    {0x00, 0x20, ':', ':', 0x7F, 0xFF},
+    {0x00, 0x00, '\n', '\n', '\r', '\r'}};
+
+
+static const char *
+scan_chars_scalar(const char *p, const char *end, int cls)
+{
+	const unsigned char *s = (const unsigned char *)p;
+	const unsigned char *e = (const unsigned char *)end;
+
+	switch (cls) {
+	case SCAN_CTRL:
+		while ((s < e) && (*s >= 0x20) && (*s != 0x7F)) {
+			s++;
+		}
+		break;
+	case SCAN_WORD_END:
+		while ((s < e) && (*s > 0x20) && (*s != 0x7F)) {
+			s++;
+		}
+		break;
+	case SCAN_NAME_END:
+		while ((s < e) && (*s > 0x20) && (*s < 0x7F) && (*s != ':')) {
+			s++;
+		}
+		break;
+	default:
+		while ((s < e) && (*s != 0) && (*s != '\r') && (*s != '\n')) {
+			s++;
+		}
+		break;
+	}
+	return (const char *)s;
+}
+
+
+#if defined(SCAN_X86)
+SCAN_TARGET("sse4.2")
+static const char *
+scan_chars_sse42(const char *p, const char *end, int cls)
+{
+	const __m128i ranges =
+	    _mm_loadu_si128((const __m128i *)(const void *)scan_ranges[cls]);
+	__m128i v;
+	int idx;
+
+	while (end - p >= 16) {
+		v = _mm_loadu_si128((const __m128i *)(const void *)p);
+		idx = _mm_cmpestri(ranges,
+		                   2 * SCAN_NUM_RANGES,
+		                   v,
+		                   16,
+		                   _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES
+		                       | _SIDD_LEAST_SIGNIFICANT);
+		if (idx < 16) {
+			return p + idx;
+		}
+		p += 16;
+	}
+	return scan_chars_scalar(p, end, cls);
+}
+
+
+SCAN_TARGET("avx2")
+static const char *
+scan_chars_avx2(const char *p, const char *end, int cls)
+{
+	const unsigned char *r = scan_ranges[cls];
+	const __m256i lo0 = _mm256_set1_epi8((char)r[0]);
+	const __m256i lo1 = _mm256_set1_epi8((char)r[2]);
+	const __m256i lo2 = _mm256_set1_epi8((char)r[4]);
+	const __m256i w0 = _mm256_set1_epi8((char)(r[1] - r[0]));
+	const __m256i w1 = _mm256_set1_epi8((char)(r[3] - r[2]));
+	const __m256i w2 = _mm256_set1_epi8((char)(r[5] - r[4]));
+	__m256i v, d0, d1, d2, hit;
+	unsigned mask;
+	int idx;
+
+	if (end - p < 16) {
+		return scan_chars_scalar(p, end, cls);
+	}
+
+	/* Most header fields are short: check the first 16 bytes with SSE4.2
+	 * before using the 32 byte loop */
+	idx = _mm_cmpestri(_mm_loadu_si128((const __m128i *)(const void *)r),
+	                   2 * SCAN_NUM_RANGES,
+	                   _mm_loadu_si128((const __m128i *)(const void *)p),
+	                   16,
+	                   _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES
+	                       | _SIDD_LEAST_SIGNIFICANT);
+	if (idx < 16) {
+		return p + idx;
+	}
+	p += 16;
+
+	while (end - p >= 32) {
+		v = _mm256_loadu_si256((const __m256i *)(const void *)p);
+		/* lo <= c <= hi  <=>  (unsigned)(c - lo) <= (hi - lo) */
+		d0 = _mm256_sub_epi8(v, lo0);
+		d1 = _mm256_sub_epi8(v, lo1);
+		d2 = _mm256_sub_epi8(v, lo2);
+		hit = _mm256_or_si256(
+		    _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(d0, w0), d0),
+		                    _mm256_cmpeq_epi8(_mm256_min_epu8(d1, w1), d1)),
+		    _mm256_cmpeq_epi8(_mm256_min_epu8(d2, w2), d2));
+		mask = (unsigned)_mm256_movemask_epi8(hit);
+		if (mask != 0) {
+			return p + __builtin_ctz(mask);
+		}
+		p += 32;
+	}
+	return scan_chars_sse42(p, end, cls);
+}
+#endif /* SCAN_X86 */
+
+
+/* Implementation levels for scan_select */
+enum { SCAN_LEVEL_SCALAR, SCAN_LEVEL_SSE42, SCAN_LEVEL_AVX2 };
+
+static const char *(*scan_chars_impl)(const char *p,
+                                      const char *end,
+                                      int cls) = scan_chars_scalar;
+
+
+/* Select the implementation for level.
+ * Return 1 if the CPU supports it, 0 otherwise (no change). */
+static int
+scan_select(int level)
+{
+	switch (level) {
+	case SCAN_LEVEL_SCALAR:
+		scan_chars_impl = scan_chars_scalar;
+		return 1;
+#if defined(SCAN_X86)
+	case SCAN_LEVEL_SSE42:
+		if (__builtin_cpu_supports("sse4.2")) {
+			scan_chars_impl = scan_chars_sse42;
+			return 1;
+		}
+		break;
+	case SCAN_LEVEL_AVX2:
+		if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("sse4.2")) {
+			scan_chars_impl = scan_chars_avx2;
+			return 1;
+		}
+		break;
+#endif
+	default:
+		break;
+	}
+	return 0;
+}
+
+
+/* Select the fastest implementation supported by the CPU.
+ * Called once by mg_init_library. */
+static void
+scan_init(void)
+{
+#if defined(SCAN_X86)
+	__builtin_cpu_init();
+#endif
+	if (!scan_select(SCAN_LEVEL_AVX2) && !scan_select(SCAN_LEVEL_SSE42)) {
+		scan_select(SCAN_LEVEL_SCALAR);
+	}
+}
+
+
+/* Find the first character of class cls in [p, end), or return end */
+static const char *
+scan_chars(const char *p, const char *end, int cls)
+{
+	if (end - p < 16) {
+		/* Not worth a function call and a SIMD setup */
+		return scan_chars_scalar(p, end, cls);
+	}
+	return scan_chars_impl(p, end, cls);
+}
@@ -254,6 +254,19 @@ signal_handler(int sig_num)
 }
 
 
+#if !defined(_WIN32)
+/* Set by SIGHUP: reopen the access log files (log rotation) */
+static volatile sig_atomic_t g_reopen_logs = 0;
+
+static void
+reopen_signal_handler(int sig_num)
+{
+	(void)sig_num;
+	g_reopen_logs = 1;
+}
+#endif
+
+
 static NO_RETURN void
 die(const char *fmt, ...)
 {
@@ -1296,6 +1309,10 @@ start_civetweb(int argc, char *argv[])
 	/* Setup signal handler: quit on Ctrl-C */
 	signal(SIGTERM, signal_handler);
 	signal(SIGINT, signal_handler);
+#if !defined(_WIN32)
+	/* Reopen log files on SIGHUP */
+	signal(SIGHUP, reopen_signal_handler);
+#endif
 
 #if defined(DAEMONIZE)
 	/* Daemonize */
@@ -3254,6 +3271,10 @@ main(int argc, char *argv[])
 
 	while (g_exit_flag == 0) {
 		sleep(1);
+		if (g_reopen_logs) {
+			g_reopen_logs = 0;
+			mg_reopen_log_files(g_ctx);
+		}
 	}
 
 	fprintf(stdout,
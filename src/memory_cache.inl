@@ -0,0 +1,609 @@
+/* memory_cache.inl
+ *
+ * In-memory cache for small static files.
+ *
+ * If static_file_memory_cache_size is set, complete "200 OK" responses
+ * for files up to MG_MEMORY_CACHE_FILE_SIZE_LIMIT bytes are kept in
+ * memory: the response header lines that do not depend on the request
+ * (Content-Type, Content-Length, Etag, Last-Modified, Cache-Control,
+ * additional_header, ...) followed by the file content. A hit sends the
+ * status line, Date and Connection header and the cached data with one
+ * gather write (one TLS write for HTTPS), without opening the file.
+ *
+ * Entries are keyed by the resolved file path and the domain. An entry is
+ * only used if the size and modification time still match the status of
+ * the file, so it is not outdated longer than the status returned by
+ * mg_stat_cached. The least recently used entries are removed when the
+ * memory budget is exceeded.
+ *
+ * This file is part of the CivetWeb project.
+ */
+
+#if defined(NO_FILESYSTEMS)
+#error "This file must only be included, if NO_FILESYSTEMS is not set"
+#endif
+
+/* Files larger than this limit are not kept in the memory cache */
+#if !defined(MG_MEMORY_CACHE_FILE_SIZE_LIMIT)
+#define MG_MEMORY_CACHE_FILE_SIZE_LIMIT (64 * 1024) /* in bytes */
+#endif
+
+
+struct mg_memory_cache_shard;
+
+struct mg_memory_cache_entry {
+	struct mg_memory_cache_entry *hash_next;
+	struct mg_memory_cache_entry *lru_prev; /* more recently used */
+	struct mg_memory_cache_entry *lru_next; /* less recently used */
+	struct mg_memory_cache_shard *shard;
+	uint32_t hash;
+	int refs;     /* Users of this entry */
+	int unlinked; /* Removed from the shard: free with the last reference */
+
+	/* Constant after the entry has been created */
+	const struct mg_domain_context *dom;
+	uint64_t size; /* File status the response has been created for */
+	time_t last_modified;
+	size_t mem_size;   /* Memory used by this entry */
+	size_t header_len; /* Header lines, including the empty line */
+	size_t data_len;   /* Header lines and file content */
+	char *data;
+	char path[1]; /* Allocated together with the entry */
+};
+
+struct mg_memory_cache_shard {
+	pthread_mutex_t mutex;
+	struct mg_memory_cache_entry **buckets;
+	uint32_t bucket_mask;
+	struct mg_memory_cache_entry lru; /* List head, lru.lru_next is the most
+	                                   * recently used entry */
+	unsigned count;
+	size_t mem_size;
+	size_t max_mem_size;
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long evictions;
+};
+
+struct mg_memory_cache {
+	struct mg_memory_cache_shard shard[MG_FILE_CACHE_SHARDS];
+};
+
+
+static struct mg_memory_cache_shard *
+memory_cache_shard(struct mg_memory_cache *mc, uint32_t hash)
+{
+	return &mc->shard[(hash >> 24) & (MG_FILE_CACHE_SHARDS - 1)];
+}
+
+
+/* Remove an entry from its shard. The shard mutex must be locked. */
+static void
+memory_cache_unlink(struct mg_memory_cache_shard *s,
+                    struct mg_memory_cache_entry *e)
+{
+	struct mg_memory_cache_entry **pp = &s->buckets[e->hash & s->bucket_mask];
+
+	while (*pp != e) {
+		pp = &(*pp)->hash_next;
+	}
+	*pp = e->hash_next;
+	e->lru_prev->lru_next = e->lru_next;
+	e->lru_next->lru_prev = e->lru_prev;
+	s->count--;
+	s->mem_size -= e->mem_size;
+
+	if (e->refs == 0) {
+		mg_free(e);
+	} else {
+		e->unlinked = 1;
+	}
+}
+
+
+/* Find the entry for path and dom, and mark it as most recently used.
+ * The shard mutex must be locked. */
+static struct mg_memory_cache_entry *
+memory_cache_find(struct mg_memory_cache_shard *s,
+                  uint32_t hash,
+                  const char *path,
+                  const struct mg_domain_context *dom)
+{
+	struct mg_memory_cache_entry *e = s->buckets[hash & s->bucket_mask];
+
+	while ((e != NULL)
+	       && ((e->hash != hash) || (e->dom != dom) || strcmp(e->path, path))) {
+		e = e->hash_next;
+	}
+	if ((e != NULL) && (s->lru.lru_next != e)) {
+		e->lru_prev->lru_next = e->lru_next;
+		e->lru_next->lru_prev = e->lru_prev;
+		e->lru_prev = &s->lru;
+		e->lru_next = s->lru.lru_next;
+		s->lru.lru_next->lru_prev = e;
+		s->lru.lru_next = e;
+	}
+	return e;
+}
+
+
+/* Add a new entry, replacing an older one for the same file. Least
+ * recently used entries are evicted until the entry fits into the memory
+ * budget of the shard. The shard mutex must be locked. */
+static void
+memory_cache_insert(struct mg_memory_cache_shard *s,
+                    struct mg_memory_cache_entry *e)
+{
+	struct mg_memory_cache_entry **bucket;
+	struct mg_memory_cache_entry *old;
+
+	old = memory_cache_find(s, e->hash, e->path, e->dom);
+	if (old != NULL) {
+		memory_cache_unlink(s, old);
+	}
+	while ((s->count > 0) && (s->mem_size + e->mem_size > s->max_mem_size)) {
+		memory_cache_unlink(s, s->lru.lru_prev);
+		s->evictions++;
+	}
+
+	bucket = &s->buckets[e->hash & s->bucket_mask];
+	e->hash_next = *bucket;
+	*bucket = e;
+	e->lru_prev = &s->lru;
+	e->lru_next = s->lru.lru_next;
+	s->lru.lru_next->lru_prev = e;
+	s->lru.lru_next = e;
+	s->count++;
+	s->mem_size += e->mem_size;
+}
+
+
+static void
+memory_cache_release(struct mg_memory_cache_entry *e)
+{
+	struct mg_memory_cache_shard *s = e->shard;
+	int do_free;
+
+	pthread_mutex_lock(&s->mutex);
+	e->refs--;
+	do_free = (e->unlinked && (e->refs == 0));
+	pthread_mutex_unlock(&s->mutex);
+
+	if (do_free) {
+		mg_free(e);
+	}
+}
+
+
+/* Free the cache. No other thread must use it anymore. */
+static void
+mg_memory_cache_free(struct mg_memory_cache *mc)
+{
+	struct mg_memory_cache_entry *e, *next;
+	int i;
+
+	if (mc == NULL) {
+		return;
+	}
+	for (i = 0; i < MG_FILE_CACHE_SHARDS; i++) {
+		struct mg_memory_cache_shard *s = &mc->shard[i];
+		for (e = s->lru.lru_next; e != &s->lru; e = next) {
+			next = e->lru_next;
+			mg_free(e);
+		}
+		mg_free(s->buckets);
+		pthread_mutex_destroy(&s->mutex);
+	}
+	mg_free(mc);
+}
+
+
+static struct mg_memory_cache *
+mg_memory_cache_create(struct mg_context *ctx, size_t max_size)
+{
+	struct mg_memory_cache *mc;
+	unsigned num_buckets;
+	int i;
+
+	(void)ctx; /* unused, if memory statistics are disabled */
+	mc = (struct mg_memory_cache *)mg_calloc_ctx(1, sizeof(*mc), ctx);
+	if (mc == NULL) {
+		return NULL;
+	}
+
+	/* Assume an average entry size of 4 kB */
+	num_buckets = 1;
+	while ((num_buckets < 4096)
+	       && (num_buckets * 4096u * MG_FILE_CACHE_SHARDS < max_size)) {
+		num_buckets <<= 1;
+	}
+
+	for (i = 0; i < MG_FILE_CACHE_SHARDS; i++) {
+		struct mg_memory_cache_shard *s = &mc->shard[i];
+		pthread_mutex_init(&s->mutex, &pthread_mutex_attr);
+		s->buckets = (struct mg_memory_cache_entry **)
+		    mg_calloc_ctx(num_buckets, sizeof(s->buckets[0]), ctx);
+		s->bucket_mask = num_buckets - 1;
+		s->lru.lru_next = s->lru.lru_prev = &s->lru;
+		s->max_mem_size = max_size / MG_FILE_CACHE_SHARDS;
+	}
+	for (i = 0; i < MG_FILE_CACHE_SHARDS; i++) {
+		if (mc->shard[i].buckets == NULL) {
+			mg_memory_cache_free(mc);
+			return NULL;
+		}
+	}
+	return mc;
+}
+
+
+/* Remove all entries for path and below path (all domains) */
+static void
+mg_memory_cache_invalidate(struct mg_context *ctx, const char *path)
+{
+	struct mg_memory_cache_shard *s;
+	struct mg_memory_cache_entry *e, *next;
+	size_t path_len;
+	int i;
+
+	if ((ctx == NULL) || (ctx->memory_cache == NULL) || (path == NULL)) {
+		return;
+	}
+	path_len = strlen(path);
+
+	for (i = 0; i < MG_FILE_CACHE_SHARDS; i++) {
+		s = &ctx->memory_cache->shard[i];
+		pthread_mutex_lock(&s->mutex);
+		for (e = s->lru.lru_next; e != &s->lru; e = next) {
+			next = e->lru_next;
+			if (file_cache_path_is_below(e->path, path, path_len)) {
+				memory_cache_unlink(s, e);
+			}
+		}
+		pthread_mutex_unlock(&s->mutex);
+	}
+}
+
+
+/* Get the entry for path and dom with an additional reference, if it has
+ * been created for the current status of the file. */
+static struct mg_memory_cache_entry *
+memory_cache_get(struct mg_memory_cache *mc,
+                 const char *path,
+                 const struct mg_domain_context *dom,
+                 const struct mg_file_stat *filestat)
+{
+	uint32_t hash = file_cache_hash(path);
+	struct mg_memory_cache_shard *s = memory_cache_shard(mc, hash);
+	struct mg_memory_cache_entry *e;
+
+	pthread_mutex_lock(&s->mutex);
+	e = memory_cache_find(s, hash, path, dom);
+	if ((e != NULL)
+	    && ((e->size != filestat->size)
+	        || (e->last_modified != filestat->last_modified))) {
+		/* The file has been modified */
+		memory_cache_unlink(s, e);
+		e = NULL;
+	}
+	if (e != NULL) {
+		e->refs++;
+		s->hits++;
+	} else {
+		s->misses++;
+	}
+	pthread_mutex_unlock(&s->mutex);
+	return e;
+}
+
+
+/* Allocate a new entry for path with data_len bytes of data */
+static struct mg_memory_cache_entry *
+memory_cache_entry_alloc(struct mg_context *ctx,
+                         const char *path,
+                         const struct mg_domain_context *dom,
+                         const struct mg_file_stat *filestat,
+                         size_t data_len)
+{
+	size_t path_len = strlen(path);
+	size_t mem_size = sizeof(struct mg_memory_cache_entry) + path_len + data_len;
+	struct mg_memory_cache_entry *e =
+	    (struct mg_memory_cache_entry *)mg_malloc_ctx(mem_size, ctx);
+
+	(void)ctx; /* unused, if memory statistics are disabled */
+	if (e != NULL) {
+		memset(e, 0, sizeof(*e));
+		e->hash = file_cache_hash(path);
+		e->dom = dom;
+		e->size = filestat->size;
+		e->last_modified = filestat->last_modified;
+		e->mem_size = mem_size;
+		e->data_len = data_len;
+		e->data = e->path + path_len + 1;
+		memcpy(e->path, path, path_len + 1);
+	}
+	return e;
+}
+
+
+/* Add a new entry, the caller holds a reference (release it with
+ * memory_cache_release). Entries larger than the memory budget of a shard
+ * are not added, but freed with the last reference. */
+static void
+memory_cache_add(struct mg_memory_cache *mc, struct mg_memory_cache_entry *e)
+{
+	struct mg_memory_cache_shard *s = memory_cache_shard(mc, e->hash);
+
+	e->shard = s;
+	e->refs = 1;
+	if (e->mem_size <= s->max_mem_size) {
+		pthread_mutex_lock(&s->mutex);
+		memory_cache_insert(s, e);
+		pthread_mutex_unlock(&s->mutex);
+	} else {
+		e->unlinked = 1;
+	}
+}
+
+
+/* Read the file and create the response headers for a new entry.
+ * Returns NULL if the response can not be cached. */
+static struct mg_memory_cache_entry *
+memory_cache_load(struct mg_connection *conn,
+                  const char *path,
+                  const struct mg_file_stat *filestat,
+                  const struct vec *mime_vec)
+{
+	struct mg_file file = STRUCT_FILE_INITIALIZER;
+	struct mg_memory_cache_entry *e = NULL;
+	char lm[64], etag[64], len[32];
+	time_t last_modified = filestat->last_modified;
+	size_t header_len = 0, num_read, n;
+	char *p;
+	int i;
+
+	/* Collect the response headers */
+	if (mg_response_header_start(conn, 200) != 0) {
+		return NULL;
+	}
+	gmt_time_string(lm, sizeof(lm), &last_modified);
+	construct_etag(etag, sizeof(etag), filestat);
+	mg_snprintf(
+	    conn, NULL, len, sizeof(len), "%" INT64_FMT, (int64_t)filestat->size);
+	send_static_cache_header(conn);
+	send_additional_header(conn);
+	send_cors_header(conn);
+	mg_response_header_add(conn,
+	                       "Content-Type",
+	                       mime_vec->ptr,
+	                       (int)mime_vec->len);
+	mg_response_header_add(conn, "Last-Modified", lm, -1);
+	mg_response_header_add(conn, "Etag", etag, -1);
+	mg_response_header_add(conn, "Content-Length", len, -1);
+	mg_response_header_add(conn, "Accept-Ranges", "bytes", -1);
+	mg_response_header_add(conn, "Vary", "Accept-Encoding", -1);
+
+	for (i = 0; i < conn->response_info.num_headers; i++) {
+		const struct mg_header *h = &conn->response_info.http_headers[i];
+		if (!mg_strcasecmp(h->name, "Date")
+		    || !mg_strcasecmp(h->name, "Connection")) {
+			/* Configured by additional_header: use the regular code */
+			goto done;
+		}
+		header_len += strlen(h->name) + strlen(h->value) + 4;
+	}
+	header_len += 2;
+
+	e = memory_cache_entry_alloc(conn->phys_ctx,
+	                             path,
+	                             conn->dom_ctx,
+	                             filestat,
+	                             header_len + (size_t)filestat->size);
+	if (e == NULL) {
+		goto done;
+	}
+	e->header_len = header_len;
+
+	p = e->data;
+	for (i = 0; i < conn->response_info.num_headers; i++) {
+		const struct mg_header *h = &conn->response_info.http_headers[i];
+		n = strlen(h->name);
+		memcpy(p, h->name, n);
+		p += n;
+		*p++ = ':';
+		*p++ = ' ';
+		n = strlen(h->value);
+		memcpy(p, h->value, n);
+		p += n;
+		*p++ = '\r';
+		*p++ = '\n';
+	}
+	*p++ = '\r';
+	*p++ = '\n';
+
+	/* Read the file. It must still have the size used for the headers. */
+	num_read = 0;
+	if (mg_fopen(conn, path, MG_FOPEN_MODE_READ, &file)) {
+		num_read = fread(p, 1, (size_t)filestat->size, file.access.fp);
+		if ((num_read == (size_t)filestat->size)
+		    && (fgetc(file.access.fp) != EOF)) {
+			num_read = 0;
+		}
+		(void)mg_fclose(&file.access);
+	}
+	if (num_read != (size_t)filestat->size) {
+		mg_free(e);
+		e = NULL;
+	}
+
+done:
+	free_buffered_response_header_list(conn);
+	conn->request_state = 0;
+	return e;
+}
+
+
+/* Send the status line, the Date and Connection header and the cached
+ * header lines and content. */
+static int
+memory_cache_send_entry(struct mg_connection *conn,
+                        const struct mg_memory_cache_entry *e,
+                        int is_head_request)
+{
+	char hdr[256], date[64];
+	const char *data = e->data;
+	size_t hdr_len, data_len = is_head_request ? e->header_len : e->data_len;
+	time_t curtime = time(NULL);
+	int ret;
+
+	gmt_time_string(date, sizeof(date), &curtime);
+	mg_snprintf(conn,
+	            NULL, /* buffer is big enough */
+	            hdr,
+	            sizeof(hdr),
+	            "HTTP/%s 200 OK\r\n"
+	            "Date: %s\r\n"
+	            "Connection: %s\r\n",
+	            conn->request_info.http_version
+	                ? conn->request_info.http_version
+	                : "1.0",
+	            date,
+	            suggest_connection_header(conn));
+	hdr_len = strlen(hdr);
+
+#if !defined(_WIN32)
+	if ((conn->ssl == NULL) && (conn->throttle == 0) && (conn->out_len == 0)) {
+		/* One system call for the complete response */
+		struct iovec iov[2];
+		struct msghdr msg;
+		ssize_t n;
+
+		iov[0].iov_base = hdr;
+		iov[0].iov_len = hdr_len;
+		iov[1].iov_base = (void *)data;
+		iov[1].iov_len = data_len;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = 2;
+		do {
+			n = sendmsg(conn->client.sock, &msg, MSG_NOSIGNAL);
+		} while ((n < 0) && (ERRNO == EINTR));
+		if (n < 0) {
+			if (!ERROR_TRY_AGAIN(ERRNO)) {
+				return -1;
+			}
+			n = 0;
+		}
+		conn->num_bytes_sent += n;
+		conn->request_state = 10;
+
+		/* The socket buffer is full: send the rest the regular way */
+		if ((size_t)n < hdr_len) {
+			if (mg_write(conn, hdr + n, hdr_len - (size_t)n)
+			    != (int)(hdr_len - (size_t)n)) {
+				return -1;
+			}
+			n = 0;
+		} else {
+			n -= (ssize_t)hdr_len;
+		}
+		if ((size_t)n < data_len) {
+			if (mg_write(conn, data + n, data_len - (size_t)n)
+			    != (int)(data_len - (size_t)n)) {
+				return -1;
+			}
+		}
+		return 0;
+	}
+#endif
+
+	{
+		/* TLS (or throttling): one record for the complete response */
+		char *buf = (char *)mg_malloc_ctx(hdr_len + data_len, conn->phys_ctx);
+		if (buf == NULL) {
+			ret = ((mg_write(conn, hdr, hdr_len) == (int)hdr_len)
+			       && (mg_write(conn, data, data_len) == (int)data_len))
+			          ? 0
+			          : -1;
+		} else {
+			memcpy(buf, hdr, hdr_len);
+			memcpy(buf + hdr_len, data, data_len);
+			ret = (mg_write(conn, buf, hdr_len + data_len)
+			       == (int)(hdr_len + data_len))
+			          ? 0
+			          : -1;
+			mg_free(buf);
+		}
+	}
+	return ret;
+}
+
+
+/* Send a "200 OK" response for a static file from the memory cache.
+ * The file is added to the cache if it is not already there.
+ * Returns 1 if the response has been sent, 0 if the regular code must be
+ * used (request or file not suitable for the cache, out of memory). */
+static int
+memory_cache_send(struct mg_connection *conn,
+                  const char *path,
+                  const struct mg_file_stat *filestat,
+                  const struct vec *mime_vec,
+                  int is_head_request)
+{
+	struct mg_memory_cache *mc = conn->phys_ctx->memory_cache;
+	struct mg_memory_cache_entry *e;
+
+	if ((mc == NULL) || (conn->protocol_type != PROTOCOL_TYPE_HTTP1)
+	    || (filestat->size > MG_MEMORY_CACHE_FILE_SIZE_LIMIT)
+	    || filestat->is_directory || (conn->request_state != 0)
+	    || (mg_get_header_id(conn, MG_HDR_ORIGIN) != NULL)) {
+		/* CORS headers depend on the Origin request header */
+		return 0;
+	}
+
+	if (filestat->size + sizeof(*e) > mc->shard[0].max_mem_size) {
+		return 0;
+	}
+
+	e = memory_cache_get(mc, path, conn->dom_ctx, filestat);
+	if (e == NULL) {
+		/* Load the file without holding the lock */
+		e = memory_cache_load(conn, path, filestat, mime_vec);
+		if (e == NULL) {
+			return 0;
+		}
+		memory_cache_add(mc, e);
+	}
+
+	(void)memory_cache_send_entry(conn, e, is_head_request);
+	memory_cache_release(e);
+	return 1;
+}
+
+
+#if defined(USE_SERVER_STATS)
+static void
+memory_cache_get_stats(struct mg_memory_cache *mc,
+                       unsigned *entries,
+                       uint64_t *size,
+                       unsigned long *hits,
+                       unsigned long *misses,
+                       unsigned long *evictions)
+{
+	int i;
+
+	*entries = 0;
+	*size = 0;
+	*hits = *misses = *evictions = 0;
+	for (i = 0; i < MG_FILE_CACHE_SHARDS; i++) {
+		struct mg_memory_cache_shard *s = &mc->shard[i];
+		pthread_mutex_lock(&s->mutex);
+		*entries += s->count;
+		*size += s->mem_size;
+		*hits += s->hits;
+		*misses += s->misses;
+		*evictions += s->evictions;
+		pthread_mutex_unlock(&s->mutex);
+	}
+}
+#endif
@@ -0,0 +1,581 @@
+/* Experimental io_uring backend for the socket and file I/O of the worker
+ * threads (Linux only).
+ *
+ * Every worker thread owns one small ring. Socket reads and writes are
+ * submitted together with a linked timeout, so waiting for the socket and
+ * the transfer itself take one system call instead of poll plus recv/send.
+ * Files are sent by chains of linked read/send operations, several chunks
+ * per submission. The response headers are collected in the output buffer
+ * (see mg_response_header_send) and sent as the first operation of the
+ * chain, so a small static file takes one submission.
+ *
+ * The ring is set up using the raw system calls, so liburing is not
+ * required. If io_uring is not available (old kernel, seccomp filters,
+ * /proc/sys/kernel/io_uring_disabled), the regular poll based code is used.
+ */
+#if !defined(USE_IO_URING)
+#error "This file must only be included, if USE_IO_URING is set"
+#endif
+
+#if !defined(MG_URING_ENTRIES)
+#define MG_URING_ENTRIES (16)
+#endif
+
+/* Number of read/send pairs per submission in mg_uring_send_file */
+#if !defined(MG_URING_FILE_CHUNKS)
+#define MG_URING_FILE_CHUNKS (4)
+#endif
+#if !defined(MG_URING_FILE_CHUNK_SIZE)
+#define MG_URING_FILE_CHUNK_SIZE (16384)
+#endif
+
+/* Files up to this size are sent by one chain, instead of sendfile */
+#define MG_URING_FILE_BATCH                                                    \
+	((int64_t)MG_URING_FILE_CHUNKS * MG_URING_FILE_CHUNK_SIZE)
+
+/* Size of the output buffer for the response headers, if no
+ * output_buffer_size is configured */
+#if !defined(MG_URING_HEADER_BUF_SIZE)
+#define MG_URING_HEADER_BUF_SIZE (4096)
+#endif
+
+mg_static_assert(MG_URING_ENTRIES >= 2 * MG_URING_FILE_CHUNKS + 1,
+                 "io_uring too small for file send chain");
+
+/* user_data of the linked timeout operation */
+#define MG_URING_UD_TIMEOUT (~(uint64_t)0)
+
+/* user_data of the send operation for the output buffer */
+#define MG_URING_UD_OUT_BUF ((uint64_t)(2 * MG_URING_FILE_CHUNKS))
+
+
+struct mg_uring {
+	int fd;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *ring_mem; /* SQ and CQ ring (IORING_FEAT_SINGLE_MMAP) */
+	size_t ring_size;
+	size_t sqes_size;
+	unsigned to_submit; /* prepared, but not yet submitted */
+	char *file_buf;     /* MG_URING_FILE_CHUNKS * MG_URING_FILE_CHUNK_SIZE,
+	                       allocated with the first mg_uring_send_file */
+};
+
+
+/* The ring of the calling worker thread, or NULL */
+static struct mg_uring *
+mg_uring_of_thread(void)
+{
+	struct mg_workerTLS *tls =
+	    (struct mg_workerTLS *)pthread_getspecific(sTlsKey);
+
+	/* Only worker and helper threads (is_master == 0) initialize the
+	 * uring element. */
+	if ((tls == NULL) || (tls->is_master != 0)) {
+		return NULL;
+	}
+	return tls->uring;
+}
+
+
+static void
+mg_uring_destroy(struct mg_uring *r)
+{
+	if (r == NULL) {
+		return;
+	}
+	if (r->sqes != NULL) {
+		munmap(r->sqes, r->sqes_size);
+	}
+	if (r->ring_mem != NULL) {
+		munmap(r->ring_mem, r->ring_size);
+	}
+	if (r->fd >= 0) {
+		close(r->fd);
+	}
+	mg_free(r->file_buf);
+	mg_free(r);
+}
+
+
+static struct mg_uring *
+mg_uring_create(struct mg_context *ctx)
+{
+	struct io_uring_params p;
+	struct mg_uring *r;
+	size_t cq_size;
+	char *mem;
+
+	r = (struct mg_uring *)mg_calloc_ctx(1, sizeof(*r), ctx);
+	if (r == NULL) {
+		return NULL;
+	}
+
+	memset(&p, 0, sizeof(p));
+	r->fd = (int)syscall(__NR_io_uring_setup, MG_URING_ENTRIES, &p);
+	if (r->fd < 0) {
+		DEBUG_TRACE("io_uring_setup failed: %s", strerror(ERRNO));
+		mg_free(r);
+		return NULL;
+	}
+	set_close_on_exec(r->fd, NULL, ctx);
+
+	/* Linked timeouts and waiting with a timeout need Linux 5.11 */
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP)
+	    || !(p.features & IORING_FEAT_NODROP)
+	    || !(p.features & IORING_FEAT_EXT_ARG)) {
+		DEBUG_TRACE("io_uring features %x not sufficient", p.features);
+		mg_uring_destroy(r);
+		return NULL;
+	}
+
+	r->ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (cq_size > r->ring_size) {
+		r->ring_size = cq_size;
+	}
+	mem = (char *)mmap(NULL,
+	                   r->ring_size,
+	                   PROT_READ | PROT_WRITE,
+	                   MAP_SHARED | MAP_POPULATE,
+	                   r->fd,
+	                   IORING_OFF_SQ_RING);
+	if (mem == MAP_FAILED) {
+		mg_uring_destroy(r);
+		return NULL;
+	}
+	r->ring_mem = mem;
+
+	r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = (struct io_uring_sqe *)mmap(NULL,
+	                                      r->sqes_size,
+	                                      PROT_READ | PROT_WRITE,
+	                                      MAP_SHARED | MAP_POPULATE,
+	                                      r->fd,
+	                                      IORING_OFF_SQES);
+	if ((void *)r->sqes == MAP_FAILED) {
+		r->sqes = NULL;
+		mg_uring_destroy(r);
+		return NULL;
+	}
+
+	r->sq_head = (unsigned *)(void *)(mem + p.sq_off.head);
+	r->sq_tail = (unsigned *)(void *)(mem + p.sq_off.tail);
+	r->sq_mask = (unsigned *)(void *)(mem + p.sq_off.ring_mask);
+	r->sq_array = (unsigned *)(void *)(mem + p.sq_off.array);
+	r->cq_head = (unsigned *)(void *)(mem + p.cq_off.head);
+	r->cq_tail = (unsigned *)(void *)(mem + p.cq_off.tail);
+	r->cq_mask = (unsigned *)(void *)(mem + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)(void *)(mem + p.cq_off.cqes);
+
+	return r;
+}
+
+
+/* Get the next free submission queue entry. The caller must not prepare
+ * more than MG_URING_ENTRIES entries before calling mg_uring_enter. */
+static struct io_uring_sqe *
+mg_uring_sqe(struct mg_uring *r)
+{
+	unsigned tail = *r->sq_tail + r->to_submit;
+	unsigned idx = tail & *r->sq_mask;
+	struct io_uring_sqe *sqe = &r->sqes[idx];
+
+	memset(sqe, 0, sizeof(*sqe));
+	r->sq_array[idx] = idx;
+	r->to_submit++;
+	return sqe;
+}
+
+
+/* Submit all prepared entries and wait until min_complete completions are
+ * available, or timeout_ms (if >= 0) has elapsed.
+ * Returns 0 or -errno (-ETIME for a timeout). */
+static int
+mg_uring_enter(struct mg_uring *r, unsigned min_complete, int timeout_ms)
+{
+	struct __kernel_timespec ts;
+	struct io_uring_getevents_arg arg;
+	unsigned flags = IORING_ENTER_GETEVENTS;
+	void *argp = NULL;
+	size_t argsz = 0;
+	unsigned to_submit = r->to_submit;
+	int ret;
+
+	/* Publish the prepared entries. If a call is interrupted, the kernel
+	 * only takes entries which are not yet consumed, so the same to_submit
+	 * value can be used again. */
+	__atomic_store_n(r->sq_tail, *r->sq_tail + to_submit, __ATOMIC_RELEASE);
+	r->to_submit = 0;
+
+	if (timeout_ms >= 0) {
+		ts.tv_sec = timeout_ms / 1000;
+		ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+		memset(&arg, 0, sizeof(arg));
+		arg.ts = (uint64_t)(uintptr_t)&ts;
+		flags |= IORING_ENTER_EXT_ARG;
+		argp = &arg;
+		argsz = sizeof(arg);
+	}
+
+	do {
+		ret = (int)syscall(__NR_io_uring_enter,
+		                   r->fd,
+		                   to_submit,
+		                   min_complete,
+		                   flags,
+		                   argp,
+		                   argsz);
+	} while ((ret < 0) && (ERRNO == EINTR));
+
+	return (ret < 0) ? -ERRNO : 0;
+}
+
+
+/* Get one completion. Returns 0 if there is none. */
+static int
+mg_uring_cqe(struct mg_uring *r, uint64_t *user_data, int *res)
+{
+	unsigned head = *r->cq_head;
+	struct io_uring_cqe *cqe;
+
+	if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+		return 0;
+	}
+	cqe = &r->cqes[head & *r->cq_mask];
+	*user_data = cqe->user_data;
+	*res = cqe->res;
+	__atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+
+/* One recv (IORING_OP_RECV) or send (IORING_OP_SEND) on a socket, waiting
+ * at most timeout_ms for the socket to become ready.
+ * Returns the number of bytes transferred, 0 for EOF (recv), -ETIME for a
+ * timeout or another -errno. */
+static int
+mg_uring_sock_io(struct mg_uring *r,
+                 int opcode,
+                 SOCKET sock,
+                 void *buf,
+                 int len,
+                 int timeout_ms)
+{
+	struct __kernel_timespec ts;
+	struct io_uring_sqe *sqe;
+	uint64_t ud;
+	int res, ret = -ETIME, pending = 2, err;
+
+	sqe = mg_uring_sqe(r);
+	sqe->opcode = (uint8_t)opcode;
+	sqe->fd = sock;
+	sqe->addr = (uint64_t)(uintptr_t)buf;
+	sqe->len = (unsigned)len;
+	sqe->msg_flags = (opcode == IORING_OP_SEND) ? MSG_NOSIGNAL : 0;
+	sqe->flags = IOSQE_IO_LINK;
+	sqe->user_data = 0;
+
+	ts.tv_sec = timeout_ms / 1000;
+	ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+	sqe = mg_uring_sqe(r);
+	sqe->opcode = IORING_OP_LINK_TIMEOUT;
+	sqe->fd = -1;
+	sqe->addr = (uint64_t)(uintptr_t)&ts;
+	sqe->len = 1;
+	sqe->user_data = MG_URING_UD_TIMEOUT;
+
+	/* Both completions must be collected, before buf and ts may go out of
+	 * scope. */
+	while (pending > 0) {
+		err = mg_uring_enter(r, (unsigned)pending, -1);
+		if (err < 0) {
+			/* Should not happen: the ring is private to this thread */
+			DEBUG_TRACE("io_uring_enter failed: %d", err);
+			return err;
+		}
+		while ((pending > 0) && mg_uring_cqe(r, &ud, &res)) {
+			pending--;
+			if (ud != MG_URING_UD_TIMEOUT) {
+				/* The linked timeout cancels the I/O operation */
+				ret = (res == -ECANCELED) ? -ETIME : res;
+			}
+		}
+	}
+	return ret;
+}
+
+
+/* Wait until a socket is ready, after an operation completed with -EAGAIN
+ * (the socket is in non-blocking mode). Returns the result of poll. */
+static int
+mg_uring_wait_socket(SOCKET sock, short events, int timeout_ms)
+{
+	struct pollfd pfd;
+
+	pfd.fd = sock;
+	pfd.events = events;
+	pfd.revents = 0;
+	return poll(&pfd, 1, timeout_ms);
+}
+
+
+/* Receive data from a socket, like poll and recv in pull_inner.
+ * Returns the number of bytes read, 0 for a timeout, -2 for an error,
+ * a closed connection, or a stop signal. */
+static int
+mg_uring_recv(struct mg_uring *r,
+              SOCKET sock,
+              char *buf,
+              int len,
+              double timeout,
+              const stop_flag_t *stop_flag)
+{
+	int ms_total = (timeout >= 0.0) ? (int)(timeout * 1000.0) : -1;
+	int ms_now, res;
+
+	/* Wait in slices of SOCKET_TIMEOUT_QUANTUM, to react on the stop flag
+	 * (see mg_poll). */
+	do {
+		if (!STOP_FLAG_IS_ZERO(stop_flag)) {
+			return -2;
+		}
+		ms_now = SOCKET_TIMEOUT_QUANTUM;
+		if ((ms_total >= 0) && (ms_total < ms_now)) {
+			ms_now = ms_total;
+		}
+		res = mg_uring_sock_io(r, IORING_OP_RECV, sock, buf, len, ms_now);
+		if (res > 0) {
+			return res;
+		}
+		if (res == -EAGAIN) {
+			/* Wait for the socket, then try again */
+			res = mg_uring_wait_socket(sock, POLLIN, ms_now);
+			if (res > 0) {
+				continue;
+			}
+			if ((res < 0) && (ERRNO != EINTR)) {
+				return -2;
+			}
+			res = -ETIME;
+		}
+		if (res != -ETIME) {
+			/* 0: shutdown of the socket at client side, or error */
+			return -2;
+		}
+		if (ms_total > 0) {
+			ms_total -= ms_now;
+		}
+	} while (ms_total != 0);
+
+	return 0;
+}
+
+
+/* Send data from an opened file using chains of linked read and send
+ * operations. offset is the position in the file, len the number of bytes
+ * to send. Data in the output buffer of conn (the response headers) is
+ * sent by the first operation of the first chain.
+ * Returns the number of bytes sent, -1 for an error (the connection
+ * should be closed), or -2 if no file data was sent and io_uring can not
+ * be used for this file (the caller should fall back to another method). */
+static int64_t
+mg_uring_send_file(struct mg_uring *r,
+                   struct mg_connection *conn,
+                   int fd,
+                   int64_t offset,
+                   int64_t len)
+{
+	int read_res[MG_URING_FILE_CHUNKS], send_res[MG_URING_FILE_CHUNKS];
+	int chunk_len[MG_URING_FILE_CHUNKS];
+	struct io_uring_sqe *sqe;
+	int64_t sent = 0, round_sent;
+	uint64_t ud, start, again_start = 0;
+	int timeout_ms = -1, n, i, res, pending, err, aborted, again;
+	int out_len, out_res = 0;
+
+	if (r->file_buf == NULL) {
+		r->file_buf = (char *)mg_malloc_ctx(MG_URING_FILE_CHUNKS
+		                                        * MG_URING_FILE_CHUNK_SIZE,
+		                                    conn->phys_ctx);
+		if (r->file_buf == NULL) {
+			return -2;
+		}
+	}
+
+	if (conn->dom_ctx->config[REQUEST_TIMEOUT]) {
+		timeout_ms = atoi(conn->dom_ctx->config[REQUEST_TIMEOUT]);
+	}
+	if (timeout_ms <= 0) {
+		timeout_ms = atoi(config_options[REQUEST_TIMEOUT].default_value);
+	}
+
+	while (len > 0) {
+		/* Prepare one chain: send the output buffer, read chunk 0, send
+		 * chunk 0, read chunk 1, ...
+		 * A short send would not break the chain, so the following chunks
+		 * would be sent anyway: MSG_WAITALL makes io_uring retry until
+		 * the chunk is sent completely (or an error breaks the chain). */
+		out_len = conn->out_len;
+		if (out_len > 0) {
+			out_res = -ECANCELED;
+			sqe = mg_uring_sqe(r);
+			sqe->opcode = IORING_OP_SEND;
+			sqe->fd = conn->client.sock;
+			sqe->addr = (uint64_t)(uintptr_t)conn->out_buf;
+			sqe->len = (unsigned)out_len;
+			sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+			sqe->flags = IOSQE_IO_LINK;
+			sqe->user_data = MG_URING_UD_OUT_BUF;
+		}
+		for (n = 0; (n < MG_URING_FILE_CHUNKS) && (len > 0); n++) {
+			int64_t chunk_offs = (int64_t)n * MG_URING_FILE_CHUNK_SIZE;
+			if (chunk_offs >= len) {
+				break;
+			}
+			chunk_len[n] = (len - chunk_offs > MG_URING_FILE_CHUNK_SIZE)
+			                   ? MG_URING_FILE_CHUNK_SIZE
+			                   : (int)(len - chunk_offs);
+			read_res[n] = send_res[n] = -ECANCELED;
+
+			sqe = mg_uring_sqe(r);
+			sqe->opcode = IORING_OP_READ;
+			sqe->fd = fd;
+			sqe->off = (uint64_t)(offset + chunk_offs);
+			sqe->addr = (uint64_t)(uintptr_t)(r->file_buf + chunk_offs);
+			sqe->len = (unsigned)chunk_len[n];
+			sqe->flags = IOSQE_IO_LINK;
+			sqe->user_data = (uint64_t)(2 * (unsigned)n);
+
+			sqe = mg_uring_sqe(r);
+			sqe->opcode = IORING_OP_SEND;
+			sqe->fd = conn->client.sock;
+			sqe->addr = (uint64_t)(uintptr_t)(r->file_buf + chunk_offs);
+			sqe->len = (unsigned)chunk_len[n];
+			sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+			sqe->flags = IOSQE_IO_LINK;
+			sqe->user_data = (uint64_t)(2 * (unsigned)n + 1);
+		}
+		sqe->flags = 0; /* end of chain */
+
+		/* Wait for all completions */
+		pending = 2 * n + ((out_len > 0) ? 1 : 0);
+		aborted = 0;
+		start = mg_get_current_time_ns();
+		while (pending > 0) {
+			err = mg_uring_enter(r,
+			                     (unsigned)pending,
+			                     aborted ? -1 : SOCKET_TIMEOUT_QUANTUM);
+			if ((err < 0) && (err != -ETIME)) {
+				mg_cry_internal(conn, "io_uring_enter failed: %d", err);
+				aborted = 1;
+				shutdown(conn->client.sock, SHUTDOWN_BOTH);
+			}
+			while ((pending > 0) && mg_uring_cqe(r, &ud, &res)) {
+				pending--;
+				if (ud == MG_URING_UD_OUT_BUF) {
+					out_res = res;
+				} else if (ud & 1) {
+					send_res[ud / 2] = res;
+				} else {
+					read_res[ud / 2] = res;
+				}
+			}
+			if ((pending > 0) && !aborted
+			    && (!STOP_FLAG_IS_ZERO(&conn->phys_ctx->stop_flag)
+			        || ((mg_get_current_time_ns() - start)
+			            > (uint64_t)timeout_ms * 1000000u))) {
+				/* The client does not read the data: the pending send
+				 * operations complete with an error after shutdown. */
+				aborted = 1;
+				shutdown(conn->client.sock, SHUTDOWN_BOTH);
+			}
+		}
+		if (aborted) {
+			return -1;
+		}
+
+		/* The output buffer must be sent, before the file data */
+		again = 0;
+		if (out_len > 0) {
+			if (out_res == out_len) {
+				conn->out_len = 0;
+			} else if (out_res > 0) {
+				/* Short send: the file operations have been canceled */
+				memmove(conn->out_buf,
+				        conn->out_buf + out_res,
+				        (size_t)(out_len - out_res));
+				conn->out_len = out_len - out_res;
+				again_start = 0;
+				continue;
+			} else if (out_res == -EAGAIN) {
+				again = 1;
+			} else {
+				return -1;
+			}
+		}
+
+		/* Count the data sent by this chain */
+		round_sent = 0;
+		for (i = 0; (i < n) && !again; i++) {
+			if (read_res[i] < 0) {
+				if ((sent == 0) && (round_sent == 0) && (i == 0)
+				    && (read_res[i] != -ECANCELED)) {
+					/* Not a regular file (e.g. -ESPIPE) */
+					return -2;
+				}
+				break;
+			}
+			if (send_res[i] < 0) {
+				if (send_res[i] == -EAGAIN) {
+					again = (round_sent == 0);
+				} else if (send_res[i] != -ECANCELED) {
+					/* Error sending data to the client */
+					return (sent + round_sent > 0) ? (sent + round_sent)
+					                               : -1;
+				}
+				break;
+			}
+			round_sent += send_res[i];
+			if ((send_res[i] < read_res[i]) || (read_res[i] < chunk_len[i])) {
+				/* End of file */
+				break;
+			}
+		}
+		if (again) {
+			/* The socket buffer is full: wait, then try again */
+			if (again_start == 0) {
+				again_start = mg_get_current_time_ns();
+			} else if ((mg_get_current_time_ns() - again_start)
+			           > (uint64_t)timeout_ms * 1000000u) {
+				return (sent > 0) ? sent : -1;
+			}
+			if (!STOP_FLAG_IS_ZERO(&conn->phys_ctx->stop_flag)
+			    || ((mg_uring_wait_socket(conn->client.sock,
+			                              POLLOUT,
+			                              SOCKET_TIMEOUT_QUANTUM)
+			         < 0)
+			        && (ERRNO != EINTR))) {
+				return (sent > 0) ? sent : -1;
+			}
+			continue;
+		}
+		if (round_sent == 0) {
+			/* End of file or client did not accept data */
+			break;
+		}
+		again_start = 0;
+		sent += round_sent;
+		offset += round_sent;
+		len -= round_sent;
+	}
+
+	return sent;
+}
@@ -59,6 +59,12 @@ static const char lua_regkey_connlist = 2;
 static const char lua_regkey_lsp_include_history = 3;
 static const char lua_regkey_environment_type = 4;
 static const char lua_regkey_dtor = 5;
+static const char lua_regkey_pool_base = 6;
+static const char lua_regkey_pool_env = 7;
+static const char lua_regkey_pool_env_mt = 8;
+static const char lua_regkey_pool_mg_mt = 9;
+static const char lua_regkey_pool_onerror = 10;
+static const char lua_regkey_pool_package = 11;
 
 
 /* Limit nesting depth of mg.include.
@@ -2599,7 +2605,7 @@ prepare_lua_request_info_inner(const struct mg_connection *conn, lua_State *L)
 		        .content_length); /* lua_Number may be used as 52 bit integer */
 		lua_rawset(L, -3);
 	}
-	if ((s = mg_get_header(conn, "Content-Type")) != NULL) {
+	if ((s = mg_get_header_id(conn, MG_HDR_CONTENT_TYPE)) != NULL) {
 		reg_string(L, "content_type", s);
 	}
 
@@ -2840,33 +2846,10 @@ lua_error_handler(lua_State *L)
 
 
 static void
-prepare_lua_environment(struct mg_context *ctx,
-                        struct mg_connection *conn,
-                        struct lua_websock_data *ws_conn_list,
-                        lua_State *L,
-                        const char *script_name,
-                        int lua_env_type)
+prepare_lua_libs(lua_State *L)
 {
-	const char *preload_file_name = NULL;
-	const char *debug_params = NULL;
-
-	int lua_context_flags = lua_env_type;
-
-	DEBUG_TRACE("Lua environment type %i: %p, connection %p, script %s",
-	            lua_env_type,
-	            L,
-	            conn,
-	            script_name);
-
 	civetweb_open_lua_libs(L);
 
-#if defined(MG_EXPERIMENTAL_INTERFACES)
-	/* Check if debugging should be enabled */
-	if ((conn != NULL) && (conn->dom_ctx != NULL)) {
-		debug_params = conn->dom_ctx->config[LUA_DEBUG_PARAMS];
-	}
-#endif
-
 #if LUA_VERSION_NUM == 502
 	/* Keep the "connect" method for compatibility,
 	 * but do not backport it to Lua 5.1.
@@ -2880,39 +2863,45 @@ prepare_lua_environment(struct mg_context *ctx,
 	lua_pop(L, 1);
 	lua_register(L, "connect", lsp_connect);
 #endif
+}
 
-	/* Store context in the registry */
-	if (ctx != NULL) {
-		lua_pushlightuserdata(L, (void *)&lua_regkey_ctx);
-		lua_pushlightuserdata(L, (void *)ctx);
-		lua_settable(L, LUA_REGISTRYINDEX);
-	}
-	if (ws_conn_list != NULL) {
-		lua_pushlightuserdata(L, (void *)&lua_regkey_connlist);
-		lua_pushlightuserdata(L, (void *)ws_conn_list);
-		lua_settable(L, LUA_REGISTRYINDEX);
-	}
-	lua_pushlightuserdata(L, (void *)&lua_regkey_environment_type);
-	lua_pushinteger(L, lua_context_flags);
-	lua_settable(L, LUA_REGISTRYINDEX);
 
-	/* State close function */
-	reg_gc(L, conn);
+/* Add the connection independent elements to the "mg" table on the top of
+ * the stack */
+static void
+reg_mg_functions(lua_State *L)
+{
+	reg_function(L, "time", lsp_get_time);
+	reg_function(L, "get_var", lsp_get_var);
+	reg_function(L, "split_form_data", lsp_split_form_urlencoded);
+	reg_function(L, "get_cookie", lsp_get_cookie);
+	reg_function(L, "md5", lsp_md5);
+	reg_function(L, "url_encode", lsp_url_encode);
+	reg_function(L, "url_decode", lsp_url_decode);
+	reg_function(L, "base64_encode", lsp_base64_encode);
+	reg_function(L, "base64_decode", lsp_base64_decode);
+	reg_function(L, "get_response_code_text", lsp_get_response_code_text);
+	reg_function(L, "random", lsp_random);
+	reg_function(L, "get_info", lsp_get_info);
+	reg_function(L, "trace", lsp_trace);
 
-	/* Lua server pages store the depth of mg.include, in order
-	 * to detect recursions and prevent stack overflows. */
-	if (lua_env_type == LUA_ENV_TYPE_LUA_SERVER_PAGE) {
-		struct lsp_include_history *h;
-		lua_pushlightuserdata(L, (void *)&lua_regkey_lsp_include_history);
-		h = (struct lsp_include_history *)
-		    lua_newuserdata(L, sizeof(struct lsp_include_history));
-		lua_settable(L, LUA_REGISTRYINDEX);
-		memset(h, 0, sizeof(struct lsp_include_history));
+	if (pf_uuid_generate.f) {
+		reg_function(L, "uuid", lsp_uuid);
 	}
 
-	/* Register mg module */
-	lua_newtable(L);
+	reg_string(L, "version", CIVETWEB_VERSION);
+}
 
+
+/* Add the connection and environment specific elements to the "mg" table on
+ * the top of the stack */
+static void
+reg_mg_request(struct mg_context *ctx,
+               struct mg_connection *conn,
+               lua_State *L,
+               const char *script_name,
+               int lua_env_type)
+{
 	switch (lua_env_type) {
 	case LUA_ENV_TYPE_LUA_SERVER_PAGE:
 		reg_string(L, "lua_type", "page");
@@ -2964,26 +2953,6 @@ prepare_lua_environment(struct mg_context *ctx,
 	reg_conn_function(L, "get_mime_type", lsp_get_mime_type, conn);
 	reg_conn_function(L, "get_option", lsp_get_option, conn);
 
-	reg_function(L, "time", lsp_get_time);
-	reg_function(L, "get_var", lsp_get_var);
-	reg_function(L, "split_form_data", lsp_split_form_urlencoded);
-	reg_function(L, "get_cookie", lsp_get_cookie);
-	reg_function(L, "md5", lsp_md5);
-	reg_function(L, "url_encode", lsp_url_encode);
-	reg_function(L, "url_decode", lsp_url_decode);
-	reg_function(L, "base64_encode", lsp_base64_encode);
-	reg_function(L, "base64_decode", lsp_base64_decode);
-	reg_function(L, "get_response_code_text", lsp_get_response_code_text);
-	reg_function(L, "random", lsp_random);
-	reg_function(L, "get_info", lsp_get_info);
-	reg_function(L, "trace", lsp_trace);
-
-	if (pf_uuid_generate.f) {
-		reg_function(L, "uuid", lsp_uuid);
-	}
-
-	reg_string(L, "version", CIVETWEB_VERSION);
-
 	reg_string(L, "script_name", script_name);
 
 	if ((conn != NULL) && (conn->dom_ctx != NULL)) {
@@ -3028,6 +2997,87 @@ prepare_lua_environment(struct mg_context *ctx,
 			prepare_lua_response_table(conn, L);
 		}
 	}
+}
+
+
+static void
+set_lua_debug_hook(lua_State *L, const char *debug_params)
+{
+	int mask = 0;
+	if (0 != strchr(debug_params, 'c')) {
+		mask |= LUA_MASKCALL;
+	}
+	if (0 != strchr(debug_params, 'r')) {
+		mask |= LUA_MASKRET;
+	}
+	if (0 != strchr(debug_params, 'l')) {
+		mask |= LUA_MASKLINE;
+	}
+	lua_sethook(L, lua_debug_hook, mask, 0);
+}
+
+
+static void
+prepare_lua_environment(struct mg_context *ctx,
+                        struct mg_connection *conn,
+                        struct lua_websock_data *ws_conn_list,
+                        lua_State *L,
+                        const char *script_name,
+                        int lua_env_type)
+{
+	const char *preload_file_name = NULL;
+	const char *debug_params = NULL;
+
+	int lua_context_flags = lua_env_type;
+
+	DEBUG_TRACE("Lua environment type %i: %p, connection %p, script %s",
+	            lua_env_type,
+	            L,
+	            conn,
+	            script_name);
+
+	prepare_lua_libs(L);
+
+#if defined(MG_EXPERIMENTAL_INTERFACES)
+	/* Check if debugging should be enabled */
+	if ((conn != NULL) && (conn->dom_ctx != NULL)) {
+		debug_params = conn->dom_ctx->config[LUA_DEBUG_PARAMS];
+	}
+#endif
+
+	/* Store context in the registry */
+	if (ctx != NULL) {
+		lua_pushlightuserdata(L, (void *)&lua_regkey_ctx);
+		lua_pushlightuserdata(L, (void *)ctx);
+		lua_settable(L, LUA_REGISTRYINDEX);
+	}
+	if (ws_conn_list != NULL) {
+		lua_pushlightuserdata(L, (void *)&lua_regkey_connlist);
+		lua_pushlightuserdata(L, (void *)ws_conn_list);
+		lua_settable(L, LUA_REGISTRYINDEX);
+	}
+	lua_pushlightuserdata(L, (void *)&lua_regkey_environment_type);
+	lua_pushinteger(L, lua_context_flags);
+	lua_settable(L, LUA_REGISTRYINDEX);
+
+	/* State close function */
+	reg_gc(L, conn);
+
+	/* Lua server pages store the depth of mg.include, in order
+	 * to detect recursions and prevent stack overflows. */
+	if (lua_env_type == LUA_ENV_TYPE_LUA_SERVER_PAGE) {
+		struct lsp_include_history *h;
+		lua_pushlightuserdata(L, (void *)&lua_regkey_lsp_include_history);
+		h = (struct lsp_include_history *)
+		    lua_newuserdata(L, sizeof(struct lsp_include_history));
+		lua_settable(L, LUA_REGISTRYINDEX);
+		memset(h, 0, sizeof(struct lsp_include_history));
+	}
+
+	/* Register mg module */
+	lua_newtable(L);
+	reg_mg_functions(L);
+	reg_mg_request(ctx, conn, L, script_name, lua_env_type);
 
 	/* Store as global table "mg" */
 	lua_setglobal(L, "mg");
@@ -3065,17 +3115,573 @@ prepare_lua_environment(struct mg_context *ctx,
 
 	/* If debugging is enabled, add a hook */
 	if (debug_params) {
-		int mask = 0;
-		if (0 != strchr(debug_params, 'c')) {
-			mask |= LUA_MASKCALL;
+		set_lua_debug_hook(L, debug_params);
+	}
+}
+
+
+/* Lua state pool (lua_state_pool_size)
+ *
+ * Lua scripts and Lua server pages may reuse Lua states, instead of creating
+ * and closing a state for every request. A pooled state is prepared once:
+ * its base environment holds the standard libraries, the connection
+ * independent "mg" functions, the "shared" table and everything defined by
+ * the lua_preload_file of the domain. Every request runs in a new global
+ * table, which reads the names it does not have from the base environment.
+ * Globals set by a script are dropped with this table when the request is
+ * complete. The standard library tables (except "package") and the "mg"
+ * functions of the base environment are shared read-only. Functions defined
+ * by the preload file see the globals of the current request (e.g., "mg").
+ * The "package" tables are restored after every request: a module loaded by
+ * "require" is bound to the globals of the request that loaded it, so it is
+ * loaded again by the next request.
+ */
+
+struct lua_pool_entry {
+	lua_State *L;
+	const struct mg_domain_context *dom_ctx; /* Preload file of the domain */
+};
+
+struct lua_state_pool {
+	pthread_mutex_t mutex;
+	struct lua_pool_entry *idle; /* Idle states */
+	unsigned idle_count;
+	unsigned size; /* Maximum number of idle states */
+	int collect;   /* Full garbage collection after every request */
+	unsigned long created;
+	unsigned long reused;
+};
+
+
+static struct lua_state_pool *
+lua_pool_create(struct mg_context *ctx, unsigned size, int collect)
+{
+	struct lua_state_pool *pool;
+
+	(void)ctx; /* unused, if memory statistics are disabled */
+	pool = (struct lua_state_pool *)mg_calloc_ctx(1, sizeof(*pool), ctx);
+	if (pool == NULL) {
+		return NULL;
+	}
+	pool->idle = (struct lua_pool_entry *)
+	    mg_calloc_ctx(size, sizeof(pool->idle[0]), ctx);
+	if (pool->idle == NULL) {
+		mg_free(pool);
+		return NULL;
+	}
+	pthread_mutex_init(&pool->mutex, &pthread_mutex_attr);
+	pool->size = size;
+	pool->collect = collect;
+	return pool;
+}
+
+
+static void
+lua_pool_free(struct lua_state_pool *pool)
+{
+	unsigned i;
+
+	if (pool == NULL) {
+		return;
+	}
+	for (i = 0; i < pool->idle_count; i++) {
+		lua_close(pool->idle[i].L);
+	}
+	pthread_mutex_destroy(&pool->mutex);
+	mg_free(pool->idle);
+	mg_free(pool);
+}
+
+
+static void
+lua_pool_get_stats(struct lua_state_pool *pool,
+                   unsigned *idle,
+                   unsigned long *created,
+                   unsigned long *reused)
+{
+	pthread_mutex_lock(&pool->mutex);
+	*idle = pool->idle_count;
+	*created = pool->created;
+	*reused = pool->reused;
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+
+/* Replace the global table by the table on the top of the stack (pop it) */
+static void
+lua_pool_set_globals(lua_State *L)
+{
+#if LUA_VERSION_NUM > 501
+	lua_rawseti(L, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
+#else
+	lua_replace(L, LUA_GLOBALSINDEX);
+#endif
+}
+
+
+/* __index of the base environment: names the base environment does not
+ * have are looked up in the global table of the current request */
+static int
+lua_pool_base_index(lua_State *L)
+{
+	lua_pushlightuserdata(L, (void *)&lua_regkey_pool_env);
+	lua_rawget(L, LUA_REGISTRYINDEX);
+	if (!lua_istable(L, -1)) {
+		lua_pushnil(L);
+		return 1;
+	}
+	lua_pushvalue(L, 2);
+	lua_rawget(L, -2);
+	return 1;
+}
+
+
+/* __newindex of the base environment: new globals set by functions of the
+ * base environment are stored in the global table of the current request */
+static int
+lua_pool_base_newindex(lua_State *L)
+{
+	lua_pushlightuserdata(L, (void *)&lua_regkey_pool_env);
+	lua_rawget(L, LUA_REGISTRYINDEX);
+	if (!lua_istable(L, -1)) {
+		lua_pop(L, 1);
+		lua_rawset(L, 1);
+		return 0;
+	}
+	lua_pushvalue(L, 2);
+	lua_pushvalue(L, 3);
+	lua_rawset(L, -3);
+	return 0;
+}
+
+
+static int
+lua_pool_readonly(lua_State *L)
+{
+	return luaL_error(L, "attempt to modify a shared library table");
+}
+
+
+#if LUA_VERSION_NUM > 501
+/* __pairs of a read-only library table: iterate the library table */
+static int
+lua_pool_readonly_pairs(lua_State *L)
+{
+	lua_pushvalue(L, lua_upvalueindex(1)); /* next */
+	lua_pushvalue(L, lua_upvalueindex(2)); /* library table */
+	lua_pushnil(L);
+	return 3;
+}
+#endif
+
+
+/* Replace the library table t[name] by a read-only proxy.
+ * t is at the absolute stack index idx. */
+static void
+lua_pool_protect(lua_State *L, int idx, const char *name)
+{
+	lua_getfield(L, idx, name);
+	if (!lua_istable(L, -1)) {
+		lua_pop(L, 1);
+		return;
+	}
+	lua_newtable(L); /* proxy */
+	lua_newtable(L); /* metatable of the proxy */
+	lua_pushvalue(L, -3);
+	lua_setfield(L, -2, "__index");
+	lua_pushcfunction(L, lua_pool_readonly);
+	lua_setfield(L, -2, "__newindex");
+#if LUA_VERSION_NUM > 501
+	lua_getglobal(L, "next");
+	lua_pushvalue(L, -4);
+	lua_pushcclosure(L, lua_pool_readonly_pairs, 2);
+	lua_setfield(L, -2, "__pairs");
+#endif
+	lua_pushliteral(L, "shared");
+	lua_setfield(L, -2, "__metatable");
+	lua_setmetatable(L, -2);
+
+	/* require(name) returns the proxy as well */
+	lua_getfield(L, idx, "package");
+	if (lua_istable(L, -1)) {
+		lua_getfield(L, -1, "loaded");
+		if (lua_istable(L, -1)) {
+			lua_pushvalue(L, -3); /* proxy */
+			lua_setfield(L, -2, name);
 		}
-		if (0 != strchr(debug_params, 'r')) {
-			mask |= LUA_MASKRET;
+		lua_pop(L, 1);
+	}
+	lua_pop(L, 1);
+
+	lua_setfield(L, idx, name);
+	lua_pop(L, 1); /* library table */
+}
+
+
+/* snap[t] = shallow copy of the table t.
+ * snap and t are absolute stack indices. */
+static void
+lua_pool_copy_table(lua_State *L, int snap, int t)
+{
+	lua_pushvalue(L, t);
+	lua_newtable(L);
+	lua_pushnil(L);
+	while (lua_next(L, t) != 0) {
+		lua_pushvalue(L, -2);
+		lua_insert(L, -2);
+		lua_rawset(L, -4);
+	}
+	lua_rawset(L, snap);
+}
+
+
+/* Keep copies of the "package" table and the tables changed by "require"
+ * of the base environment (at the absolute stack index base) */
+static void
+lua_pool_save_package(lua_State *L, int base)
+{
+	static const char *const fields[] = {"loaded",
+	                                     "preload",
+	                                     "searchers",
+	                                     "loaders",
+	                                     NULL};
+	int snap, pkg, i;
+
+	lua_pushlightuserdata(L, (void *)&lua_regkey_pool_package);
+	lua_newtable(L); /* table -> copy */
+	snap = lua_gettop(L);
+	lua_getfield(L, base, "package");
+	pkg = lua_gettop(L);
+	if (lua_istable(L, pkg)) {
+		lua_pool_copy_table(L, snap, pkg);
+		for (i = 0; fields[i] != NULL; i++) {
+			lua_getfield(L, pkg, fields[i]);
+			if (lua_istable(L, -1)) {
+				lua_pool_copy_table(L, snap, lua_gettop(L));
+			}
+			lua_pop(L, 1);
+		}
+	}
+	lua_pop(L, 1);
+	lua_settable(L, LUA_REGISTRYINDEX);
+}
+
+
+/* Restore the tables saved by lua_pool_save_package. This removes the
+ * modules loaded by the request. */
+static void
+lua_pool_restore_package(lua_State *L)
+{
+	int snap, t, copy;
+
+	lua_pushlightuserdata(L, (void *)&lua_regkey_pool_package);
+	lua_gettable(L, LUA_REGISTRYINDEX);
+	snap = lua_gettop(L);
+	if (!lua_istable(L, snap)) {
+		lua_pop(L, 1);
+		return;
+	}
+	lua_pushnil(L);
+	while (lua_next(L, snap) != 0) {
+		t = lua_gettop(L) - 1;
+		copy = lua_gettop(L);
+
+		/* Remove new keys (assigning nil is allowed while iterating) */
+		lua_pushnil(L);
+		while (lua_next(L, t) != 0) {
+			lua_pop(L, 1);
+			lua_pushvalue(L, -1);
+			lua_rawget(L, copy);
+			if (lua_isnil(L, -1)) {
+				lua_pushvalue(L, -2);
+				lua_pushnil(L);
+				lua_rawset(L, t);
+			}
+			lua_pop(L, 1);
+		}
+
+		/* Restore all other values */
+		lua_pushnil(L);
+		while (lua_next(L, copy) != 0) {
+			lua_pushvalue(L, -2);
+			lua_insert(L, -2);
+			lua_rawset(L, t);
+		}
+		lua_pop(L, 1); /* copy */
+	}
+	lua_pop(L, 1);
+}
+
+
+/* Prepare the base environment of a new pooled state for the domain of
+ * conn */
+static void
+lua_pool_prepare_base(struct mg_connection *conn, lua_State *L)
+{
+	static const char *const libs[] = {"coroutine",
+	                                   "debug",
+	                                   "io",
+	                                   "math",
+	                                   "os",
+	                                   "string",
+	                                   "table",
+	                                   "utf8",
+	                                   "bit32",
+	                                   NULL};
+	const char *preload_file_name = conn->dom_ctx->config[LUA_PRELOAD_FILE];
+	struct lsp_include_history *h;
+	int i, base;
+
+	prepare_lua_libs(L);
+
+	/* Store context in the registry */
+	lua_pushlightuserdata(L, (void *)&lua_regkey_ctx);
+	lua_pushlightuserdata(L, (void *)conn->phys_ctx);
+	lua_settable(L, LUA_REGISTRYINDEX);
+
+	/* mg.include history, reset for every request */
+	lua_pushlightuserdata(L, (void *)&lua_regkey_lsp_include_history);
+	h = (struct lsp_include_history *)
+	    lua_newuserdata(L, sizeof(struct lsp_include_history));
+	lua_settable(L, LUA_REGISTRYINDEX);
+	memset(h, 0, sizeof(struct lsp_include_history));
+
+	/* Connection independent "mg" functions. The "mg" table of a request
+	 * gets them by the metatable. */
+	lua_newtable(L);
+	reg_mg_functions(L);
+	lua_pushlightuserdata(L, (void *)&lua_regkey_pool_mg_mt);
+	lua_newtable(L);
+	lua_pushvalue(L, -3);
+	lua_setfield(L, -2, "__index");
+	lua_pushliteral(L, "shared");
+	lua_setfield(L, -2, "__metatable");
+	lua_settable(L, LUA_REGISTRYINDEX);
+
+	/* The preload file sees the connection independent functions */
+	lua_setglobal(L, "mg");
+
+	/* Register "shared" table */
+	lua_shared_register(L);
+
+	/* Default mg.onerror function. It is set for every request: mg.onerror
+	 * may be replaced or removed by a page. "mg" is the table of the
+	 * current request when the function is called. */
+	lua_pushlightuserdata(L, (void *)&lua_regkey_pool_onerror);
+	if ((luaL_loadstring(L,
+	                     "return function(e) mg.write('\\nLua error:\\n', "
+	                     "debug.traceback(e, 1)) end")
+	     != 0)
+	    || (lua_pcall(L, 0, 1, 0) != 0)) {
+		lua_pop(L, 1);
+		lua_pushnil(L);
+	}
+	lua_settable(L, LUA_REGISTRYINDEX);
+
+	/* Preload file into the base environment */
+	if (preload_file_name != NULL) {
+		if ((luaL_loadfile(L, preload_file_name) != 0)
+		    || (lua_pcall(L, 0, 0, 0) != 0)) {
+			const char *msg = lua_tostring(L, -1);
+			mg_cry_internal(conn,
+			                "Error in %s: %s",
+			                preload_file_name,
+			                (msg != NULL) ? msg : "?");
+			lua_pop(L, 1);
+		}
+	}
+	lua_pushnil(L);
+	lua_setglobal(L, "mg");
+
+	/* Protect the base environment */
+#if LUA_VERSION_NUM > 501
+	lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
+#else
+	lua_pushvalue(L, LUA_GLOBALSINDEX);
+#endif
+	base = lua_gettop(L);
+	for (i = 0; libs[i] != NULL; i++) {
+		lua_pool_protect(L, base, libs[i]);
+	}
+
+	/* String methods ("s:format()") use the read-only "string" proxy as
+	 * well, getmetatable("") does not return the shared metatable */
+	lua_pushliteral(L, "");
+	if (lua_getmetatable(L, -1)) {
+		lua_getfield(L, base, "string");
+		lua_setfield(L, -2, "__index");
+		lua_pushliteral(L, "shared");
+		lua_setfield(L, -2, "__metatable");
+		lua_pop(L, 1);
+	}
+	lua_pop(L, 1);
+
+	lua_pool_save_package(L, base);
+	lua_newtable(L);
+	lua_pushcfunction(L, lua_pool_base_index);
+	lua_setfield(L, -2, "__index");
+	lua_pushcfunction(L, lua_pool_base_newindex);
+	lua_setfield(L, -2, "__newindex");
+	lua_pushliteral(L, "shared");
+	lua_setfield(L, -2, "__metatable");
+	lua_setmetatable(L, base);
+
+	lua_pushlightuserdata(L, (void *)&lua_regkey_pool_base);
+	lua_pushvalue(L, base);
+	lua_settable(L, LUA_REGISTRYINDEX);
+
+	/* Metatable for the global table of a request */
+	lua_pushlightuserdata(L, (void *)&lua_regkey_pool_env_mt);
+	lua_newtable(L);
+	lua_pushvalue(L, base);
+	lua_setfield(L, -2, "__index");
+	lua_pushliteral(L, "shared");
+	lua_setfield(L, -2, "__metatable");
+	lua_settable(L, LUA_REGISTRYINDEX);
+
+	lua_settop(L, 0);
+}
+
+
+/* Prepare a new global table and "mg" table for a request */
+static void
+lua_pool_prepare_request(struct mg_connection *conn,
+                         lua_State *L,
+                         const char *script_name,
+                         int lua_env_type)
+{
+	struct mg_context *ctx = conn->phys_ctx;
+	struct lsp_include_history *h;
+
+	lua_newtable(L);
+	lua_pushlightuserdata(L, (void *)&lua_regkey_pool_env_mt);
+	lua_gettable(L, LUA_REGISTRYINDEX);
+	lua_setmetatable(L, -2);
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "_G");
+	lua_pushlightuserdata(L, (void *)&lua_regkey_pool_env);
+	lua_pushvalue(L, -2);
+	lua_settable(L, LUA_REGISTRYINDEX);
+	lua_pool_set_globals(L);
+
+	lua_pushlightuserdata(L, (void *)&lua_regkey_environment_type);
+	lua_pushinteger(L, lua_env_type);
+	lua_settable(L, LUA_REGISTRYINDEX);
+
+	lua_pushlightuserdata(L, (void *)&lua_regkey_lsp_include_history);
+	lua_gettable(L, LUA_REGISTRYINDEX);
+	h = (struct lsp_include_history *)lua_touserdata(L, -1);
+	memset(h, 0, sizeof(struct lsp_include_history));
+	lua_pop(L, 1);
+
+	/* Register mg module */
+	lua_newtable(L);
+	lua_pushlightuserdata(L, (void *)&lua_regkey_pool_mg_mt);
+	lua_gettable(L, LUA_REGISTRYINDEX);
+	lua_setmetatable(L, -2);
+	reg_mg_request(ctx, conn, L, script_name, lua_env_type);
+	lua_pushlightuserdata(L, (void *)&lua_regkey_pool_onerror);
+	lua_gettable(L, LUA_REGISTRYINDEX);
+	lua_setfield(L, -2, "onerror");
+	lua_setglobal(L, "mg");
+
+	/* Call user init function */
+	if (ctx->callbacks.init_lua != NULL) {
+		ctx->callbacks.init_lua(conn, L, (unsigned)lua_env_type);
+	}
+
+#if defined(MG_EXPERIMENTAL_INTERFACES)
+	/* If debugging is enabled, add a hook */
+	if (conn->dom_ctx->config[LUA_DEBUG_PARAMS] != NULL) {
+		set_lua_debug_hook(L, conn->dom_ctx->config[LUA_DEBUG_PARAMS]);
+	}
+#endif
+}
+
+
+/* Get a Lua state for a Lua script or Lua server page from the pool, or
+ * create a new one. Return NULL if out of memory. The state must be
+ * returned by lua_pool_release. */
+static lua_State *
+lua_pool_acquire(struct mg_connection *conn,
+                 const char *script_name,
+                 int lua_env_type)
+{
+	struct lua_state_pool *pool = conn->phys_ctx->lua_pool;
+	lua_State *L = NULL;
+	unsigned i;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (i = pool->idle_count; i > 0; i--) {
+		if (pool->idle[i - 1].dom_ctx == conn->dom_ctx) {
+			L = pool->idle[i - 1].L;
+			pool->idle_count--;
+			pool->idle[i - 1] = pool->idle[pool->idle_count];
+			pool->reused++;
+			break;
 		}
-		if (0 != strchr(debug_params, 'l')) {
-			mask |= LUA_MASKLINE;
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	if (L == NULL) {
+		L = lua_newstate(lua_allocator, (void *)(conn->phys_ctx));
+		if (L == NULL) {
+			return NULL;
 		}
-		lua_sethook(L, lua_debug_hook, mask, 0);
+		DEBUG_TRACE("New pooled Lua state %p", L);
+		lua_pool_prepare_base(conn, L);
+
+		pthread_mutex_lock(&pool->mutex);
+		pool->created++;
+		pthread_mutex_unlock(&pool->mutex);
+	}
+
+	lua_pool_prepare_request(conn, L, script_name, lua_env_type);
+	return L;
+}
+
+
+/* Drop the global table of the request and return the state to the pool.
+ * If the pool is full, the state is closed. */
+static void
+lua_pool_release(struct mg_connection *conn, lua_State *L)
+{
+	struct lua_state_pool *pool = conn->phys_ctx->lua_pool;
+	unsigned lua_env_type;
+
+	lua_pushlightuserdata(L, (void *)&lua_regkey_environment_type);
+	lua_gettable(L, LUA_REGISTRYINDEX);
+	lua_env_type = (unsigned)lua_tointeger(L, -1);
+	lua_pop(L, 1);
+	if (conn->phys_ctx->callbacks.exit_lua != NULL) {
+		conn->phys_ctx->callbacks.exit_lua(conn, L, lua_env_type);
+	}
+
+	lua_settop(L, 0);
+	lua_sethook(L, NULL, 0, 0);
+	lua_pushlightuserdata(L, (void *)&lua_regkey_pool_env);
+	lua_pushnil(L);
+	lua_settable(L, LUA_REGISTRYINDEX);
+	lua_pushlightuserdata(L, (void *)&lua_regkey_pool_base);
+	lua_gettable(L, LUA_REGISTRYINDEX);
+	lua_pool_set_globals(L);
+	lua_pool_restore_package(L);
+	if (pool->collect) {
+		lua_gc(L, LUA_GCCOLLECT, 0);
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+	if (pool->idle_count < pool->size) {
+		pool->idle[pool->idle_count].L = L;
+		pool->idle[pool->idle_count].dom_ctx = conn->dom_ctx;
+		pool->idle_count++;
+		L = NULL;
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	if (L != NULL) {
+		DEBUG_TRACE("Close Lua environment %p", L);
+		lua_close(L);
 	}
 }
 
@@ -3093,11 +3699,23 @@ mg_exec_lua_script(struct mg_connection *conn,
 	conn->must_close = 1;
 
 	/* Execute a plain Lua script. */
-	if (path != NULL
-	    && (L = lua_newstate(lua_allocator, (void *)(conn->phys_ctx)))
-	           != NULL) {
-		prepare_lua_environment(
-		    conn->phys_ctx, conn, NULL, L, path, LUA_ENV_TYPE_PLAIN_LUA_PAGE);
+	if (path == NULL) {
+		return;
+	}
+	if (conn->phys_ctx->lua_pool != NULL) {
+		L = lua_pool_acquire(conn, path, LUA_ENV_TYPE_PLAIN_LUA_PAGE);
+	} else {
+		L = lua_newstate(lua_allocator, (void *)(conn->phys_ctx));
+		if (L != NULL) {
+			prepare_lua_environment(conn->phys_ctx,
+			                        conn,
+			                        NULL,
+			                        L,
+			                        path,
+			                        LUA_ENV_TYPE_PLAIN_LUA_PAGE);
+		}
+	}
+	if (L != NULL) {
 		lua_pushcclosure(L, &lua_error_handler, 0);
 
 		if (exports != NULL) {
@@ -3130,8 +3748,12 @@ mg_exec_lua_script(struct mg_connection *conn,
 				lua_error_handler(L);
 			}
 		}
-		DEBUG_TRACE("Close Lua environment %p", L);
-		lua_close(L);
+		if (conn->phys_ctx->lua_pool != NULL) {
+			lua_pool_release(conn, L);
+		} else {
+			DEBUG_TRACE("Close Lua environment %p", L);
+			lua_close(L);
+		}
 	}
 }
 
@@ -3209,8 +3831,22 @@ handle_lsp_request(struct mg_connection *conn,
 		/* We got a Lua state as argument. Use it! */
 		L = ls;
 	} else {
-		/* We need to create a Lua state. */
-		L = lua_newstate(lua_allocator, (void *)(conn->phys_ctx));
+		/* We need to create a Lua state, or take one from the pool. */
+		if (conn->phys_ctx->lua_pool != NULL) {
+			L = lua_pool_acquire(conn, path, LUA_ENV_TYPE_LUA_SERVER_PAGE);
+		} else {
+			L = lua_newstate(lua_allocator, (void *)(conn->phys_ctx));
+			if (L != NULL) {
+				/* New Lua state needs CivetWeb functions (e.g., the "mg"
+				 * library). */
+				prepare_lua_environment(conn->phys_ctx,
+				                        conn,
+				                        NULL,
+				                        L,
+				                        path,
+				                        LUA_ENV_TYPE_LUA_SERVER_PAGE);
+			}
+		}
 		if (L == NULL) {
 			/* We neither got a Lua state from the command line,
 			 * nor did we succeed in creating our own state.
@@ -3223,10 +3859,6 @@ handle_lsp_request(struct mg_connection *conn,
 
 			goto cleanup_handle_lsp_request;
 		}
-
-		/* New Lua state needs CivetWeb functions (e.g., the "mg" library). */
-		prepare_lua_environment(
-		    conn->phys_ctx, conn, NULL, L, path, LUA_ENV_TYPE_LUA_SERVER_PAGE);
 	}
 
 	/* Get LSP include history table */
@@ -3291,8 +3923,12 @@ handle_lsp_request(struct mg_connection *conn,
 cleanup_handle_lsp_request:
 
 	if (L != NULL && ls == NULL) {
-		DEBUG_TRACE("Close Lua environment %p", L);
-		lua_close(L);
+		if (conn->phys_ctx->lua_pool != NULL) {
+			lua_pool_release(conn, L);
+		} else {
+			DEBUG_TRACE("Close Lua environment %p", L);
+			lua_close(L);
+		}
 	}
 	if (p != NULL) {
 		munmap(p, filep->stat.size);
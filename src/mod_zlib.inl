@@ -28,8 +28,18 @@ zfree(void *opaque, void *address)
 }
 
 
-static void
-send_compressed_data(struct mg_connection *conn, struct mg_file *filep)
+/* Receives the compressed data of gzip_file. Returns 0 on success. */
+typedef int (*gzip_output_fn)(void *arg, const unsigned char *data, unsigned len);
+
+
+/* Compress the file in gzip format, using compression level "level".
+ * Returns 1 if the complete file has been compressed, 0 on error. */
+static int
+gzip_file(struct mg_connection *conn,
+          FILE *in_file,
+          int level,
+          gzip_output_fn output,
+          void *output_arg)
 {
 	int zret;
 	zng_stream zstream;
@@ -37,7 +47,6 @@ send_compressed_data(struct mg_connection *conn, struct mg_file *filep)
 	unsigned bytes_avail;
 	unsigned char in_buf[MG_BUF_LEN];
 	unsigned char out_buf[MG_BUF_LEN];
-	FILE *in_file = filep->access.fp;
 
 	/* Prepare state buffer. User server context memory allocation. */
 	memset(&zstream, 0, sizeof(zstream));
@@ -47,7 +56,7 @@ send_compressed_data(struct mg_connection *conn, struct mg_file *filep)
 
 	/* Initialize for GZIP compression (MAX_WBITS | 16) */
 	zret = zng_deflateInit2(&zstream,
-	                    Z_BEST_COMPRESSION,
+	                    level,
 	                    Z_DEFLATED,
 	                    MAX_WBITS | 16,
 	                    MEM_LEVEL,
@@ -59,7 +68,7 @@ send_compressed_data(struct mg_connection *conn, struct mg_file *filep)
 		                zret,
 		                (zstream.msg ? zstream.msg : "<no error message>"));
 		zng_deflateEnd(&zstream);
-		return;
+		return 0;
 	}
 
 	/* Read until end of file */
@@ -68,7 +77,7 @@ send_compressed_data(struct mg_connection *conn, struct mg_file *filep)
 		if (ferror(in_file)) {
 			mg_cry_internal(conn, "fread failed: %s", strerror(ERRNO));
 			(void)zng_deflateEnd(&zstream);
-			return;
+			return 0;
 		}
 
 		do_flush = (feof(in_file) ? Z_FINISH : Z_NO_FLUSH);
@@ -89,7 +98,7 @@ send_compressed_data(struct mg_connection *conn, struct mg_file *filep)
 
 			bytes_avail = MG_BUF_LEN - zstream.avail_out;
 			if (bytes_avail) {
-				if (mg_send_chunk(conn, (char *)out_buf, bytes_avail) < 0) {
+				if (output(output_arg, out_buf, bytes_avail) != 0) {
 					zret = -98;
 					break;
 				}
@@ -120,12 +129,241 @@ send_compressed_data(struct mg_connection *conn, struct mg_file *filep)
 	}
 
 	zng_deflateEnd(&zstream);
+	return (zret == Z_STREAM_END);
+}
+
+
+/* Compression level for static files */
+static int
+gzip_level(const struct mg_connection *conn)
+{
+	return atoi(conn->phys_ctx->dd.config[STATIC_FILE_COMPRESSION_LEVEL]);
+}
+
+
+static int
+gzip_output_chunk(void *arg, const unsigned char *data, unsigned len)
+{
+	struct mg_connection *conn = (struct mg_connection *)arg;
+	return (mg_send_chunk(conn, (const char *)data, len) < 0) ? -1 : 0;
+}
+
+
+static void
+send_compressed_data(struct mg_connection *conn, struct mg_file *filep)
+{
+	(void)gzip_file(
+	    conn, filep->access.fp, gzip_level(conn), gzip_output_chunk, conn);
 
 	/* Send "end of chunked data" marker */
 	mg_write(conn, "0\r\n\r\n", 5);
 }
 
 
+#if !defined(NO_FILESYSTEMS)
+/* Cache for compressed files: stores the gzip variant of static files, so
+ * they are compressed only once. The cache is either a directory
+ * (static_file_compression_cache_directory) or memory
+ * (static_file_compression_cache_size, using the data structures of
+ * memory_cache.inl). Cached variants are identified by path, size and
+ * modification time of the original file. */
+
+struct gzip_buffer {
+	struct mg_context *ctx;
+	char *buf;
+	size_t len;
+	size_t size;
+	size_t max_size;
+};
+
+
+static int
+gzip_output_buffer(void *arg, const unsigned char *data, unsigned len)
+{
+	struct gzip_buffer *b = (struct gzip_buffer *)arg;
+
+	if (b->len + len > b->max_size) {
+		/* Too large for the cache */
+		return -1;
+	}
+	if (b->len + len > b->size) {
+		size_t new_size = (b->size > 0) ? (b->size * 2) : MG_BUF_LEN * 4;
+		char *new_buf;
+		while (new_size < b->len + len) {
+			new_size *= 2;
+		}
+		new_buf = (char *)mg_realloc_ctx(b->buf, new_size, b->ctx);
+		if (new_buf == NULL) {
+			return -1;
+		}
+		b->buf = new_buf;
+		b->size = new_size;
+	}
+	memcpy(b->buf + b->len, data, len);
+	b->len += len;
+	return 0;
+}
+
+
+static int
+gzip_output_file(void *arg, const unsigned char *data, unsigned len)
+{
+	FILE *fp = (FILE *)arg;
+	return (fwrite(data, 1, len, fp) == len) ? 0 : -1;
+}
+
+
+/* Compress path into the memory cache */
+static struct mg_memory_cache_entry *
+gzip_cache_load_memory(struct mg_connection *conn,
+                       const char *path,
+                       const struct mg_file_stat *filestat)
+{
+	struct mg_memory_cache *mc = conn->phys_ctx->compression_cache;
+	struct mg_file file = STRUCT_FILE_INITIALIZER;
+	struct mg_memory_cache_entry *e = NULL;
+	struct gzip_buffer b;
+	int ok;
+
+	memset(&b, 0, sizeof(b));
+	b.ctx = conn->phys_ctx;
+	b.max_size = mc->shard[0].max_mem_size;
+
+	if (!mg_fopen(conn, path, MG_FOPEN_MODE_READ, &file)) {
+		return NULL;
+	}
+	ok = gzip_file(
+	    conn, file.access.fp, gzip_level(conn), gzip_output_buffer, &b);
+	(void)mg_fclose(&file.access);
+
+	if (ok) {
+		e = memory_cache_entry_alloc(conn->phys_ctx, path, NULL, filestat, b.len);
+	}
+	if (e != NULL) {
+		memcpy(e->data, b.buf, b.len);
+		memory_cache_add(mc, e);
+	}
+	mg_free(b.buf);
+	return e;
+}
+
+
+/* Compress path into the cache directory, using the file name gz_path */
+static int
+gzip_cache_load_file(struct mg_connection *conn,
+                     const char *path,
+                     const char *gz_path)
+{
+	struct mg_file in_file = STRUCT_FILE_INITIALIZER;
+	struct mg_file out_file = STRUCT_FILE_INITIALIZER;
+	char tmp_path[UTF8_PATH_MAX];
+	int truncated, ok = 0;
+
+	/* Compress to a temporary file first: other threads must not see
+	 * an incomplete file */
+	mg_snprintf(conn,
+	            &truncated,
+	            tmp_path,
+	            sizeof(tmp_path),
+	            "%s.%lu.tmp",
+	            gz_path,
+	            mg_current_thread_id());
+	if (truncated) {
+		return 0;
+	}
+	if (!mg_fopen(conn, path, MG_FOPEN_MODE_READ, &in_file)) {
+		return 0;
+	}
+	if (mg_fopen(conn, tmp_path, MG_FOPEN_MODE_WRITE, &out_file)) {
+		ok = gzip_file(conn,
+		               in_file.access.fp,
+		               gzip_level(conn),
+		               gzip_output_file,
+		               out_file.access.fp);
+		ok = (mg_fclose(&out_file.access) == 0) && ok;
+		if (ok && (rename(tmp_path, gz_path) != 0)) {
+			/* Another thread has been faster (Windows) */
+			ok = 0;
+		}
+		if (!ok) {
+			(void)mg_remove(conn, tmp_path);
+		}
+	} else {
+		mg_cry_internal(conn,
+		                "Cannot create %s: %s",
+		                tmp_path,
+		                strerror(ERRNO));
+	}
+	(void)mg_fclose(&in_file.access);
+
+	/* The metadata cache may know that gz_path did not exist */
+	mg_file_cache_invalidate(conn->phys_ctx, gz_path);
+	return ok;
+}
+
+
+/* Get the gzip variant of a static file from the compression cache, or
+ * compress the file and add it to the cache.
+ * Returns:
+ *   0: the cache is not used
+ *   1: *entry holds a reference to the compressed data in memory
+ *   2: the compressed file is gz_path, with status *gz_stat */
+static int
+gzip_cache_get(struct mg_connection *conn,
+               const char *path,
+               const struct mg_file_stat *filestat,
+               char *gz_path,
+               size_t gz_path_len,
+               struct mg_file_stat *gz_stat,
+               struct mg_memory_cache_entry **entry)
+{
+	const char *dir =
+	    conn->phys_ctx->dd.config[STATIC_FILE_COMPRESSION_CACHE_DIR];
+	struct mg_memory_cache *mc = conn->phys_ctx->compression_cache;
+
+	if ((dir != NULL) && (*dir != 0)) {
+		/* 64 bit FNV-1a hash of the path */
+		uint64_t h = 14695981039346656037u;
+		const char *p;
+		int truncated;
+
+		for (p = path; *p; p++) {
+			h ^= (uint8_t)*p;
+			h *= 1099511628211u;
+		}
+		mg_snprintf(conn,
+		            &truncated,
+		            gz_path,
+		            gz_path_len,
+		            "%s/%08lx%08lx-%" INT64_FMT "-%" INT64_FMT ".gz",
+		            dir,
+		            (unsigned long)(h >> 32),
+		            (unsigned long)(h & 0xffffffffu),
+		            (int64_t)filestat->size,
+		            (int64_t)filestat->last_modified);
+		if (truncated) {
+			return 0;
+		}
+		if ((mg_stat_cached(conn, gz_path, gz_stat) && !gz_stat->is_directory)
+		    || (gzip_cache_load_file(conn, path, gz_path)
+		        && mg_stat_cached(conn, gz_path, gz_stat))) {
+			return 2;
+		}
+		return 0;
+	}
+
+	if ((mc != NULL) && (filestat->size <= mc->shard[0].max_mem_size)) {
+		*entry = memory_cache_get(mc, path, NULL, filestat);
+		if (*entry == NULL) {
+			*entry = gzip_cache_load_memory(conn, path, filestat);
+		}
+		return (*entry != NULL) ? 1 : 0;
+	}
+	return 0;
+}
+#endif /* NO_FILESYSTEMS */
+
+
 #if defined(USE_WEBSOCKET) && defined(MG_EXPERIMENTAL_INTERFACES)
 static int
 websocket_deflate_initialize(struct mg_connection *conn, int server)
@@ -178,7 +416,8 @@ websocket_deflate_initialize(struct mg_connection *conn, int server)
 static void
 websocket_deflate_negotiate(struct mg_connection *conn)
 {
-	const char *extensions = mg_get_header(conn, "Sec-WebSocket-Extensions");
+	const char *extensions =
+	    mg_get_header_id(conn, MG_HDR_SEC_WEBSOCKET_EXTENSIONS);
 	int val;
 	if (extensions && !strncmp(extensions, "permessage-deflate", 18)) {
 		conn->accept_gzip = 1;
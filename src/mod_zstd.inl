@@ -0,0 +1,78 @@
+/* Experimental implementation for on-the-fly compression of chunked
+ * responses (mg_send_chunk) using zstd */
+#if !defined(USE_ZSTD)
+#error "This file must only be included, if USE_ZSTD is set"
+#endif
+
+
+/* Start zstd compression of the data sent by mg_send_chunk.
+ * Return 1 if the compression context is ready, 0 on error. */
+static int
+zstd_chunk_start(struct mg_connection *conn)
+{
+	if (conn->chunk_zstd != NULL) {
+		ZSTD_freeCCtx(conn->chunk_zstd);
+	}
+	conn->chunk_zstd = ZSTD_createCCtx();
+	if (conn->chunk_zstd == NULL) {
+		mg_cry_internal(conn, "%s", "Cannot create zstd context");
+		return 0;
+	}
+	return 1;
+}
+
+
+/* Compress one chunk and send the compressed data as chunks.
+ * Every chunk is flushed, so the client can decompress all data sent up to
+ * now (required for streamed responses). An empty chunk ends the zstd frame
+ * and the chunked response.
+ * Return the number of bytes sent, or -1 on error. */
+static int
+zstd_send_chunk(struct mg_connection *conn,
+                const char *chunk,
+                unsigned int chunk_len)
+{
+	char buf[MG_BUF_LEN];
+	ZSTD_inBuffer in;
+	ZSTD_outBuffer out;
+	ZSTD_EndDirective mode;
+	size_t remaining;
+	int ret, t = 0;
+
+	in.src = chunk;
+	in.size = chunk_len;
+	in.pos = 0;
+	mode = (chunk_len > 0) ? ZSTD_e_flush : ZSTD_e_end;
+
+	do {
+		out.dst = buf;
+		out.size = sizeof(buf);
+		out.pos = 0;
+		remaining = ZSTD_compressStream2(conn->chunk_zstd, &out, &in, mode);
+		if (ZSTD_isError(remaining)) {
+			mg_cry_internal(conn,
+			                "zstd compression failed: %s",
+			                ZSTD_getErrorName(remaining));
+			return -1;
+		}
+		if (out.pos > 0) {
+			ret = send_chunk_data(conn, buf, (unsigned int)out.pos);
+			if (ret < 0) {
+				return -1;
+			}
+			t += ret;
+		}
+	} while (remaining > 0);
+
+	if (chunk_len == 0) {
+		/* End of the response */
+		ZSTD_freeCCtx(conn->chunk_zstd);
+		conn->chunk_zstd = NULL;
+		ret = send_chunk_data(conn, "", 0);
+		if (ret < 0) {
+			return -1;
+		}
+		t += ret;
+	}
+	return t;
+}
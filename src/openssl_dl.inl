@@ -31,6 +31,10 @@ typedef struct bignum BIGNUM;
 typedef struct ossl_init_settings_st OPENSSL_INIT_SETTINGS;
 typedef struct evp_md EVP_MD;
 typedef struct x509 X509;
+typedef struct evp_cipher_st EVP_CIPHER;
+typedef struct evp_cipher_ctx_st EVP_CIPHER_CTX;
+typedef struct engine_st ENGINE;
+typedef struct bio_st BIO;
 
 
 #define SSL_CTRL_OPTIONS (32)
@@ -59,6 +63,7 @@ typedef struct x509 X509;
 #define SSL_OP_NO_SESSION_RESUMPTION_ON_RENEGOTIATION (0x00010000ul)
 #define SSL_OP_NO_COMPRESSION (0x00020000ul)
 #define SSL_OP_NO_RENEGOTIATION (0x40000000ul)
+#define SSL_OP_ENABLE_KTLS (0x00000008ul)
 
 #define SSL_CB_HANDSHAKE_START (0x10)
 #define SSL_CB_HANDSHAKE_DONE (0x20)
@@ -85,6 +90,8 @@ typedef struct x509 X509;
 enum ssl_func_category {
 	TLS_Mandatory, /* required for HTTPS */
 	TLS_ALPN,      /* required for Application Layer Protocol Negotiation */
+	TLS_TICKETS,   /* required for session ticket keys */
+	TLS_KTLS,      /* required for kernel TLS (SSL_sendfile) */
 	TLS_END_OF_LIST
 };
 
@@ -181,6 +188,45 @@ typedef int (*tSSL_next_protos_advertised_cb)(SSL *ssl,
 
 #define SSL_CTX_set_timeout (*(long (*)(SSL_CTX *, long))ssl_sw[42].ptr)
 
+#if defined(OPENSSL_API_3_0)
+typedef struct evp_mac_ctx_st EVP_MAC_CTX;
+typedef struct ossl_param_st {
+	const char *key;
+	unsigned int data_type;
+	void *data;
+	size_t data_size;
+	size_t return_size;
+} OSSL_PARAM;
+#define OSSL_PARAM_UTF8_STRING (4)
+#define OSSL_PARAM_OCTET_STRING (5)
+
+typedef int (*tSSL_ticket_key_evp_cb)(SSL *ssl,
+                                      unsigned char *key_name,
+                                      unsigned char *iv,
+                                      EVP_CIPHER_CTX *ctx,
+                                      EVP_MAC_CTX *hctx,
+                                      int enc);
+#define SSL_CTX_set_tlsext_ticket_key_evp_cb                                   \
+	(*(int (*)(SSL_CTX *, tSSL_ticket_key_evp_cb))ssl_sw[43].ptr)
+#define SSL_get_wbio (*(BIO * (*)(const SSL *)) ssl_sw[44].ptr)
+#if defined(__linux__)
+#define SSL_sendfile                                                           \
+	(*(ssize_t(*)(SSL *, int, off_t, size_t, int))ssl_sw[45].ptr)
+#endif
+
+#define BIO_CTRL_GET_KTLS_SEND (73)
+#define BIO_get_ktls_send(b)                                                   \
+	(BIO_ctrl((b), BIO_CTRL_GET_KTLS_SEND, 0, NULL) > 0)
+#else
+typedef struct hmac_ctx_st HMAC_CTX;
+
+#define SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB (72)
+#define SSL_CTX_set_tlsext_ticket_key_cb(ctx, cb)                              \
+	SSL_CTX_callback_ctrl(ctx,                                                 \
+	                      SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB,                   \
+	                      (void (*)(void))cb)
+#endif
+
 #define SSL_CTX_clear_options(ctx, op)                                         \
 	SSL_CTX_ctrl((ctx), SSL_CTRL_CLEAR_OPTIONS, (op), NULL)
 #define SSL_CTX_set_ecdh_auto(ctx, onoff)                                      \
@@ -230,6 +276,32 @@ typedef int (*tSSL_next_protos_advertised_cb)(SSL *ssl,
 #define BN_free (*(void (*)(const BIGNUM *a))crypto_sw[13].ptr)
 #define CRYPTO_free (*(void (*)(void *addr))crypto_sw[14].ptr)
 #define ERR_clear_error (*(void (*)(void))crypto_sw[15].ptr)
+#define RAND_bytes (*(int (*)(unsigned char *, int))crypto_sw[16].ptr)
+#define EVP_aes_256_cbc (*(const EVP_CIPHER *(*)(void))crypto_sw[17].ptr)
+#define EVP_EncryptInit_ex                                                     \
+	(*(int (*)(EVP_CIPHER_CTX *,                                               \
+	           const EVP_CIPHER *,                                             \
+	           ENGINE *,                                                       \
+	           const unsigned char *,                                          \
+	           const unsigned char *))crypto_sw[18]                            \
+	      .ptr)
+#define EVP_DecryptInit_ex                                                     \
+	(*(int (*)(EVP_CIPHER_CTX *,                                               \
+	           const EVP_CIPHER *,                                             \
+	           ENGINE *,                                                       \
+	           const unsigned char *,                                          \
+	           const unsigned char *))crypto_sw[19]                            \
+	      .ptr)
+#if defined(OPENSSL_API_3_0)
+#define EVP_MAC_CTX_set_params                                                 \
+	(*(int (*)(EVP_MAC_CTX *, const OSSL_PARAM *))crypto_sw[20].ptr)
+#define BIO_ctrl (*(long (*)(BIO *, int, long, void *))crypto_sw[21].ptr)
+#else
+#define HMAC_Init_ex                                                           \
+	(*(int (*)(HMAC_CTX *, const void *, int, const EVP_MD *, ENGINE *))       \
+	      crypto_sw[20]                                                        \
+	          .ptr)
+#endif
 
 #define OPENSSL_free(a) CRYPTO_free(a)
 
@@ -287,6 +359,13 @@ static struct ssl_func ssl_sw[] = {
     {"SSL_CTX_set_alpn_select_cb", TLS_ALPN, NULL},
     {"SSL_CTX_set_next_protos_advertised_cb", TLS_ALPN, NULL},
     {"SSL_CTX_set_timeout", TLS_Mandatory, NULL},
+#if defined(OPENSSL_API_3_0)
+    {"SSL_CTX_set_tlsext_ticket_key_evp_cb", TLS_TICKETS, NULL},
+    {"SSL_get_wbio", TLS_KTLS, NULL},
+#if defined(__linux__)
+    {"SSL_sendfile", TLS_KTLS, NULL},
+#endif
+#endif
     {NULL, TLS_END_OF_LIST, NULL}};
 
 
@@ -309,6 +388,16 @@ static struct ssl_func crypto_sw[] = {
     {"BN_free", TLS_Mandatory, NULL},
     {"CRYPTO_free", TLS_Mandatory, NULL},
     {"ERR_clear_error", TLS_Mandatory, NULL},
+    {"RAND_bytes", TLS_TICKETS, NULL},
+    {"EVP_aes_256_cbc", TLS_TICKETS, NULL},
+    {"EVP_EncryptInit_ex", TLS_TICKETS, NULL},
+    {"EVP_DecryptInit_ex", TLS_TICKETS, NULL},
+#if defined(OPENSSL_API_3_0)
+    {"EVP_MAC_CTX_set_params", TLS_TICKETS, NULL},
+    {"BIO_ctrl", TLS_KTLS, NULL},
+#else
+    {"HMAC_Init_ex", TLS_TICKETS, NULL},
+#endif
     {NULL, TLS_END_OF_LIST, NULL}};
 #endif
 
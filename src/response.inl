@@ -12,21 +12,16 @@
 #endif
 
 
-/* Internal function to free header list */
+/* Internal function to free header list.
+ * The strings are allocated in the per-request arena. */
 static void
 free_buffered_response_header_list(struct mg_connection *conn)
 {
 #if !defined(NO_RESPONSE_BUFFERING)
 	while (conn->response_info.num_headers > 0) {
 		conn->response_info.num_headers--;
-		mg_free((void *)conn->response_info
-		            .http_headers[conn->response_info.num_headers]
-		            .name);
 		conn->response_info.http_headers[conn->response_info.num_headers].name =
 		    0;
-		mg_free((void *)conn->response_info
-		            .http_headers[conn->response_info.num_headers]
-		            .value);
 		conn->response_info.http_headers[conn->response_info.num_headers]
 		    .value = 0;
 	}
@@ -157,28 +152,19 @@ mg_response_header_add(struct mg_connection *conn,
 		return -4;
 	}
 
-	/* Alloc new element */
+	/* Alloc new element in the per-request arena */
 	conn->response_info.http_headers[hidx].name =
-	    mg_strdup_ctx(header, conn->phys_ctx);
-	if (value_len >= 0) {
-		char *hbuf =
-		    (char *)mg_malloc_ctx((unsigned)value_len + 1, conn->phys_ctx);
-		if (hbuf) {
-			memcpy(hbuf, value, (unsigned)value_len);
-			hbuf[value_len] = 0;
-		}
-		conn->response_info.http_headers[hidx].value = hbuf;
-	} else {
-		conn->response_info.http_headers[hidx].value =
-		    mg_strdup_ctx(value, conn->phys_ctx);
-	}
+	    request_arena_strndup(conn, header, strlen(header));
+	conn->response_info.http_headers[hidx].value =
+	    request_arena_strndup(conn,
+	                          value,
+	                          (value_len >= 0) ? (size_t)value_len
+	                                           : strlen(value));
 
 	if ((conn->response_info.http_headers[hidx].name == 0)
 	    || (conn->response_info.http_headers[hidx].value == 0)) {
 		/* Out of memory */
-		mg_free((void *)conn->response_info.http_headers[hidx].name);
 		conn->response_info.http_headers[hidx].name = 0;
-		mg_free((void *)conn->response_info.http_headers[hidx].value);
 		conn->response_info.http_headers[hidx].value = 0;
 		return -5;
 	}
@@ -225,7 +211,8 @@ mg_response_header_add_lines(struct mg_connection *conn,
 
 	/* We need to work on a copy of the work buffer, sice parse_http_headers
 	 * will modify */
-	workbuffer = mg_strdup_ctx(http1_headers, conn->phys_ctx);
+	workbuffer =
+	    request_arena_strndup(conn, http1_headers, strlen(http1_headers));
 	if (!workbuffer) {
 		/* Out of memory */
 		return -5;
@@ -245,8 +232,7 @@ mg_response_header_add_lines(struct mg_connection *conn,
 		}
 	}
 
-	/* mg_response_header_add created a copy, so we can free the original */
-	mg_free(workbuffer);
+	/* The work buffer is freed with the request */
 	return ret;
 }
 
@@ -301,8 +287,19 @@ mg_response_header_send(struct mg_connection *conn)
 	}
 #endif
 
+#if defined(USE_IO_URING)
+	/* Collect the header lines in the output buffer. They are sent with
+	 * the first body data, or at the end of the request. */
+	if (conn->out_headers_only) {
+		conn->out_buffering = 1;
+	}
+#endif
+
 	/* Send */
 	if (!send_http1_response_status_line(conn)) {
+#if defined(USE_IO_URING)
+		conn->out_buffering = 0;
+#endif
 		free_buffered_response_header_list(conn);
 		return -4;
 	};
@@ -335,6 +332,11 @@ mg_response_header_send(struct mg_connection *conn)
 
 	mg_write(conn, "\r\n", 2);
 	conn->request_state = 3;
+#if defined(USE_IO_URING)
+	if (conn->out_headers_only) {
+		conn->out_buffering = 0;
+	}
+#endif
 
 	/* ok */
 	free_buffered_response_header_list(conn);
@@ -0,0 +1,468 @@
+/* Compiled routing table for request, websocket and authorization handlers.
+ * This file is part of the CivetWeb web server.
+ * See https://github.com/civetweb/civetweb/
+ */
+
+/* Handlers registered by mg_set_request_handler and the related functions
+ * are stored in a linked list (dom_ctx->handlers). For every change of this
+ * list, an immutable routing table is compiled and published by a pointer
+ * swap. Lookups (get_request_handler) do not use the context lock, and do not
+ * walk the list.
+ *
+ * For every handler type, the table contains:
+ * - a radix trie of all handler URIs, for an exact match (step 0) and for
+ *   a match of "uri/something" (step 1),
+ * - a radix trie of the lower case URIs without pattern characters, and
+ * - the list of URIs with pattern characters, for the (case insensitive)
+ *   match_prefix lookup (step 2).
+ * If more than one handler matches in a step, the first registered handler
+ * is used, as for the linked list.
+ *
+ * Publishing uses two table slots with reader counters: a lookup increments
+ * the counter of the current slot, a writer publishes the new table in the
+ * other slot, and waits until no lookup uses the old table before freeing
+ * it. Writers are serialized by the context lock. */
+
+
+/* Characters with a special meaning for match_prefix */
+#define ROUTE_PATTERN_CHARS "?*$|"
+
+
+struct mg_route_node {
+	const char *label;     /* Part of the key (URI) */
+	size_t label_len;      /* Length of label */
+	unsigned first_child;  /* Index of the first child node */
+	unsigned num_children; /* Children are sorted by label[0] */
+	int route;             /* Handler index, or -1 */
+};
+
+
+struct mg_route_set {
+	struct mg_route_node *exact;  /* All URIs */
+	struct mg_route_node *nocase; /* Lower case URIs without patterns */
+	unsigned *patterns;           /* Handler indexes of URIs with patterns */
+	unsigned num_patterns;
+};
+
+
+struct mg_route_table {
+	/* REQUEST_HANDLER, WEBSOCKET_HANDLER, AUTH_HANDLER */
+	struct mg_route_set set[3];
+
+	/* All handlers, in list (registration) order */
+	struct mg_handler_info **handlers;
+	unsigned num_handlers;
+
+	/* Lower case copies of the URIs */
+	char *lower;
+};
+
+
+struct mg_route_key {
+	const char *key;
+	size_t len;
+	unsigned route;
+};
+
+
+static int
+route_key_compare(const void *p1, const void *p2, void *user)
+{
+	const struct mg_route_key *k1 = (const struct mg_route_key *)p1;
+	const struct mg_route_key *k2 = (const struct mg_route_key *)p2;
+	size_t len = (k1->len < k2->len) ? k1->len : k2->len;
+	int ret = memcmp(k1->key, k2->key, len);
+
+	(void)user;
+	if (ret != 0) {
+		return ret;
+	}
+	if (k1->len != k2->len) {
+		return (k1->len < k2->len) ? -1 : 1;
+	}
+	/* Equal keys (only in the lower case trie): first registered first */
+	return (k1->route < k2->route) ? -1 : ((k1->route > k2->route) ? 1 : 0);
+}
+
+
+/* Fill node with the sorted keys[lo..hi), all sharing the first depth
+ * characters. */
+static void
+route_trie_fill(struct mg_route_node *nodes,
+                unsigned *num_nodes,
+                const struct mg_route_key *keys,
+                size_t lo,
+                size_t hi,
+                size_t depth,
+                unsigned node)
+{
+	const struct mg_route_key *first = &keys[lo];
+	const struct mg_route_key *last = &keys[hi - 1];
+	struct mg_route_node *nd = &nodes[node];
+	size_t lcp = depth, n, group;
+	unsigned child;
+
+	/* For sorted keys, the common prefix of the first and the last key is
+	 * common to all keys */
+	while ((lcp < first->len) && (lcp < last->len)
+	       && (first->key[lcp] == last->key[lcp])) {
+		lcp++;
+	}
+	nd->label = first->key + depth;
+	nd->label_len = lcp - depth;
+	nd->route = -1;
+	if (first->len == lcp) {
+		nd->route = (int)first->route;
+		while ((lo < hi) && (keys[lo].len == lcp)) {
+			lo++;
+		}
+	}
+
+	/* One child for every different character after the common prefix */
+	nd->num_children = 0;
+	for (n = lo; n < hi; n++) {
+		if ((n == lo) || (keys[n].key[lcp] != keys[n - 1].key[lcp])) {
+			nd->num_children++;
+		}
+	}
+	nd->first_child = *num_nodes;
+	*num_nodes += nd->num_children;
+
+	child = nd->first_child;
+	for (n = lo; n < hi; n = group) {
+		for (group = n + 1;
+		     (group < hi) && (keys[group].key[lcp] == keys[n].key[lcp]);
+		     group++) {
+		}
+		route_trie_fill(nodes, num_nodes, keys, n, group, lcp, child);
+		child++;
+	}
+}
+
+
+/* Build a radix trie from num_keys keys (sorts the keys array).
+ * Return NULL for 0 keys or if out of memory (*error is set). */
+static struct mg_route_node *
+route_trie_build(struct mg_context *ctx,
+                 struct mg_route_key *keys,
+                 size_t num_keys,
+                 int *error)
+{
+	struct mg_route_node *nodes;
+	unsigned num_nodes = 1;
+
+	(void)ctx; /* mg_calloc_ctx macro might not need it */
+	if (num_keys == 0) {
+		return NULL;
+	}
+	mg_sort(keys, num_keys, sizeof(keys[0]), route_key_compare, NULL);
+
+	/* Every node except the root has a route or at least two children */
+	nodes = (struct mg_route_node *)
+	    mg_calloc_ctx(2 * num_keys + 1, sizeof(struct mg_route_node), ctx);
+	if (nodes == NULL) {
+		*error = 1;
+		return NULL;
+	}
+	route_trie_fill(nodes, &num_nodes, keys, 0, num_keys, 0, 0);
+	DEBUG_ASSERT(num_nodes <= 2 * num_keys + 1);
+	return nodes;
+}
+
+
+/* Walk the trie along uri.
+ * Case sensitive trie: *exact is the route of the key equal to uri; the
+ * return value is the first registered route for a key followed by '/' in
+ * uri.
+ * Lower case trie: the return value is the first registered route for a
+ * (non empty) key, uri starts with.
+ * -1 if there is no such route. */
+static int
+route_trie_find(const struct mg_route_node *nodes,
+                const char *uri,
+                size_t uri_len,
+                int nocase,
+                int *exact)
+{
+	const struct mg_route_node *nd = nodes;
+	size_t pos = 0, i;
+	unsigned lo, hi, mid;
+	unsigned char c, ch;
+	int best = -1, is_prefix;
+
+	*exact = -1;
+	while (nd != NULL) {
+		if (nd->label_len > uri_len - pos) {
+			break;
+		}
+		if (nocase) {
+			for (i = 0; i < nd->label_len; i++) {
+				if ((unsigned char)nd->label[i]
+				    != (unsigned char)lowercase(uri + pos + i)) {
+					break;
+				}
+			}
+			if (i < nd->label_len) {
+				break;
+			}
+		} else if (memcmp(nd->label, uri + pos, nd->label_len) != 0) {
+			break;
+		}
+		pos += nd->label_len;
+
+		if (nd->route >= 0) {
+			if (nocase) {
+				is_prefix = (pos > 0);
+			} else {
+				is_prefix = (pos < uri_len) && (uri[pos] == '/');
+				if (pos == uri_len) {
+					*exact = nd->route;
+				}
+			}
+			if (is_prefix && ((best < 0) || (nd->route < best))) {
+				best = nd->route;
+			}
+		}
+		if (pos == uri_len) {
+			break;
+		}
+
+		/* Binary search for the child starting with the next character */
+		c = (unsigned char)(nocase ? lowercase(uri + pos) : uri[pos]);
+		lo = nd->first_child;
+		hi = nd->first_child + nd->num_children;
+		nd = NULL;
+		while (lo < hi) {
+			mid = lo + (hi - lo) / 2;
+			ch = (unsigned char)nodes[mid].label[0];
+			if (ch == c) {
+				nd = &nodes[mid];
+				break;
+			}
+			if (ch < c) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
+		}
+	}
+	return best;
+}
+
+
+static void
+route_table_free(struct mg_route_table *table)
+{
+	int t;
+
+	if (table == NULL) {
+		return;
+	}
+	for (t = 0; t < 3; t++) {
+		mg_free(table->set[t].exact);
+		mg_free(table->set[t].nocase);
+		mg_free(table->set[t].patterns);
+	}
+	mg_free(table->handlers);
+	mg_free(table->lower);
+	mg_free(table);
+}
+
+
+/* Compile the routing table for a list of handlers */
+static struct mg_route_table *
+route_table_create(struct mg_context *ctx, struct mg_handler_info *list)
+{
+	struct mg_route_table *table;
+	struct mg_route_key *keys;
+	struct mg_handler_info *rh;
+	size_t lower_size = 0, num_keys, num_patterns, pos, j;
+	unsigned i;
+	int t, error = 0;
+
+	table = (struct mg_route_table *)
+	    mg_calloc_ctx(1, sizeof(struct mg_route_table), ctx);
+	if (table == NULL) {
+		return NULL;
+	}
+	for (rh = list; rh != NULL; rh = rh->next) {
+		table->num_handlers++;
+		lower_size += rh->uri_len + 1;
+	}
+	table->handlers = (struct mg_handler_info **)
+	    mg_calloc_ctx(table->num_handlers, sizeof(rh), ctx);
+	table->lower = (char *)mg_malloc_ctx(lower_size, ctx);
+	keys = (struct mg_route_key *)
+	    mg_calloc_ctx(table->num_handlers, sizeof(keys[0]), ctx);
+	if ((table->handlers == NULL) || (table->lower == NULL) || (keys == NULL)) {
+		mg_free(keys);
+		route_table_free(table);
+		return NULL;
+	}
+
+	pos = 0;
+	for (i = 0, rh = list; rh != NULL; i++, rh = rh->next) {
+		table->handlers[i] = rh;
+		for (j = 0; j <= rh->uri_len; j++) {
+			table->lower[pos + j] = (char)lowercase(rh->uri + j);
+		}
+		pos += rh->uri_len + 1;
+	}
+
+	for (t = 0; t < 3; t++) {
+		struct mg_route_set *set = &table->set[t];
+
+		/* All URIs, as registered */
+		num_keys = 0;
+		for (i = 0; i < table->num_handlers; i++) {
+			rh = table->handlers[i];
+			if (rh->handler_type == t) {
+				keys[num_keys].key = rh->uri;
+				keys[num_keys].len = rh->uri_len;
+				keys[num_keys].route = i;
+				num_keys++;
+			}
+		}
+		set->exact = route_trie_build(ctx, keys, num_keys, &error);
+
+		/* Lower case URIs without patterns, and URIs with patterns */
+		num_keys = num_patterns = 0;
+		pos = 0;
+		for (i = 0; i < table->num_handlers; i++) {
+			rh = table->handlers[i];
+			if (rh->handler_type == t) {
+				if (strpbrk(rh->uri, ROUTE_PATTERN_CHARS) != NULL) {
+					num_patterns++;
+				} else {
+					keys[num_keys].key = table->lower + pos;
+					keys[num_keys].len = rh->uri_len;
+					keys[num_keys].route = i;
+					num_keys++;
+				}
+			}
+			pos += rh->uri_len + 1;
+		}
+		set->nocase = route_trie_build(ctx, keys, num_keys, &error);
+
+		if (num_patterns > 0) {
+			set->patterns = (unsigned *)
+			    mg_calloc_ctx(num_patterns, sizeof(unsigned), ctx);
+			if (set->patterns == NULL) {
+				error = 1;
+				break;
+			}
+			for (i = 0; i < table->num_handlers; i++) {
+				rh = table->handlers[i];
+				if ((rh->handler_type == t)
+				    && (strpbrk(rh->uri, ROUTE_PATTERN_CHARS) != NULL)) {
+					set->patterns[set->num_patterns++] = i;
+				}
+			}
+		}
+	}
+	mg_free(keys);
+
+	if (error) {
+		route_table_free(table);
+		return NULL;
+	}
+	return table;
+}
+
+
+/* Find the handler for uri (the same handler as the linear search of the
+ * handler list in three steps) */
+static struct mg_handler_info *
+route_table_find(const struct mg_route_table *table,
+                 int handler_type,
+                 const char *uri,
+                 size_t uri_len)
+{
+	const struct mg_route_set *set = &table->set[handler_type];
+	const struct mg_handler_info *rh;
+	int exact, best;
+	unsigned i;
+
+	/* Step 0 and 1: exact match, or match of uri/something */
+	best = route_trie_find(set->exact, uri, uri_len, 0, &exact);
+	if (exact >= 0) {
+		return table->handlers[exact];
+	}
+	if (best >= 0) {
+		return table->handlers[best];
+	}
+
+	/* Step 2: pattern match. Only patterns registered before the first
+	 * matching plain URI need to be checked. */
+	best = route_trie_find(set->nocase, uri, uri_len, 1, &exact);
+	for (i = 0; i < set->num_patterns; i++) {
+		if ((best >= 0) && (set->patterns[i] > (unsigned)best)) {
+			break;
+		}
+		rh = table->handlers[set->patterns[i]];
+		if (match_prefix(rh->uri, rh->uri_len, uri) > 0) {
+			best = (int)set->patterns[i];
+			break;
+		}
+	}
+	return (best >= 0) ? table->handlers[best] : NULL;
+}
+
+
+/* Get the current routing table for a lookup. The table must be released
+ * by route_table_release(dom_ctx, *slot). */
+static const struct mg_route_table *
+route_table_acquire(struct mg_domain_context *dom_ctx, int *slot)
+{
+	ptrdiff_t gen;
+
+	for (;;) {
+		gen = dom_ctx->routes_gen;
+		*slot = (int)(gen & 1);
+		mg_atomic_inc(&dom_ctx->routes_readers[*slot]);
+		if (dom_ctx->routes_gen == gen) {
+			return dom_ctx->routes[*slot];
+		}
+		/* A new table has been published in the meantime */
+		mg_atomic_dec(&dom_ctx->routes_readers[*slot]);
+	}
+}
+
+
+static void
+route_table_release(struct mg_domain_context *dom_ctx, int slot)
+{
+	mg_atomic_dec(&dom_ctx->routes_readers[slot]);
+}
+
+
+/* Compile and publish the routing table for dom_ctx->handlers. The caller
+ * must hold the context lock. Wait until no lookup uses the previous table
+ * any more, and free it.
+ * Return 1 if ok, 0 if out of memory (the previous table remains). */
+static int
+route_table_update(struct mg_context *ctx, struct mg_domain_context *dom_ctx)
+{
+	struct mg_route_table *table = NULL;
+	int cur = (int)(dom_ctx->routes_gen & 1);
+
+	if (dom_ctx->handlers != NULL) {
+		table = route_table_create(ctx, dom_ctx->handlers);
+		if (table == NULL) {
+			return 0;
+		}
+	}
+
+	/* The other slot is unused: its table has been freed by the previous
+	 * update. Incrementing the generation publishes the new table. */
+	dom_ctx->routes[1 - cur] = table;
+	mg_atomic_inc(&dom_ctx->routes_gen);
+
+	/* Lookups are short: usually there is no need to wait */
+	while (dom_ctx->routes_readers[cur] != 0) {
+		mg_sleep(1);
+	}
+	route_table_free(dom_ctx->routes[cur]);
+	dom_ctx->routes[cur] = NULL;
+	return 1;
+}
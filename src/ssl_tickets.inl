@@ -0,0 +1,392 @@
+/* ssl_tickets.inl
+ *
+ * TLS session ticket keys.
+ *
+ * OpenSSL encrypts session tickets with a random key of the SSL_CTX. This
+ * key never changes while the server is running, and other server processes
+ * can not decrypt the tickets. If ssl_session_ticket_key_file is set, the
+ * keys are read from this file instead. The file contains one or more keys
+ * of 80 bytes each (16 bytes key name, 32 bytes HMAC secret, 32 bytes AES
+ * secret, like the ticket key files of nginx). New tickets are encrypted
+ * with the first key, tickets encrypted with any key in the file are
+ * accepted and renewed. Servers sharing the file resume the sessions of each
+ * other.
+ *
+ * If ssl_session_ticket_key_rotation is set, a timer checks the key file in
+ * this interval and reads it again if it has been modified, so the keys can
+ * be rotated without a restart. Without a key file, the timer creates a new
+ * random key in this interval and keeps the previous one to decrypt the
+ * tickets issued before.
+ *
+ * OpenSSL takes the ticket keys from the SSL_CTX a connection has been
+ * created with, not from the SSL_CTX selected by SNI, so the keys are set
+ * per server for the SSL_CTX of the main domain.
+ *
+ * This file is part of the CivetWeb project.
+ */
+
+
+#define SSL_TICKET_KEY_NAME_LEN (16)
+#define SSL_TICKET_KEY_SECRET_LEN (32)
+#define SSL_TICKET_IV_LEN (16) /* AES block size */
+#define SSL_TICKET_MAX_KEYS (16)
+
+
+struct mg_ssl_ticket_key {
+	unsigned char name[SSL_TICKET_KEY_NAME_LEN];
+	unsigned char hmac_secret[SSL_TICKET_KEY_SECRET_LEN];
+	unsigned char aes_secret[SSL_TICKET_KEY_SECRET_LEN];
+};
+
+mg_static_assert(sizeof(struct mg_ssl_ticket_key) == 80,
+                 "ticket key size mismatch");
+
+struct mg_ssl_ticket_keys {
+	pthread_mutex_t lock; /* Protects key and num_keys */
+	struct mg_ssl_ticket_key key[SSL_TICKET_MAX_KEYS];
+	unsigned num_keys; /* key[0] encrypts new tickets */
+	/* Key file as read last time. One byte more than the keys, to detect
+	 * files that are too large. */
+	unsigned char
+	    file_data[SSL_TICKET_MAX_KEYS * sizeof(struct mg_ssl_ticket_key) + 1];
+	size_t file_len;
+};
+
+
+#if defined(OPENSSL_API_3_0)
+typedef EVP_MAC_CTX ssl_ticket_mac_ctx;
+
+static int
+ssl_ticket_set_mac_key(EVP_MAC_CTX *hctx, unsigned char *secret)
+{
+	OSSL_PARAM params[3];
+
+	memset(params, 0, sizeof(params));
+	params[0].key = "key";
+	params[0].data_type = OSSL_PARAM_OCTET_STRING;
+	params[0].data = secret;
+	params[0].data_size = SSL_TICKET_KEY_SECRET_LEN;
+	params[0].return_size = (size_t)-1;
+	params[1].key = "digest";
+	params[1].data_type = OSSL_PARAM_UTF8_STRING;
+	params[1].data = (void *)"SHA256";
+	params[1].data_size = 6;
+	params[1].return_size = (size_t)-1;
+	return EVP_MAC_CTX_set_params(hctx, params);
+}
+#else
+typedef HMAC_CTX ssl_ticket_mac_ctx;
+
+static int
+ssl_ticket_set_mac_key(HMAC_CTX *hctx, unsigned char *secret)
+{
+	return HMAC_Init_ex(hctx,
+	                    secret,
+	                    SSL_TICKET_KEY_SECRET_LEN,
+	                    EVP_get_digestbyname("SHA256"),
+	                    NULL);
+}
+#endif
+
+
+/* Ticket key callback of OpenSSL. Return 1 if the ticket key has been set
+ * up, 2 if the ticket must be renewed, 0 if the ticket key is unknown and
+ * -1 on error. */
+static int
+ssl_ticket_key_cb(SSL *ssl,
+                  unsigned char *name,
+                  unsigned char *iv,
+                  EVP_CIPHER_CTX *cctx,
+                  ssl_ticket_mac_ctx *hctx,
+                  int enc)
+{
+	const struct mg_connection *conn =
+	    (const struct mg_connection *)SSL_get_app_data(ssl);
+	struct mg_ssl_ticket_keys *tk;
+	struct mg_ssl_ticket_key key;
+	unsigned i;
+	int ret = 0;
+
+	if ((conn == NULL) || ((tk = conn->phys_ctx->ticket_keys) == NULL)) {
+		return -1;
+	}
+
+	/* Use a copy of the key, the keys may be replaced by the timer */
+	pthread_mutex_lock(&tk->lock);
+	if (enc) {
+		key = tk->key[0];
+		ret = 1;
+	} else {
+		for (i = 0; i < tk->num_keys; i++) {
+			if (!memcmp(name, tk->key[i].name, SSL_TICKET_KEY_NAME_LEN)) {
+				key = tk->key[i];
+				ret = (i == 0) ? 1 : 2;
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&tk->lock);
+
+	if (ret == 0) {
+		/* Unknown key (e.g., rotated out): full handshake */
+		return 0;
+	}
+
+	if (enc) {
+		memcpy(name, key.name, SSL_TICKET_KEY_NAME_LEN);
+		if ((RAND_bytes(iv, SSL_TICKET_IV_LEN) != 1)
+		    || (EVP_EncryptInit_ex(
+		            cctx, EVP_aes_256_cbc(), NULL, key.aes_secret, iv)
+		        != 1)) {
+			ret = -1;
+		}
+	} else {
+		if (EVP_DecryptInit_ex(
+		        cctx, EVP_aes_256_cbc(), NULL, key.aes_secret, iv)
+		    != 1) {
+			ret = -1;
+		}
+	}
+	if ((ret > 0) && (ssl_ticket_set_mac_key(hctx, key.hmac_secret) != 1)) {
+		ret = -1;
+	}
+
+	memset(&key, 0, sizeof(key));
+	return ret;
+}
+
+
+#if !defined(NO_FILESYSTEMS)
+/* Read the key file. The keys are replaced only if the content of the file
+ * differs from the last read, since a file may be replaced within the
+ * resolution of its modification time. Return 1 if ok or unchanged, 0 on
+ * error (the previous keys remain in use). */
+static int
+ssl_ticket_keys_read(struct mg_context *ctx,
+                     struct mg_ssl_ticket_keys *tk,
+                     const char *path)
+{
+	struct mg_file file = STRUCT_FILE_INITIALIZER;
+	struct mg_connection fc;
+	unsigned char data[sizeof(tk->file_data)];
+	size_t len;
+	int ok = 1;
+
+	if (!mg_fopen(fake_connection(&fc, ctx), path, MG_FOPEN_MODE_READ, &file)) {
+		mg_cry_ctx_internal(ctx,
+		                    "Cannot open ticket key file %s: %s",
+		                    path,
+		                    strerror(ERRNO));
+		return 0;
+	}
+	len = fread(data, 1, sizeof(data), file.access.fp);
+	(void)mg_fclose(&file.access);
+
+	if (((tk->num_keys > 0) || (tk->file_len > 0)) && (len == tk->file_len)
+	    && !memcmp(data, tk->file_data, len)) {
+		/* Not modified (an invalid file has been reported already) */
+		memset(data, 0, sizeof(data));
+		return 1;
+	}
+
+	if ((len == 0) || ((len % sizeof(tk->key[0])) != 0)
+	    || (len > sizeof(tk->key))) {
+		mg_cry_ctx_internal(ctx,
+		                    "Ticket key file %s must contain 1 to %u keys of "
+		                    "%u bytes",
+		                    path,
+		                    (unsigned)SSL_TICKET_MAX_KEYS,
+		                    (unsigned)sizeof(tk->key[0]));
+		ok = 0;
+	}
+
+	pthread_mutex_lock(&tk->lock);
+	memcpy(tk->file_data, data, len);
+	tk->file_len = len;
+	if (ok) {
+		memcpy(tk->key, data, len);
+		tk->num_keys = (unsigned)(len / sizeof(tk->key[0]));
+	}
+	pthread_mutex_unlock(&tk->lock);
+
+	memset(data, 0, sizeof(data));
+	return ok;
+}
+#endif
+
+
+/* Create a new random key to encrypt new tickets, keep the previous key to
+ * decrypt tickets. Return 1 if ok, 0 on error. */
+static int
+ssl_ticket_keys_generate(struct mg_context *ctx, struct mg_ssl_ticket_keys *tk)
+{
+	struct mg_ssl_ticket_key key;
+
+	if (RAND_bytes((unsigned char *)&key, (int)sizeof(key)) != 1) {
+		mg_cry_ctx_internal(ctx,
+		                    "Cannot create ticket key: %s",
+		                    ssl_error());
+		return 0;
+	}
+
+	pthread_mutex_lock(&tk->lock);
+	tk->key[1] = tk->key[0];
+	tk->key[0] = key;
+	tk->num_keys = (tk->num_keys == 0) ? 1 : 2;
+	pthread_mutex_unlock(&tk->lock);
+
+	memset(&key, 0, sizeof(key));
+	return 1;
+}
+
+
+static void
+ssl_ticket_keys_free(struct mg_context *ctx)
+{
+	if (ctx->ticket_keys != NULL) {
+		(void)pthread_mutex_destroy(&ctx->ticket_keys->lock);
+		memset(ctx->ticket_keys, 0, sizeof(*ctx->ticket_keys));
+		mg_free(ctx->ticket_keys);
+		ctx->ticket_keys = NULL;
+	}
+}
+
+
+/* Load the ticket keys of the server and use them for the SSL_CTX of the
+ * main domain. Return 1 if ok or not configured, 0 on error. */
+static int
+ssl_ticket_keys_init(struct mg_context *phys_ctx,
+                     struct mg_domain_context *dom_ctx)
+{
+	const char *path = phys_ctx->dd.config[SSL_SESSION_TICKET_KEY_FILE];
+	struct mg_ssl_ticket_keys *tk;
+	int rotation = 0;
+	int ok;
+
+#if defined(USE_TIMERS)
+	if (phys_ctx->dd.config[SSL_SESSION_TICKET_KEY_ROTATION] != NULL) {
+		rotation = atoi(phys_ctx->dd.config[SSL_SESSION_TICKET_KEY_ROTATION]);
+	}
+#endif
+	if ((dom_ctx != &(phys_ctx->dd)) || ((path == NULL) && (rotation <= 0))) {
+		return 1;
+	}
+
+#if !defined(NO_SSL_DL)
+	if (tls_feature_missing[TLS_TICKETS]) {
+		mg_cry_ctx_internal(phys_ctx,
+		                    "%s",
+		                    "Session ticket keys not supported by the TLS "
+		                    "library");
+		return 0;
+	}
+#endif
+
+	if (phys_ctx->ticket_keys == NULL) {
+		tk = (struct mg_ssl_ticket_keys *)
+		    mg_calloc_ctx(1, sizeof(*tk), phys_ctx);
+		if (tk == NULL) {
+			mg_cry_ctx_internal(phys_ctx, "%s", "Out of memory");
+			return 0;
+		}
+		if (0 != pthread_mutex_init(&tk->lock, &pthread_mutex_attr)) {
+			mg_free(tk);
+			return 0;
+		}
+		phys_ctx->ticket_keys = tk;
+
+		if (path != NULL) {
+#if !defined(NO_FILESYSTEMS)
+			ok = ssl_ticket_keys_read(phys_ctx, tk, path);
+#else
+			mg_cry_ctx_internal(phys_ctx,
+			                    "%s",
+			                    "Ticket key files require a file system");
+			ok = 0;
+#endif
+		} else {
+			ok = ssl_ticket_keys_generate(phys_ctx, tk);
+		}
+		if (!ok) {
+			ssl_ticket_keys_free(phys_ctx);
+			return 0;
+		}
+	}
+
+#if defined(OPENSSL_API_3_0)
+	if (SSL_CTX_set_tlsext_ticket_key_evp_cb(dom_ctx->ssl_ctx,
+	                                         ssl_ticket_key_cb)
+	    != 1) {
+#else
+	if (SSL_CTX_set_tlsext_ticket_key_cb(dom_ctx->ssl_ctx, ssl_ticket_key_cb)
+	    != 1) {
+#endif
+		mg_cry_ctx_internal(phys_ctx,
+		                    "Cannot set ticket key callback: %s",
+		                    ssl_error());
+		return 0;
+	}
+	return 1;
+}
+
+
+#if defined(USE_TIMERS)
+static int
+ssl_ticket_keys_rotate(void *arg)
+{
+	struct mg_context *ctx = (struct mg_context *)arg;
+	struct mg_ssl_ticket_keys *tk = ctx->ticket_keys;
+	const char *path = ctx->dd.config[SSL_SESSION_TICKET_KEY_FILE];
+
+	if (path == NULL) {
+		(void)ssl_ticket_keys_generate(ctx, tk);
+	} else {
+#if !defined(NO_FILESYSTEMS)
+		struct mg_file_stat st;
+		struct mg_connection fc;
+
+		/* The file is compared with the last read. Errors are logged, the
+		 * previous keys remain in use. */
+		if (mg_stat(fake_connection(&fc, ctx), path, &st)) {
+			(void)ssl_ticket_keys_read(ctx, tk, path);
+		}
+#endif
+	}
+
+	/* Keep the timer */
+	return 1;
+}
+
+
+/* Start the timer for ssl_session_ticket_key_rotation. Return 0 if ok or
+ * not configured, -1 on error. */
+static int
+ssl_ticket_keys_start_rotation(struct mg_context *ctx)
+{
+	int rotation;
+
+	if ((ctx->ticket_keys == NULL)
+	    || (ctx->dd.config[SSL_SESSION_TICKET_KEY_ROTATION] == NULL)) {
+		return 0;
+	}
+	rotation = atoi(ctx->dd.config[SSL_SESSION_TICKET_KEY_ROTATION]);
+	if (rotation <= 0) {
+		return 0;
+	}
+	if (timer_add(ctx,
+	              (double)rotation,
+	              (double)rotation,
+	              1,
+	              ssl_ticket_keys_rotate,
+	              (void *)ctx,
+	              NULL)
+	    != 0) {
+		mg_cry_ctx_internal(ctx, "%s", "Cannot add ticket key rotation timer");
+		return -1;
+	}
+	return 0;
+}
+#endif
+
+
+/* End of ssl_tickets.inl */
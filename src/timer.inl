@@ -3,31 +3,50 @@
  * (C) 2014-2021 by the CivetWeb authors, MIT license.
  */
 
-#if !defined(MAX_TIMERS)
-#define MAX_TIMERS MAX_WORKER_THREADS
-#endif
+/* Timers are kept in a 4-ary min-heap, ordered by the due time. Every
+ * timer uses a slot of the timer table, the heap holds the due time and the
+ * slot number. Adding and cancelling a timer and taking the next due timer
+ * are O(log n). The id returned by timer_add2 contains the slot number and
+ * the sequence number of the slot, so an old id cannot cancel a new timer
+ * using the same slot.
+ * If MAX_TIMERS is defined, it limits the number of timers. */
 #if !defined(TIMER_RESOLUTION)
 /* Timer resolution in ms */
 #define TIMER_RESOLUTION (10)
 #endif
 
+#define TIMER_HEAP_ARITY (4)
+#define TIMER_NONE (0xFFFFFFFFu)
+
 typedef int (*taction)(void *arg);
 typedef void (*tcancelaction)(void *arg);
 
 struct ttimer {
 	double time;
 	double period;
-	taction action;
+	taction action; /* NULL for a free slot */
 	void *arg;
 	tcancelaction cancel;
+	unsigned heap_pos; /* TIMER_NONE while the action runs */
+	unsigned next_free;
+	uint32_t seq;  /* Incremented when the slot is freed */
+	int cancelled; /* Cancelled while the action runs */
+};
+
+struct ttimer_heap_entry {
+	double time;
+	unsigned slot;
 };
 
 struct ttimers {
-	pthread_t threadid;      /* Timer thread ID */
-	pthread_mutex_t mutex;   /* Protects timer lists */
-	struct ttimer *timers;   /* List of timers */
-	unsigned timer_count;    /* Current size of timer list */
-	unsigned timer_capacity; /* Capacity of timer list */
+	pthread_t threadid;             /* Timer thread ID */
+	pthread_mutex_t mutex;          /* Protects timer lists */
+	struct ttimer *timers;          /* Timer slots */
+	struct ttimer_heap_entry *heap; /* Scheduled timers */
+	unsigned timer_count;           /* Number of timers in the heap */
+	unsigned used_count;            /* Number of used slots */
+	unsigned timer_capacity;        /* Number of slots */
+	unsigned free_slot;             /* First free slot, or TIMER_NONE */
 #if defined(_WIN32)
 	DWORD last_tick;
 	uint64_t now_tick64;
@@ -70,17 +89,169 @@ timer_getcurrenttime(struct mg_context *ctx)
 }
 
 
+static void
+timer_heap_set(struct ttimers *tt, unsigned pos, struct ttimer_heap_entry e)
+{
+	tt->heap[pos] = e;
+	tt->timers[e.slot].heap_pos = pos;
+}
+
+
+/* Move the entry at pos up to its place */
+static void
+timer_heap_up(struct ttimers *tt, unsigned pos)
+{
+	struct ttimer_heap_entry e = tt->heap[pos];
+	unsigned parent;
+
+	while (pos > 0) {
+		parent = (pos - 1) / TIMER_HEAP_ARITY;
+		if (tt->heap[parent].time <= e.time) {
+			break;
+		}
+		timer_heap_set(tt, pos, tt->heap[parent]);
+		pos = parent;
+	}
+	timer_heap_set(tt, pos, e);
+}
+
+
+/* Move the entry at pos down to its place */
+static void
+timer_heap_down(struct ttimers *tt, unsigned pos)
+{
+	struct ttimer_heap_entry e = tt->heap[pos];
+	unsigned child, last, min, i;
+
+	for (;;) {
+		child = pos * TIMER_HEAP_ARITY + 1;
+		if (child >= tt->timer_count) {
+			break;
+		}
+		last = child + TIMER_HEAP_ARITY;
+		if (last > tt->timer_count) {
+			last = tt->timer_count;
+		}
+		min = child;
+		for (i = child + 1; i < last; i++) {
+			if (tt->heap[i].time < tt->heap[min].time) {
+				min = i;
+			}
+		}
+		if (e.time <= tt->heap[min].time) {
+			break;
+		}
+		timer_heap_set(tt, pos, tt->heap[min]);
+		pos = min;
+	}
+	timer_heap_set(tt, pos, e);
+}
+
+
+static void
+timer_heap_push(struct ttimers *tt, unsigned slot)
+{
+	unsigned pos = tt->timer_count++;
+
+	tt->heap[pos].time = tt->timers[slot].time;
+	tt->heap[pos].slot = slot;
+	tt->timers[slot].heap_pos = pos;
+	timer_heap_up(tt, pos);
+}
+
+
+static void
+timer_heap_remove(struct ttimers *tt, unsigned pos)
+{
+	unsigned slot = tt->heap[pos].slot;
+	double time = tt->heap[pos].time;
+
+	tt->timers[slot].heap_pos = TIMER_NONE;
+	tt->timer_count--;
+	if (pos < tt->timer_count) {
+		/* Fill the gap with the last entry */
+		timer_heap_set(tt, pos, tt->heap[tt->timer_count]);
+		if (tt->heap[pos].time < time) {
+			timer_heap_up(tt, pos);
+		} else {
+			timer_heap_down(tt, pos);
+		}
+	}
+}
+
+
+/* Get a free slot. Return TIMER_NONE if out of memory. */
+static unsigned
+timer_slot_alloc(struct mg_context *ctx)
+{
+	struct ttimers *tt = ctx->timers;
+	unsigned slot;
+
+	if (tt->free_slot == TIMER_NONE) {
+		unsigned u, capacity = (tt->timer_capacity * 2) + 1;
+		struct ttimer *timers;
+		struct ttimer_heap_entry *heap;
+
+		if (capacity >= TIMER_NONE / 2) {
+			return TIMER_NONE;
+		}
+		timers = (struct ttimer *)mg_realloc_ctx(tt->timers,
+		                                         capacity * sizeof(timers[0]),
+		                                         ctx);
+		if (timers == NULL) {
+			return TIMER_NONE;
+		}
+		tt->timers = timers;
+		heap = (struct ttimer_heap_entry *)
+		    mg_realloc_ctx(tt->heap, capacity * sizeof(heap[0]), ctx);
+		if (heap == NULL) {
+			/* The larger slot table can be used later */
+			return TIMER_NONE;
+		}
+		tt->heap = heap;
+		for (u = capacity; u > tt->timer_capacity; u--) {
+			memset(&timers[u - 1], 0, sizeof(timers[0]));
+			timers[u - 1].heap_pos = TIMER_NONE;
+			timers[u - 1].next_free = tt->free_slot;
+			tt->free_slot = u - 1;
+		}
+		tt->timer_capacity = capacity;
+	}
+	slot = tt->free_slot;
+	tt->free_slot = tt->timers[slot].next_free;
+	tt->used_count++;
+	return slot;
+}
+
+
+static void
+timer_slot_free(struct ttimers *tt, unsigned slot)
+{
+	tt->timers[slot].action = NULL;
+	tt->timers[slot].heap_pos = TIMER_NONE;
+	tt->timers[slot].seq++;
+	tt->timers[slot].next_free = tt->free_slot;
+	tt->free_slot = slot;
+	tt->used_count--;
+}
+
+
+/* Add a timer. If id is not NULL, store an id for timer_cancel.
+ * Return 0 on success, 1 on error. */
 TIMER_API int
-timer_add(struct mg_context *ctx,
-          double next_time,
-          double period,
-          int is_relative,
-          taction action,
-          void *arg,
-          tcancelaction cancel)
+timer_add2(struct mg_context *ctx,
+           double next_time,
+           double period,
+           int is_relative,
+           taction action,
+           void *arg,
+           tcancelaction cancel,
+           uint64_t *id)
 {
 	int error = 0;
 	double now;
+	unsigned slot = TIMER_NONE;
+	struct ttimer *t;
 
 	if (!ctx->timers) {
 		return 1;
@@ -109,48 +280,100 @@ timer_add(struct mg_context *ctx,
 	}
 
 	pthread_mutex_lock(&ctx->timers->mutex);
-	if (ctx->timers->timer_count == MAX_TIMERS) {
+#if defined(MAX_TIMERS)
+	if (ctx->timers->used_count >= MAX_TIMERS) {
 		error = 1;
-	} else if (ctx->timers->timer_count == ctx->timers->timer_capacity) {
-		unsigned capacity = (ctx->timers->timer_capacity * 2) + 1;
-		struct ttimer *timers =
-		    (struct ttimer *)mg_realloc_ctx(ctx->timers->timers,
-		                                    capacity * sizeof(struct ttimer),
-		                                    ctx);
-		if (timers) {
-			ctx->timers->timers = timers;
-			ctx->timers->timer_capacity = capacity;
-		} else {
+	} else
+#endif
+	{
+		slot = timer_slot_alloc(ctx);
+		if (slot == TIMER_NONE) {
 			error = 1;
 		}
 	}
 	if (!error) {
-		/* Insert new timer into a sorted list. */
-		/* The linear list is still most efficient for short lists (small
-		 * number of timers) - if there are many timers, different
-		 * algorithms will work better. */
-		unsigned u = ctx->timers->timer_count;
-		for (; (u > 0) && (ctx->timers->timers[u - 1].time > next_time); u--) {
-			ctx->timers->timers[u] = ctx->timers->timers[u - 1];
+		t = &ctx->timers->timers[slot];
+		t->time = next_time;
+		t->period = period;
+		t->action = action;
+		t->arg = arg;
+		t->cancel = cancel;
+		t->cancelled = 0;
+		timer_heap_push(ctx->timers, slot);
+		if (id != NULL) {
+			*id = ((uint64_t)t->seq << 32) | slot;
 		}
-		ctx->timers->timers[u].time = next_time;
-		ctx->timers->timers[u].period = period;
-		ctx->timers->timers[u].action = action;
-		ctx->timers->timers[u].arg = arg;
-		ctx->timers->timers[u].cancel = cancel;
-		ctx->timers->timer_count++;
 	}
 	pthread_mutex_unlock(&ctx->timers->mutex);
 	return error;
 }
 
 
+TIMER_API int
+timer_add(struct mg_context *ctx,
+          double next_time,
+          double period,
+          int is_relative,
+          taction action,
+          void *arg,
+          tcancelaction cancel)
+{
+	return timer_add2(
+	    ctx, next_time, period, is_relative, action, arg, cancel, NULL);
+}
+
+
+/* Cancel the timer id of timer_add2.
+ * Return 0 if the timer has been removed: the cancel action has been
+ * called, the timer action will not be called (again).
+ * Return 2 if the timer action is running right now: it will not be called
+ * again, the cancel action will be called when it returns.
+ * Return 1 if the timer does not exist (any more). */
+TIMER_API int
+timer_cancel(struct mg_context *ctx, uint64_t id)
+{
+	struct ttimers *tt = ctx->timers;
+	unsigned slot = (unsigned)(id & 0xFFFFFFFFu);
+	tcancelaction cancel = NULL;
+	void *arg = NULL;
+	int ret = 1;
+
+	if (!tt) {
+		return 1;
+	}
+
+	pthread_mutex_lock(&tt->mutex);
+	if ((slot < tt->timer_capacity) && (tt->timers[slot].action != NULL)
+	    && (tt->timers[slot].seq == (uint32_t)(id >> 32))
+	    && !tt->timers[slot].cancelled) {
+		if (tt->timers[slot].heap_pos == TIMER_NONE) {
+			/* The timer thread calls the action right now */
+			tt->timers[slot].cancelled = 1;
+			ret = 2;
+		} else {
+			timer_heap_remove(tt, tt->timers[slot].heap_pos);
+			cancel = tt->timers[slot].cancel;
+			arg = tt->timers[slot].arg;
+			timer_slot_free(tt, slot);
+			ret = 0;
+		}
+	}
+	pthread_mutex_unlock(&tt->mutex);
+
+	if (cancel != NULL) {
+		cancel(arg);
+	}
+	return ret;
+}
+
+
 static void
 timer_thread_run(void *thread_func_param)
 {
 	struct mg_context *ctx = (struct mg_context *)thread_func_param;
-	double d;
-	unsigned u;
+	struct ttimers *tt = ctx->timers;
+	double d, next_time;
+	unsigned slot;
 	int action_res;
 	struct ttimer t;
 
@@ -164,36 +387,38 @@ timer_thread_run(void *thread_func_param)
 	/* Timer main loop */
 	d = timer_getcurrenttime(ctx);
 	while (STOP_FLAG_IS_ZERO(&ctx->stop_flag)) {
-		pthread_mutex_lock(&ctx->timers->mutex);
-		if ((ctx->timers->timer_count > 0)
-		    && (d >= ctx->timers->timers[0].time)) {
-			/* Timer list is sorted. First action should run now. */
-			/* Store active timer in "t" */
-			t = ctx->timers->timers[0];
-
-			/* Shift all other timers */
-			for (u = 1; u < ctx->timers->timer_count; u++) {
-				ctx->timers->timers[u - 1] = ctx->timers->timers[u];
-			}
-			ctx->timers->timer_count--;
+		pthread_mutex_lock(&tt->mutex);
+		if ((tt->timer_count > 0) && (d >= tt->heap[0].time)) {
+			/* The first timer in the heap is due. Store it in "t",
+			 * the slot remains in use while the action runs. */
+			slot = tt->heap[0].slot;
+			timer_heap_remove(tt, 0);
+			t = tt->timers[slot];
 
-			pthread_mutex_unlock(&ctx->timers->mutex);
+			pthread_mutex_unlock(&tt->mutex);
 
 			/* Call timer action */
 			action_res = t.action(t.arg);
 
+			/* You can not set timers into the past */
+			next_time = timer_getcurrenttime(ctx);
+			if (next_time < t.time + t.period) {
+				next_time = t.time + t.period;
+			}
+
 			/* action_res == 1: reschedule */
 			/* action_res == 0: do not reschedule, free(arg) */
-			if ((action_res > 0) && (t.period > 0)) {
-				/* Should schedule timer again */
-				timer_add(ctx,
-				          t.time + t.period,
-				          t.period,
-				          0,
-				          t.action,
-				          t.arg,
-				          t.cancel);
+			pthread_mutex_lock(&tt->mutex);
+			if ((action_res > 0) && (t.period > 0)
+			    && !tt->timers[slot].cancelled) {
+				/* Schedule timer again, with the same id */
+				tt->timers[slot].time = next_time;
+				timer_heap_push(tt, slot);
+				pthread_mutex_unlock(&tt->mutex);
 			} else {
+				timer_slot_free(tt, slot);
+				pthread_mutex_unlock(&tt->mutex);
+
 				/* Allow user to free timer argument */
 				if (t.cancel != NULL) {
 					t.cancel(t.arg);
@@ -201,7 +426,7 @@ timer_thread_run(void *thread_func_param)
 			}
 			continue;
 		} else {
-			pthread_mutex_unlock(&ctx->timers->mutex);
+			pthread_mutex_unlock(&tt->mutex);
 		}
 
 		/* TIMER_RESOLUTION = 10 ms seems reasonable.
@@ -214,12 +439,19 @@ timer_thread_run(void *thread_func_param)
 	}
 
 	/* Remove remaining timers */
-	for (u = 0; u < ctx->timers->timer_count; u++) {
-		t = ctx->timers->timers[u];
+	pthread_mutex_lock(&tt->mutex);
+	while (tt->timer_count > 0) {
+		slot = tt->heap[tt->timer_count - 1].slot;
+		timer_heap_remove(tt, tt->timer_count - 1);
+		t = tt->timers[slot];
+		timer_slot_free(tt, slot);
+		pthread_mutex_unlock(&tt->mutex);
 		if (t.cancel != NULL) {
 			t.cancel(t.arg);
 		}
+		pthread_mutex_lock(&tt->mutex);
 	}
+	pthread_mutex_unlock(&tt->mutex);
 }
 
 
@@ -257,6 +489,8 @@ timers_init(struct mg_context *ctx)
 		return -1;
 	}
 	ctx->timers->timers = NULL;
+	ctx->timers->heap = NULL;
+	ctx->timers->free_slot = TIMER_NONE;
 
 	/* Initialize mutex */
 	if (0 != pthread_mutex_init(&ctx->timers->mutex, NULL)) {
@@ -289,6 +523,7 @@ timers_exit(struct mg_context *ctx)
 		mg_join_thread(ctx->timers->threadid);
 		(void)pthread_mutex_destroy(&ctx->timers->mutex);
 		mg_free(ctx->timers->timers);
+		mg_free(ctx->timers->heap);
 		mg_free(ctx->timers);
 		ctx->timers = NULL;
 	}
@@ -0,0 +1,510 @@
+/* Copyright (c) 2026 the Civetweb developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * HTTP/2 benchmark in the style of h2load (Linux only, requires USE_HTTP2).
+ *
+ * A TLS server with enable_http2 is started on a random local port. Client
+ * threads send requests for a small static file and for a request handler
+ * that takes 10 ms. Every client uses one connection, either HTTP/2 with
+ * several concurrent streams or HTTP/1.1 with keep-alive. The requests per
+ * second are printed.
+ *
+ * Usage: h2bench [requests [clients [streams [certificate]]]]
+ *
+ * The client uses the TLS functions bound by civetweb.c. The program
+ * returns 1 if a response is not correct, so it can be used as a quick
+ * test as well.
+ */
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#endif
+
+#define CIVETWEB_API static
+
+#include "../src/civetweb.c"
+
+#include <stdlib.h>
+
+#if !defined(H2BENCH_CERT)
+#define H2BENCH_CERT "../resources/cert/server.pem"
+#endif
+
+#define H2BENCH_MAX_STREAMS (64)
+#define H2BENCH_WINDOW (1u << 24)
+
+
+static SSL_CTX *client_ctx;
+static int port;
+static int num_requests;
+static int num_streams;
+static const char *path;
+static size_t body_len;
+static volatile int errors;
+
+
+/* Connect to the server, negotiate h2 or http/1.1 */
+static SSL *
+tls_connect(int *sock)
+{
+	struct sockaddr_in sin;
+	SSL *ssl;
+
+	*sock = (int)socket(AF_INET, SOCK_STREAM, 0);
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons((uint16_t)port);
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if ((*sock < 0) || connect(*sock, (struct sockaddr *)&sin, sizeof(sin))) {
+		return NULL;
+	}
+	ssl = SSL_new(client_ctx);
+	if (ssl == NULL) {
+		return NULL;
+	}
+	if ((SSL_set_fd(ssl, *sock) != 1) || (SSL_connect(ssl) != 1)) {
+		SSL_free(ssl);
+		return NULL;
+	}
+	return ssl;
+}
+
+
+static int
+tls_read_all(SSL *ssl, void *buf, int len)
+{
+	int n, got = 0;
+
+	while (got < len) {
+		n = SSL_read(ssl, (char *)buf + got, len - got);
+		if (n <= 0) {
+			return -1;
+		}
+		got += n;
+	}
+	return got;
+}
+
+
+static void
+h2_frame(uint8_t *head, uint32_t len, uint8_t type, uint8_t flags, uint32_t id)
+{
+	head[0] = (uint8_t)(len >> 16);
+	head[1] = (uint8_t)(len >> 8);
+	head[2] = (uint8_t)len;
+	head[3] = type;
+	head[4] = flags;
+	head[5] = (uint8_t)(id >> 24);
+	head[6] = (uint8_t)(id >> 16);
+	head[7] = (uint8_t)(id >> 8);
+	head[8] = (uint8_t)id;
+}
+
+
+/* Send a GET request on a new stream. The header block uses the static
+ * HPACK table only: :method GET, :scheme https, :path and :authority
+ * as literals without indexing. */
+static int
+h2_request(SSL *ssl, uint32_t id)
+{
+	uint8_t req[9 + 256];
+	size_t len = strlen(path);
+	uint32_t n = 0;
+
+	req[9 + n++] = 0x82;
+	req[9 + n++] = 0x87;
+	req[9 + n++] = 0x04;
+	req[9 + n++] = (uint8_t)len;
+	memcpy(req + 9 + n, path, len);
+	n += (uint32_t)len;
+	req[9 + n++] = 0x01;
+	req[9 + n++] = 0x01;
+	req[9 + n++] = 'b';
+	h2_frame(req, n, 1 /* HEADERS */, 0x05 /* END_STREAM, END_HEADERS */, id);
+	return (SSL_write(ssl, req, (int)(9 + n)) == (int)(9 + n)) ? 0 : -1;
+}
+
+
+/* One HTTP/2 connection with up to num_streams concurrent streams */
+static int
+h2_client(SSL *ssl)
+{
+	static const char preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+	uint8_t buf[16384 + 9], *head = buf;
+	uint32_t ids[H2BENCH_MAX_STREAMS];
+	size_t got[H2BENCH_MAX_STREAMS];
+	uint32_t next_id = 1, id, len, unacked = 0;
+	int sent = 0, done = 0, open = 0, i;
+
+	/* Preface, large stream windows and connection window */
+	memcpy(buf, preface, 24);
+	h2_frame(buf + 24, 6, 4 /* SETTINGS */, 0, 0);
+	buf[33] = 0;
+	buf[34] = 4; /* SETTINGS_INITIAL_WINDOW_SIZE */
+	buf[35] = (uint8_t)(H2BENCH_WINDOW >> 24);
+	buf[36] = (uint8_t)(H2BENCH_WINDOW >> 16);
+	buf[37] = (uint8_t)(H2BENCH_WINDOW >> 8);
+	buf[38] = (uint8_t)H2BENCH_WINDOW;
+	h2_frame(buf + 39, 4, 8 /* WINDOW_UPDATE */, 0, 0);
+	buf[48] = (uint8_t)((H2BENCH_WINDOW - 65535) >> 24);
+	buf[49] = (uint8_t)((H2BENCH_WINDOW - 65535) >> 16);
+	buf[50] = (uint8_t)((H2BENCH_WINDOW - 65535) >> 8);
+	buf[51] = (uint8_t)(H2BENCH_WINDOW - 65535);
+	if (SSL_write(ssl, buf, 52) != 52) {
+		return -1;
+	}
+
+	while (done < num_requests) {
+		/* Keep num_streams requests in flight */
+		while ((open < num_streams) && (sent < num_requests)) {
+			if (h2_request(ssl, next_id) != 0) {
+				return -1;
+			}
+			ids[open] = next_id;
+			got[open] = 0;
+			open++;
+			sent++;
+			next_id += 2;
+		}
+
+		if (tls_read_all(ssl, head, 9) != 9) {
+			return -1;
+		}
+		len = ((uint32_t)head[0] << 16) | ((uint32_t)head[1] << 8) | head[2];
+		id = (((uint32_t)head[5] << 24) | ((uint32_t)head[6] << 16)
+		      | ((uint32_t)head[7] << 8) | head[8])
+		     & 0x7FFFFFFFu;
+		if ((len > 16384) || (tls_read_all(ssl, buf + 9, (int)len) != (int)len)) {
+			return -1;
+		}
+
+		switch (head[3]) {
+		case 0: /* DATA */
+		case 1: /* HEADERS */
+			for (i = 0; (i < open) && (ids[i] != id); i++) {
+			}
+			if (i == open) {
+				return -1;
+			}
+			if (head[3] == 0) {
+				got[i] += len;
+				unacked += len;
+			} else if ((len == 0) || (buf[9] != 0x88)) {
+				/* Not ":status: 200" */
+				return -1;
+			}
+			if (head[4] & 1) {
+				/* END_STREAM */
+				if (got[i] != body_len) {
+					return -1;
+				}
+				ids[i] = ids[open - 1];
+				got[i] = got[open - 1];
+				open--;
+				done++;
+			}
+			break;
+		case 3: /* RST_STREAM */
+		case 7: /* GOAWAY */
+			return -1;
+		case 4: /* SETTINGS */
+			if (!(head[4] & 1)) {
+				h2_frame(buf, 0, 4, 1 /* ACK */, 0);
+				if (SSL_write(ssl, buf, 9) != 9) {
+					return -1;
+				}
+			}
+			break;
+		default:
+			break;
+		}
+
+		if (unacked >= H2BENCH_WINDOW / 2) {
+			h2_frame(buf, 4, 8 /* WINDOW_UPDATE */, 0, 0);
+			buf[9] = (uint8_t)(unacked >> 24);
+			buf[10] = (uint8_t)(unacked >> 16);
+			buf[11] = (uint8_t)(unacked >> 8);
+			buf[12] = (uint8_t)unacked;
+			if (SSL_write(ssl, buf, 13) != 13) {
+				return -1;
+			}
+			unacked = 0;
+		}
+	}
+	return 0;
+}
+
+
+/* One HTTP/1.1 keep-alive connection, sending one request after another */
+static int
+h1_client(SSL *ssl)
+{
+	char hdr[1024], body[16384], *p;
+	int i, n, hlen, want;
+	int64_t got, clen;
+
+	for (i = 0; i < num_requests; i++) {
+		mg_snprintf(
+		    NULL, NULL, hdr, sizeof(hdr), "GET %s HTTP/1.1\r\nHost: b\r\n\r\n", path);
+		n = (int)strlen(hdr);
+		if (SSL_write(ssl, hdr, n) != n) {
+			return -1;
+		}
+
+		/* Read the header */
+		hlen = 0;
+		p = NULL;
+		while (p == NULL) {
+			n = SSL_read(ssl, hdr + hlen, (int)sizeof(hdr) - 1 - hlen);
+			if (n <= 0) {
+				return -1;
+			}
+			hlen += n;
+			hdr[hlen] = 0;
+			p = strstr(hdr, "\r\n\r\n");
+		}
+		if (strncmp(hdr, "HTTP/1.1 200", 12)
+		    || (strstr(hdr, "Content-Length: ") == NULL)) {
+			return -1;
+		}
+		clen = atoll(strstr(hdr, "Content-Length: ") + 16);
+		got = hlen - (int)(p + 4 - hdr);
+
+		/* Read the body */
+		while (got < clen) {
+			want = (clen - got > (int64_t)sizeof(body)) ? (int)sizeof(body)
+			                                             : (int)(clen - got);
+			n = SSL_read(ssl, body, want);
+			if (n <= 0) {
+				return -1;
+			}
+			got += n;
+		}
+		if ((got != clen) || (clen != (int64_t)body_len)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+
+static void *
+client(void *arg)
+{
+	int use_h2 = *(int *)arg;
+	SSL *ssl;
+	int sock = -1;
+
+	ssl = tls_connect(&sock);
+	if ((ssl == NULL) || ((use_h2 ? h2_client(ssl) : h1_client(ssl)) != 0)) {
+		__atomic_fetch_add(&errors, 1, __ATOMIC_RELAXED);
+	}
+	if (ssl != NULL) {
+		SSL_free(ssl);
+	}
+	if (sock >= 0) {
+		close(sock);
+	}
+	return NULL;
+}
+
+
+static void
+run(const char *name, const char *uri, size_t len, int clients, int use_h2)
+{
+	pthread_t th[64];
+	uint64_t start, duration;
+	int i;
+
+	path = uri;
+	body_len = len;
+
+	start = mg_get_current_time_ns();
+	for (i = 0; i < clients; i++) {
+		pthread_create(&th[i], NULL, client, &use_h2);
+	}
+	for (i = 0; i < clients; i++) {
+		pthread_join(th[i], NULL);
+	}
+	duration = mg_get_current_time_ns() - start;
+
+	printf("%-8s %-12s %10.0f req/s\n",
+	       name,
+	       use_h2 ? "HTTP/2" : "HTTP/1.1",
+	       (double)clients * num_requests * 1.0E9 / (double)duration);
+}
+
+
+/* A handler that takes some time, like a database request */
+static int
+delay_handler(struct mg_connection *conn, void *cbdata)
+{
+	(void)cbdata;
+	mg_sleep(10);
+	mg_send_http_ok(conn, "text/plain", 5);
+	mg_write(conn, "delay", 5);
+	return 200;
+}
+
+
+static int
+write_file(const char *dir, const char *name, size_t len)
+{
+	char fname[256], buf[4096];
+	size_t i, n;
+	FILE *f;
+
+	mg_snprintf(NULL, NULL, fname, sizeof(fname), "%s/%s", dir, name);
+	f = fopen(fname, "wb");
+	if (f == NULL) {
+		return 0;
+	}
+	for (i = 0; i < sizeof(buf); i++) {
+		buf[i] = (char)('a' + i % 26);
+	}
+	for (i = 0; i < len; i += n) {
+		n = (len - i > sizeof(buf)) ? sizeof(buf) : (len - i);
+		fwrite(buf, 1, n, f);
+	}
+	fclose(f);
+	return 1;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	char dir[] = "/tmp/h2benchXXXXXX", fname[256], threads[16];
+	char stream_threads[16];
+	const char *options[] = {"listening_ports",
+	                         "127.0.0.1:0s",
+	                         "document_root",
+	                         dir,
+	                         "ssl_certificate",
+	                         H2BENCH_CERT,
+	                         "enable_http2",
+	                         "yes",
+	                         "num_threads",
+	                         threads,
+	                         "http2_stream_threads",
+	                         stream_threads,
+	                         "enable_keep_alive",
+	                         "yes",
+	                         "keep_alive_timeout_ms",
+	                         "10000",
+	                         "tcp_nodelay",
+	                         "1",
+	                         NULL};
+	static const unsigned char alpn[] = "\x02h2\x08http/1.1";
+	static const unsigned char alpn_h1[] = "\x08http/1.1";
+	struct mg_callbacks callbacks;
+	struct mg_server_port sp;
+	struct mg_context *ctx;
+	int clients = 4, requests;
+
+	requests = 20000;
+	num_streams = 16;
+	if (argc > 1) {
+		requests = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		clients = atoi(argv[2]);
+	}
+	if (argc > 3) {
+		num_streams = atoi(argv[3]);
+	}
+	if (argc > 4) {
+		options[5] = argv[4];
+	}
+	if ((requests < 1) || (clients < 1) || (clients > 64) || (num_streams < 1)
+	    || (num_streams > H2BENCH_MAX_STREAMS)) {
+		fprintf(stderr,
+		        "Usage: %s [requests [clients (1-64) [streams (1-%i) "
+		        "[certificate]]]]\n",
+		        argv[0],
+		        H2BENCH_MAX_STREAMS);
+		return 2;
+	}
+	sprintf(threads, "%i", clients);
+	sprintf(stream_threads, "%i", clients * num_streams);
+
+	if ((mkdtemp(dir) == NULL) || !write_file(dir, "small.txt", 1024)) {
+		fprintf(stderr, "Cannot create test files\n");
+		return 2;
+	}
+
+	mg_init_library(MG_FEATURES_TLS | MG_FEATURES_HTTP2);
+	memset(&callbacks, 0, sizeof(callbacks));
+	ctx = mg_start(&callbacks, NULL, options);
+	if ((ctx == NULL) || (mg_get_server_ports(ctx, 1, &sp) != 1)) {
+		fprintf(stderr, "Cannot start server\n");
+		return 2;
+	}
+	port = sp.port;
+	mg_set_request_handler(ctx, "/delay", delay_handler, NULL);
+
+#if (defined(OPENSSL_API_1_1) || defined(OPENSSL_API_3_0))                     \
+    && !defined(NO_SSL_DL)
+	client_ctx = SSL_CTX_new(TLS_client_method());
+#else
+	client_ctx = SSL_CTX_new(SSLv23_client_method());
+#endif
+	if (client_ctx == NULL) {
+		fprintf(stderr, "Cannot create TLS client context\n");
+		return 2;
+	}
+
+	printf("%i clients, %i streams per HTTP/2 connection\n",
+	       clients,
+	       num_streams);
+
+	num_requests = (requests + clients - 1) / clients;
+	SSL_CTX_set_alpn_protos(client_ctx, alpn_h1, sizeof(alpn_h1) - 1);
+	run("1 KB", "/small.txt", 1024, clients, 0);
+	SSL_CTX_set_alpn_protos(client_ctx, alpn, sizeof(alpn) - 1);
+	run("1 KB", "/small.txt", 1024, clients, 1);
+
+	/* The handler takes 10 ms: use fewer requests */
+	num_requests = (num_requests + 49) / 50;
+	SSL_CTX_set_alpn_protos(client_ctx, alpn_h1, sizeof(alpn_h1) - 1);
+	run("10 ms", "/delay", 5, clients, 0);
+	SSL_CTX_set_alpn_protos(client_ctx, alpn, sizeof(alpn) - 1);
+	run("10 ms", "/delay", 5, clients, 1);
+
+	SSL_CTX_free(client_ctx);
+	mg_stop(ctx);
+	mg_exit_library();
+
+	mg_snprintf(NULL, NULL, fname, sizeof(fname), "%s/small.txt", dir);
+	remove(fname);
+	rmdir(dir);
+
+	if (errors) {
+		printf("%i connections failed\n", errors);
+		return 1;
+	}
+	return 0;
+}
+
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
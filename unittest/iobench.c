@@ -0,0 +1,396 @@
+/* Copyright (c) 2026 the Civetweb developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * Benchmark for the I/O path of the worker threads (Linux only).
+ *
+ * The same source is built with and without USE_IO_URING. A server is
+ * started on a random local port, client threads send keep-alive requests
+ * for a small and a large static file. The requests per second and the
+ * number of I/O related system calls of the server per request are
+ * printed.
+ *
+ * Usage: iobench [requests [clients [allow_sendfile_call]]]
+ *
+ * System calls are counted by replacing the libc functions used by
+ * civetweb.c with counting wrappers. The program returns 1 if a response
+ * is not correct, so it can be used as a quick test as well.
+ */
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#endif
+
+/* Include the system headers before redefining the functions below */
+#if !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* as in civetweb.c */
+#endif
+#include <poll.h>
+#include <stdarg.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+enum {
+	CNT_RECV,
+	CNT_SEND,
+	CNT_POLL,
+	CNT_SENDFILE,
+	CNT_READ,
+	CNT_WRITE,
+	CNT_URING,
+	CNT_OTHER,
+	CNT_NUM
+};
+static const char *cnt_name[CNT_NUM] =
+    {"recv", "send", "poll", "sendfile", "read", "write", "uring", "other"};
+static volatile long sys_cnt[CNT_NUM];
+
+static ssize_t bench_recv(int fd, void *buf, size_t len, int flags);
+static ssize_t bench_send(int fd, const void *buf, size_t len, int flags);
+static int bench_poll(struct pollfd *fds, nfds_t n, int timeout);
+static ssize_t bench_sendfile(int out, int in, off_t *offs, size_t len);
+static ssize_t bench_read(int fd, void *buf, size_t len);
+static ssize_t bench_write(int fd, const void *buf, size_t len);
+static long bench_syscall(long nr, ...);
+
+#define recv bench_recv
+#define send bench_send
+#define poll bench_poll
+#define sendfile bench_sendfile
+#define read bench_read
+#define write bench_write
+#define syscall bench_syscall
+
+/* The API functions are not static: functions of the header, which are
+ * not compiled with the build flags used here, would cause warnings */
+#include "../src/civetweb.c"
+
+#undef recv
+#undef send
+#undef poll
+#undef sendfile
+#undef read
+#undef write
+#undef syscall
+
+#include <stdlib.h>
+
+
+#define COUNT(x) __atomic_fetch_add(&sys_cnt[x], 1, __ATOMIC_RELAXED)
+
+static ssize_t
+bench_recv(int fd, void *buf, size_t len, int flags)
+{
+	COUNT(CNT_RECV);
+	return recv(fd, buf, len, flags);
+}
+
+static ssize_t
+bench_send(int fd, const void *buf, size_t len, int flags)
+{
+	COUNT(CNT_SEND);
+	return send(fd, buf, len, flags);
+}
+
+static int
+bench_poll(struct pollfd *fds, nfds_t n, int timeout)
+{
+	COUNT(CNT_POLL);
+	return poll(fds, n, timeout);
+}
+
+static ssize_t
+bench_sendfile(int out, int in, off_t *offs, size_t len)
+{
+	COUNT(CNT_SENDFILE);
+	return sendfile(out, in, offs, len);
+}
+
+static ssize_t
+bench_read(int fd, void *buf, size_t len)
+{
+	COUNT(CNT_READ);
+	return read(fd, buf, len);
+}
+
+static ssize_t
+bench_write(int fd, const void *buf, size_t len)
+{
+	COUNT(CNT_WRITE);
+	return write(fd, buf, len);
+}
+
+static long
+bench_syscall(long nr, ...)
+{
+	va_list ap;
+	long a[6];
+	int i;
+
+	va_start(ap, nr);
+	for (i = 0; i < 6; i++) {
+		a[i] = va_arg(ap, long);
+	}
+	va_end(ap);
+
+#if defined(__NR_io_uring_enter)
+	COUNT((nr == __NR_io_uring_enter) ? CNT_URING : CNT_OTHER);
+#else
+	COUNT(CNT_OTHER);
+#endif
+	return syscall(nr, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+
+
+static int port;
+static int num_requests;
+static const char *path;
+static size_t body_len;
+static volatile int errors;
+
+
+/* One keep-alive connection, sending num_requests requests for path */
+static void *
+client(void *arg)
+{
+	struct sockaddr_in sin;
+	char hdr[1024], *body, *p;
+	int sock, i, n, hlen, want;
+	int64_t got, clen;
+
+	(void)arg;
+	body = (char *)mg_malloc(65536);
+	sock = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons((uint16_t)port);
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if ((body == NULL) || (sock < 0)
+	    || connect(sock, (struct sockaddr *)&sin, sizeof(sin))) {
+		__atomic_fetch_add(&errors, 1, __ATOMIC_RELAXED);
+		mg_free(body);
+		return NULL;
+	}
+
+	for (i = 0; i < num_requests; i++) {
+		mg_snprintf(
+		    NULL, NULL, hdr, sizeof(hdr), "GET %s HTTP/1.1\r\nHost: b\r\n\r\n", path);
+		n = (int)strlen(hdr);
+		if (send(sock, hdr, (size_t)n, 0) != n) {
+			break;
+		}
+
+		/* Read the header */
+		hlen = 0;
+		p = NULL;
+		while (p == NULL) {
+			n = (int)recv(sock, hdr + hlen, sizeof(hdr) - 1 - (size_t)hlen, 0);
+			if (n <= 0) {
+				break;
+			}
+			hlen += n;
+			hdr[hlen] = 0;
+			p = strstr(hdr, "\r\n\r\n");
+		}
+		if ((p == NULL) || strncmp(hdr, "HTTP/1.1 200", 12)
+		    || (strstr(hdr, "Content-Length: ") == NULL)) {
+			break;
+		}
+		clen = atoll(strstr(hdr, "Content-Length: ") + 16);
+		got = hlen - (int)(p + 4 - hdr);
+
+		/* Read the body */
+		while (got < clen) {
+			want = (clen - got > 65536) ? 65536 : (int)(clen - got);
+			n = (int)recv(sock, body, (size_t)want, 0);
+			if (n <= 0) {
+				break;
+			}
+			got += n;
+		}
+		if ((got != clen) || (clen != (int64_t)body_len)) {
+			break;
+		}
+	}
+	if (i != num_requests) {
+		__atomic_fetch_add(&errors, 1, __ATOMIC_RELAXED);
+	}
+
+	close(sock);
+	mg_free(body);
+	return NULL;
+}
+
+
+static void
+run(const char *name, const char *uri, size_t len, int clients)
+{
+	pthread_t th[64];
+	uint64_t start, duration;
+	long total = 0, c[CNT_NUM];
+	int i, req;
+
+	path = uri;
+	body_len = len;
+	for (i = 0; i < CNT_NUM; i++) {
+		sys_cnt[i] = 0;
+	}
+
+	start = mg_get_current_time_ns();
+	for (i = 0; i < clients; i++) {
+		pthread_create(&th[i], NULL, client, NULL);
+	}
+	for (i = 0; i < clients; i++) {
+		pthread_join(th[i], NULL);
+	}
+	duration = mg_get_current_time_ns() - start;
+
+	req = clients * num_requests;
+	printf("%-8s %10.0f req/s  syscalls/req:", name, req * 1.0E9 / duration);
+	for (i = 0; i < CNT_NUM; i++) {
+		c[i] = sys_cnt[i];
+		total += c[i];
+		if (c[i] > 0) {
+			printf(" %s %.2f", cnt_name[i], (double)c[i] / req);
+		}
+	}
+	printf("  total %.2f\n", (double)total / req);
+}
+
+
+static int
+write_file(const char *dir, const char *name, size_t len)
+{
+	char fname[256], buf[4096];
+	size_t i, n;
+	FILE *f;
+
+	mg_snprintf(NULL, NULL, fname, sizeof(fname), "%s/%s", dir, name);
+	f = fopen(fname, "wb");
+	if (f == NULL) {
+		return 0;
+	}
+	for (i = 0; i < sizeof(buf); i++) {
+		buf[i] = (char)('a' + i % 26);
+	}
+	for (i = 0; i < len; i += n) {
+		n = (len - i > sizeof(buf)) ? sizeof(buf) : (len - i);
+		fwrite(buf, 1, n, f);
+	}
+	fclose(f);
+	return 1;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	char dir[] = "/tmp/iobenchXXXXXX", fname[256], threads[16];
+	const char *allow_sendfile = "yes";
+	const char *options[] = {"listening_ports",
+	                         "127.0.0.1:0",
+	                         "document_root",
+	                         dir,
+	                         "num_threads",
+	                         threads,
+	                         "enable_keep_alive",
+	                         "yes",
+	                         "keep_alive_timeout_ms",
+	                         "10000",
+	                         "tcp_nodelay",
+	                         "1",
+	                         "allow_sendfile_call",
+	                         NULL,
+	                         NULL};
+	struct mg_callbacks callbacks;
+	struct mg_server_port sp;
+	struct mg_context *ctx;
+	int clients = 4;
+
+	num_requests = 20000;
+	if (argc > 1) {
+		num_requests = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		clients = atoi(argv[2]);
+	}
+	if (argc > 3) {
+		allow_sendfile = argv[3];
+	}
+	if ((num_requests < 1) || (clients < 1) || (clients > 64)) {
+		fprintf(stderr,
+		        "Usage: %s [requests [clients (1-64) [allow_sendfile_call]]]\n",
+		        argv[0]);
+		return 2;
+	}
+	num_requests /= clients;
+	if (num_requests < 1) {
+		num_requests = 1;
+	}
+	sprintf(threads, "%i", clients);
+	options[13] = allow_sendfile;
+
+	if ((mkdtemp(dir) == NULL) || !write_file(dir, "small.txt", 1024)
+	    || !write_file(dir, "large.bin", 1024 * 1024)) {
+		fprintf(stderr, "Cannot create test files\n");
+		return 2;
+	}
+
+	mg_init_library(0);
+	memset(&callbacks, 0, sizeof(callbacks));
+	ctx = mg_start(&callbacks, NULL, options);
+	if ((ctx == NULL) || (mg_get_server_ports(ctx, 1, &sp) != 1)) {
+		fprintf(stderr, "Cannot start server\n");
+		return 2;
+	}
+	port = sp.port;
+
+#if defined(USE_IO_URING)
+	printf("USE_IO_URING, ");
+#else
+	printf("poll, ");
+#endif
+	printf("%i clients, allow_sendfile_call=%s\n", clients, allow_sendfile);
+	run("1 KB", "/small.txt", 1024, clients);
+	num_requests = (num_requests + 9) / 10;
+	run("1 MB", "/large.bin", 1024 * 1024, clients);
+
+	mg_stop(ctx);
+	mg_exit_library();
+
+	mg_snprintf(NULL, NULL, fname, sizeof(fname), "%s/small.txt", dir);
+	remove(fname);
+	mg_snprintf(NULL, NULL, fname, sizeof(fname), "%s/large.bin", dir);
+	remove(fname);
+	rmdir(dir);
+
+	if (errors) {
+		printf("%i connections failed\n", errors);
+		return 1;
+	}
+	return 0;
+}
+
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
@@ -0,0 +1,177 @@
+/* Copyright (c) 2026 the Civetweb developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * Throughput benchmark for the HTTP request parser (parse_http_request).
+ *
+ * Usage: parsebench [iterations]
+ *
+ * A small, a typical browser and a large request (long cookie) are parsed
+ * with every character scanner implementation supported by the CPU
+ * (scalar, SSE4.2, AVX2, see http_scan.inl). The parse rate and the
+ * throughput are printed. The program returns 1 if the implementations
+ * do not return the same result, so it can be used as a quick test as well.
+ */
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#endif
+
+#define CIVETWEB_API static
+
+#include "../src/civetweb.c"
+
+#include <stdlib.h>
+
+
+static const char *level_name[] = {"scalar", "sse4.2", "avx2"};
+
+static const char *small_request = "GET / HTTP/1.1\r\n"
+                                   "Host: localhost\r\n"
+                                   "\r\n";
+
+static const char *browser_request =
+    "GET /static/js/app.min.js?v=20260301 HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, "
+    "like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+    "sec-ch-ua-platform: \"Linux\"\r\n"
+    "Accept: */*\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Dest: script\r\n"
+    "Referer: https://www.example.com/shop/index.html\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Accept-Language: en-US,en;q=0.9,de;q=0.8\r\n"
+    "Cookie: session=8f14e45fceea167a5a36dedd4bea2543; theme=dark; "
+    "consent=1\r\n"
+    "If-None-Match: \"65e1a7c2.1f3a\"\r\n"
+    "\r\n";
+
+
+/* Parse request n times with the current scanner.
+ * Return the request length (or error), store the duration in ns. */
+static int
+bench(const char *request, size_t len, int n, uint64_t *duration)
+{
+	struct mg_request_info ri;
+	char *buf = (char *)mg_malloc(len + 1);
+	uint64_t start;
+	int i, ret = -1;
+
+	if (buf == NULL) {
+		return -1;
+	}
+	start = mg_get_current_time_ns();
+	for (i = 0; i < n; i++) {
+		memcpy(buf, request, len);
+		ret = parse_http_request(buf, (int)len, &ri);
+	}
+	*duration = mg_get_current_time_ns() - start;
+
+	/* Check the result of the last run */
+	if ((ret > 0) && ((ri.num_headers < 1) || strcmp(ri.request_method, "GET")
+	                  || strcmp(ri.http_headers[0].name, "Host"))) {
+		ret = -1;
+	}
+	mg_free(buf);
+	return ret;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	const char *names[3] = {"small", "browser", "large"};
+	const char *requests[3];
+	char *large;
+	size_t len, pos;
+	int iterations = 1000000;
+	int r, level, ret, ref_ret[3], errors = 0;
+	uint64_t duration;
+
+	if (argc > 1) {
+		iterations = atoi(argv[1]);
+	}
+	if (iterations < 1) {
+		fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+		return 2;
+	}
+
+	/* Large request: browser request with a 4 KB cookie */
+	len = strlen(browser_request);
+	large = (char *)mg_malloc(len + 4200);
+	if (large == NULL) {
+		return 2;
+	}
+	pos = len - 2;
+	memcpy(large, browser_request, pos);
+	memcpy(large + pos, "Cookie: tracking=", 17);
+	pos += 17;
+	memset(large + pos, 'x', 4096);
+	pos += 4096;
+	memcpy(large + pos, "\r\n\r\n", 5);
+
+	requests[0] = small_request;
+	requests[1] = browser_request;
+	requests[2] = large;
+
+	mg_init_library(0);
+
+	for (level = SCAN_LEVEL_SCALAR; level <= SCAN_LEVEL_AVX2; level++) {
+		if (!scan_select(level)) {
+			printf("%-7s not available\n", level_name[level]);
+			continue;
+		}
+		for (r = 0; r < 3; r++) {
+			len = strlen(requests[r]);
+			ret = bench(requests[r], len, iterations, &duration);
+			if (level == SCAN_LEVEL_SCALAR) {
+				ref_ret[r] = ret;
+			}
+			if ((ret <= 0) || (ret != ref_ret[r])) {
+				errors++;
+			}
+			printf("%-7s %-8s %5u bytes %10.0f req/s %8.1f MB/s\n",
+			       level_name[level],
+			       names[r],
+			       (unsigned)len,
+			       iterations * 1.0E9 / (double)duration,
+			       (double)len * iterations * 1.0E3 / (double)duration);
+		}
+	}
+
+	mg_exit_library();
+	mg_free(large);
+
+	if (errors) {
+		printf("%i parse errors\n", errors);
+		return 1;
+	}
+	return 0;
+}
+
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
@@ -712,6 +712,117 @@ START_TEST(test_mg_match)
 END_TEST
 
 
+/* Linear search of the handler list, as done before the routing table */
+static struct mg_handler_info *
+route_list_find(struct mg_handler_info *list,
+                int handler_type,
+                const char *uri)
+{
+	size_t urilen = strlen(uri);
+	struct mg_handler_info *rh;
+	int step, matched;
+
+	for (step = 0; step < 3; step++) {
+		for (rh = list; rh != NULL; rh = rh->next) {
+			if (rh->handler_type != handler_type) {
+				continue;
+			}
+			if (step == 0) {
+				matched = (rh->uri_len == urilen) && !strcmp(rh->uri, uri);
+			} else if (step == 1) {
+				matched = (rh->uri_len < urilen) && (uri[rh->uri_len] == '/')
+				          && !memcmp(rh->uri, uri, rh->uri_len);
+			} else {
+				matched = match_prefix(rh->uri, rh->uri_len, uri) > 0;
+			}
+			if (matched) {
+				return rh;
+			}
+		}
+	}
+	return NULL;
+}
+
+
+START_TEST(test_route_table)
+{
+	static const char *uris[] = {"/api/v1/users",
+	                             "/api",
+	                             "/api/v1",
+	                             "/API/v2",
+	                             "/api/v1/users/**",
+	                             "/static/*.js$",
+	                             "/ws",
+	                             "/api/v1/us",
+	                             "/x?z",
+	                             "**.cgi$",
+	                             "/a|/b",
+	                             "/Api",
+	                             "/",
+	                             "",
+	                             "/ws/chat",
+	                             "/api"};
+	static const char *parts[] =
+	    {"/", "api", "API", "v1", "v2", "users", "us", "x", "xyz", "ws", "chat",
+	     ".js", ".cgi", "a", "b", "static", "Api"};
+	struct mg_handler_info rh[sizeof(uris) / sizeof(uris[0])];
+	struct mg_handler_info *list = NULL, **lastref = &list;
+	struct mg_route_table *table;
+	char uri[128];
+	int i, j, n, t, num = (int)(sizeof(uris) / sizeof(uris[0]));
+
+	/* The same URI with different handler types: 0, 1, 2, 0, 1, ... */
+	memset(rh, 0, sizeof(rh));
+	for (i = 0; i < num; i++) {
+		rh[i].uri = (char *)uris[i];
+		rh[i].uri_len = strlen(uris[i]);
+		rh[i].handler_type = i % 3;
+		*lastref = &rh[i];
+		lastref = &rh[i].next;
+	}
+
+	/* Empty list */
+	table = route_table_create(NULL, NULL);
+	ck_assert_ptr_ne(table, NULL);
+	ck_assert_ptr_eq(route_table_find(table, REQUEST_HANDLER, "/", 1), NULL);
+	route_table_free(table);
+
+	table = route_table_create(NULL, list);
+	ck_assert_ptr_ne(table, NULL);
+
+	/* Registered URIs */
+	for (i = 0; i < num; i++) {
+		for (t = 0; t < 3; t++) {
+			ck_assert_ptr_eq(route_table_find(table, t, uris[i], strlen(uris[i])),
+			                 route_list_find(list, t, uris[i]));
+		}
+	}
+	ck_assert_ptr_eq(route_table_find(table, REQUEST_HANDLER, "/api/v1/users", 13),
+	                 &rh[0]);
+	ck_assert_ptr_eq(route_table_find(table, REQUEST_HANDLER, "/api/v1/users/1", 15),
+	                 &rh[0]);
+	ck_assert_ptr_eq(route_table_find(table, WEBSOCKET_HANDLER, "/api/x", 6),
+	                 &rh[1]);
+
+	/* Random URIs */
+	srand(4711);
+	for (i = 0; i < 100000; i++) {
+		uri[0] = 0;
+		n = rand() % 6;
+		for (j = 0; j < n; j++) {
+			strcat(uri, parts[rand() % (sizeof(parts) / sizeof(parts[0]))]);
+		}
+		for (t = 0; t < 3; t++) {
+			ck_assert_ptr_eq(route_table_find(table, t, uri, strlen(uri)),
+			                 route_list_find(list, t, uri));
+		}
+	}
+
+	route_table_free(table);
+}
+END_TEST
+
+
 START_TEST(test_remove_dot_segments)
 {
 	int i;
@@ -1340,6 +1451,225 @@ START_TEST(test_parse_http_headers)
 END_TEST
 
 
+/* Parse buf with the current scan_chars implementation and store the
+ * results as offsets in res */
+static int
+parse_http_request_offsets(char *buf, int len, int *res)
+{
+	struct mg_request_info ri;
+	int i, n = 0;
+
+	memset(&ri, 0, sizeof(ri));
+	res[n++] = parse_http_request(buf, len, &ri);
+	res[n++] = ri.request_method ? (int)(ri.request_method - buf) : -1;
+	res[n++] = ri.request_uri ? (int)(ri.request_uri - buf) : -1;
+	res[n++] = ri.http_version ? (int)(ri.http_version - buf) : -1;
+	res[n++] = ri.num_headers;
+	for (i = 0; i < ri.num_headers; i++) {
+		res[n++] = (int)(ri.http_headers[i].name - buf);
+		res[n++] = (int)(ri.http_headers[i].value - buf);
+	}
+	return n;
+}
+
+
+START_TEST(test_parse_http_simd)
+{
+	/* Compare the SIMD implementations of the character scanner with the
+	 * scalar one, for single scans and for the complete request parser */
+	static const char *parts[] = {"GET ",
+	                              "/a/b.html",
+	                              " HTTP/1.1",
+	                              "\r\n",
+	                              "\n",
+	                              "\r",
+	                              "Host: x",
+	                              "Accept-Encoding: gzip, br",
+	                              "a:b",
+	                              " ",
+	                              "\t",
+	                              ":",
+	                              "\x7f",
+	                              "\x80\xff",
+	                              "\x01",
+	                              "0123456789abcdefghijklmnopqrstuvwxyz"};
+	char in[512], buf[512], ref_buf[512];
+	int res[2 * MG_MAX_HEADERS + 5], ref[2 * MG_MAX_HEADERS + 5];
+	int i, j, len, cls, level, n, ref_n;
+	const char *r, *ref_r;
+
+	mg_init_library(0);
+
+	srand(1234);
+	for (i = 0; i < 5000; i++) {
+		/* Random HTTP-like input */
+		len = 0;
+		n = rand() % 40;
+		for (j = 0; j < n; j++) {
+			const char *part =
+			    parts[rand() % (int)(sizeof(parts) / sizeof(parts[0]))];
+			if ((size_t)len + strlen(part) >= sizeof(in)) {
+				break;
+			}
+			memcpy(in + len, part, strlen(part));
+			len += (int)strlen(part);
+		}
+		if (rand() % 2) {
+			memcpy(in + len, "\r\n\r\n", 4);
+			len += 4;
+		}
+
+		for (level = SCAN_LEVEL_SSE42; level <= SCAN_LEVEL_AVX2; level++) {
+			if (!scan_select(level)) {
+				continue;
+			}
+
+			/* Single scans, for all start positions */
+			for (cls = 0; cls < SCAN_CLASS_COUNT; cls++) {
+				for (j = 0; j < len; j++) {
+					r = scan_chars_impl(in + j, in + len, cls);
+					ref_r = scan_chars_scalar(in + j, in + len, cls);
+					ck_assert_ptr_eq(r, ref_r);
+				}
+			}
+
+			/* Complete request */
+			memcpy(buf, in, (size_t)len);
+			n = parse_http_request_offsets(buf, len, res);
+			scan_select(SCAN_LEVEL_SCALAR);
+			memcpy(ref_buf, in, (size_t)len);
+			ref_n = parse_http_request_offsets(ref_buf, len, ref);
+			ck_assert_int_eq(n, ref_n);
+			ck_assert(!memcmp(res, ref, (size_t)n * sizeof(int)));
+			ck_assert(!memcmp(buf, ref_buf, (size_t)len));
+		}
+	}
+
+	scan_init();
+	mg_exit_library();
+}
+END_TEST
+
+
+START_TEST(test_header_index)
+{
+	static const char *req = "GET / HTTP/1.1\r\n"
+	                         "host: localhost\r\n"
+	                         "X-Custom: 1\r\n"
+	                         "Range: bytes=1-2\r\n"
+	                         "RANGE: bytes=3-4\r\n"
+	                         "Sec-WebSocket-Key1: k1\r\n"
+	                         "Content-Length: 0\r\n"
+	                         "\r\n";
+	struct mg_connection conn;
+	char buf[256];
+	int i;
+
+	/* The name table must match the MG_HDR_* ids */
+	for (i = 0; i < MG_HDR_COUNT; i++) {
+		ck_assert_uint_eq(well_known_headers[i].len,
+		                  strlen(well_known_headers[i].name));
+		ck_assert_int_eq(get_header_name_id(well_known_headers[i].name), i);
+	}
+	ck_assert_int_eq(get_header_name_id("content-type"), MG_HDR_CONTENT_TYPE);
+	ck_assert_int_eq(get_header_name_id("Content-Typ"), -1);
+	ck_assert_int_eq(get_header_name_id("X-Custom"), -1);
+
+	memset(&conn, 0, sizeof(conn));
+	strcpy(buf, req);
+	i = parse_http_request(buf, (int)strlen(buf), &conn.request_info);
+	ck_assert_int_eq(i, (int)strlen(req));
+	conn.connection_type = CONNECTION_TYPE_REQUEST;
+
+	/* Without index: linear search */
+	ck_assert_str_eq(mg_get_header_id(&conn, MG_HDR_HOST), "localhost");
+	ck_assert_str_eq(mg_get_header_id(&conn, MG_HDR_RANGE), "bytes=1-2");
+
+	index_http_headers(&conn);
+	ck_assert_int_eq(conn.header_index_type, CONNECTION_TYPE_REQUEST);
+	for (i = 0; i < MG_HDR_COUNT; i++) {
+		/* Same result as the linear search */
+		ck_assert_ptr_eq(mg_get_header_id(&conn, i),
+		                 get_header(conn.request_info.http_headers,
+		                            conn.request_info.num_headers,
+		                            well_known_headers[i].name));
+	}
+	ck_assert_str_eq(mg_get_header_id(&conn, MG_HDR_HOST), "localhost");
+	ck_assert_str_eq(mg_get_header_id(&conn, MG_HDR_RANGE), "bytes=1-2");
+	ck_assert_str_eq(mg_get_header_id(&conn, MG_HDR_SEC_WEBSOCKET_KEY1), "k1");
+	ck_assert_ptr_eq(mg_get_header_id(&conn, MG_HDR_SEC_WEBSOCKET_KEY), NULL);
+	ck_assert_ptr_eq(mg_get_header_id(&conn, -1), NULL);
+	ck_assert_ptr_eq(mg_get_header_id(&conn, MG_HDR_COUNT), NULL);
+	ck_assert_ptr_eq(mg_get_header_id(NULL, MG_HDR_HOST), NULL);
+
+	/* mg_get_header uses the index for well-known names */
+	ck_assert_str_eq(mg_get_header(&conn, "HOST"), "localhost");
+	ck_assert_str_eq(mg_get_header(&conn, "x-custom"), "1");
+	ck_assert_ptr_eq(mg_get_header(&conn, "Origin"), NULL);
+
+	/* Other connection type: the index is not used */
+	conn.connection_type = CONNECTION_TYPE_RESPONSE;
+	ck_assert_ptr_eq(mg_get_header_id(&conn, MG_HDR_HOST), NULL);
+}
+END_TEST
+
+
+START_TEST(test_parse_accept_encoding)
+{
+	struct mg_connection conn;
+	unsigned short *q = conn.accept_encoding;
+
+	memset(&conn, 0, sizeof(conn));
+
+	parse_accept_encoding(&conn, NULL);
+	ck_assert_uint_eq(q[CONTENT_CODING_IDENTITY], 1000);
+	ck_assert_uint_eq(q[CONTENT_CODING_GZIP], 0);
+	ck_assert_uint_eq(q[CONTENT_CODING_BR], 0);
+	ck_assert_uint_eq(q[CONTENT_CODING_ZSTD], 0);
+	ck_assert_int_eq(conn.accept_gzip, 0);
+
+	parse_accept_encoding(&conn, "gzip, deflate, br, zstd");
+	ck_assert_uint_eq(q[CONTENT_CODING_GZIP], 1000);
+	ck_assert_uint_eq(q[CONTENT_CODING_BR], 1000);
+	ck_assert_uint_eq(q[CONTENT_CODING_ZSTD], 1000);
+	ck_assert_int_eq(conn.accept_gzip, 1);
+
+	/* q-values, case and white space */
+	parse_accept_encoding(&conn, "GZip;q=0.5 ,br ; Q=0.25,zstd;q=1.0");
+	ck_assert_uint_eq(q[CONTENT_CODING_GZIP], 500);
+	ck_assert_uint_eq(q[CONTENT_CODING_BR], 250);
+	ck_assert_uint_eq(q[CONTENT_CODING_ZSTD], 1000);
+
+	/* "gzip;q=0" excludes gzip, "strstr" is not enough */
+	parse_accept_encoding(&conn, "gzip;q=0, br;q=0.001");
+	ck_assert_uint_eq(q[CONTENT_CODING_GZIP], 0);
+	ck_assert_uint_eq(q[CONTENT_CODING_BR], 1);
+	ck_assert_int_eq(conn.accept_gzip, 0);
+	parse_accept_encoding(&conn, "x-gzip, gzipx");
+	ck_assert_uint_eq(q[CONTENT_CODING_GZIP], 1000);
+	parse_accept_encoding(&conn, "gzipx");
+	ck_assert_uint_eq(q[CONTENT_CODING_GZIP], 0);
+
+	/* Wildcard for all codings not listed */
+	parse_accept_encoding(&conn, "*;q=0.3, br;q=0");
+	ck_assert_uint_eq(q[CONTENT_CODING_IDENTITY], 300);
+	ck_assert_uint_eq(q[CONTENT_CODING_GZIP], 300);
+	ck_assert_uint_eq(q[CONTENT_CODING_BR], 0);
+	ck_assert_uint_eq(q[CONTENT_CODING_ZSTD], 300);
+	parse_accept_encoding(&conn, "identity;q=0.5, *;q=0");
+	ck_assert_uint_eq(q[CONTENT_CODING_IDENTITY], 500);
+	ck_assert_uint_eq(q[CONTENT_CODING_GZIP], 0);
+
+	/* Invalid input */
+	parse_accept_encoding(&conn, ";q=1, ,, br;q=x, zstd;");
+	ck_assert_uint_eq(q[CONTENT_CODING_BR], 0);
+	ck_assert_uint_eq(q[CONTENT_CODING_ZSTD], 1000);
+	parse_accept_encoding(&conn, "");
+	ck_assert_uint_eq(q[CONTENT_CODING_ZSTD], 0);
+}
+END_TEST
+
+
 START_TEST(test_encode_decode)
 {
 	char buf[128];
@@ -1608,6 +1938,10 @@ START_TEST(test_config_options)
 	ck_assert_str_eq("ssi_pattern", config_options[SSI_EXTENSIONS].name);
 	ck_assert_str_eq("throttle", config_options[THROTTLE].name);
 	ck_assert_str_eq("access_log_file", config_options[ACCESS_LOG_FILE].name);
+	ck_assert_str_eq("access_log_format",
+	                 config_options[ACCESS_LOG_FORMAT].name);
+	ck_assert_str_eq("access_log_fields",
+	                 config_options[ACCESS_LOG_FIELDS].name);
 	ck_assert_str_eq("enable_directory_listing",
 	                 config_options[ENABLE_DIRECTORY_LISTING].name);
 	ck_assert_str_eq("error_log_file", config_options[ERROR_LOG_FILE].name);
@@ -1637,9 +1971,24 @@ START_TEST(test_config_options)
 	                 config_options[REQUEST_TIMEOUT].name);
 	ck_assert_str_eq("keep_alive_timeout_ms",
 	                 config_options[KEEP_ALIVE_TIMEOUT].name);
+#if defined(__linux__)
+	ck_assert_str_eq("enable_keep_alive_parking",
+	                 config_options[ENABLE_KEEP_ALIVE_PARKING].name);
+#endif
 	ck_assert_str_eq("linger_timeout_ms", config_options[LINGER_TIMEOUT].name);
 	ck_assert_str_eq("listen_backlog",
 	                 config_options[LISTEN_BACKLOG_SIZE].name);
+	ck_assert_str_eq("connection_queue_high_water",
+	                 config_options[CONNECTION_QUEUE_HIGH_WATER].name);
+	ck_assert_str_eq("connection_overload_action",
+	                 config_options[CONNECTION_OVERLOAD_ACTION].name);
+	ck_assert_str_eq("connection_overload_retry_after",
+	                 config_options[CONNECTION_OVERLOAD_RETRY_AFTER].name);
+	ck_assert_str_eq("output_buffer_size",
+	                 config_options[OUTPUT_BUFFER_SIZE].name);
+#if defined(__linux__)
+	ck_assert_str_eq("acceptor_threads", config_options[ACCEPTOR_THREADS].name);
+#endif
 	ck_assert_str_eq("ssl_verify_peer",
 	                 config_options[SSL_DO_VERIFY_PEER].name);
 	ck_assert_str_eq("ssl_ca_path", config_options[SSL_CA_PATH].name);
@@ -1651,6 +2000,15 @@ START_TEST(test_config_options)
 	ck_assert_str_eq("ssl_protocol_version",
 	                 config_options[SSL_PROTOCOL_VERSION].name);
 	ck_assert_str_eq("ssl_short_trust", config_options[SSL_SHORT_TRUST].name);
+	ck_assert_str_eq("ssl_session_ticket_key_file",
+	                 config_options[SSL_SESSION_TICKET_KEY_FILE].name);
+#if defined(USE_TIMERS)
+	ck_assert_str_eq("ssl_session_ticket_key_rotation",
+	                 config_options[SSL_SESSION_TICKET_KEY_ROTATION].name);
+#endif
+#if defined(__linux__)
+	ck_assert_str_eq("ssl_ktls", config_options[SSL_KTLS].name);
+#endif
 
 #if defined(USE_WEBSOCKET)
 	ck_assert_str_eq("websocket_timeout_ms",
@@ -1662,6 +2020,26 @@ START_TEST(test_config_options)
 	ck_assert_str_eq("decode_url", config_options[DECODE_URL].name);
 	ck_assert_str_eq("decode_query_string",
 	                 config_options[DECODE_QUERY_STRING].name);
+	ck_assert_str_eq("static_file_stat_cache_size",
+	                 config_options[STATIC_FILE_STAT_CACHE_SIZE].name);
+	ck_assert_str_eq("static_file_stat_cache_ttl_ms",
+	                 config_options[STATIC_FILE_STAT_CACHE_TTL].name);
+	ck_assert_str_eq("static_file_memory_cache_size",
+	                 config_options[STATIC_FILE_MEMORY_CACHE_SIZE].name);
+#if defined(USE_ZLIB)
+	ck_assert_str_eq("static_file_compression_level",
+	                 config_options[STATIC_FILE_COMPRESSION_LEVEL].name);
+	ck_assert_str_eq("static_file_compression_cache_size",
+	                 config_options[STATIC_FILE_COMPRESSION_CACHE_SIZE].name);
+	ck_assert_str_eq("static_file_compression_cache_directory",
+	                 config_options[STATIC_FILE_COMPRESSION_CACHE_DIR].name);
+#endif
+	ck_assert_str_eq("access_log_buffer_size",
+	                 config_options[ACCESS_LOG_BUFFER_SIZE].name);
+	ck_assert_str_eq("access_log_flush_interval_ms",
+	                 config_options[ACCESS_LOG_FLUSH_INTERVAL].name);
+	ck_assert_str_eq("auth_file_cache_size",
+	                 config_options[AUTH_FILE_CACHE_SIZE].name);
 
 #if defined(USE_LUA)
 	ck_assert_str_eq("lua_preload_file", config_options[LUA_PRELOAD_FILE].name);
@@ -1716,6 +2094,17 @@ START_TEST(test_config_options)
 	                 config_options[LUA_BACKGROUND_SCRIPT].name);
 	ck_assert_str_eq("lua_background_script_params",
 	                 config_options[LUA_BACKGROUND_SCRIPT_PARAMS].name);
+	ck_assert_str_eq("lua_state_pool_size",
+	                 config_options[LUA_STATE_POOL_SIZE].name);
+	ck_assert_str_eq("lua_state_pool_reset",
+	                 config_options[LUA_STATE_POOL_RESET].name);
+#endif
+#if defined(USE_HTTP2)
+	ck_assert_str_eq("enable_http2", config_options[ENABLE_HTTP2].name);
+	ck_assert_str_eq("http2_stream_threads",
+	                 config_options[HTTP2_STREAM_THREADS].name);
+	ck_assert_str_eq("enable_http2_cleartext",
+	                 config_options[ENABLE_HTTP2_CLEARTEXT].name);
 #endif
 
 	ck_assert_str_eq("additional_header",
@@ -1727,6 +2116,909 @@ START_TEST(test_config_options)
 END_TEST
 
 
+START_TEST(test_file_cache)
+{
+	/* Metadata cache for static files (file_cache.inl) */
+	struct mg_context ctx;
+	struct mg_connection conn;
+	struct mg_file_stat st;
+	struct mg_file file = STRUCT_FILE_INITIALIZER;
+	const char *name = "file_cache_test.txt";
+	char path[64];
+	unsigned count;
+	FILE *f;
+	int i;
+
+	mark_point();
+	memset(&ctx, 0, sizeof(ctx));
+	memset(&conn, 0, sizeof(conn));
+	conn.phys_ctx = &ctx;
+	conn.dom_ctx = &ctx.dd;
+
+	f = fopen(name, "w");
+	ck_assert_ptr_ne(f, NULL);
+	fputs("0123456789", f);
+	fclose(f);
+
+	/* 32 entries, no expiry */
+	ctx.file_cache = mg_file_cache_create(&ctx, 32, 0);
+	ck_assert_ptr_ne(ctx.file_cache, NULL);
+
+	ck_assert_int_eq(mg_stat_cached(&conn, name, &st), 1);
+	ck_assert_uint_eq((unsigned)st.size, 10);
+	ck_assert_int_eq(mg_stat_cached(&conn, "file_cache_no_file", &st), 0);
+
+	/* The cached status is used until the entry is invalidated */
+	remove(name);
+	ck_assert_int_eq(mg_stat_cached(&conn, name, &st), 1);
+	mg_file_cache_invalidate(&ctx, name);
+	ck_assert_int_eq(mg_stat_cached(&conn, name, &st), 0);
+
+	f = fopen(name, "w");
+	ck_assert_ptr_ne(f, NULL);
+	fputs("0123456789", f);
+	fclose(f);
+	mg_file_cache_invalidate(&ctx, name);
+
+	ck_assert_int_eq(mg_fopen_cached(&conn, name, &file), 1);
+	ck_assert_uint_eq((unsigned)file.stat.size, 10);
+#if !defined(_WIN32)
+	{
+		char buf[16];
+
+		/* The descriptor of the cache entry is used ... */
+		ck_assert_ptr_eq(file.access.fp, NULL);
+		ck_assert_ptr_ne(file.access.cached, NULL);
+
+		/* ... and remains valid after the entry has been removed */
+		mg_file_cache_invalidate(&ctx, name);
+		ck_assert_int_eq(
+		    (int)pread(file.access.cached->fd, buf, sizeof(buf), 2), 8);
+		ck_assert(!memcmp(buf, "23456789", 8));
+	}
+#endif
+	ck_assert(is_file_opened(&file.access));
+	ck_assert_int_eq(mg_fclose(&file.access), 0);
+	ck_assert(!is_file_opened(&file.access));
+
+	/* Invalidating a directory removes the entries below it */
+	ck_assert_int_eq(mg_stat_cached(&conn, "file_cache_dir/a", &st), 0);
+	ck_assert_int_eq(mg_stat_cached(&conn, "file_cache_dir/b/c", &st), 0);
+	ck_assert_int_eq(mg_stat_cached(&conn, "file_cache_dirx", &st), 0);
+	mg_file_cache_invalidate(&ctx, "file_cache_dir");
+	for (i = 0; i < 3; i++) {
+		static const char *const paths[3] = {"file_cache_dir/a",
+		                                     "file_cache_dir/b/c",
+		                                     "file_cache_dirx"};
+		uint32_t hash = file_cache_hash(paths[i]);
+		struct mg_file_cache_shard *s = file_cache_shard(ctx.file_cache, hash);
+		pthread_mutex_lock(&s->mutex);
+		if (i < 2) {
+			ck_assert_ptr_eq(file_cache_find(s, hash, paths[i], 0), NULL);
+		} else {
+			ck_assert_ptr_ne(file_cache_find(s, hash, paths[i], 0), NULL);
+		}
+		pthread_mutex_unlock(&s->mutex);
+	}
+
+	/* The number of entries is limited */
+	for (i = 0; i < 200; i++) {
+		sprintf(path, "file_cache_no_file_%i", i);
+		ck_assert_int_eq(mg_stat_cached(&conn, path, &st), 0);
+	}
+	count = 0;
+	for (i = 0; i < MG_FILE_CACHE_SHARDS; i++) {
+		count += ctx.file_cache->shard[i].count;
+	}
+	ck_assert_uint_le(count, 32);
+	ck_assert_uint_gt(count, 0);
+
+	mg_file_cache_free(ctx.file_cache);
+	remove(name);
+}
+END_TEST
+
+
+START_TEST(test_memory_cache)
+{
+	/* Memory budget and invalidation of the memory cache
+	 * (memory_cache.inl) */
+	struct mg_context ctx;
+	struct mg_memory_cache_shard *s;
+	struct mg_memory_cache_entry *e;
+	char path[64];
+	unsigned long evictions = 0;
+	unsigned count = 0;
+	uint32_t hash;
+	int i;
+
+	mark_point();
+	memset(&ctx, 0, sizeof(ctx));
+
+	/* 1 kB per shard */
+	ctx.memory_cache = mg_memory_cache_create(&ctx, 1024 * MG_FILE_CACHE_SHARDS);
+	ck_assert_ptr_ne(ctx.memory_cache, NULL);
+
+	for (i = 0; i < 200; i++) {
+		sprintf(path, "/memory/cache/%i", i);
+		hash = file_cache_hash(path);
+		s = memory_cache_shard(ctx.memory_cache, hash);
+		e = (struct mg_memory_cache_entry *)mg_calloc(1,
+		                                              sizeof(*e) + strlen(path));
+		ck_assert_ptr_ne(e, NULL);
+		strcpy(e->path, path);
+		e->hash = hash;
+		e->shard = s;
+		e->mem_size = 300;
+		pthread_mutex_lock(&s->mutex);
+		memory_cache_insert(s, e);
+		ck_assert_ptr_eq(memory_cache_find(s, hash, path, NULL), e);
+		pthread_mutex_unlock(&s->mutex);
+	}
+	for (i = 0; i < MG_FILE_CACHE_SHARDS; i++) {
+		s = &ctx.memory_cache->shard[i];
+		ck_assert_uint_le(s->mem_size, s->max_mem_size);
+		ck_assert_uint_eq(s->mem_size, s->count * 300);
+		count += s->count;
+		evictions += s->evictions;
+	}
+	ck_assert_uint_eq(count + evictions, 200);
+
+	/* The most recently added entry is still there */
+	hash = file_cache_hash(path);
+	s = memory_cache_shard(ctx.memory_cache, hash);
+	ck_assert_ptr_ne(memory_cache_find(s, hash, path, NULL), NULL);
+	mg_memory_cache_invalidate(&ctx, path);
+	ck_assert_ptr_eq(memory_cache_find(s, hash, path, NULL), NULL);
+
+	/* Invalidating a directory removes all entries below it */
+	mg_memory_cache_invalidate(&ctx, "/memory/cache");
+	for (i = 0; i < MG_FILE_CACHE_SHARDS; i++) {
+		ck_assert_uint_eq(ctx.memory_cache->shard[i].count, 0);
+		ck_assert_uint_eq(ctx.memory_cache->shard[i].mem_size, 0);
+	}
+
+	mg_memory_cache_free(ctx.memory_cache);
+}
+END_TEST
+
+
+START_TEST(test_request_arena)
+{
+	/* Per-request arena (mg_request_alloc) */
+	struct mg_context ctx;
+	struct mg_connection conn;
+	struct mg_arena_block *kept;
+	char *p[64], *big;
+	size_t used = 0;
+	int i;
+
+	mark_point();
+	memset(&ctx, 0, sizeof(ctx));
+	memset(&conn, 0, sizeof(conn));
+	conn.phys_ctx = &ctx;
+
+	ck_assert_ptr_eq(mg_request_alloc(NULL, 10), NULL);
+	ck_assert_ptr_eq(mg_request_alloc(&conn, (size_t)-1), NULL);
+
+	/* Small allocations: aligned, not overlapping, several blocks */
+	for (i = 0; i < 64; i++) {
+		p[i] = (char *)mg_request_alloc(&conn, (size_t)(i * 3 + 1));
+		ck_assert_ptr_ne(p[i], NULL);
+		ck_assert_uint_eq(((uintptr_t)p[i]) % sizeof(void *), 0);
+		memset(p[i], i, (size_t)(i * 3 + 1));
+		used += ARENA_ROUND_UP((size_t)(i * 3 + 1));
+	}
+	for (i = 0; i < 64; i++) {
+		ck_assert_int_eq(p[i][0], i);
+		ck_assert_int_eq(p[i][i * 3], i);
+	}
+	ck_assert_uint_eq(conn.arena_used, used);
+
+	/* A large allocation does not replace the current block */
+	kept = conn.arena;
+	big = (char *)mg_request_alloc(&conn, 3 * MG_REQUEST_ARENA_BLOCK_SIZE);
+	ck_assert_ptr_ne(big, NULL);
+	memset(big, 0xAA, 3 * MG_REQUEST_ARENA_BLOCK_SIZE);
+	ck_assert_ptr_eq(conn.arena, kept);
+	ck_assert_ptr_eq(mg_request_alloc(&conn, 8), ((char *)p[63]) + 192);
+
+	/* Reset: one standard block is kept and reused */
+	request_arena_reset(&conn);
+	ck_assert_uint_eq(conn.arena_used, 0);
+	ck_assert_ptr_ne(conn.arena, NULL);
+	ck_assert_ptr_eq(conn.arena->next, NULL);
+	ck_assert_uint_eq(conn.arena->size, MG_REQUEST_ARENA_BLOCK_SIZE);
+	ck_assert_ptr_eq(request_arena_strndup(&conn, "abcdef", 3),
+	                 ((char *)conn.arena) + ARENA_HEADER_SIZE);
+	ck_assert_str_eq(((char *)conn.arena) + ARENA_HEADER_SIZE, "abc");
+
+	request_arena_free(&conn);
+	ck_assert_ptr_eq(conn.arena, NULL);
+}
+END_TEST
+
+
+START_TEST(test_access_log_format)
+{
+	/* JSON and binary access log formats (access_log.inl) */
+	struct mg_context ctx;
+	struct mg_domain_context dom;
+	struct mg_connection conn;
+	char buf[256];
+	char *p;
+	size_t len;
+
+	mark_point();
+	memset(&ctx, 0, sizeof(ctx));
+	memset(&dom, 0, sizeof(dom));
+	memset(&conn, 0, sizeof(conn));
+	conn.phys_ctx = &ctx;
+	conn.dom_ctx = &dom;
+	conn.connection_type = CONNECTION_TYPE_REQUEST;
+	conn.request_info.request_method = "GET";
+	conn.request_info.request_uri = "/a\"b";
+	conn.request_info.http_version = "1.1";
+	conn.request_info.num_headers = 1;
+	conn.request_info.http_headers[0].name = "User-Agent";
+	conn.request_info.http_headers[0].value = "x\ty";
+	conn.status_code = 200;
+	conn.num_bytes_sent = 1234;
+	conn.handler_name = "file";
+
+	/* Invalid options */
+	dom.config[ACCESS_LOG_FORMAT] = "xml";
+	ck_assert_int_eq(access_log_parse_format(&dom), ACCESS_LOG_FORMAT);
+	dom.config[ACCESS_LOG_FORMAT] = "json";
+	dom.config[ACCESS_LOG_FIELDS] = "status,nope";
+	ck_assert_int_eq(access_log_parse_format(&dom), ACCESS_LOG_FIELDS);
+
+	/* JSON: strings are escaped, missing values are null */
+	dom.config[ACCESS_LOG_FIELDS] =
+	    "method,uri,status,bytes_sent,remote_user,user_agent,handler";
+	ck_assert_int_eq(access_log_parse_format(&dom), -1);
+	ck_assert_int_eq(dom.access_log_format, ACCESS_LOG_FORMAT_JSON);
+	ck_assert_uint_eq(dom.access_log_num_fields, 7);
+	len = access_log_format_json(&conn, buf, sizeof(buf));
+	ck_assert_str_eq(buf,
+	                 "{\"method\":\"GET\",\"uri\":\"/a\\\"b\",\"status\":200,"
+	                 "\"bytes_sent\":1234,\"remote_user\":null,"
+	                 "\"user_agent\":\"x\\u0009y\",\"handler\":\"file\"}");
+	ck_assert_uint_eq(len, strlen(buf));
+
+	/* Fields not fitting into the buffer are omitted */
+	len = access_log_format_json(&conn, buf, 40);
+	ck_assert_str_eq(buf, "{\"method\":\"GET\"}");
+	ck_assert_uint_eq(len, 16);
+
+	/* DEL and invalid UTF-8 are escaped, valid UTF-8 is copied */
+	p = access_log_json_str(buf,
+	                        buf + sizeof(buf),
+	                        "\x7f\xc3\xa4\xc3(\xe2\x82\xac"
+	                        "\xed\xa0\x80\xc0\xaf\xf0\x9f\x98\x80\xff");
+	*p = 0;
+	ck_assert_str_eq(buf,
+	                 "\"\\u007f\xc3\xa4\\u00c3(\xe2\x82\xac"
+	                 "\\u00ed\\u00a0\\u0080\\u00c0\\u00af"
+	                 "\xf0\x9f\x98\x80\\u00ff\"");
+
+	/* A multi byte character is not split when truncating */
+	p = access_log_json_str(buf, buf + 5, "ab\xe2\x82\xac");
+	*p = 0;
+	ck_assert_str_eq(buf, "\"ab\"");
+
+	/* Binary: length, then id and value of every field */
+	dom.config[ACCESS_LOG_FORMAT] = "binary";
+	dom.config[ACCESS_LOG_FIELDS] = "status,method,remote_user";
+	ck_assert_int_eq(access_log_parse_format(&dom), -1);
+	len = access_log_format_binary(&conn, buf, sizeof(buf));
+	ck_assert_uint_eq(len, 22);
+	ck_assert(!memcmp(buf,
+	                  "\0\0\0\x12"
+	                  "\x08\0\0\0\0\0\0\0\xc8"
+	                  "\x04\0\x03GET"
+	                  "\x02\0\0",
+	                  22));
+
+	/* Binary: a text line (Lua log()) is a record with one string field */
+	strcpy(buf, "lua");
+	len = access_log_format_binary_text(buf, sizeof(buf));
+	ck_assert_uint_eq(len, 10);
+	ck_assert(!memcmp(buf, "\0\0\0\x06\xff\0\x03lua", 10));
+
+	/* Default: NCSA text format */
+	dom.config[ACCESS_LOG_FORMAT] = NULL;
+	ck_assert_int_eq(access_log_parse_format(&dom), -1);
+	ck_assert_int_eq(dom.access_log_format, ACCESS_LOG_FORMAT_NCSA);
+}
+END_TEST
+
+
+#if defined(ACCESS_LOG_ASYNC)
+START_TEST(test_access_log)
+{
+	/* Ring buffer of the asynchronous access log (access_log.inl) */
+	struct mg_context ctx;
+	struct mg_domain_context dom;
+	struct mg_access_log al;
+	struct access_log_ring ring;
+	char line[1000], path[64], rd[1100];
+	FILE *fp;
+	int i, stored, lines;
+
+	mark_point();
+	memset(&ctx, 0, sizeof(ctx));
+	memset(&dom, 0, sizeof(dom));
+	memset(&al, 0, sizeof(al));
+	memset(&ring, 0, sizeof(ring));
+	sprintf(path, "access_log_test_%i.log", (int)getpid());
+	(void)remove(path);
+	dom.config[ACCESS_LOG_FILE] = path;
+	ring.buf = (char *)mg_malloc(ACCESS_LOG_MIN_RING_SIZE);
+	ck_assert_ptr_ne(ring.buf, NULL);
+	al.rings = &ring;
+	al.num_rings = 1;
+	al.size = ACCESS_LOG_MIN_RING_SIZE;
+	ck_assert_int_eq(pthread_mutex_init(&al.mutex, NULL), 0);
+	ck_assert_int_eq(pthread_cond_init(&al.cond, NULL), 0);
+
+	/* Fill the ring without a writer: lines are dropped, not blocked */
+	memset(line, 'S', sizeof(line));
+	line[99] = '\n';
+	ck_assert(access_log_push(&al, &ring, &dom, line, 100));
+	for (i = 0; i < 20; i++) {
+		memset(line, 'a' + i, sizeof(line));
+		line[sizeof(line) - 1] = '\n';
+		if (!access_log_push(&al, &ring, &dom, line, sizeof(line))) {
+			break;
+		}
+	}
+	stored = i;
+	ck_assert_int_eq(stored,
+	                 (int)((ACCESS_LOG_MIN_RING_SIZE - ACCESS_LOG_REC_SIZE(100))
+	                       / ACCESS_LOG_REC_SIZE(sizeof(line))));
+	ck_assert_uint_eq(ring.dropped, 1);
+	ck_assert_int_eq(al.wakeup, 1);
+
+	/* Drain and add more lines: the next record wraps around the end */
+	access_log_drain(&al, &ctx, &ring);
+	ck_assert_uint_eq(ring.head, ring.tail);
+	for (i = 0; i < 3; i++) {
+		memset(line, 'A' + i, sizeof(line));
+		line[sizeof(line) - 1] = '\n';
+		ck_assert(access_log_push(&al, &ring, &dom, line, sizeof(line)));
+	}
+	ck_assert_uint_lt(ring.head & (al.size - 1), 4 * sizeof(line));
+	access_log_drain(&al, &ctx, &ring);
+	ck_assert_uint_eq(ring.head, ring.tail);
+	ck_assert_uint_eq(al.lines, (unsigned long)(stored + 4));
+	access_log_close_files(&al, 1);
+	ck_assert_ptr_eq(al.files, NULL);
+
+	/* All lines are in the file, in the right order */
+	fp = fopen(path, "r");
+	ck_assert_ptr_ne(fp, NULL);
+	lines = 0;
+	while (fgets(rd, sizeof(rd), fp) != NULL) {
+		if (lines == 0) {
+			ck_assert_uint_eq(strlen(rd), 100);
+			ck_assert_int_eq(rd[98], 'S');
+		} else if (lines <= stored) {
+			ck_assert_uint_eq(strlen(rd), sizeof(line));
+			ck_assert_int_eq(rd[sizeof(line) - 2], 'a' + lines - 1);
+		} else {
+			ck_assert_uint_eq(strlen(rd), sizeof(line));
+			ck_assert_int_eq(rd[0], 'A' + lines - stored - 1);
+		}
+		lines++;
+	}
+	fclose(fp);
+	ck_assert_int_eq(lines, stored + 4);
+	(void)remove(path);
+
+	pthread_cond_destroy(&al.cond);
+	pthread_mutex_destroy(&al.mutex);
+	mg_free(ring.buf);
+}
+END_TEST
+#endif
+
+
+/* Authorize with read_auth_file (without cache), for comparison */
+static int
+auth_read_file(struct mg_connection *conn,
+               const char *path,
+               const struct auth_header *ah)
+{
+	struct read_auth_file_struct workdata;
+	struct mg_file file = STRUCT_FILE_INITIALIZER;
+	int ret;
+
+	memset(&workdata, 0, sizeof(workdata));
+	workdata.conn = conn;
+	workdata.auth_header = *ah;
+	workdata.domain = "r";
+	if (!mg_fopen(conn, path, MG_FOPEN_MODE_READ, &file)) {
+		return -1;
+	}
+	ret = read_auth_file(&file, &workdata, INITIAL_DEPTH);
+	(void)mg_fclose(&file.access);
+	return ret;
+}
+
+
+/* Authorize against the passwords file path using the cache, for realm
+ * "r". Return -1 if the file cannot be loaded or does not exist. */
+static int
+auth_cache_check(struct mg_connection *conn,
+                 const char *path,
+                 const struct auth_header *ah)
+{
+	struct mg_auth_db *db = auth_cache_acquire(conn, path);
+	int ret;
+
+	if (db == NULL) {
+		return -1;
+	}
+	ret = db->missing ? -1 : auth_db_authorize(conn, db, ah, "r");
+	auth_db_release(db);
+	return ret;
+}
+
+
+START_TEST(test_auth_cache)
+{
+	/* Cache for parsed passwords files (auth_cache.inl) */
+	static const char *cases[][3] = {{"u", "pw1", "1"},
+	                                 {"u", "pw2", "0"},
+	                                 {"u", "pw3", "0"},
+	                                 {"v", "pwv", "1"},
+	                                 {"v", "pw1", "0"},
+	                                 {"w", "pw1", "0"}};
+	struct mg_context ctx;
+	struct mg_connection conn;
+	struct auth_header ah;
+	char f1[64], f2[64], f3[64], h[4][33];
+	FILE *fp;
+	int i;
+
+	mark_point();
+	memset(&ctx, 0, sizeof(ctx));
+	memset(&conn, 0, sizeof(conn));
+	conn.phys_ctx = &ctx;
+	ctx.auth_cache = mg_auth_cache_create(&ctx, 2);
+	ck_assert_ptr_ne(ctx.auth_cache, NULL);
+
+	sprintf(f1, "auth_cache_test_%i_1.txt", (int)getpid());
+	sprintf(f2, "auth_cache_test_%i_2.txt", (int)getpid());
+	sprintf(f3, "auth_cache_test_%i_3.txt", (int)getpid());
+	mg_md5(h[0], "u", ":r:", "pw1", NULL);
+	mg_md5(h[1], "u", ":r:", "pw2", NULL);
+	mg_md5(h[2], "u", ":r:", "pw3", NULL);
+	mg_md5(h[3], "v", ":r:", "pwv", NULL);
+
+	/* The first line for a user ends the search in a file, so pw2 and the
+	 * line in the included file are never used */
+	fp = fopen(f1, "w");
+	ck_assert_ptr_ne(fp, NULL);
+	fprintf(fp, ":# test\nu:r:%s\nu:r:%s\n:include=%s\n", h[0], h[1], f2);
+	fclose(fp);
+	fp = fopen(f2, "w");
+	ck_assert_ptr_ne(fp, NULL);
+	fprintf(fp, "u:x:%s\nu:r:%s\nv:r:%s\n", h[2], h[2], h[3]);
+	fclose(fp);
+
+	memset(&ah, 0, sizeof(ah));
+	ah.type = 1;
+	for (i = 0; i < (int)(sizeof(cases) / sizeof(cases[0])); i++) {
+		ah.user = (char *)cases[i][0];
+		ah.plain_password = (char *)cases[i][1];
+		ck_assert_int_eq(auth_read_file(&conn, f1, &ah), atoi(cases[i][2]));
+		ck_assert_int_eq(auth_cache_check(&conn, f1, &ah), atoi(cases[i][2]));
+	}
+	ck_assert_uint_eq(ctx.auth_cache->count, 1);
+	ck_assert_uint_eq(ctx.auth_cache->lru.lru_next->num_files, 2);
+
+	/* Lines before an include are not shadowed by the included file */
+	ah.user = (char *)"u";
+	ah.plain_password = (char *)"pw3";
+	ck_assert_int_eq(auth_cache_check(&conn, f2, &ah), 1);
+	ck_assert_uint_eq(ctx.auth_cache->count, 2);
+
+	/* Changes by mg_modify_passwords_file are visible at once */
+	(void)remove(f3);
+	ck_assert_int_eq(mg_modify_passwords_file(f3, "r", "u", "aa"), 1);
+	ah.plain_password = (char *)"aa";
+	ck_assert_int_eq(auth_cache_check(&conn, f3, &ah), 1);
+	ck_assert_int_eq(mg_modify_passwords_file(f3, "r", "u", "bb"), 1);
+	ck_assert_int_eq(auth_cache_check(&conn, f3, &ah), 0);
+	ah.plain_password = (char *)"bb";
+	ck_assert_int_eq(auth_cache_check(&conn, f3, &ah), 1);
+
+	/* Least recently used file removed */
+	ck_assert_uint_eq(ctx.auth_cache->count, 2);
+	ck_assert_ptr_eq(auth_cache_find(ctx.auth_cache,
+	                                 f1,
+	                                 auth_cache_hash(f1, NULL)),
+	                 NULL);
+
+	/* Other changes are detected by the next status check */
+	(void)remove(f3);
+	ck_assert_int_eq(auth_cache_check(&conn, f3, &ah), 1);
+	ctx.auth_cache->lru.lru_next->next_check = 0;
+	ctx.auth_cache->check_interval = 0;
+
+	/* Missing files are cached as well, until they are created */
+	ck_assert_int_eq(auth_cache_check(&conn, f3, &ah), -1);
+	ck_assert_uint_eq(ctx.auth_cache->count, 2);
+	ck_assert_int_eq(ctx.auth_cache->lru.lru_next->missing, 1);
+	ck_assert_int_eq(auth_cache_check(&conn, f3, &ah), -1);
+	ck_assert_int_eq(ctx.auth_cache->lru.lru_next->missing, 1);
+	fp = fopen(f3, "w");
+	ck_assert_ptr_ne(fp, NULL);
+	mg_md5(h[1], "u", ":r:", "bb", NULL);
+	fprintf(fp, "u:r:%s\n", h[1]);
+	fclose(fp);
+	ck_assert_int_eq(auth_cache_check(&conn, f3, &ah), 1);
+	ck_assert_int_eq(ctx.auth_cache->lru.lru_next->missing, 0);
+	(void)remove(f3);
+
+	/* Changed included file */
+	ah.user = (char *)"v";
+	ah.plain_password = (char *)"pw1";
+	ck_assert_int_eq(auth_cache_check(&conn, f1, &ah), 0);
+	fp = fopen(f2, "w");
+	ck_assert_ptr_ne(fp, NULL);
+	mg_md5(h[2], "v", ":r:", "pw1", NULL);
+	fprintf(fp, "v:r:%s\n", h[2]);
+	fclose(fp);
+	ck_assert_int_eq(auth_cache_check(&conn, f1, &ah), 1);
+	ck_assert_uint_eq(ctx.auth_cache->count, 2);
+	ck_assert_int_eq((int)ctx.auth_cache->lru.lru_next->refs, 1);
+
+	(void)remove(f1);
+	(void)remove(f2);
+	mg_auth_cache_free(ctx.auth_cache);
+}
+END_TEST
+
+
+/* Check an address against the access control list like check_acl did
+ * before the list has been compiled */
+static int
+acl_check_list(const char *list, const union usa *sa)
+{
+	struct vec vec;
+	int allowed = '-', flag, matched;
+
+	while ((list = next_option(list, &vec, NULL)) != NULL) {
+		flag = vec.ptr[0];
+		vec.ptr++;
+		vec.len--;
+		matched = parse_match_net(&vec, sa, 1);
+		ck_assert_int_ge(matched, 0);
+		if (matched) {
+			allowed = flag;
+		}
+	}
+	return allowed == '+';
+}
+
+
+START_TEST(test_acl)
+{
+	/* Compiled access_control_list (acl.inl) */
+	static const char *lists[] = {
+	    "+192.168.0.0/16",
+	    "-0.0.0.0/0,+10.0.0.0/8,-10.1.0.0/16,+10.1.2.3",
+	    "+10.0.0.0/8,-0.0.0.0/0",
+	    "+10.1.0.0/16,-10.0.0.0/8,+10.1.0.0/16,-10.1.2.0/24",
+	    "+10.1.2.3/8,+1.2.3.4/32",
+#if defined(USE_IPV6)
+	    "+::/0,-10.0.0.0/8,-[fe80::]/10,+fe80::1:0/112,+[::1]",
+#endif
+	    ""};
+	static const uint8_t octets[] = {0, 1, 2, 3, 10, 127, 168, 192, 254, 255};
+	struct mg_context ctx;
+	struct mg_acl *acl;
+	union usa sa;
+	uint32_t ip;
+	int i, j, k, error;
+
+	mark_point();
+	memset(&ctx, 0, sizeof(ctx));
+
+	ck_assert_ptr_eq(acl_create(&ctx, NULL, &error), NULL);
+	ck_assert_int_eq(error, 0);
+	ck_assert_ptr_eq(acl_create(&ctx, "+1.2.3.4,1.2.3.5", &error), NULL);
+	ck_assert_int_eq(error, -2);
+	ck_assert_ptr_eq(acl_create(&ctx, "+1.2.3.256", &error), NULL);
+	ck_assert_int_eq(error, -2);
+	ck_assert_ptr_eq(acl_create(&ctx, "+1.2.3.4/33", &error), NULL);
+	ck_assert_int_eq(error, -2);
+
+	for (i = 0; i < (int)(sizeof(lists) / sizeof(lists[0])); i++) {
+		acl = acl_create(&ctx, lists[i], &error);
+		ck_assert_int_eq(error, 0);
+		ck_assert_ptr_ne(acl, NULL);
+
+		/* Compare with the list for many different addresses */
+		memset(&sa, 0, sizeof(sa));
+		sa.sin.sin_family = AF_INET;
+		for (j = 0; j < 10000; j++) {
+			ip = 0;
+			for (k = 0; k < 4; k++) {
+				ip = (ip << 8) | octets[(j * 7 + k * j / 3 + k) % 10];
+			}
+			sa.sin.sin_addr.s_addr = htonl(ip);
+			ck_assert_int_eq(acl_match(acl, &sa), acl_check_list(lists[i], &sa));
+		}
+		sa.sin.sin_addr.s_addr = htonl(0x0A010203u); /* 10.1.2.3 */
+		ck_assert_int_eq(acl_match(acl, &sa), acl_check_list(lists[i], &sa));
+#if defined(USE_IPV6)
+		memset(&sa, 0, sizeof(sa));
+		sa.sin6.sin6_family = AF_INET6;
+		for (j = 0; j < 1000; j++) {
+			sa.sin6.sin6_addr.s6_addr[0] = (j & 1) ? 0xFE : 0;
+			sa.sin6.sin6_addr.s6_addr[1] = (j & 2) ? 0x80 : 0xC0;
+			sa.sin6.sin6_addr.s6_addr[13] = (uint8_t)((j >> 2) & 1);
+			sa.sin6.sin6_addr.s6_addr[15] = (uint8_t)(j >> 3);
+			ck_assert_int_eq(acl_match(acl, &sa), acl_check_list(lists[i], &sa));
+		}
+#endif
+		acl_free(acl);
+	}
+
+	/* Runtime update */
+	ctx.context_type = CONTEXT_SERVER;
+	ck_assert_int_eq(pthread_mutex_init(&ctx.nonce_mutex, NULL), 0);
+	memset(&sa, 0, sizeof(sa));
+	sa.sin.sin_family = AF_INET;
+	sa.sin.sin_addr.s_addr = htonl(0x7F000001u); /* 127.0.0.1 */
+	ck_assert_int_eq(check_acl(&ctx, &sa), 1);
+	ck_assert_int_eq(mg_set_access_control_list(&ctx, "-127.0.0.0/8"), 0);
+	ck_assert_int_eq(check_acl(&ctx, &sa), 0);
+	ck_assert_int_eq(mg_set_access_control_list(&ctx, "+127.0.0.1,x"), -2);
+	ck_assert_int_eq(check_acl(&ctx, &sa), 0);
+	ck_assert_int_eq(mg_set_access_control_list(&ctx, "+127.0.0.1"), 0);
+	ck_assert_int_eq(check_acl(&ctx, &sa), 1);
+	ck_assert_int_eq(mg_set_access_control_list(&ctx, NULL), 0);
+	ck_assert_int_eq(check_acl(&ctx, &sa), 1);
+	ck_assert_int_eq(mg_set_access_control_list(NULL, NULL), -1);
+	acl_free(ctx.acl[0]);
+	acl_free(ctx.acl[1]);
+	pthread_mutex_destroy(&ctx.nonce_mutex);
+}
+END_TEST
+
+
+#if defined(USE_HTTP2)
+START_TEST(test_hpack)
+{
+	/* HPACK (http2.inl), examples from RFC 7541, appendix C */
+	static const uint8_t huff_www[] = {0xf1, 0xe3, 0xc2, 0xe5, 0xf2, 0x3a,
+	                                   0x6b, 0xa0, 0xab, 0x90, 0xf4, 0xff};
+	static const uint8_t huff_key[] =
+	    {0x25, 0xa8, 0x49, 0xe9, 0x5b, 0xa9, 0x7d, 0x7f};
+	static const uint8_t num_1337[] = {0x1f, 0x9a, 0x0a};
+	struct mg_context ctx;
+	struct mg_hpack_table table;
+	const struct mg_hpack_entry *e;
+	uint8_t buf[1024];
+	char str[512], *dec;
+	uint64_t num;
+	int i, n, pos;
+
+	mark_point();
+	memset(&ctx, 0, sizeof(ctx));
+	hpack_init();
+
+	/* Huffman coding */
+	ck_assert_int_eq((int)hpack_huff_len("www.example.com", 15), 12);
+	ck_assert_int_eq((int)hpack_huff_encode(buf, "www.example.com", 15), 12);
+	ck_assert(!memcmp(buf, huff_www, sizeof(huff_www)));
+	ck_assert_int_eq(hpack_huff_decode(str, huff_www, 12), 15);
+	ck_assert(!memcmp(str, "www.example.com", 15));
+	ck_assert_int_eq((int)hpack_huff_encode(buf, "custom-key", 10), 8);
+	ck_assert(!memcmp(buf, huff_key, sizeof(huff_key)));
+	ck_assert_int_eq(hpack_huff_decode(str, huff_key, 8), 10);
+	ck_assert(!memcmp(str, "custom-key", 10));
+	for (i = 0; i < 256; i++) {
+		str[i] = (char)(255 - i);
+	}
+	n = (int)hpack_huff_encode(buf, str, 256);
+	ck_assert_int_eq(n, (int)hpack_huff_len(str, 256));
+	ck_assert_int_eq(hpack_huff_decode(str + 256, buf, n), 256);
+	ck_assert(!memcmp(str, str + 256, 256));
+
+	/* Padding must be all ones and shorter than 8 bits, EOS is invalid */
+	buf[0] = 0x1f; /* 'a' */
+	ck_assert_int_eq(hpack_huff_decode(str, buf, 1), 1);
+	ck_assert_int_eq(str[0], 'a');
+	buf[0] = 0x18;
+	ck_assert_int_eq(hpack_huff_decode(str, buf, 1), -1);
+	buf[1] = 0xff;
+	buf[0] = 0x1f;
+	ck_assert_int_eq(hpack_huff_decode(str, buf + 1, 1), -1);
+	memset(buf, 0xff, 4);
+	ck_assert_int_eq(hpack_huff_decode(str, buf, 4), -1);
+
+	/* Integers */
+	ck_assert_int_eq(hpack_putnum(buf, 0, 0x1f, 10), 1);
+	ck_assert_int_eq(buf[0], 10);
+	ck_assert_int_eq(hpack_putnum(buf, 0xe0, 0x1f, 1337), 3);
+	ck_assert_int_eq(buf[0], 0xff);
+	ck_assert(!memcmp(buf + 1, num_1337 + 1, 2));
+	pos = 0;
+	ck_assert_int_eq(hpack_getnum(num_1337, &pos, 3, 0x1f, &num), 0);
+	ck_assert_int_eq((int)num, 1337);
+	ck_assert_int_eq(pos, 3);
+	pos = 0;
+	ck_assert_int_eq(hpack_getnum(num_1337, &pos, 2, 0x1f, &num), -1);
+	memset(buf, 0xff, 8);
+	pos = 0;
+	ck_assert_int_eq(hpack_getnum(buf, &pos, 8, 0x7f, &num), -1);
+
+	/* Strings: Huffman encoded only if shorter */
+	n = hpack_put_string(buf, "www.example.com", 15);
+	ck_assert_int_eq(n, 13);
+	ck_assert_int_eq(buf[0], 0x8c);
+	n += hpack_put_string(buf + n, "\x01\x02", 2);
+	ck_assert_int_eq(n, 16);
+	ck_assert_int_eq(buf[13], 0x02);
+	pos = 0;
+	dec = hpack_decode(buf, &pos, n, &ctx);
+	ck_assert_str_eq(dec, "www.example.com");
+	ck_assert_int_eq(pos, 13);
+	mg_free(dec);
+	dec = hpack_decode(buf, &pos, n, &ctx);
+	ck_assert_str_eq(dec, "\x01\x02");
+	ck_assert_int_eq(pos, 16);
+	mg_free(dec);
+	pos = 0;
+	ck_assert_ptr_eq(hpack_decode(buf, &pos, 12, &ctx), NULL);
+
+	/* Dynamic table: entry size is name + value + 32 (RFC 7541, 4.1) */
+	memset(&table, 0, sizeof(table));
+	table.max_size = 100;
+	ck_assert(
+	    hpack_table_add(&table, "custom-key", 10, "custom-hdr", 10, &ctx));
+	ck_assert_int_eq((int)table.size, 52);
+	ck_assert(hpack_table_add(&table, "a", 1, "b", 1, &ctx));
+	ck_assert_int_eq((int)table.size, 86);
+	ck_assert(hpack_table_add(&table, "c", 1, "d", 1, &ctx));
+	ck_assert_int_eq((int)table.size, 68);
+	ck_assert_uint_eq(table.count, 2);
+	e = hpack_table_get(&table, 62);
+	ck_assert_ptr_ne(e, NULL);
+	ck_assert_str_eq(e->name, "c");
+	ck_assert_str_eq(e->value, "d");
+	e = hpack_table_get(&table, 63);
+	ck_assert_ptr_ne(e, NULL);
+	ck_assert_str_eq(e->name, "a");
+	ck_assert_ptr_eq(hpack_table_get(&table, 64), NULL);
+	ck_assert_ptr_eq(hpack_table_get(&table, 61), NULL);
+	hpack_table_resize(&table, 40);
+	ck_assert_uint_eq(table.count, 1);
+	ck_assert_str_eq(hpack_table_get(&table, 62)->name, "c");
+	ck_assert(
+	    hpack_table_add(&table, "custom-key", 10, "custom-hdr", 10, &ctx));
+	ck_assert_uint_eq(table.count, 0);
+	ck_assert_int_eq((int)table.size, 0);
+
+	/* Encoder: indexed, incremental indexing and never indexed fields */
+	table.max_size = HTTP2_HEADER_TABLE_SIZE;
+	ck_assert_int_eq(hpack_encode_field(&table, buf, ":status", "200", &ctx),
+	                 1);
+	ck_assert_int_eq(buf[0], 0x88);
+	n = hpack_encode_field(&table, buf, "content-type", "text/plain", &ctx);
+	ck_assert_int_eq(buf[0], 0x5f); /* 0x40 + 31 */
+	ck_assert_int_eq(buf[1] & 0x80, 0x80);
+	ck_assert_uint_eq(table.count, 1);
+	ck_assert_int_eq(hpack_encode_field(&table,
+	                                    buf + n,
+	                                    "content-type",
+	                                    "text/plain",
+	                                    &ctx),
+	                 1);
+	ck_assert_int_eq(buf[n], 0xbe);
+	n = hpack_encode_field(&table, buf, "x-custom", "1", &ctx);
+	ck_assert_int_eq(buf[0], 0x40);
+	ck_assert_uint_eq(table.count, 2);
+	ck_assert_int_eq(hpack_encode_field(&table, buf, "x-custom", "2", &ctx),
+	                 3);
+	ck_assert_int_eq(buf[0], 0x7e); /* name of entry 62 */
+	ck_assert_int_eq(buf[1], 0x01);
+	ck_assert_uint_eq(table.count, 3);
+	hpack_encode_field(&table, buf, "set-cookie", "id=1", &ctx);
+	ck_assert_int_eq(buf[0], 0x1f);
+	ck_assert_int_eq(buf[1], 0x28); /* 55 - 15 */
+	ck_assert_uint_eq(table.count, 3);
+	hpack_encode_field(&table, buf, "content-length", "12", &ctx);
+	ck_assert_int_eq(buf[0], 0x0f);
+	ck_assert_int_eq(buf[1], 0x0d); /* 28 - 15 */
+	ck_assert_uint_eq(table.count, 3);
+	hpack_encode_field(&table,
+	                   buf,
+	                   "date",
+	                   "Sun, 18 Oct 2026 10:00:00 GMT",
+	                   &ctx);
+	ck_assert_int_eq(buf[0], 0x0f);
+	ck_assert_int_eq(buf[1], 0x12); /* 33 - 15 */
+	ck_assert_uint_eq(table.count, 3);
+	hpack_table_evict(&table, 0);
+	ck_assert_uint_eq(table.count, 0);
+}
+END_TEST
+#endif
+
+
+#if !defined(_WIN32)
+START_TEST(test_output_buffer)
+{
+	/* Output buffer (output_buffer_size), using a socket pair */
+	static const char *head = "HTTP/1.1 200 OK\r\nX: 1\r\n\r\n";
+	struct mg_context ctx;
+	struct mg_connection conn;
+	char out_buf[64], body[300], expected[400], received[400];
+	int sv[2], i, n, len, expected_len;
+
+	mark_point();
+	memset(&ctx, 0, sizeof(ctx));
+	memset(&conn, 0, sizeof(conn));
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+	conn.phys_ctx = &ctx;
+	conn.client.sock = sv[0];
+	conn.out_buf = out_buf;
+	conn.out_buf_size = (int)sizeof(out_buf);
+	conn.out_buffering = 1;
+
+	for (i = 0; i < (int)sizeof(body); i++) {
+		body[i] = (char)('a' + i % 26);
+	}
+	expected_len = (int)strlen(head);
+	memcpy(expected, head, (size_t)expected_len);
+	memcpy(expected + expected_len, body, sizeof(body));
+	expected_len += (int)sizeof(body);
+	memcpy(expected + expected_len, "end", 3);
+	expected_len += 3;
+
+	/* Small writes are collected */
+	ck_assert_int_eq(mg_printf(&conn, "HTTP/1.1 200 OK\r\n"), 17);
+	ck_assert_int_eq(mg_write(&conn, "X: 1\r\n\r\n", 8), 8);
+	ck_assert_int_eq(conn.out_len, 25);
+	ck_assert_int_eq((int)recv(sv[1], received, sizeof(received), MSG_DONTWAIT),
+	                 -1);
+
+	/* Data not fitting in the buffer is sent with the buffered data */
+	ck_assert_int_eq(mg_write(&conn, body, sizeof(body)), (int)sizeof(body));
+	ck_assert_int_eq(conn.out_len, 0);
+
+	/* Buffered until mg_flush */
+	ck_assert_int_eq(mg_write(&conn, "end", 3), 3);
+	ck_assert_int_eq(conn.out_len, 3);
+	ck_assert_int_eq(mg_flush(&conn), 0);
+	ck_assert_int_eq(conn.out_len, 0);
+	ck_assert_int_eq(mg_flush(&conn), 0);
+	ck_assert_int_eq((int)conn.num_bytes_sent, expected_len);
+
+	/* The client receives all data in the right order */
+	len = 0;
+	while (len < expected_len) {
+		n = (int)recv(sv[1], received + len, sizeof(received) - (size_t)len, 0);
+		ck_assert_int_gt(n, 0);
+		len += n;
+	}
+	ck_assert_int_eq(len, expected_len);
+	ck_assert(!memcmp(received, expected, (size_t)expected_len));
+
+	close(sv[0]);
+	close(sv[1]);
+}
+END_TEST
+#endif
+
+
 #if !defined(REPLACE_CHECK_FOR_LOCAL_DEBUGGING)
 Suite *
 make_private_suite(void)
@@ -1750,6 +3042,17 @@ make_private_suite(void)
 	TCase *const tcase_parse_date_string = tcase_create("Date Parsing");
 	TCase *const tcase_sha1 = tcase_create("SHA1");
 	TCase *const tcase_config_options = tcase_create("Config Options");
+	TCase *const tcase_file_cache = tcase_create("File Cache");
+	TCase *const tcase_request_arena = tcase_create("Request Arena");
+	TCase *const tcase_access_log = tcase_create("Access Log");
+	TCase *const tcase_auth_cache = tcase_create("Auth Cache");
+	TCase *const tcase_acl = tcase_create("Access Control List");
+#if !defined(_WIN32)
+	TCase *const tcase_output_buffer = tcase_create("Output Buffer");
+#endif
+#if defined(USE_HTTP2)
+	TCase *const tcase_hpack = tcase_create("HPACK");
+#endif
 
 	tcase_add_test(tcase_http_message, test_parse_http_message);
 	tcase_set_timeout(tcase_http_message, civetweb_min_test_timeout);
@@ -1763,6 +3066,7 @@ make_private_suite(void)
 	tcase_add_test(tcase_url_parsing_1, test_match_prefix_strlen);
 	tcase_add_test(tcase_url_parsing_1, test_match_prefix_fuzz);
 	tcase_add_test(tcase_url_parsing_1, test_mg_match);
+	tcase_add_test(tcase_url_parsing_1, test_route_table);
 	tcase_set_timeout(tcase_url_parsing_1, civetweb_min_test_timeout);
 	suite_add_tcase(suite, tcase_url_parsing_1);
 
@@ -1799,6 +3103,9 @@ make_private_suite(void)
 	suite_add_tcase(suite, tcase_internal_parse_6);
 
 	tcase_add_test(tcase_internal_parse_7, test_parse_http_headers);
+	tcase_add_test(tcase_internal_parse_7, test_parse_http_simd);
+	tcase_add_test(tcase_internal_parse_7, test_header_index);
+	tcase_add_test(tcase_internal_parse_7, test_parse_accept_encoding);
 	tcase_set_timeout(tcase_internal_parse_7, civetweb_min_test_timeout);
 	suite_add_tcase(suite, tcase_internal_parse_7);
 
@@ -1822,6 +3129,42 @@ make_private_suite(void)
 	tcase_set_timeout(tcase_config_options, civetweb_min_test_timeout);
 	suite_add_tcase(suite, tcase_config_options);
 
+	tcase_add_test(tcase_file_cache, test_file_cache);
+	tcase_add_test(tcase_file_cache, test_memory_cache);
+	tcase_set_timeout(tcase_file_cache, civetweb_min_test_timeout);
+	suite_add_tcase(suite, tcase_file_cache);
+
+	tcase_add_test(tcase_request_arena, test_request_arena);
+	tcase_set_timeout(tcase_request_arena, civetweb_min_test_timeout);
+	suite_add_tcase(suite, tcase_request_arena);
+
+	tcase_add_test(tcase_access_log, test_access_log_format);
+#if defined(ACCESS_LOG_ASYNC)
+	tcase_add_test(tcase_access_log, test_access_log);
+#endif
+	tcase_set_timeout(tcase_access_log, civetweb_min_test_timeout);
+	suite_add_tcase(suite, tcase_access_log);
+
+	tcase_add_test(tcase_auth_cache, test_auth_cache);
+	tcase_set_timeout(tcase_auth_cache, civetweb_min_test_timeout);
+	suite_add_tcase(suite, tcase_auth_cache);
+
+	tcase_add_test(tcase_acl, test_acl);
+	tcase_set_timeout(tcase_acl, civetweb_min_test_timeout);
+	suite_add_tcase(suite, tcase_acl);
+
+#if !defined(_WIN32)
+	tcase_add_test(tcase_output_buffer, test_output_buffer);
+	tcase_set_timeout(tcase_output_buffer, civetweb_min_test_timeout);
+	suite_add_tcase(suite, tcase_output_buffer);
+#endif
+
+#if defined(USE_HTTP2)
+	tcase_add_test(tcase_hpack, test_hpack);
+	tcase_set_timeout(tcase_hpack, civetweb_min_test_timeout);
+	suite_add_tcase(suite, tcase_hpack);
+#endif
+
 	return suite;
 }
 #endif
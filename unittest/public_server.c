@@ -4967,6 +4967,110 @@ START_TEST(test_error_log_file)
 END_TEST
 
 
+START_TEST(test_access_log_binary_lua)
+{
+	/* Server var */
+	struct mg_context *ctx;
+	const char *OPTIONS[32];
+	int opt_cnt = 0;
+
+	/* Client var */
+	struct mg_connection *client;
+	char client_err_buf[256];
+	const char *uri[2] = {"/not_existing_file.ext", "/lua_line"};
+
+	/* File content check var */
+	FILE *f;
+	unsigned char buf[1024];
+	size_t len, pos, rec_len;
+	int i;
+
+	if (!mg_check_feature(MG_FEATURES_LUA)) {
+		/* Server built without Lua */
+		return;
+	}
+
+	mark_point();
+
+	/* Lines returned by log() are text in a binary access log */
+	f = fopen("access_log_bg.lua", "w");
+	ck_assert(f != NULL);
+	fprintf(f,
+	        "function log(req, resp)\n"
+	        "  if req.uri == '/lua_line' then return 'lua ' .. req.uri end\n"
+	        "  return true\n"
+	        "end\n");
+	fclose(f);
+	(void)remove("access.log");
+
+	/* Set options and start server */
+	OPTIONS[opt_cnt++] = "listening_ports";
+	OPTIONS[opt_cnt++] = "8080";
+	OPTIONS[opt_cnt++] = "num_threads";
+	OPTIONS[opt_cnt++] = "1";
+	OPTIONS[opt_cnt++] = "access_log_file";
+	OPTIONS[opt_cnt++] = "access.log";
+	OPTIONS[opt_cnt++] = "access_log_format";
+	OPTIONS[opt_cnt++] = "binary";
+	OPTIONS[opt_cnt++] = "access_log_fields";
+	OPTIONS[opt_cnt++] = "status,uri";
+	OPTIONS[opt_cnt++] = "lua_background_script";
+	OPTIONS[opt_cnt++] = "access_log_bg.lua";
+#if !defined(NO_FILES)
+	OPTIONS[opt_cnt++] = "document_root";
+	OPTIONS[opt_cnt++] = ".";
+#endif
+	OPTIONS[opt_cnt] = NULL;
+
+	ctx = test_mg_start(NULL, 0, OPTIONS, __LINE__);
+	ck_assert(ctx != NULL);
+
+	for (i = 0; i < 2; i++) {
+		memset(client_err_buf, 0, sizeof(client_err_buf));
+		client = mg_download("127.0.0.1",
+		                     8080,
+		                     0,
+		                     client_err_buf,
+		                     sizeof(client_err_buf),
+		                     "GET %s HTTP/1.0\r\n\r\n",
+		                     uri[i]);
+		ck_assert_str_eq(client_err_buf, "");
+		ck_assert(client != NULL);
+		mg_close_connection(client);
+	}
+
+	/* Stop the server */
+	test_mg_stop(ctx, __LINE__);
+
+	/* Two records: the fields of the first request, then the Lua line as
+	 * a string field with the id 255 */
+	f = fopen("access.log", "rb");
+	ck_assert(f != NULL);
+	len = fread(buf, 1, sizeof(buf), f);
+	fclose(f);
+
+	ck_assert_uint_ge(len, 4);
+	rec_len = ((size_t)buf[0] << 24) | ((size_t)buf[1] << 16)
+	          | ((size_t)buf[2] << 8) | (size_t)buf[3];
+	ck_assert_uint_eq(rec_len, 9 + 3 + strlen(uri[0]));
+	ck_assert_int_eq(buf[4], 8); /* status */
+	ck_assert_int_eq(buf[11], 0x01);
+	ck_assert_int_eq(buf[12], 0x94); /* 404 */
+	ck_assert_int_eq(buf[13], 5); /* uri */
+	ck_assert(!memcmp(buf + 16, uri[0], strlen(uri[0])));
+
+	pos = 4 + rec_len;
+	ck_assert_uint_eq(len, pos + 4 + 3 + strlen("lua /lua_line"));
+	ck_assert(!memcmp(buf + pos, "\0\0\0\x10\xff\0\x0dlua /lua_line", 20));
+
+	(void)remove("access.log");
+	(void)remove("access_log_bg.lua");
+
+	mark_point();
+}
+END_TEST
+
+
 static int
 test_throttle_begin_request(struct mg_connection *conn)
 {
@@ -5871,6 +5975,252 @@ START_TEST(test_minimal_https_server_callback)
 END_TEST
 
 
+START_TEST(test_lua_state_pool)
+{
+	/* Server var */
+	struct mg_context *ctx;
+	const char *OPTIONS[16];
+	int opt_cnt = 0;
+
+	/* Client var */
+	struct mg_connection *client;
+	char client_err_buf[256];
+	char client_data_buf[256];
+	const struct mg_response_info *client_ri;
+
+	char expected[64];
+	char info[4096];
+	FILE *f;
+	int i, len;
+
+	if (!mg_check_feature(MG_FEATURES_LUA)) {
+		/* Server built without Lua */
+		return;
+	}
+
+	mark_point();
+
+	/* The module is bound to the globals of the request loading it */
+	f = fopen("lua_pool_mod.lua", "w");
+	ck_assert(f != NULL);
+	fprintf(f,
+	        "local m = {}\n"
+	        "function m.query() return mg.request_info.query_string end\n"
+	        "return m\n");
+	fclose(f);
+
+	/* Globals, loaded modules and changes of the string library must not
+	 * be visible to later requests */
+	f = fopen("lua_pool_test.lua", "w");
+	ck_assert(f != NULL);
+	fprintf(f,
+	        "mg.write('HTTP/1.0 200 OK\\r\\n"
+	        "Content-Type: text/plain\\r\\n\\r\\n')\n"
+	        "package.path = './?.lua'\n"
+	        "mg.write(tostring(g), ' ', require('lua_pool_mod').query(), ' ',\n"
+	        "         tostring(getmetatable(_G)), ' ',\n"
+	        "         tostring(getmetatable('')), ' ',\n"
+	        "         tostring(('x').evil), ' ', ('x'):upper())\n"
+	        "g = 1\n"
+	        "pcall(function() getmetatable('').__index.evil = 1 end)\n"
+	        "pcall(function() string.evil = 1 end)\n");
+	fclose(f);
+
+	/* Set options and start server */
+	OPTIONS[opt_cnt++] = "listening_ports";
+	OPTIONS[opt_cnt++] = "8080";
+	OPTIONS[opt_cnt++] = "document_root";
+	OPTIONS[opt_cnt++] = ".";
+	OPTIONS[opt_cnt++] = "num_threads";
+	OPTIONS[opt_cnt++] = "1";
+	OPTIONS[opt_cnt++] = "lua_state_pool_size";
+	OPTIONS[opt_cnt++] = "1";
+	OPTIONS[opt_cnt] = NULL;
+
+	ctx = test_mg_start(NULL, 0, OPTIONS, __LINE__);
+	ck_assert(ctx != NULL);
+
+	for (i = 0; i < 3; i++) {
+		memset(client_err_buf, 0, sizeof(client_err_buf));
+		memset(client_data_buf, 0, sizeof(client_data_buf));
+
+		client = mg_download("127.0.0.1",
+		                     8080,
+		                     0,
+		                     client_err_buf,
+		                     sizeof(client_err_buf),
+		                     "GET /lua_pool_test.lua?q%i HTTP/1.0\r\n\r\n",
+		                     i);
+		ck_assert_str_eq(client_err_buf, "");
+		ck_assert(client != NULL);
+
+		client_ri = mg_get_response_info(client);
+		ck_assert(client_ri != NULL);
+		ck_assert_int_eq(client_ri->status_code, 200);
+
+		len = mg_read(client, client_data_buf, sizeof(client_data_buf) - 1);
+		ck_assert_int_gt(len, 0);
+		client_data_buf[len] = 0;
+		sprintf(expected, "nil q%i shared shared nil X", i);
+		ck_assert_str_eq(client_data_buf, expected);
+
+		mg_close_connection(client);
+	}
+
+	/* One state has been created and reused for the later requests */
+	if (mg_check_feature(MG_FEATURES_STATS)) {
+		len = mg_get_context_info(ctx, info, sizeof(info));
+		ck_assert_int_gt(len, 0);
+		ck_assert_ptr_ne(strstr(info, "\"luaStatePool\""), NULL);
+		ck_assert_ptr_ne(strstr(info, "\"created\" : 1,"), NULL);
+		ck_assert_ptr_ne(strstr(info, "\"reused\" : 2"), NULL);
+	}
+
+	/* Stop the server */
+	test_mg_stop(ctx, __LINE__);
+
+	(void)remove("lua_pool_mod.lua");
+	(void)remove("lua_pool_test.lua");
+
+	mark_point();
+}
+END_TEST
+
+
+static int
+test_http2_cleartext_handler(struct mg_connection *conn, void *cbdata)
+{
+	(void)cbdata;
+	mg_send_http_ok(conn, "text/plain", 2);
+	mg_write(conn, "ok", 2);
+	return 200;
+}
+
+
+START_TEST(test_http2_cleartext)
+{
+#if !defined(_WIN32)
+	/* Server var */
+	struct mg_context *ctx;
+	const char *OPTIONS[8];
+	int opt_cnt = 0;
+
+	/* Client var */
+	struct mg_connection *client;
+	char client_err_buf[256];
+	char client_data_buf[256];
+	const struct mg_response_info *client_ri;
+
+	/* Raw HTTP/2 client: connection preface, empty SETTINGS frame, HEADERS
+	 * frame for stream 1 (END_STREAM, END_HEADERS) with the static table
+	 * entries ":method GET", ":scheme http" and ":path /" */
+	static const unsigned char h2_request[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+	                                          "\0\0\0\x04\0\0\0\0\0"
+	                                          "\0\0\x03\x01\x05\0\0\0\x01"
+	                                          "\x82\x86\x84";
+	unsigned char buf[4096];
+	struct sockaddr_in sin;
+	struct timeval tv;
+	int sock, len, pos, frame_len, frame_type, frame_stream;
+	int got_settings = 0, got_headers = 0;
+
+	if (!mg_check_feature(MG_FEATURES_HTTP2)) {
+		/* Server built without HTTP/2 */
+		return;
+	}
+
+	mark_point();
+
+	/* Set options and start server */
+	OPTIONS[opt_cnt++] = "listening_ports";
+	OPTIONS[opt_cnt++] = "8080";
+	OPTIONS[opt_cnt++] = "enable_http2_cleartext";
+	OPTIONS[opt_cnt++] = "yes";
+	OPTIONS[opt_cnt] = NULL;
+
+	ctx = test_mg_start(NULL, 0, OPTIONS, __LINE__);
+	ck_assert(ctx != NULL);
+	mg_set_request_handler(ctx, "/", test_http2_cleartext_handler, NULL);
+
+	/* HTTP/2 with prior knowledge on a plain socket */
+	sock = (int)socket(AF_INET, SOCK_STREAM, 0);
+	ck_assert_int_ge(sock, 0);
+	tv.tv_sec = 5;
+	tv.tv_usec = 0;
+	(void)setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(8080);
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	ck_assert_int_eq(connect(sock, (struct sockaddr *)&sin, sizeof(sin)), 0);
+	ck_assert_int_eq((int)send(sock, h2_request, sizeof(h2_request) - 1, 0),
+	                 (int)sizeof(h2_request) - 1);
+
+	/* The server SETTINGS, then a HEADERS frame for stream 1 with
+	 * ":status 200" (static table entry 8) */
+	len = 0;
+	pos = 0;
+	while (!got_headers) {
+		if ((len - pos < 9)
+		    || (len - pos < 9 + ((buf[pos] << 16) | (buf[pos + 1] << 8)
+		                         | buf[pos + 2]))) {
+			int n;
+			ck_assert_int_lt(len, (int)sizeof(buf));
+			n = (int)recv(sock, buf + len, sizeof(buf) - (size_t)len, 0);
+			ck_assert_int_gt(n, 0);
+			len += n;
+			continue;
+		}
+		frame_len = (buf[pos] << 16) | (buf[pos + 1] << 8) | buf[pos + 2];
+		frame_type = buf[pos + 3];
+		frame_stream = (buf[pos + 5] << 24) | (buf[pos + 6] << 16)
+		               | (buf[pos + 7] << 8) | buf[pos + 8];
+		if ((frame_type == 4) && !(buf[pos + 4] & 1)) {
+			/* SETTINGS (not an ACK) must be the first frame */
+			ck_assert_int_eq(pos, 0);
+			ck_assert_int_eq(frame_stream, 0);
+			got_settings = 1;
+		} else if (frame_type == 1) {
+			ck_assert_int_eq(frame_stream, 1);
+			ck_assert_int_gt(frame_len, 0);
+			ck_assert_int_eq(buf[pos + 9], 0x88);
+			got_headers = 1;
+		}
+		pos += 9 + frame_len;
+	}
+	ck_assert(got_settings);
+	close(sock);
+
+	/* HTTP/1.1 still works on the same port */
+	memset(client_err_buf, 0, sizeof(client_err_buf));
+	memset(client_data_buf, 0, sizeof(client_data_buf));
+	client = mg_download("127.0.0.1",
+	                     8080,
+	                     0,
+	                     client_err_buf,
+	                     sizeof(client_err_buf),
+	                     "GET / HTTP/1.1\r\nHost: 127.0.0.1\r\n"
+	                     "Connection: close\r\n\r\n");
+	ck_assert_str_eq(client_err_buf, "");
+	ck_assert(client != NULL);
+	client_ri = mg_get_response_info(client);
+	ck_assert(client_ri != NULL);
+	ck_assert_int_eq(client_ri->status_code, 200);
+	ck_assert_str_eq(client_ri->http_version, "1.1");
+	len = mg_read(client, client_data_buf, sizeof(client_data_buf) - 1);
+	ck_assert_int_eq(len, 2);
+	ck_assert_str_eq(client_data_buf, "ok");
+	mg_close_connection(client);
+
+	/* Stop the server */
+	test_mg_stop(ctx, __LINE__);
+
+	mark_point();
+#endif
+}
+END_TEST
+
+
 #if !defined(REPLACE_CHECK_FOR_LOCAL_DEBUGGING)
 Suite *
 make_public_server_suite(void)
@@ -5899,6 +6249,8 @@ make_public_server_suite(void)
 	TCase *const tcase_throttle = tcase_create("Limit speed");
 	TCase *const tcase_large_file = tcase_create("Large file");
 	TCase *const tcase_file_in_mem = tcase_create("File in memory");
+	TCase *const tcase_lua_state_pool = tcase_create("Lua State Pool");
+	TCase *const tcase_http2_cleartext = tcase_create("HTTP2 Cleartext");
 
 
 	tcase_add_test(tcase_checktestenv, test_the_test_environment);
@@ -5975,6 +6327,7 @@ make_public_server_suite(void)
 	suite_add_tcase(suite, tcase_error_handling);
 
 	tcase_add_test(tcase_error_log, test_error_log_file);
+	tcase_add_test(tcase_error_log, test_access_log_binary_lua);
 	tcase_set_timeout(tcase_error_log, civetweb_mid_server_test_timeout);
 	suite_add_tcase(suite, tcase_error_log);
 
@@ -5986,6 +6339,14 @@ make_public_server_suite(void)
 	tcase_set_timeout(tcase_large_file, civetweb_mid_server_test_timeout);
 	suite_add_tcase(suite, tcase_large_file);
 
+	tcase_add_test(tcase_lua_state_pool, test_lua_state_pool);
+	tcase_set_timeout(tcase_lua_state_pool, civetweb_min_server_test_timeout);
+	suite_add_tcase(suite, tcase_lua_state_pool);
+
+	tcase_add_test(tcase_http2_cleartext, test_http2_cleartext);
+	tcase_set_timeout(tcase_http2_cleartext, civetweb_min_server_test_timeout);
+	suite_add_tcase(suite, tcase_http2_cleartext);
+
 	return suite;
 }
 #endif
@@ -6026,8 +6387,11 @@ MAIN_PUBLIC_SERVER(void)
 	test_keep_alive(0);
 	test_error_handling(0);
 	test_error_log_file(0);
+	test_access_log_binary_lua(0);
 	test_throttle(0);
 	test_large_file(0);
+	test_lua_state_pool(0);
+	test_http2_cleartext(0);
 
 	mg_exit_library();
 
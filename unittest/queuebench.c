@@ -0,0 +1,309 @@
+/* Copyright (c) 2026 the Civetweb developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * Micro benchmark for the socket queue between the accept loop(s) and the
+ * worker threads (produce_socket / consume_socket).
+ *
+ * The same source is built once for every queue implementation:
+ *   default:           mutex and condition variables
+ *   ALTERNATIVE_QUEUE: one slot and event per worker thread
+ *   LOCKFREE_QUEUE:    lock-free ring buffer and futex
+ *
+ * Usage: queuebench [items [max_threads [queue_size]]]
+ *
+ * For 1, 2, 4, ... max_threads producer and consumer threads, items
+ * "sockets" are passed through the queue. The throughput and the handoff
+ * latency (time from produce_socket until consume_socket returns) are
+ * printed. The program returns 1 if not every item was consumed exactly
+ * once, so it can be used as a quick test as well.
+ */
+#ifdef _MSC_VER
+#ifndef _CRT_SECURE_NO_WARNINGS
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+#endif
+
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#endif
+
+#define CIVETWEB_API static
+
+#include "../src/civetweb.c"
+
+#include <stdlib.h>
+#include <time.h>
+
+
+#if defined(ALTERNATIVE_QUEUE)
+static const char *queue_name = "ALTERNATIVE_QUEUE";
+#elif defined(LOCKFREE_QUEUE)
+static const char *queue_name = "LOCKFREE_QUEUE";
+#else
+static const char *queue_name = "default";
+#endif
+
+
+static struct mg_context bench_ctx;
+static uint64_t *produced_at; /* produce time of item i */
+static uint64_t *latency;     /* handoff latency of item i */
+static volatile int *consumed; /* how often item i was consumed */
+static volatile ptrdiff_t consumed_total;
+static volatile ptrdiff_t next_item;
+static int num_items;
+
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+
+static void *
+producer(void *arg)
+{
+	struct socket so;
+	ptrdiff_t item;
+
+	(void)arg;
+	memset(&so, 0, sizeof(so));
+	while ((item = mg_atomic_inc(&next_item) - 1) < (ptrdiff_t)num_items) {
+		so.sock = (SOCKET)item;
+		produced_at[item] = now_ns();
+		produce_socket(&bench_ctx, &so, 0);
+	}
+	return NULL;
+}
+
+
+static void *
+consumer(void *arg)
+{
+	struct socket so;
+	int thread_index = (int)(ptrdiff_t)arg;
+
+	while (consume_socket(&bench_ctx, &so, thread_index, 0)) {
+		latency[so.sock] = now_ns() - produced_at[so.sock];
+		consumed[so.sock]++;
+		mg_atomic_inc(&consumed_total);
+	}
+	return NULL;
+}
+
+
+static int
+cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x < y) ? -1 : ((x > y) ? 1 : 0);
+}
+
+
+static int
+setup_queue(int threads, int queue_size)
+{
+	memset(&bench_ctx, 0, sizeof(bench_ctx));
+	bench_ctx.num_acceptors = 1;
+
+	/* All "worker threads" are already running, so produce_socket will
+	 * never start a new thread */
+	bench_ctx.cfg_max_worker_threads = (unsigned)threads;
+	bench_ctx.spawned_worker_threads = (unsigned)threads;
+	if (0 != pthread_mutex_init(&bench_ctx.thread_mutex, &pthread_mutex_attr)) {
+		return 0;
+	}
+
+#if defined(ALTERNATIVE_QUEUE)
+	{
+		int i;
+		(void)queue_size;
+		bench_ctx.client_socks =
+		    (struct socket *)mg_calloc((size_t)threads, sizeof(struct socket));
+		bench_ctx.client_wait_events =
+		    (void **)mg_calloc((size_t)threads, sizeof(void *));
+		if (!bench_ctx.client_socks || !bench_ctx.client_wait_events) {
+			return 0;
+		}
+		for (i = 0; i < threads; i++) {
+			bench_ctx.client_wait_events[i] = event_create();
+		}
+	}
+	return 1;
+#else
+	return init_socket_queues(&bench_ctx, queue_size);
+#endif
+}
+
+
+static void
+stop_queue(int threads)
+{
+	int i;
+
+	STOP_FLAG_ASSIGN(&bench_ctx.stop_flag, 1);
+#if defined(ALTERNATIVE_QUEUE)
+	for (i = 0; i < threads; i++) {
+		event_signal(bench_ctx.client_wait_events[i]);
+	}
+#else
+	(void)threads;
+	(void)i;
+	socket_queue_wakeup(&bench_ctx.sq[0]);
+#endif
+}
+
+
+static void
+free_queue(int threads)
+{
+#if defined(ALTERNATIVE_QUEUE)
+	int i;
+	for (i = 0; i < threads; i++) {
+		event_destroy(bench_ctx.client_wait_events[i]);
+	}
+	mg_free(bench_ctx.client_socks);
+	mg_free(bench_ctx.client_wait_events);
+#else
+	(void)threads;
+	free_socket_queues(&bench_ctx);
+#endif
+	pthread_mutex_destroy(&bench_ctx.thread_mutex);
+}
+
+
+static int
+run(int threads, int queue_size)
+{
+	pthread_t prod[64], cons[64];
+	uint64_t start, duration;
+	int i, errors = 0;
+
+	memset((void *)consumed, 0, (size_t)num_items * sizeof(consumed[0]));
+	consumed_total = 0;
+	next_item = 0;
+
+	if (!setup_queue(threads, queue_size)) {
+		fprintf(stderr, "Cannot initialize queue\n");
+		return 1;
+	}
+
+	for (i = 0; i < threads; i++) {
+		pthread_create(&cons[i], NULL, consumer, (void *)(ptrdiff_t)i);
+	}
+	start = now_ns();
+	for (i = 0; i < threads; i++) {
+		pthread_create(&prod[i], NULL, producer, NULL);
+	}
+	for (i = 0; i < threads; i++) {
+		pthread_join(prod[i], NULL);
+	}
+	while (consumed_total < (ptrdiff_t)num_items) {
+		mg_sleep(1);
+	}
+	duration = now_ns() - start;
+
+	stop_queue(threads);
+	for (i = 0; i < threads; i++) {
+		pthread_join(cons[i], NULL);
+	}
+	free_queue(threads);
+
+	for (i = 0; i < num_items; i++) {
+		if (consumed[i] != 1) {
+			errors++;
+		}
+	}
+
+	qsort(latency, (size_t)num_items, sizeof(latency[0]), cmp_u64);
+	printf("%-18s %4i %9.3f %10.2f %10.2f %12.2f%s\n",
+	       queue_name,
+	       threads,
+	       (double)num_items * 1000.0 / (double)duration,
+	       (double)latency[num_items / 2] / 1000.0,
+	       (double)latency[(int)((double)num_items * 0.99)] / 1000.0,
+	       (double)latency[num_items - 1] / 1000.0,
+	       errors ? "  ERROR" : "");
+
+	return errors ? 1 : 0;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	int max_threads = 64, queue_size = 20, threads, ret = 0;
+
+	num_items = 200000;
+	if (argc > 1) {
+		num_items = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		max_threads = atoi(argv[2]);
+	}
+	if (argc > 3) {
+		queue_size = atoi(argv[3]);
+	}
+	if ((num_items < 1) || (max_threads < 1) || (max_threads > 64)
+	    || (queue_size < 1)) {
+		fprintf(stderr,
+		        "Usage: %s [items [max_threads (1-64) [queue_size]]]\n",
+		        argv[0]);
+		return 2;
+	}
+
+	mg_init_library(0);
+
+	produced_at = (uint64_t *)mg_calloc((size_t)num_items, sizeof(uint64_t));
+	latency = (uint64_t *)mg_calloc((size_t)num_items, sizeof(uint64_t));
+	consumed = (volatile int *)mg_calloc((size_t)num_items, sizeof(int));
+	if (!produced_at || !latency || !consumed) {
+		fprintf(stderr, "Out of memory\n");
+		return 2;
+	}
+
+	printf("%i items, queue size %i\n", num_items, queue_size);
+	printf("%-18s %4s %9s %10s %10s %12s\n",
+	       "queue",
+	       "thr",
+	       "Mitems/s",
+	       "p50 [us]",
+	       "p99 [us]",
+	       "max [us]");
+	for (threads = 1; threads <= max_threads; threads *= 2) {
+		ret |= run(threads, queue_size);
+	}
+
+	mg_free(produced_at);
+	mg_free(latency);
+	mg_free((void *)consumed);
+	mg_exit_library();
+
+	return ret;
+}
+
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
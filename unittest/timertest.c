@@ -338,6 +338,203 @@ START_TEST(test_timer_mixed)
 END_TEST
 
 
+/* Counters for test_timer_cancel and test_timer_scaling */
+struct timer_counts {
+	volatile ptrdiff_t calls;
+	volatile ptrdiff_t cancels;
+};
+
+
+static int
+action_count(void *arg)
+{
+	mg_atomic_inc(&((struct timer_counts *)arg)->calls);
+	return 1;
+}
+
+
+static void
+cancel_count(void *arg)
+{
+	mg_atomic_inc(&((struct timer_counts *)arg)->cancels);
+}
+
+
+START_TEST(test_timer_cancel)
+{
+	struct mg_context ctx;
+	struct timer_counts c[4];
+	uint64_t id[4], old_id;
+	ptrdiff_t calls;
+
+	memset(&ctx, 0, sizeof(ctx));
+	memset(c, 0, sizeof(c));
+
+	mark_point();
+	timers_init(&ctx);
+	mg_sleep(100);
+	mark_point();
+
+	/* 0: single shot, cancelled before it runs */
+	ck_assert_int_eq(
+	    timer_add2(&ctx, 0.5, 0, 1, action_count, &c[0], cancel_count, &id[0]),
+	    0);
+	/* 1: periodic, cancelled after some runs */
+	ck_assert_int_eq(
+	    timer_add2(&ctx, 0, 0.1, 1, action_count, &c[1], cancel_count, &id[1]),
+	    0);
+	/* 2: periodic, not cancelled */
+	ck_assert_int_eq(
+	    timer_add2(&ctx, 0, 0.1, 1, action_count, &c[2], cancel_count, &id[2]),
+	    0);
+	/* 3: single shot, runs before it is cancelled */
+	ck_assert_int_eq(
+	    timer_add2(&ctx, 0, 0, 1, action_count, &c[3], cancel_count, &id[3]),
+	    0);
+
+	ck_assert_int_eq(timer_cancel(&ctx, id[0]), 0);
+	ck_assert_int_eq(c[0].cancels, 1);
+	ck_assert_int_eq(timer_cancel(&ctx, id[0]), 1);
+
+	mg_sleep(550);
+	ck_assert_int_ne(timer_cancel(&ctx, id[1]), 1);
+	mg_sleep(50);
+	calls = c[1].calls;
+	ck_assert_int_ge(calls, 3);
+	ck_assert_int_eq(c[1].cancels, 1);
+	ck_assert_int_eq(c[3].calls, 1);
+	ck_assert_int_eq(c[3].cancels, 1);
+	ck_assert_int_eq(timer_cancel(&ctx, id[3]), 1);
+
+	/* An old id does not cancel a new timer in the same slot */
+	old_id = id[0];
+	ck_assert_int_eq(
+	    timer_add2(&ctx, 10, 0, 1, action_count, &c[0], NULL, &id[0]), 0);
+	ck_assert_int_eq(timer_cancel(&ctx, old_id), 1);
+	ck_assert_int_eq(timer_cancel(&ctx, 12345678), 1);
+
+	mg_sleep(500);
+
+	mark_point();
+	ctx.stop_flag = 99; /* End timer thread */
+	timers_exit(&ctx);
+	mark_point();
+
+	ck_assert_int_eq(c[0].calls, 0);
+	ck_assert_int_eq(c[0].cancels, 1);
+	ck_assert_int_eq(c[1].calls, calls);
+	ck_assert_int_eq(c[1].cancels, 1);
+	ck_assert_int_ge(c[2].calls, 8);
+	ck_assert_int_eq(c[2].cancels, 1);
+}
+END_TEST
+
+
+/* Largest number of timers in the scaling test. The default keeps the
+ * test short; build with -DTIMER_SCALING_MAX=1000000 for a benchmark. */
+#if !defined(TIMER_SCALING_MAX)
+#define TIMER_SCALING_MAX (100000)
+#endif
+
+
+/* Deterministic pseudo random numbers for the benchmark */
+static uint32_t
+bench_random(uint32_t *state)
+{
+	*state = *state * 1103515245u + 12345u;
+	return *state >> 8;
+}
+
+
+START_TEST(test_timer_scaling)
+{
+	/* Add, cancel and run 10^3 to TIMER_SCALING_MAX timers, print the
+	 * time per timer */
+	struct mg_context ctx;
+	struct timer_counts c;
+	uint64_t *ids;
+	uint32_t rnd = 1;
+	unsigned n, i, j, k;
+	double t0, t1, t2, due;
+	uint64_t tmp;
+
+	ids = (uint64_t *)mg_malloc(TIMER_SCALING_MAX * sizeof(ids[0]));
+	ck_assert_ptr_ne(ids, NULL);
+
+	for (n = 1000; n <= TIMER_SCALING_MAX; n *= 10) {
+		memset(&ctx, 0, sizeof(ctx));
+		memset(&c, 0, sizeof(c));
+		mark_point();
+		ck_assert_int_eq(timers_init(&ctx), 0);
+
+		/* Add timers in random order, far in the future */
+		t0 = timer_getcurrenttime(&ctx);
+		for (i = 0; i < n; i++) {
+			ck_assert_int_eq(timer_add2(&ctx,
+			                            1000.0 + (bench_random(&rnd) % n),
+			                            0,
+			                            1,
+			                            action_count,
+			                            &c,
+			                            cancel_count,
+			                            &ids[i]),
+			                 0);
+		}
+		t1 = timer_getcurrenttime(&ctx);
+
+		/* Check the heap order */
+		pthread_mutex_lock(&ctx.timers->mutex);
+		ck_assert_uint_eq(ctx.timers->timer_count, n);
+		for (i = 1; i < n; i++) {
+			ck_assert(ctx.timers->heap[(i - 1) / TIMER_HEAP_ARITY].time
+			          <= ctx.timers->heap[i].time);
+		}
+		pthread_mutex_unlock(&ctx.timers->mutex);
+
+		/* Cancel all timers in random order */
+		for (i = n - 1; i > 0; i--) {
+			j = bench_random(&rnd) % (i + 1);
+			tmp = ids[i];
+			ids[i] = ids[j];
+			ids[j] = tmp;
+		}
+		t2 = timer_getcurrenttime(&ctx);
+		for (i = 0; i < n; i++) {
+			ck_assert_int_eq(timer_cancel(&ctx, ids[i]), 0);
+		}
+		ck_assert_int_eq(c.cancels, (ptrdiff_t)n);
+		printf("%8u timers: add %7.1f ns, cancel %7.1f ns",
+		       n,
+		       (t1 - t0) * 1.0E9 / n,
+		       (timer_getcurrenttime(&ctx) - t2) * 1.0E9 / n);
+
+		/* Let all timers run once, all due at the same time */
+		due = timer_getcurrenttime(&ctx) + 0.2;
+		for (i = 0; i < n; i++) {
+			ck_assert_int_eq(timer_add(&ctx,
+			                           due,
+			                           0,
+			                           0,
+			                           action_count,
+			                           &c,
+			                           NULL),
+			                 0);
+		}
+		for (k = 0; (c.calls < (ptrdiff_t)n) && (k < 60000); k++) {
+			mg_sleep(1);
+		}
+		ck_assert_int_eq(c.calls, (ptrdiff_t)n);
+		printf(", run %7.1f ns\n",
+		       (timer_getcurrenttime(&ctx) - due) * 1.0E9 / n);
+
+		ctx.stop_flag = 99; /* End timer thread */
+		timers_exit(&ctx);
+	}
+	mg_free(ids);
+}
+END_TEST
+
+
 #if !defined(REPLACE_CHECK_FOR_LOCAL_DEBUGGING)
 Suite *
 make_timertest_suite(void)
@@ -347,6 +544,8 @@ make_timertest_suite(void)
 	TCase *const tcase_timer_cyclic = tcase_create("Timer Periodic");
 	TCase *const tcase_timer_oneshot = tcase_create("Timer Single Shot");
 	TCase *const tcase_timer_mixed = tcase_create("Timer Mixed");
+	TCase *const tcase_timer_cancel = tcase_create("Timer Cancel");
+	TCase *const tcase_timer_scaling = tcase_create("Timer Scaling");
 
 	tcase_add_test(tcase_timer_cyclic, test_timer_cyclic);
 	tcase_set_timeout(tcase_timer_cyclic, 30);
@@ -361,6 +560,14 @@ make_timertest_suite(void)
 	tcase_set_timeout(tcase_timer_mixed, 30);
 	suite_add_tcase(suite, tcase_timer_mixed);
 
+	tcase_add_test(tcase_timer_cancel, test_timer_cancel);
+	tcase_set_timeout(tcase_timer_cancel, 30);
+	suite_add_tcase(suite, tcase_timer_cancel);
+
+	tcase_add_test(tcase_timer_scaling, test_timer_scaling);
+	tcase_set_timeout(tcase_timer_scaling, 30);
+	suite_add_tcase(suite, tcase_timer_scaling);
+
 	return suite;
 }
 
@@ -386,6 +593,8 @@ MAIN_TIMER_PRIVATE(void)
 	test_timer_oneshot_by_timer_add(0);
 	test_timer_oneshot_by_callback_retval(0);
 	test_timer_mixed(0);
+	test_timer_cancel(0);
+	test_timer_scaling(0);
 
 	mg_exit_library();
 